@@ -29,6 +29,7 @@ const char kBasicRapporAnalyzerConstructorFailure[] =
     "basic-rappor-analyzer-constructor-failure";
 const char kAddObservationFailure[] =
     "basic-rappor-analyzer-add-observation-failure";
+const char kMergeFailure[] = "basic-rappor-analyzer-merge-failure";
 }  // namespace
 
 BasicRapporAnalyzer::BasicRapporAnalyzer(const BasicRapporConfig& config)
@@ -84,6 +85,28 @@ bool BasicRapporAnalyzer::AddObservation(const BasicRapporObservation& obs) {
   return true;
 }
 
+bool BasicRapporAnalyzer::Merge(const BasicRapporAnalyzer& other) {
+  if (!config_->valid() || !other.config_->valid()) {
+    LOG_STACKDRIVER_COUNT_METRIC(ERROR, kMergeFailure)
+        << "BasicRapporConfig is invalid";
+    return false;
+  }
+  if (config_->num_bits() != other.config_->num_bits() ||
+      config_->prob_0_becomes_1() != other.config_->prob_0_becomes_1() ||
+      config_->prob_1_stays_1() != other.config_->prob_1_stays_1()) {
+    LOG_STACKDRIVER_COUNT_METRIC(ERROR, kMergeFailure)
+        << "Cannot merge BasicRapporAnalyzers with different "
+           "BasicRapporConfigs.";
+    return false;
+  }
+  num_observations_ += other.num_observations_;
+  observation_errors_ += other.observation_errors_;
+  for (size_t category = 0; category < category_counts_.size(); category++) {
+    category_counts_[category] += other.category_counts_[category];
+  }
+  return true;
+}
+
 std::vector<BasicRapporAnalyzer::CategoryResult>
 BasicRapporAnalyzer::Analyze() {
   double q = config_->prob_1_stays_1();
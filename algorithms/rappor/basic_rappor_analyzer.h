@@ -42,6 +42,17 @@ class BasicRapporAnalyzer {
   // an error and so observation_errors() was incremented.
   bool AddObservation(const BasicRapporObservation& obs);
 
+  // Adds the observations that were added to |other| to this
+  // BasicRapporAnalyzer, as if they had been added to it via
+  // AddObservation(), together with the observation_errors() of |other|.
+  // This allows observations to be added to several BasicRapporAnalyzers,
+  // for example one per thread, and then combined.
+  //
+  // Returns false, and leaves this BasicRapporAnalyzer unchanged, if either
+  // of the configs is invalid or if they differ in the number of categories
+  // or the probabilities of the randomized response.
+  bool Merge(const BasicRapporAnalyzer& other);
+
   // The number of times that AddObservation() was invoked minus the value
   // of observation_errors().
   size_t num_observations() const { return num_observations_; }
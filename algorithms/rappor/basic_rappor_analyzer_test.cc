@@ -71,13 +71,15 @@ class BasicRapporAnalyzerTest : public ::testing::Test {
 
   // Sets the member variable encoder_ to be a new BasicRapporEncoder configured
   // to use |num_categories| categories and the current values of
-  // prob_0_becomes_1_, prob_1_stays_1_, a deterministic RNG.
+  // prob_0_becomes_1_, prob_1_stays_1_, a deterministic RNG. Each encoder
+  // uses a different stream of the deterministic RNG, so that the
+  // experiments performed with different encoders are independent.
   void SetEncoder(int num_categories) {
     encoder_.reset(new BasicRapporEncoder(
         Config(num_categories, prob_0_becomes_1_, prob_1_stays_1_),
         ClientSecret::GenerateNewSecret()));
-    encoder_->SetRandomForTesting(
-        std::unique_ptr<crypto::Random>(new crypto::DeterministicRandom()));
+    encoder_->SetRandomForTesting(std::unique_ptr<crypto::Random>(
+        new crypto::DeterministicRandom(num_encoders_++)));
   }
 
   // Uses |encoder_| to encode |num_observations| observations for the given
@@ -275,6 +277,7 @@ class BasicRapporAnalyzerTest : public ::testing::Test {
   double prob_0_becomes_1_ = 0.0;
   double prob_1_stays_1_ = 1.0;
   std::unique_ptr<BasicRapporEncoder> encoder_;
+  uint32_t num_encoders_ = 0;
   std::unique_ptr<BasicRapporAnalyzer> analyzer_;
   int add_bad_observation_call_count_ = 0;
   int add_good_observation_call_count_ = 0;
@@ -453,6 +456,33 @@ TEST_F(BasicRapporAnalyzerTest, InvalidObservations) {
   AddObservation("00000001");
 }
 
+// Tests that Merge() adds the counts and errors of another analyzer, and
+// that it fails for an analyzer with a different config.
+TEST_F(BasicRapporAnalyzerTest, Merge) {
+  SetAnalyzer(10);
+  AddObservation("0000000000000101");
+  AddObservation("0000001000000001");
+  AddObservationExpectFalse("00000001");
+
+  BasicRapporAnalyzer other(Config(10, prob_0_becomes_1_, prob_1_stays_1_));
+  EXPECT_TRUE(other.AddObservation(
+      BasicRapporObservationFromString("0000000000000011")));
+  EXPECT_FALSE(
+      other.AddObservation(BasicRapporObservationFromString("00000001")));
+
+  EXPECT_TRUE(analyzer_->Merge(other));
+  CheckState(3, 2);
+  ExpectRawCounts({3, 1, 1, 0, 0, 0, 0, 0, 0, 1});
+
+  BasicRapporAnalyzer more_categories(
+      Config(11, prob_0_becomes_1_, prob_1_stays_1_));
+  EXPECT_FALSE(analyzer_->Merge(more_categories));
+  BasicRapporAnalyzer other_probabilities(Config(10, 0.25, 0.75));
+  EXPECT_FALSE(analyzer_->Merge(other_probabilities));
+  CheckState(3, 2);
+  ExpectRawCounts({3, 1, 1, 0, 0, 0, 0, 0, 0, 1});
+}
+
 // Invokes OneBitTest on various y using n=100, p=0, q=1
 TEST_F(BasicRapporAnalyzerTest, OneBitTestN100P0Q1) {
   int n = 100;
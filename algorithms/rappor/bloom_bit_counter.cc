@@ -16,7 +16,9 @@
 
 #include <glog/logging.h>
 
+#include <algorithm>
 #include <cmath>
+#include <cstring>
 #include <utility>
 #include <vector>
 
@@ -31,10 +33,13 @@ const char kBloomBitCounterConstructorFailure[] =
     "bloom-bit-counter-constructor-failure";
 const char kAddObservationFailure[] =
     "bloom-bin-counter-add-observation-failure";
+const char kMergeFailure[] = "bloom-bit-counter-merge-failure";
 }  // namespace
 
 BloomBitCounter::BloomBitCounter(const RapporConfig& config)
-    : config_(new RapporConfigValidator(config)), num_bloom_bytes_(0) {
+    : config_(new RapporConfigValidator(config)),
+      num_bloom_bytes_(0),
+      num_bloom_words_(0) {
   if (!config_->valid()) {
     LOG_STACKDRIVER_COUNT_METRIC(ERROR, kBloomBitCounterConstructorFailure)
         << "RapporConfig is invalid";
@@ -46,6 +51,12 @@ BloomBitCounter::BloomBitCounter(const RapporConfig& config)
     estimated_bloom_counts_.emplace_back(cohort, num_bits);
   }
   num_bloom_bytes_ = (num_bits + 7) / 8;
+  num_bloom_words_ = (num_bloom_bytes_ + 7) / 8;
+  pending_counts_.resize(config_->num_cohorts());
+  for (auto& pending : pending_counts_) {
+    pending.bit_planes.resize(kNumBitPlanes * num_bloom_words_, 0);
+  }
+  observation_words_.resize(num_bloom_words_, 0);
 }
 
 bool BloomBitCounter::AddObservation(const RapporObservation& obs) {
@@ -74,34 +85,104 @@ bool BloomBitCounter::AddObservation(const RapporObservation& obs) {
   num_observations_++;
   estimated_bloom_counts_[cohort].num_observations++;
 
-  // We iterate through the bits of the observation "from right to left",
-  // i.e. from the least-significant bit of the last byte to the
-  // most-significant bit of the first byte. If the ith bit is set we increment
-  // bit_sums[i] for the appropriate cohort.
-  //
-  // NOTE(rudominer) Possible performance optimizations: Consider using x86
-  // vector operations or the find-first-bit-set instruction or simply checking
-  // for zero bytes.
-  std::vector<size_t>& bit_sums = estimated_bloom_counts_[cohort].bit_sums;
-  size_t bit_index = 0;
-  for (int byte_index = num_bloom_bytes_ - 1; byte_index >= 0; byte_index--) {
-    uint8_t bit_mask = 1;
-    for (int bit_in_byte_index = 0; bit_in_byte_index < 8;
-         bit_in_byte_index++) {
-      if (bit_index >= bit_sums.size()) {
-        return true;
-      }
-      if (bit_mask & obs.data()[byte_index]) {
-        bit_sums[bit_index]++;
-      }
-      bit_index++;
-      bit_mask <<= 1;
+  // We add the observation, one 64-bit word at a time, to the bit-sliced
+  // counters of the cohort. The carry out of a plane is added to the next
+  // one. All of the planes are visited even once the carry is zero, which is
+  // faster than the unpredictable branch that would skip them. The bytes of
+  // the last word past num_bloom_bytes_ are always zero.
+  std::memcpy(observation_words_.data(), obs.data().data(), num_bloom_bytes_);
+  PendingCounts& pending = pending_counts_[cohort];
+  uint64_t* planes = pending.bit_planes.data();
+  for (size_t word_index = 0; word_index < num_bloom_words_; word_index++) {
+    uint64_t carry = observation_words_[word_index];
+    uint64_t* word_planes = planes + word_index * kNumBitPlanes;
+    for (size_t plane = 0; plane < kNumBitPlanes; plane++) {
+      uint64_t sum = word_planes[plane] ^ carry;
+      carry &= word_planes[plane];
+      word_planes[plane] = sum;
+    }
+  }
+  if (++pending.num_observations == kMaxPendingObservations) {
+    SpillPendingCounts(cohort);
+  }
+  return true;
+}
+
+bool BloomBitCounter::Merge(const BloomBitCounter& other) {
+  if (!config_->valid() || !other.config_->valid()) {
+    LOG_STACKDRIVER_COUNT_METRIC(ERROR, kMergeFailure)
+        << "RapporConfig is invalid";
+    return false;
+  }
+  if (config_->num_bits() != other.config_->num_bits() ||
+      config_->num_cohorts() != other.config_->num_cohorts() ||
+      config_->prob_0_becomes_1() != other.config_->prob_0_becomes_1() ||
+      config_->prob_1_stays_1() != other.config_->prob_1_stays_1()) {
+    LOG_STACKDRIVER_COUNT_METRIC(ERROR, kMergeFailure)
+        << "Cannot merge BloomBitCounters with different RapporConfigs.";
+    return false;
+  }
+  num_observations_ += other.num_observations_;
+  observation_errors_ += other.observation_errors_;
+  for (size_t cohort = 0; cohort < estimated_bloom_counts_.size(); cohort++) {
+    const CohortCounts& other_counts = other.estimated_bloom_counts_[cohort];
+    CohortCounts& counts = estimated_bloom_counts_[cohort];
+    counts.num_observations += other_counts.num_observations;
+    for (size_t bit_index = 0; bit_index < counts.bit_sums.size();
+         bit_index++) {
+      counts.bit_sums[bit_index] += other_counts.bit_sums[bit_index];
     }
+    AddPendingCounts(other.pending_counts_[cohort], &counts.bit_sums);
   }
   return true;
 }
 
+void BloomBitCounter::AddPendingCounts(const PendingCounts& pending,
+                                       std::vector<size_t>* bit_sums) const {
+  if (pending.num_observations == 0) {
+    return;
+  }
+  // The bit_sums are listed "from right to left", i.e. bit_sums[0] is the
+  // least-significant bit of the last byte of the observation data. Bits of
+  // the first byte beyond num_bits are ignored.
+  uint8_t bytes[8];
+  for (size_t word_index = 0; word_index < num_bloom_words_; word_index++) {
+    for (size_t plane = 0; plane < kNumBitPlanes; plane++) {
+      std::memcpy(bytes,
+                  &pending.bit_planes[word_index * kNumBitPlanes + plane],
+                  sizeof(bytes));
+      for (size_t i = 0; i < sizeof(bytes); i++) {
+        size_t byte_index = word_index * sizeof(bytes) + i;
+        if (byte_index >= num_bloom_bytes_) {
+          break;
+        }
+        size_t first_bit_index = (num_bloom_bytes_ - 1 - byte_index) * 8;
+        for (uint32_t bits = bytes[i]; bits != 0; bits &= bits - 1) {
+          size_t bit_index = first_bit_index + __builtin_ctz(bits);
+          if (bit_index < bit_sums->size()) {
+            (*bit_sums)[bit_index] += size_t(1) << plane;
+          }
+        }
+      }
+    }
+  }
+}
+
+void BloomBitCounter::SpillPendingCounts(uint32_t cohort) {
+  PendingCounts& pending = pending_counts_[cohort];
+  AddPendingCounts(pending, &estimated_bloom_counts_[cohort].bit_sums);
+  std::fill(pending.bit_planes.begin(), pending.bit_planes.end(), 0);
+  pending.num_observations = 0;
+}
+
+void BloomBitCounter::SpillAllPendingCounts() {
+  for (uint32_t cohort = 0; cohort < pending_counts_.size(); cohort++) {
+    SpillPendingCounts(cohort);
+  }
+}
+
 const std::vector<CohortCounts>& BloomBitCounter::EstimateCounts() {
+  SpillAllPendingCounts();
   double q = config_->prob_1_stays_1();
   double p = config_->prob_0_becomes_1();
   double one_minus_q_plus_p = 1.0 - (q + p);
@@ -15,6 +15,7 @@
 #ifndef COBALT_ALGORITHMS_RAPPOR_BLOOM_BIT_COUNTER_H_
 #define COBALT_ALGORITHMS_RAPPOR_BLOOM_BIT_COUNTER_H_
 
+#include <cstdint>
 #include <memory>
 #include <vector>
 
@@ -54,6 +55,17 @@ class BloomBitCounter {
   // an error and so observation_errors() was incremented.
   bool AddObservation(const RapporObservation& obs);
 
+  // Adds the observations counted by |other| to this BloomBitCounter, as if
+  // they had been added to it via AddObservation(), together with the
+  // observation_errors() of |other|. This allows observations to be counted
+  // by several BloomBitCounters, for example one per thread, and then
+  // combined.
+  //
+  // Returns false, and leaves this BloomBitCounter unchanged, if either of
+  // the configs is invalid or if they differ in the number of bits, the
+  // number of cohorts or the probabilities of the randomized response.
+  bool Merge(const BloomBitCounter& other);
+
   // The number of times that AddObservation() was invoked minus the value
   // of observation_errors().
   size_t num_observations() const { return num_observations_; }
@@ -76,6 +88,35 @@ class BloomBitCounter {
  private:
   friend class BloomBitCounterTest;
 
+  // The observations of a cohort that have been counted but not yet added
+  // to its bit_sums, as bit-sliced vertical counters: the count for bit i of
+  // the Bloom filter is a kNumBitPlanes-bit number whose bit k is bit i of
+  // bit-plane k. Each bit-plane is laid out like the data of a
+  // RapporObservation, packed into 64-bit words, and the planes are
+  // interleaved word by word, so that the kNumBitPlanes words of word index w
+  // are contiguous.
+  //
+  // Adding an observation is then a ripple-carry addition over whole words,
+  // rather than a branch per bit, and the counts are moved to the bit_sums
+  // only once every kMaxPendingObservations observations.
+  struct PendingCounts {
+    std::vector<uint64_t> bit_planes;
+    size_t num_observations = 0;
+  };
+
+  static const size_t kNumBitPlanes = 8;
+  static const size_t kMaxPendingObservations = (1 << kNumBitPlanes) - 1;
+
+  // Adds the counts in |pending| to |bit_sums|.
+  void AddPendingCounts(const PendingCounts& pending,
+                        std::vector<size_t>* bit_sums) const;
+
+  // Adds the pending counts of |cohort| to its bit_sums and resets them.
+  void SpillPendingCounts(uint32_t cohort);
+
+  // Spills the pending counts of all of the cohorts.
+  void SpillAllPendingCounts();
+
   std::shared_ptr<RapporConfigValidator> config_;
 
   size_t num_observations_ = 0;
@@ -83,8 +124,16 @@ class BloomBitCounter {
 
   std::vector<CohortCounts> estimated_bloom_counts_;
 
+  std::vector<PendingCounts> pending_counts_;
+
+  // The data of the observation being added, copied into whole words.
+  std::vector<uint64_t> observation_words_;
+
   // The number of bytes needed to store the bloom bits in each observation.
   size_t num_bloom_bytes_;
+
+  // The number of 64-bit words needed to store num_bloom_bytes_ bytes.
+  size_t num_bloom_words_;
 };
 
 // Stores the accumulated bit sums and the adjusted count estimates
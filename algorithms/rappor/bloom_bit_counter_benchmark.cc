@@ -0,0 +1,110 @@
+// Copyright 2018 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Benchmarks of BloomBitCounter::AddObservation(), which counts the
+// observations with bit-sliced counters, against the loop that it replaced,
+// which visits each bit of each observation. The argument of each benchmark
+// is the number of Bloom bits. The items processed are observations.
+
+#include <benchmark/benchmark.h>
+
+#include <string>
+#include <vector>
+
+#include "./observation.pb.h"
+#include "algorithms/rappor/bloom_bit_counter.h"
+#include "util/crypto_util/random_test_utils.h"
+
+namespace cobalt {
+namespace rappor {
+
+namespace {
+
+const uint32_t kNumCohorts = 50;
+const int kNumObservations = 1000;
+
+RapporConfig Config(uint32_t num_bloom_bits) {
+  RapporConfig config;
+  config.set_num_bloom_bits(num_bloom_bits);
+  config.set_num_hashes(2);
+  config.set_num_cohorts(kNumCohorts);
+  config.set_prob_0_becomes_1(0.25);
+  config.set_prob_1_stays_1(0.75);
+  return config;
+}
+
+// Returns kNumObservations observations with random data, in which each bit
+// is set with probability 1/2, as it is after the randomized response with
+// p = 0.25 and q = 0.75.
+std::vector<RapporObservation> MakeObservations(uint32_t num_bloom_bits) {
+  crypto::DeterministicRandom random;
+  std::vector<RapporObservation> observations(kNumObservations);
+  for (auto& obs : observations) {
+    obs.set_cohort(random.RandomUint32() % kNumCohorts);
+    std::string data((num_bloom_bits + 7) / 8, 0);
+    for (auto& c : data) {
+      c = random.RandomBits(0.5);
+    }
+    obs.set_data(data);
+  }
+  return observations;
+}
+
+// The former body of BloomBitCounter::AddObservation(), after the checks of
+// the observation: it iterates through the bits of the observation "from
+// right to left" and increments bit_sums[i] if the ith bit is set.
+void AddObservationBitByBit(const RapporObservation& obs,
+                            std::vector<size_t>* bit_sums) {
+  size_t bit_index = 0;
+  for (int byte_index = obs.data().size() - 1; byte_index >= 0;
+       byte_index--) {
+    uint8_t bit_mask = 1;
+    for (int bit_in_byte_index = 0; bit_in_byte_index < 8;
+         bit_in_byte_index++) {
+      if (bit_index >= bit_sums->size()) {
+        return;
+      }
+      if (bit_mask & obs.data()[byte_index]) {
+        (*bit_sums)[bit_index]++;
+      }
+      bit_index++;
+      bit_mask <<= 1;
+    }
+  }
+}
+
+void BM_AddObservation(benchmark::State& state) {
+  uint32_t num_bloom_bits = state.range(0);
+  auto observations = MakeObservations(num_bloom_bits);
+  BloomBitCounter bit_counter(Config(num_bloom_bits));
+  for (auto _ : state) {
+    for (const auto& obs : observations) {
+      bit_counter.AddObservation(obs);
+    }
+  }
+  // Include the final spill of the pending counts.
+  benchmark::DoNotOptimize(bit_counter.EstimateCounts());
+  state.SetItemsProcessed(state.iterations() * kNumObservations);
+}
+BENCHMARK(BM_AddObservation)->RangeMultiplier(4)->Range(16, 1024);
+
+void BM_AddObservationBitByBit(benchmark::State& state) {
+  uint32_t num_bloom_bits = state.range(0);
+  auto observations = MakeObservations(num_bloom_bits);
+  std::vector<std::vector<size_t>> bit_sums(
+      kNumCohorts, std::vector<size_t>(num_bloom_bits, 0));
+  for (auto _ : state) {
+    for (const auto& obs : observations) {
+      AddObservationBitByBit(obs, &bit_sums[obs.cohort()]);
+    }
+  }
+  benchmark::DoNotOptimize(bit_sums);
+  state.SetItemsProcessed(state.iterations() * kNumObservations);
+}
+BENCHMARK(BM_AddObservationBitByBit)->RangeMultiplier(4)->Range(16, 1024);
+
+}  // namespace
+
+}  // namespace rappor
+}  // namespace cobalt
@@ -96,12 +96,14 @@ class BloomBitCounterTest : public ::testing::Test {
   // Checks that bit_counter_ has the expected raw count for the given cohort
   // and bit index.
   void ExpectRawCount(uint32_t cohort, size_t index, size_t expected_count) {
+    bit_counter_->SpillAllPendingCounts();
     EXPECT_EQ(expected_count,
               bit_counter_->estimated_bloom_counts_[cohort].bit_sums[index]);
   }
 
   // Checks that bit_counter_ has the expected raw counts for the given cohort.
   void ExpectRawCounts(uint32_t cohort, std::vector<size_t> expected_counts) {
+    bit_counter_->SpillAllPendingCounts();
     EXPECT_EQ(expected_counts,
               bit_counter_->estimated_bloom_counts_[cohort].bit_sums);
   }
@@ -241,6 +243,93 @@ TEST_F(BloomBitCounterTest, RawCounts4x2) {
   ExpectRawCounts(1, {0, 1004, 1000, 2});
 }
 
+// Tests the raw counts of random observations against counts computed bit by
+// bit. The numbers of bits are chosen so that the observation data is less
+// than a byte, less than a 64-bit word and several words long, and there are
+// enough observations that the pending counts of each cohort are spilled
+// several times.
+TEST_F(BloomBitCounterTest, RawCountsRandom) {
+  const uint32_t kNumCohorts = 3;
+  crypto::DeterministicRandom random;
+  for (uint32_t num_bits : {4, 32, 256}) {
+    SCOPED_TRACE(std::string("num_bits=") + std::to_string(num_bits));
+    SetBitCounter(num_bits, kNumCohorts);
+    uint32_t num_bytes = (num_bits + 7) / 8;
+    std::vector<std::vector<size_t>> expected_counts(
+        kNumCohorts, std::vector<size_t>(num_bits, 0));
+    for (int i = 0; i < 2000; i++) {
+      uint32_t cohort = random.RandomUint32() % kNumCohorts;
+      // The observation data is a whole number of bytes. The leading bits
+      // beyond num_bits are set at random too, and must not be counted.
+      std::string binary_string(num_bytes * 8, '0');
+      for (uint32_t bit_index = 0; bit_index < num_bytes * 8; bit_index++) {
+        if (random.RandomBits(0.5) & 1) {
+          binary_string[num_bytes * 8 - 1 - bit_index] = '1';
+          if (bit_index < num_bits) {
+            expected_counts[cohort][bit_index]++;
+          }
+        }
+      }
+      AddObservation(cohort, binary_string);
+    }
+    for (uint32_t cohort = 0; cohort < kNumCohorts; cohort++) {
+      ExpectRawCounts(cohort, expected_counts[cohort]);
+    }
+  }
+}
+
+// Tests that Merge() adds the counts and errors of another BloomBitCounter,
+// including the observations that it has not yet spilled, and that it fails
+// for a BloomBitCounter with a different config.
+TEST_F(BloomBitCounterTest, Merge) {
+  SetBitCounter(16, 2);
+  BloomBitCounter other(
+      Config(16, 2, prob_0_becomes_1_, prob_1_stays_1_));
+  // Add 300 observations to |other|, so that the counts of cohort 1 are
+  // spilled once and those of cohort 0 are all pending.
+  for (int i = 0; i < 300; i++) {
+    EXPECT_TRUE(other.AddObservation(
+        RapporObservationFromString(1, "0000000100000011")));
+  }
+  for (int i = 0; i < 10; i++) {
+    EXPECT_TRUE(other.AddObservation(
+        RapporObservationFromString(0, "1000000000000001")));
+  }
+  EXPECT_FALSE(
+      other.AddObservation(RapporObservationFromString(0, "00000001")));
+
+  AddObservation(0, "0000000000000011");
+  AddObservation(1, "0000000000000010");
+  EXPECT_TRUE(bit_counter_->Merge(other));
+  CheckState(312, 1);
+
+  std::vector<size_t> expected_counts_0(16, 0);
+  expected_counts_0[0] = 11;
+  expected_counts_0[1] = 1;
+  expected_counts_0[15] = 10;
+  std::vector<size_t> expected_counts_1(16, 0);
+  expected_counts_1[0] = 300;
+  expected_counts_1[1] = 301;
+  expected_counts_1[8] = 300;
+  ExpectRawCounts(0, expected_counts_0);
+  ExpectRawCounts(1, expected_counts_1);
+  auto estimated_counts = bit_counter_->EstimateCounts();
+  EXPECT_EQ(11u, estimated_counts[0].num_observations);
+  EXPECT_EQ(301u, estimated_counts[1].num_observations);
+
+  BloomBitCounter more_bits(
+      Config(32, 2, prob_0_becomes_1_, prob_1_stays_1_));
+  EXPECT_FALSE(bit_counter_->Merge(more_bits));
+  BloomBitCounter more_cohorts(
+      Config(16, 3, prob_0_becomes_1_, prob_1_stays_1_));
+  EXPECT_FALSE(bit_counter_->Merge(more_cohorts));
+  BloomBitCounter other_probabilities(Config(16, 2, 0.25, 0.75));
+  EXPECT_FALSE(bit_counter_->Merge(other_probabilities));
+  CheckState(312, 1);
+  ExpectRawCounts(0, expected_counts_0);
+  ExpectRawCounts(1, expected_counts_1);
+}
+
 // Tests the raw counts when there are 1024 bits and 100 cohorts
 TEST_F(BloomBitCounterTest, RawCounts1024x100) {
   // Construct a bloom bit counter with 1024 bits and 100 cohorts.
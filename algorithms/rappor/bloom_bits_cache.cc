@@ -0,0 +1,83 @@
+// Copyright 2018 The Fuchsia Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "algorithms/rappor/bloom_bits_cache.h"
+
+namespace cobalt {
+namespace rappor {
+
+BloomBitsCache::BloomBitsCache(size_t capacity) : capacity_(capacity) {}
+
+std::string BloomBitsCache::MakeKey(const std::string& serialized_value,
+                                    uint32_t cohort_num, uint32_t num_bits,
+                                    uint32_t num_hashes) {
+  // The parameters have a fixed size, so appending them to the value makes
+  // the key unambiguous.
+  std::string key = serialized_value;
+  for (uint32_t parameter : {cohort_num, num_bits, num_hashes}) {
+    key.append(reinterpret_cast<const char*>(&parameter), sizeof(parameter));
+  }
+  return key;
+}
+
+bool BloomBitsCache::Get(const std::string& key, std::string* bloom_bits) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto entry = index_.find(key);
+  if (entry == index_.end()) {
+    misses_++;
+    return false;
+  }
+  hits_++;
+  entries_.splice(entries_.begin(), entries_, entry->second);
+  *bloom_bits = entry->second->second;
+  return true;
+}
+
+void BloomBitsCache::Put(const std::string& key,
+                         const std::string& bloom_bits) {
+  if (capacity_ == 0) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto entry = index_.find(key);
+  if (entry != index_.end()) {
+    entry->second->second = bloom_bits;
+    entries_.splice(entries_.begin(), entries_, entry->second);
+    return;
+  }
+  if (entries_.size() == capacity_) {
+    index_.erase(entries_.back().first);
+    entries_.pop_back();
+  }
+  entries_.emplace_front(key, bloom_bits);
+  index_[key] = entries_.begin();
+}
+
+size_t BloomBitsCache::size() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return entries_.size();
+}
+
+size_t BloomBitsCache::hits() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return hits_;
+}
+
+size_t BloomBitsCache::misses() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return misses_;
+}
+
+}  // namespace rappor
+}  // namespace cobalt
@@ -0,0 +1,83 @@
+// Copyright 2018 The Fuchsia Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef COBALT_ALGORITHMS_RAPPOR_BLOOM_BITS_CACHE_H_
+#define COBALT_ALGORITHMS_RAPPOR_BLOOM_BITS_CACHE_H_
+
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+namespace cobalt {
+namespace rappor {
+
+// A BloomBitsCache is a bounded cache of the Bloom filters computed by a
+// RapporEncoder, before the randomized response step. The Bloom filter of a
+// value only depends on the value, the cohort and the numbers of bits and
+// hashes, all of which are part of the key, so on a client, whose cohort is
+// fixed, a value that is encoded repeatedly only needs to be hashed once.
+//
+// When the cache is full, the least recently used entry is evicted.
+//
+// This object is thread safe, so that it may be shared by RapporEncoders that
+// are used on different threads.
+class BloomBitsCache {
+ public:
+  // |capacity| is the maximum number of entries. A cache with a capacity of
+  // zero caches nothing.
+  explicit BloomBitsCache(size_t capacity);
+
+  // Returns a key for the Bloom filter of the serialized ValuePart
+  // |serialized_value| in the cohort |cohort_num|, with the given numbers of
+  // bits and hashes.
+  static std::string MakeKey(const std::string& serialized_value,
+                             uint32_t cohort_num, uint32_t num_bits,
+                             uint32_t num_hashes);
+
+  // If there is an entry for |key|, copies its Bloom filter to |bloom_bits|,
+  // marks it as the most recently used one and returns true. Otherwise
+  // returns false.
+  bool Get(const std::string& key, std::string* bloom_bits);
+
+  // Adds an entry that maps |key| to |bloom_bits|, evicting the least
+  // recently used entry if the cache is full.
+  void Put(const std::string& key, const std::string& bloom_bits);
+
+  size_t capacity() const { return capacity_; }
+  size_t size() const;
+
+  // The numbers of calls to Get() that returned true and false.
+  size_t hits() const;
+  size_t misses() const;
+
+ private:
+  using Entry = std::pair<std::string, std::string>;
+
+  const size_t capacity_;
+
+  mutable std::mutex mutex_;
+  // The entries, the most recently used first.
+  std::list<Entry> entries_;
+  std::unordered_map<std::string, std::list<Entry>::iterator> index_;
+  size_t hits_ = 0;
+  size_t misses_ = 0;
+};
+
+}  // namespace rappor
+}  // namespace cobalt
+
+#endif  // COBALT_ALGORITHMS_RAPPOR_BLOOM_BITS_CACHE_H_
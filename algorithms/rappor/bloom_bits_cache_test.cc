@@ -0,0 +1,76 @@
+// Copyright 2018 The Fuchsia Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "algorithms/rappor/bloom_bits_cache.h"
+
+#include <string>
+
+#include "third_party/googletest/googletest/include/gtest/gtest.h"
+
+namespace cobalt {
+namespace rappor {
+
+// Tests that the entries that are put are found, and that hits and misses
+// are counted.
+TEST(BloomBitsCacheTest, GetAndPut) {
+  BloomBitsCache cache(2);
+  std::string bloom_bits;
+  EXPECT_FALSE(cache.Get("a", &bloom_bits));
+  cache.Put("a", "bits of a");
+  EXPECT_TRUE(cache.Get("a", &bloom_bits));
+  EXPECT_EQ("bits of a", bloom_bits);
+  cache.Put("a", "new bits of a");
+  EXPECT_TRUE(cache.Get("a", &bloom_bits));
+  EXPECT_EQ("new bits of a", bloom_bits);
+  EXPECT_EQ(1u, cache.size());
+  EXPECT_EQ(2u, cache.hits());
+  EXPECT_EQ(1u, cache.misses());
+}
+
+// Tests that the least recently used entry is evicted when the cache is full.
+TEST(BloomBitsCacheTest, EvictsLeastRecentlyUsed) {
+  BloomBitsCache cache(2);
+  std::string bloom_bits;
+  cache.Put("a", "bits of a");
+  cache.Put("b", "bits of b");
+  EXPECT_TRUE(cache.Get("a", &bloom_bits));
+  cache.Put("c", "bits of c");
+  EXPECT_EQ(2u, cache.size());
+  EXPECT_TRUE(cache.Get("a", &bloom_bits));
+  EXPECT_FALSE(cache.Get("b", &bloom_bits));
+  EXPECT_TRUE(cache.Get("c", &bloom_bits));
+  EXPECT_EQ("bits of c", bloom_bits);
+}
+
+// Tests that a cache with no capacity caches nothing.
+TEST(BloomBitsCacheTest, ZeroCapacity) {
+  BloomBitsCache cache(0);
+  std::string bloom_bits;
+  cache.Put("a", "bits of a");
+  EXPECT_FALSE(cache.Get("a", &bloom_bits));
+  EXPECT_EQ(0u, cache.size());
+}
+
+// Tests that the keys of the same value differ in each of the parameters.
+TEST(BloomBitsCacheTest, MakeKey) {
+  auto key = BloomBitsCache::MakeKey("value", 1, 128, 2);
+  EXPECT_EQ(key, BloomBitsCache::MakeKey("value", 1, 128, 2));
+  EXPECT_NE(key, BloomBitsCache::MakeKey("other value", 1, 128, 2));
+  EXPECT_NE(key, BloomBitsCache::MakeKey("value", 2, 128, 2));
+  EXPECT_NE(key, BloomBitsCache::MakeKey("value", 1, 64, 2));
+  EXPECT_NE(key, BloomBitsCache::MakeKey("value", 1, 128, 4));
+}
+
+}  // namespace rappor
+}  // namespace cobalt
@@ -0,0 +1,337 @@
+// Copyright 2018 The Fuchsia Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "algorithms/rappor/candidate_matrix_cache.h"
+
+#include <dirent.h>
+#include <glog/logging.h>
+#include <sys/stat.h>
+#include <utime.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <sstream>
+#include <thread>
+#include <utility>
+
+#include "util/crypto_util/hash.h"
+
+namespace cobalt {
+namespace rappor {
+
+namespace {
+
+// The first bytes of a file written by CandidateMatrixCache. The digit is the
+// version of the format.
+const char kFileMagic[] = {'C', 'M', 'X', '1'};
+
+// The file format is kFileMagic, then num_bits, num_cohorts, num_hashes and
+// num_candidates as uint32_ts, then the bit indices as uint16_ts. Integers are
+// in the byte order of the host, since the files are a local cache.
+const size_t kFileHeaderSize = sizeof(kFileMagic) + 4 * sizeof(uint32_t);
+
+// The suffix of the names of the files written by CandidateMatrixCache.
+const char kFileSuffix[] = ".cmx";
+
+void AppendUint32(uint32_t value, std::string* out) {
+  out->append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+bool HasDimensions(const CandidateMatrix& candidate_matrix, uint32_t num_bits,
+                   uint32_t num_cohorts, uint32_t num_hashes,
+                   uint32_t num_candidates) {
+  return candidate_matrix.num_bits == num_bits &&
+         candidate_matrix.num_cohorts == num_cohorts &&
+         candidate_matrix.num_hashes == num_hashes &&
+         candidate_matrix.num_candidates == num_candidates;
+}
+
+}  // namespace
+
+CandidateMatrix::CandidateMatrix(uint32_t num_bits, uint32_t num_cohorts,
+                                 uint32_t num_hashes, uint32_t num_candidates)
+    : num_bits(num_bits),
+      num_cohorts(num_cohorts),
+      num_hashes(num_hashes),
+      num_candidates(num_candidates),
+      bit_indices(static_cast<size_t>(num_candidates) * num_cohorts *
+                      num_hashes,
+                  0) {}
+
+void CandidateMatrix::BuildMatrix() {
+  matrix.resize(num_cohorts * num_bits, num_candidates);
+  std::vector<Eigen::Triplet<double>> sparse_matrix_triplets;
+  sparse_matrix_triplets.reserve(bit_indices.size());
+  std::vector<uint32_t> rows(num_hashes);
+  for (uint32_t candidate = 0; candidate < num_candidates; candidate++) {
+    for (uint32_t cohort = 0; cohort < num_cohorts; cohort++) {
+      // Each cohort corresponds to a block of |num_bits| rows, in which the
+      // bits are indexed "from the left". Several hashes may set the same
+      // bit, which must appear only once in the matrix.
+      for (uint32_t hash = 0; hash < num_hashes; hash++) {
+        rows[hash] = cohort * num_bits + num_bits - 1 -
+                     bit_index(candidate, cohort, hash);
+      }
+      std::sort(rows.begin(), rows.end());
+      auto rows_end = std::unique(rows.begin(), rows.end());
+      for (auto row = rows.begin(); row != rows_end; row++) {
+        sparse_matrix_triplets.emplace_back(*row, candidate, 1.0);
+      }
+    }
+  }
+  matrix.setFromTriplets(sparse_matrix_triplets.begin(),
+                         sparse_matrix_triplets.end());
+}
+
+const size_t CandidateMatrixCache::kDefaultMaxFiles;
+
+CandidateMatrixCache::CandidateMatrixCache(size_t capacity,
+                                           const std::string& directory,
+                                           size_t max_files)
+    : capacity_(capacity), directory_(directory), max_files_(max_files) {
+  CHECK_GT(max_files_, 0u);
+}
+
+std::string CandidateMatrixCache::MakeKey(
+    uint32_t num_bits, uint32_t num_cohorts, uint32_t num_hashes,
+    const RapporCandidateList& candidates) {
+  // Each candidate is preceded by its length, which makes the encoding
+  // unambiguous.
+  std::string data;
+  AppendUint32(num_bits, &data);
+  AppendUint32(num_cohorts, &data);
+  AppendUint32(num_hashes, &data);
+  for (const std::string& candidate : candidates.candidates()) {
+    AppendUint32(candidate.size(), &data);
+    data.append(candidate);
+  }
+  crypto::byte digest[crypto::hash::DIGEST_SIZE];
+  CHECK(crypto::hash::Hash(reinterpret_cast<const crypto::byte*>(data.data()),
+                           data.size(), digest));
+  static const char kHexDigits[] = "0123456789abcdef";
+  std::string key;
+  for (crypto::byte b : digest) {
+    key.push_back(kHexDigits[b >> 4]);
+    key.push_back(kHexDigits[b & 0xf]);
+  }
+  return key;
+}
+
+std::shared_ptr<const CandidateMatrix> CandidateMatrixCache::Get(
+    const std::string& key, uint32_t num_bits, uint32_t num_cohorts,
+    uint32_t num_hashes, uint32_t num_candidates) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto entry = index_.find(key);
+    if (entry != index_.end() &&
+        HasDimensions(*entry->second->second, num_bits, num_cohorts,
+                      num_hashes, num_candidates)) {
+      hits_++;
+      entries_.splice(entries_.begin(), entries_, entry->second);
+      return entry->second->second;
+    }
+    if (directory_.empty()) {
+      misses_++;
+      return nullptr;
+    }
+  }
+
+  // Read the file without holding the lock, since this parses the file and
+  // builds the matrix.
+  auto candidate_matrix =
+      ReadFile(key, num_bits, num_cohorts, num_hashes, num_candidates);
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (candidate_matrix == nullptr) {
+    misses_++;
+    return nullptr;
+  }
+  hits_++;
+  PutLocked(key, candidate_matrix);
+  return candidate_matrix;
+}
+
+void CandidateMatrixCache::Put(
+    const std::string& key,
+    std::shared_ptr<const CandidateMatrix> candidate_matrix) {
+  if (!directory_.empty()) {
+    WriteFile(key, *candidate_matrix);
+    PruneDirectory(key);
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  PutLocked(key, std::move(candidate_matrix));
+}
+
+void CandidateMatrixCache::PutLocked(
+    const std::string& key,
+    std::shared_ptr<const CandidateMatrix> candidate_matrix) {
+  if (capacity_ == 0) {
+    return;
+  }
+  auto entry = index_.find(key);
+  if (entry != index_.end()) {
+    entry->second->second = std::move(candidate_matrix);
+    entries_.splice(entries_.begin(), entries_, entry->second);
+    return;
+  }
+  if (entries_.size() == capacity_) {
+    index_.erase(entries_.back().first);
+    entries_.pop_back();
+  }
+  entries_.emplace_front(key, std::move(candidate_matrix));
+  index_[key] = entries_.begin();
+}
+
+size_t CandidateMatrixCache::size() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return entries_.size();
+}
+
+size_t CandidateMatrixCache::hits() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return hits_;
+}
+
+size_t CandidateMatrixCache::misses() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return misses_;
+}
+
+std::string CandidateMatrixCache::FilePath(const std::string& key) const {
+  return directory_ + "/" + key + kFileSuffix;
+}
+
+std::shared_ptr<const CandidateMatrix> CandidateMatrixCache::ReadFile(
+    const std::string& key, uint32_t num_bits, uint32_t num_cohorts,
+    uint32_t num_hashes, uint32_t num_candidates) const {
+  std::ifstream stream(FilePath(key),
+                       std::ifstream::in | std::ifstream::binary);
+  if (!stream) {
+    return nullptr;
+  }
+  std::string contents((std::istreambuf_iterator<char>(stream)),
+                       std::istreambuf_iterator<char>());
+  if (contents.size() < kFileHeaderSize ||
+      std::memcmp(contents.data(), kFileMagic, sizeof(kFileMagic)) != 0) {
+    LOG(WARNING) << "Ignoring invalid candidate matrix file " << FilePath(key);
+    return nullptr;
+  }
+  uint32_t header[4];
+  std::memcpy(header, contents.data() + sizeof(kFileMagic), sizeof(header));
+  if (header[0] != num_bits || header[1] != num_cohorts ||
+      header[2] != num_hashes || header[3] != num_candidates) {
+    LOG(WARNING) << "Ignoring candidate matrix file " << FilePath(key)
+                 << " with unexpected dimensions";
+    return nullptr;
+  }
+  // The numbers of bits, cohorts and hashes are bounded by the
+  // RapporConfigValidator, which also keeps num_bytes from overflowing.
+  uint64_t num_bytes = static_cast<uint64_t>(num_candidates) * num_cohorts *
+                       num_hashes * sizeof(uint16_t);
+  if (contents.size() - kFileHeaderSize != num_bytes) {
+    LOG(WARNING) << "Ignoring invalid candidate matrix file " << FilePath(key);
+    return nullptr;
+  }
+  auto candidate_matrix = std::make_shared<CandidateMatrix>(
+      num_bits, num_cohorts, num_hashes, num_candidates);
+  std::memcpy(candidate_matrix->bit_indices.data(),
+              contents.data() + kFileHeaderSize, num_bytes);
+  for (uint16_t bit_index : candidate_matrix->bit_indices) {
+    if (bit_index >= candidate_matrix->num_bits) {
+      LOG(WARNING) << "Ignoring invalid candidate matrix file "
+                   << FilePath(key);
+      return nullptr;
+    }
+  }
+  candidate_matrix->BuildMatrix();
+  // Mark the file as recently used for PruneDirectory().
+  utime(FilePath(key).c_str(), nullptr);
+  return candidate_matrix;
+}
+
+void CandidateMatrixCache::WriteFile(
+    const std::string& key, const CandidateMatrix& candidate_matrix) const {
+  std::string contents(kFileMagic, sizeof(kFileMagic));
+  AppendUint32(candidate_matrix.num_bits, &contents);
+  AppendUint32(candidate_matrix.num_cohorts, &contents);
+  AppendUint32(candidate_matrix.num_hashes, &contents);
+  AppendUint32(candidate_matrix.num_candidates, &contents);
+  contents.append(
+      reinterpret_cast<const char*>(candidate_matrix.bit_indices.data()),
+      candidate_matrix.bit_indices.size() * sizeof(uint16_t));
+
+  std::ostringstream temp_path;
+  temp_path << FilePath(key) << ".tmp."
+            << std::hash<std::thread::id>()(std::this_thread::get_id());
+  std::ofstream stream(temp_path.str(),
+                       std::ofstream::out | std::ofstream::binary);
+  stream.write(contents.data(), contents.size());
+  stream.close();
+  if (!stream) {
+    LOG(WARNING) << "Unable to write candidate matrix file "
+                 << temp_path.str();
+    std::remove(temp_path.str().c_str());
+    return;
+  }
+  if (std::rename(temp_path.str().c_str(), FilePath(key).c_str()) != 0) {
+    LOG(WARNING) << "Unable to rename candidate matrix file "
+                 << temp_path.str();
+    std::remove(temp_path.str().c_str());
+  }
+}
+
+void CandidateMatrixCache::PruneDirectory(
+    const std::string& key_to_keep) const {
+  std::unique_ptr<DIR, int (*)(DIR*)> dir(opendir(directory_.c_str()),
+                                          closedir);
+  if (!dir) {
+    LOG(WARNING) << "Unable to list candidate matrix directory " << directory_;
+    return;
+  }
+  const std::string path_to_keep = FilePath(key_to_keep);
+  const size_t suffix_size = std::strlen(kFileSuffix);
+  // The modification time in nanoseconds and the path of each file other
+  // than |path_to_keep|.
+  std::vector<std::pair<int64_t, std::string>> files;
+  while (struct dirent* entry = readdir(dir.get())) {
+    std::string name(entry->d_name);
+    if (name.size() <= suffix_size ||
+        name.compare(name.size() - suffix_size, suffix_size, kFileSuffix) !=
+            0) {
+      continue;
+    }
+    std::string path = directory_ + "/" + name;
+    struct stat file_stat;
+    if (path == path_to_keep || stat(path.c_str(), &file_stat) != 0) {
+      continue;
+    }
+    files.emplace_back(
+        static_cast<int64_t>(file_stat.st_mtim.tv_sec) * 1000000000 +
+            file_stat.st_mtim.tv_nsec,
+        std::move(path));
+  }
+  // The file for |key_to_keep| is one of the |max_files_| files.
+  if (files.size() < max_files_) {
+    return;
+  }
+  std::sort(files.begin(), files.end());
+  for (size_t i = 0; i < files.size() - (max_files_ - 1); i++) {
+    std::remove(files[i].second.c_str());
+  }
+}
+
+}  // namespace rappor
+}  // namespace cobalt
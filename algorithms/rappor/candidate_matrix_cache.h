@@ -0,0 +1,173 @@
+// Copyright 2018 The Fuchsia Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef COBALT_ALGORITHMS_RAPPOR_CANDIDATE_MATRIX_CACHE_H_
+#define COBALT_ALGORITHMS_RAPPOR_CANDIDATE_MATRIX_CACHE_H_
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "config/report_configs.pb.h"
+#include "third_party/eigen/Eigen/SparseCore"
+
+namespace cobalt {
+namespace rappor {
+
+// The result of hashing each of the candidates of a string RAPPOR analysis
+// into the Bloom filter of each cohort, and the sparse candidate matrix built
+// from it. See RapporAnalyzer::candidate_matrix_ for the definition of the
+// matrix.
+struct CandidateMatrix {
+  CandidateMatrix(uint32_t num_bits, uint32_t num_cohorts, uint32_t num_hashes,
+                  uint32_t num_candidates);
+
+  // The bit index, counted "from the right", of the given hash of the given
+  // candidate in the given cohort.
+  uint16_t& bit_index(uint32_t candidate, uint32_t cohort, uint32_t hash) {
+    return bit_indices[(candidate * num_cohorts + cohort) * num_hashes + hash];
+  }
+  const uint16_t& bit_index(uint32_t candidate, uint32_t cohort,
+                            uint32_t hash) const {
+    return bit_indices[(candidate * num_cohorts + cohort) * num_hashes + hash];
+  }
+
+  // Builds |matrix| from |bit_indices|.
+  void BuildMatrix();
+
+  const uint32_t num_bits;
+  const uint32_t num_cohorts;
+  const uint32_t num_hashes;
+  const uint32_t num_candidates;
+
+  // num_candidates * num_cohorts * num_hashes bit indices. See bit_index().
+  std::vector<uint16_t> bit_indices;
+
+  // The (num_cohorts * num_bits) X num_candidates candidate matrix.
+  Eigen::SparseMatrix<double, Eigen::RowMajor> matrix;
+};
+
+// A CandidateMatrixCache holds CandidateMatrices so that repeated string
+// RAPPOR analyses with the same RapporConfig and candidate list, such as the
+// daily runs of a report, skip hashing the candidates. The key of an entry is
+// a fingerprint of the parts of the RapporConfig that the hashes depend on
+// and of the candidate list.
+//
+// At most |capacity| entries are held in memory. When the cache is full, the
+// least recently used entry is evicted. If a |directory| is given, each entry
+// that is added is also written to a file in that directory, in a compact
+// binary form that holds only the bit indices, and an entry that is not in
+// memory is looked for there, so that the entries outlive the process. The
+// directory holds at most |max_files| files. When an entry is added beyond
+// that, the files that were least recently written or read are removed. The
+// files are ordered by their modification times, which are updated when a
+// file is read, so the order is shared by all of the processes that use the
+// directory.
+//
+// This object is thread safe, so that it may be shared by RapporAnalyzers
+// that are used on different threads.
+class CandidateMatrixCache {
+ public:
+  // The default maximum number of files in the directory.
+  static const size_t kDefaultMaxFiles = 256;
+
+  // |capacity| is the maximum number of entries held in memory. |directory|
+  // is the directory in which the entries are persisted, which must exist, or
+  // the empty string for a cache that is only held in memory. |max_files| is
+  // the maximum number of entries persisted in the directory, which must be
+  // positive.
+  explicit CandidateMatrixCache(size_t capacity,
+                                const std::string& directory = "",
+                                size_t max_files = kDefaultMaxFiles);
+
+  // Returns the key for the CandidateMatrix of |candidates| under a
+  // RapporConfig with the given numbers of bits, cohorts and hashes: the
+  // hex-encoded SHA-256 digest of these numbers and of the candidates.
+  static std::string MakeKey(uint32_t num_bits, uint32_t num_cohorts,
+                             uint32_t num_hashes,
+                             const RapporCandidateList& candidates);
+
+  // Returns the CandidateMatrix with the given |key|, from memory or else
+  // from the directory, or nullptr if there is none. An entry whose numbers
+  // of bits, cohorts, hashes and candidates are not the given ones, such as
+  // a stale or corrupted file, is ignored.
+  std::shared_ptr<const CandidateMatrix> Get(const std::string& key,
+                                             uint32_t num_bits,
+                                             uint32_t num_cohorts,
+                                             uint32_t num_hashes,
+                                             uint32_t num_candidates);
+
+  // Adds |candidate_matrix| with the given |key|, evicting the least recently
+  // used entry from memory if the cache is full, and writes it to the
+  // directory if there is one.
+  void Put(const std::string& key,
+           std::shared_ptr<const CandidateMatrix> candidate_matrix);
+
+  size_t capacity() const { return capacity_; }
+  size_t size() const;
+
+  // The numbers of calls to Get() that returned an entry and that returned
+  // nullptr. A hit may have been read from the directory.
+  size_t hits() const;
+  size_t misses() const;
+
+ private:
+  using Entry = std::pair<std::string, std::shared_ptr<const CandidateMatrix>>;
+
+  // The path of the file for the entry with the given |key|.
+  std::string FilePath(const std::string& key) const;
+
+  // Reads the entry with the given |key| from the directory and updates the
+  // modification time of its file. Returns nullptr if there is none or if the
+  // file is not valid or does not have the given dimensions.
+  std::shared_ptr<const CandidateMatrix> ReadFile(
+      const std::string& key, uint32_t num_bits, uint32_t num_cohorts,
+      uint32_t num_hashes, uint32_t num_candidates) const;
+
+  // Writes |candidate_matrix| to the file for |key|. The file is written
+  // under a temporary name and then renamed, so that a reader never sees a
+  // partial file.
+  void WriteFile(const std::string& key,
+                 const CandidateMatrix& candidate_matrix) const;
+
+  // Removes the least recently written or read files from the directory,
+  // other than the file for |key_to_keep|, until it holds at most
+  // |max_files_| of them.
+  void PruneDirectory(const std::string& key_to_keep) const;
+
+  // Adds the entry to memory. The caller must hold |mutex_|.
+  void PutLocked(const std::string& key,
+                 std::shared_ptr<const CandidateMatrix> candidate_matrix);
+
+  const size_t capacity_;
+  const std::string directory_;
+  const size_t max_files_;
+
+  mutable std::mutex mutex_;
+  // The entries, the most recently used first.
+  std::list<Entry> entries_;
+  std::unordered_map<std::string, std::list<Entry>::iterator> index_;
+  size_t hits_ = 0;
+  size_t misses_ = 0;
+};
+
+}  // namespace rappor
+}  // namespace cobalt
+
+#endif  // COBALT_ALGORITHMS_RAPPOR_CANDIDATE_MATRIX_CACHE_H_
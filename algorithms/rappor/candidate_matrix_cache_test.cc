@@ -0,0 +1,321 @@
+// Copyright 2018 The Fuchsia Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "algorithms/rappor/candidate_matrix_cache.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <utime.h>
+
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "algorithms/rappor/rappor_test_utils.h"
+#include "third_party/googletest/googletest/include/gtest/gtest.h"
+
+namespace cobalt {
+namespace rappor {
+
+namespace {
+
+const uint32_t kNumBits = 16;
+const uint32_t kNumCohorts = 3;
+const uint32_t kNumHashes = 2;
+const uint32_t kNumCandidates = 5;
+
+// Returns a CandidateMatrix whose bit indices are a function of the
+// candidate, cohort and hash, and of |seed|.
+std::shared_ptr<CandidateMatrix> MakeCandidateMatrix(uint32_t seed) {
+  auto candidate_matrix = std::make_shared<CandidateMatrix>(
+      kNumBits, kNumCohorts, kNumHashes, kNumCandidates);
+  for (uint32_t candidate = 0; candidate < kNumCandidates; candidate++) {
+    for (uint32_t cohort = 0; cohort < kNumCohorts; cohort++) {
+      for (uint32_t hash = 0; hash < kNumHashes; hash++) {
+        candidate_matrix->bit_index(candidate, cohort, hash) =
+            (seed + 7 * candidate + 3 * cohort + 5 * hash) % kNumBits;
+      }
+    }
+  }
+  candidate_matrix->BuildMatrix();
+  return candidate_matrix;
+}
+
+void ExpectEqual(const CandidateMatrix& expected,
+                 const CandidateMatrix& actual) {
+  EXPECT_EQ(expected.num_bits, actual.num_bits);
+  EXPECT_EQ(expected.num_cohorts, actual.num_cohorts);
+  EXPECT_EQ(expected.num_hashes, actual.num_hashes);
+  EXPECT_EQ(expected.num_candidates, actual.num_candidates);
+  EXPECT_EQ(expected.bit_indices, actual.bit_indices);
+  ASSERT_EQ(expected.matrix.rows(), actual.matrix.rows());
+  ASSERT_EQ(expected.matrix.cols(), actual.matrix.cols());
+  EXPECT_EQ(expected.matrix.nonZeros(), actual.matrix.nonZeros());
+  EXPECT_EQ(0, (expected.matrix - actual.matrix).norm());
+}
+
+}  // namespace
+
+class CandidateMatrixCacheTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    char directory[] = "/tmp/candidate_matrix_cache_test_XXXXXX";
+    ASSERT_NE(nullptr, mkdtemp(directory));
+    directory_ = directory;
+  }
+
+  void TearDown() override {
+    for (const std::string& path : written_paths_) {
+      std::remove(path.c_str());
+    }
+    rmdir(directory_.c_str());
+  }
+
+  // Returns the entry of |cache| with the given |key| and the dimensions of
+  // the matrices made by MakeCandidateMatrix().
+  std::shared_ptr<const CandidateMatrix> Get(CandidateMatrixCache* cache,
+                                             const std::string& key) {
+    return cache->Get(key, kNumBits, kNumCohorts, kNumHashes, kNumCandidates);
+  }
+
+  // Returns the path of the file of the entry with the given |key| and
+  // removes the file in TearDown().
+  std::string FilePath(const std::string& key) {
+    written_paths_.push_back(directory_ + "/" + key + ".cmx");
+    return written_paths_.back();
+  }
+
+  std::string directory_;
+  std::vector<std::string> written_paths_;
+};
+
+// Tests that the bit indices are placed into the matrix "from the left"
+// within the block of rows of each cohort, and that a bit that is set by
+// several hashes appears in the matrix only once.
+TEST_F(CandidateMatrixCacheTest, BuildMatrix) {
+  CandidateMatrix candidate_matrix(4, 2, 2, 1);
+  candidate_matrix.bit_index(0, 0, 0) = 0;
+  candidate_matrix.bit_index(0, 0, 1) = 2;
+  candidate_matrix.bit_index(0, 1, 0) = 1;
+  candidate_matrix.bit_index(0, 1, 1) = 1;
+  candidate_matrix.BuildMatrix();
+  ASSERT_EQ(8, candidate_matrix.matrix.rows());
+  ASSERT_EQ(1, candidate_matrix.matrix.cols());
+  EXPECT_EQ(3, candidate_matrix.matrix.nonZeros());
+  EXPECT_EQ(1.0, candidate_matrix.matrix.coeff(3, 0));
+  EXPECT_EQ(1.0, candidate_matrix.matrix.coeff(1, 0));
+  EXPECT_EQ(1.0, candidate_matrix.matrix.coeff(6, 0));
+}
+
+// Tests that the key depends on each of the numbers of bits, cohorts and
+// hashes and on the candidates, including their order.
+TEST_F(CandidateMatrixCacheTest, MakeKey) {
+  RapporCandidateList candidates;
+  PopulateRapporCandidateList(kNumCandidates, &candidates);
+  std::string key = CandidateMatrixCache::MakeKey(kNumBits, kNumCohorts,
+                                                  kNumHashes, candidates);
+  EXPECT_EQ(64u, key.size());
+  EXPECT_EQ(key, CandidateMatrixCache::MakeKey(kNumBits, kNumCohorts,
+                                               kNumHashes, candidates));
+  EXPECT_NE(key, CandidateMatrixCache::MakeKey(2 * kNumBits, kNumCohorts,
+                                               kNumHashes, candidates));
+  EXPECT_NE(key, CandidateMatrixCache::MakeKey(kNumBits, kNumCohorts + 1,
+                                               kNumHashes, candidates));
+  EXPECT_NE(key, CandidateMatrixCache::MakeKey(kNumBits, kNumCohorts,
+                                               kNumHashes + 1, candidates));
+
+  RapporCandidateList other_candidates = candidates;
+  other_candidates.mutable_candidates()->SwapElements(0, 1);
+  EXPECT_NE(key, CandidateMatrixCache::MakeKey(kNumBits, kNumCohorts,
+                                               kNumHashes, other_candidates));
+
+  // The candidates "ab", "c" and "a", "bc" must not collide.
+  RapporCandidateList split_1;
+  split_1.add_candidates("ab");
+  split_1.add_candidates("c");
+  RapporCandidateList split_2;
+  split_2.add_candidates("a");
+  split_2.add_candidates("bc");
+  EXPECT_NE(CandidateMatrixCache::MakeKey(kNumBits, kNumCohorts, kNumHashes,
+                                          split_1),
+            CandidateMatrixCache::MakeKey(kNumBits, kNumCohorts, kNumHashes,
+                                          split_2));
+}
+
+// Tests that a cache with no directory holds the |capacity| most recently
+// used entries.
+TEST_F(CandidateMatrixCacheTest, InMemory) {
+  CandidateMatrixCache cache(2);
+  EXPECT_EQ(2u, cache.capacity());
+  EXPECT_EQ(nullptr, Get(&cache, "a"));
+  EXPECT_EQ(1u, cache.misses());
+
+  auto a = MakeCandidateMatrix(0);
+  auto b = MakeCandidateMatrix(1);
+  auto c = MakeCandidateMatrix(2);
+  cache.Put("a", a);
+  cache.Put("b", b);
+  EXPECT_EQ(2u, cache.size());
+  EXPECT_EQ(a, Get(&cache, "a"));
+  EXPECT_EQ(1u, cache.hits());
+
+  // "b" is now the least recently used entry and is evicted.
+  cache.Put("c", c);
+  EXPECT_EQ(2u, cache.size());
+  EXPECT_EQ(nullptr, Get(&cache, "b"));
+  EXPECT_EQ(a, Get(&cache, "a"));
+  EXPECT_EQ(c, Get(&cache, "c"));
+  EXPECT_EQ(3u, cache.hits());
+  EXPECT_EQ(2u, cache.misses());
+
+  // Replacing an entry does not evict another one.
+  cache.Put("a", b);
+  EXPECT_EQ(2u, cache.size());
+  EXPECT_EQ(b, Get(&cache, "a"));
+  EXPECT_EQ(c, Get(&cache, "c"));
+}
+
+// Tests that a cache of capacity zero holds nothing.
+TEST_F(CandidateMatrixCacheTest, ZeroCapacity) {
+  CandidateMatrixCache cache(0);
+  cache.Put("a", MakeCandidateMatrix(0));
+  EXPECT_EQ(0u, cache.size());
+  EXPECT_EQ(nullptr, Get(&cache, "a"));
+}
+
+// Tests that the entries of a cache with a directory are read back by
+// another cache over the same directory, including entries that were
+// evicted from memory.
+TEST_F(CandidateMatrixCacheTest, OnDisk) {
+  auto a = MakeCandidateMatrix(0);
+  auto b = MakeCandidateMatrix(1);
+  {
+    CandidateMatrixCache cache(1, directory_);
+    cache.Put("a", a);
+    FilePath("a");
+    cache.Put("b", b);
+    FilePath("b");
+    EXPECT_EQ(1u, cache.size());
+    auto from_disk = Get(&cache, "a");
+    ASSERT_NE(nullptr, from_disk);
+    EXPECT_NE(a, from_disk);
+    ExpectEqual(*a, *from_disk);
+  }
+
+  CandidateMatrixCache cache(2, directory_);
+  auto from_disk = Get(&cache, "b");
+  ASSERT_NE(nullptr, from_disk);
+  ExpectEqual(*b, *from_disk);
+  EXPECT_EQ(1u, cache.size());
+  EXPECT_EQ(from_disk, Get(&cache, "b"));
+  EXPECT_EQ(nullptr, Get(&cache, "c"));
+  EXPECT_EQ(2u, cache.hits());
+  EXPECT_EQ(1u, cache.misses());
+}
+
+// Tests that files that are not valid are ignored.
+TEST_F(CandidateMatrixCacheTest, InvalidFiles) {
+  CandidateMatrixCache cache(2, directory_);
+  cache.Put("a", MakeCandidateMatrix(0));
+  std::string contents;
+  {
+    std::ifstream stream(FilePath("a"), std::ifstream::binary);
+    contents.assign(std::istreambuf_iterator<char>(stream),
+                    std::istreambuf_iterator<char>());
+  }
+  ASSERT_EQ(4 + 4 * 4 + kNumCandidates * kNumCohorts * kNumHashes * 2,
+            contents.size());
+
+  auto write_and_get = [this](const std::string& key,
+                              const std::string& file_contents) {
+    {
+      std::ofstream stream(FilePath(key), std::ofstream::binary);
+      stream << file_contents;
+    }
+    // Read from a new cache so that the entry is not in memory.
+    CandidateMatrixCache cache(2, directory_);
+    return Get(&cache, key);
+  };
+
+  EXPECT_NE(nullptr, write_and_get("valid", contents));
+  EXPECT_EQ(nullptr, write_and_get("empty", ""));
+  EXPECT_EQ(nullptr, write_and_get("truncated",
+                                   contents.substr(0, contents.size() - 1)));
+  EXPECT_EQ(nullptr, write_and_get("extended", contents + "x"));
+
+  std::string bad_magic = contents;
+  bad_magic[3] = '2';
+  EXPECT_EQ(nullptr, write_and_get("bad_magic", bad_magic));
+
+  // The file is valid but has different dimensions than the expected ones.
+  std::string other_dimensions = contents;
+  other_dimensions[4 + 3 * 4] = kNumCandidates - 1;
+  other_dimensions.resize(contents.size() - kNumCohorts * kNumHashes * 2);
+  EXPECT_EQ(nullptr, write_and_get("other_dimensions", other_dimensions));
+
+  // The last bit index is out of range.
+  std::string bad_bit_index = contents;
+  bad_bit_index[contents.size() - 2] = kNumBits;
+  bad_bit_index[contents.size() - 1] = 0;
+  EXPECT_EQ(nullptr, write_and_get("bad_bit_index", bad_bit_index));
+}
+
+// Tests that an entry with different dimensions than the expected ones is
+// not returned from memory either.
+TEST_F(CandidateMatrixCacheTest, InMemoryOtherDimensions) {
+  CandidateMatrixCache cache(2);
+  cache.Put("a", MakeCandidateMatrix(0));
+  EXPECT_EQ(nullptr, cache.Get("a", kNumBits, kNumCohorts, kNumHashes,
+                               kNumCandidates + 1));
+  EXPECT_NE(nullptr, Get(&cache, "a"));
+}
+
+// Tests that the directory holds at most |max_files| files, and that the
+// files that were least recently written or read are removed first.
+TEST_F(CandidateMatrixCacheTest, PruneDirectory) {
+  // Sets the modification time of the file for |key| to |seconds|.
+  auto set_time = [this](const std::string& key, time_t seconds) {
+    struct utimbuf times = {seconds, seconds};
+    ASSERT_EQ(0, utime(FilePath(key).c_str(), &times));
+  };
+  auto exists = [this](const std::string& key) {
+    return access(FilePath(key).c_str(), F_OK) == 0;
+  };
+
+  {
+    CandidateMatrixCache cache(1, directory_, /*max_files=*/2);
+    cache.Put("a", MakeCandidateMatrix(0));
+    set_time("a", 100);
+    cache.Put("b", MakeCandidateMatrix(1));
+    set_time("b", 200);
+    cache.Put("c", MakeCandidateMatrix(2));
+    EXPECT_FALSE(exists("a"));
+    EXPECT_TRUE(exists("b"));
+    EXPECT_TRUE(exists("c"));
+  }
+
+  // Reading "b" from the directory makes it more recently used than "c".
+  CandidateMatrixCache cache(1, directory_, /*max_files=*/2);
+  set_time("c", 300);
+  EXPECT_NE(nullptr, Get(&cache, "b"));
+  cache.Put("d", MakeCandidateMatrix(3));
+  EXPECT_TRUE(exists("b"));
+  EXPECT_FALSE(exists("c"));
+  EXPECT_TRUE(exists("d"));
+}
+
+}  // namespace rappor
+}  // namespace cobalt
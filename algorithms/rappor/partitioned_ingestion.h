@@ -0,0 +1,83 @@
+// Copyright 2018 The Fuchsia Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef COBALT_ALGORITHMS_RAPPOR_PARTITIONED_INGESTION_H_
+#define COBALT_ALGORITHMS_RAPPOR_PARTITIONED_INGESTION_H_
+
+#include <algorithm>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace cobalt {
+namespace rappor {
+
+// Adds |observations| to |*analyzer| using up to |num_threads| threads.
+//
+// The observations are split into at most |num_threads| contiguous
+// partitions. Each partition is added, on a thread of its own, to a new
+// analyzer returned by |new_analyzer|, and the new analyzers are then merged
+// into |*analyzer| in the order of the partitions. The counts are the same as
+// if the observations had been added to |*analyzer| via AddObservation(),
+// including the observation errors.
+//
+// |Analyzer| may be BloomBitCounter, RapporAnalyzer or BasicRapporAnalyzer.
+// |new_analyzer| is invoked with no arguments once per partition, on the
+// calling thread, and must return a std::unique_ptr<Analyzer> for the same
+// config as |*analyzer|.
+//
+// Returns false if any of the merges failed, in which case the observations
+// of the corresponding partitions are not in |*analyzer|.
+template <typename Analyzer, typename Observation, typename NewAnalyzer>
+bool AddObservationsPartitioned(const std::vector<Observation>& observations,
+                                size_t num_threads, NewAnalyzer new_analyzer,
+                                Analyzer* analyzer) {
+  size_t num_partitions = std::min(num_threads, observations.size());
+  if (num_partitions <= 1) {
+    for (const auto& obs : observations) {
+      analyzer->AddObservation(obs);
+    }
+    return true;
+  }
+
+  std::vector<std::unique_ptr<Analyzer>> partition_analyzers;
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < num_partitions; i++) {
+    partition_analyzers.push_back(new_analyzer());
+    Analyzer* partition_analyzer = partition_analyzers.back().get();
+    size_t begin = observations.size() * i / num_partitions;
+    size_t end = observations.size() * (i + 1) / num_partitions;
+    threads.emplace_back([&observations, partition_analyzer, begin, end] {
+      for (size_t j = begin; j < end; j++) {
+        partition_analyzer->AddObservation(observations[j]);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  bool success = true;
+  for (const auto& partition_analyzer : partition_analyzers) {
+    if (!analyzer->Merge(*partition_analyzer)) {
+      success = false;
+    }
+  }
+  return success;
+}
+
+}  // namespace rappor
+}  // namespace cobalt
+
+#endif  // COBALT_ALGORITHMS_RAPPOR_PARTITIONED_INGESTION_H_
@@ -0,0 +1,178 @@
+// Copyright 2018 The Fuchsia Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "algorithms/rappor/partitioned_ingestion.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "algorithms/rappor/basic_rappor_analyzer.h"
+#include "algorithms/rappor/bloom_bit_counter.h"
+#include "algorithms/rappor/rappor_analyzer.h"
+#include "algorithms/rappor/rappor_test_utils.h"
+#include "third_party/googletest/googletest/include/gtest/gtest.h"
+#include "util/crypto_util/random_test_utils.h"
+
+namespace cobalt {
+namespace rappor {
+
+namespace {
+
+const uint32_t kNumBloomBits = 64;
+const uint32_t kNumCohorts = 10;
+const uint32_t kNumCategories = 20;
+const double kProb0Becomes1 = 0.25;
+const double kProb1Stays1 = 0.75;
+
+BasicRapporConfig BasicConfig() {
+  BasicRapporConfig config;
+  config.set_prob_0_becomes_1(kProb0Becomes1);
+  config.set_prob_1_stays_1(kProb1Stays1);
+  for (uint32_t i = 0; i < kNumCategories; i++) {
+    config.mutable_string_categories()->add_category(CategoryName(i));
+  }
+  return config;
+}
+
+// Returns |num_observations| RapporObservations with random data and random
+// cohorts. Every hundredth observation has an invalid cohort.
+std::vector<RapporObservation> RapporObservations(int num_observations) {
+  crypto::DeterministicRandom random;
+  std::vector<RapporObservation> observations(num_observations);
+  for (int i = 0; i < num_observations; i++) {
+    observations[i].set_cohort(i % 100 == 0 ? kNumCohorts
+                                            : random.RandomUint32() %
+                                                  kNumCohorts);
+    std::string data(kNumBloomBits / 8, 0);
+    random.RandomBits(0.5, reinterpret_cast<crypto::byte*>(&data[0]),
+                      data.size());
+    observations[i].set_data(data);
+  }
+  return observations;
+}
+
+// Returns |num_observations| BasicRapporObservations with random data. Every
+// hundredth observation has the wrong number of bytes.
+std::vector<BasicRapporObservation> BasicRapporObservations(
+    int num_observations) {
+  crypto::DeterministicRandom random;
+  std::vector<BasicRapporObservation> observations(num_observations);
+  for (int i = 0; i < num_observations; i++) {
+    std::string data(i % 100 == 0 ? 1 : (kNumCategories + 7) / 8, 0);
+    random.RandomBits(0.5, reinterpret_cast<crypto::byte*>(&data[0]),
+                      data.size());
+    observations[i].set_data(data);
+  }
+  return observations;
+}
+
+}  // namespace
+
+// Tests that the counts of a BloomBitCounter are the same whether the
+// observations are added sequentially or partitioned over several threads.
+TEST(PartitionedIngestionTest, BloomBitCounter) {
+  auto config = Config(kNumBloomBits, kNumCohorts, 2, kProb0Becomes1,
+                       kProb1Stays1);
+  auto observations = RapporObservations(5000);
+  BloomBitCounter expected(config);
+  for (const auto& obs : observations) {
+    expected.AddObservation(obs);
+  }
+  auto expected_counts = expected.EstimateCounts();
+
+  for (size_t num_threads : {1, 4, 7, 64}) {
+    SCOPED_TRACE(std::string("num_threads=") + std::to_string(num_threads));
+    BloomBitCounter bit_counter(config);
+    EXPECT_TRUE(AddObservationsPartitioned(
+        observations, num_threads,
+        [&config] { return std::make_unique<BloomBitCounter>(config); },
+        &bit_counter));
+    EXPECT_EQ(expected.num_observations(), bit_counter.num_observations());
+    EXPECT_EQ(expected.observation_errors(),
+              bit_counter.observation_errors());
+    auto counts = bit_counter.EstimateCounts();
+    ASSERT_EQ(expected_counts.size(), counts.size());
+    for (size_t cohort = 0; cohort < counts.size(); cohort++) {
+      EXPECT_EQ(expected_counts[cohort].num_observations,
+                counts[cohort].num_observations);
+      EXPECT_EQ(expected_counts[cohort].bit_sums, counts[cohort].bit_sums);
+      EXPECT_EQ(expected_counts[cohort].count_estimates,
+                counts[cohort].count_estimates);
+    }
+  }
+}
+
+// Tests that the observations partitioned over several threads all reach
+// the BloomBitCounter of a RapporAnalyzer.
+TEST(PartitionedIngestionTest, RapporAnalyzer) {
+  auto config = Config(kNumBloomBits, kNumCohorts, 2, kProb0Becomes1,
+                       kProb1Stays1);
+  auto observations = RapporObservations(1000);
+  RapporAnalyzer analyzer(config, nullptr);
+  EXPECT_TRUE(AddObservationsPartitioned(
+      observations, 4,
+      [&config] { return std::make_unique<RapporAnalyzer>(config, nullptr); },
+      &analyzer));
+  EXPECT_EQ(990u, analyzer.bit_counter().num_observations());
+  EXPECT_EQ(10u, analyzer.bit_counter().observation_errors());
+}
+
+// Tests that the results of a BasicRapporAnalyzer are the same whether the
+// observations are added sequentially or partitioned over several threads.
+TEST(PartitionedIngestionTest, BasicRapporAnalyzer) {
+  auto config = BasicConfig();
+  auto observations = BasicRapporObservations(5000);
+  BasicRapporAnalyzer expected(config);
+  for (const auto& obs : observations) {
+    expected.AddObservation(obs);
+  }
+  auto expected_results = expected.Analyze();
+
+  for (size_t num_threads : {1, 4, 7}) {
+    SCOPED_TRACE(std::string("num_threads=") + std::to_string(num_threads));
+    BasicRapporAnalyzer analyzer(config);
+    EXPECT_TRUE(AddObservationsPartitioned(
+        observations, num_threads,
+        [&config] { return std::make_unique<BasicRapporAnalyzer>(config); },
+        &analyzer));
+    EXPECT_EQ(expected.num_observations(), analyzer.num_observations());
+    EXPECT_EQ(expected.observation_errors(), analyzer.observation_errors());
+    auto results = analyzer.Analyze();
+    ASSERT_EQ(expected_results.size(), results.size());
+    for (size_t i = 0; i < results.size(); i++) {
+      EXPECT_EQ(expected_results[i].count_estimate, results[i].count_estimate);
+      EXPECT_EQ(expected_results[i].std_error, results[i].std_error);
+    }
+  }
+}
+
+// Tests that AddObservationsPartitioned() fails if the analyzers that it
+// creates cannot be merged into the target analyzer.
+TEST(PartitionedIngestionTest, IncompatibleConfigs) {
+  auto observations = BasicRapporObservations(100);
+  BasicRapporAnalyzer analyzer(BasicConfig());
+  BasicRapporConfig other_config = BasicConfig();
+  other_config.set_prob_0_becomes_1(0.1);
+  EXPECT_FALSE(AddObservationsPartitioned(
+      observations, 2,
+      [&other_config] {
+        return std::make_unique<BasicRapporAnalyzer>(other_config);
+      },
+      &analyzer));
+  EXPECT_EQ(0u, analyzer.num_observations());
+}
+
+}  // namespace rappor
+}  // namespace cobalt
@@ -18,6 +18,7 @@
 #include <algorithm>
 #include <cmath>
 #include <random>
+#include <utility>
 
 #include "algorithms/rappor/rappor_encoder.h"
 #include "util/crypto_util/hash.h"
@@ -40,9 +41,12 @@ const char kAnalyzeFailure[] = "rappor-analyzer-analyze-failure";
 
 using crypto::byte;
 
-RapporAnalyzer::RapporAnalyzer(const RapporConfig& config,
-                               const RapporCandidateList* candidates)
-    : bit_counter_(config), config_(bit_counter_.config()) {
+RapporAnalyzer::RapporAnalyzer(
+    const RapporConfig& config, const RapporCandidateList* candidates,
+    std::shared_ptr<CandidateMatrixCache> candidate_matrix_cache)
+    : bit_counter_(config),
+      config_(bit_counter_.config()),
+      candidate_matrix_cache_(std::move(candidate_matrix_cache)) {
   candidate_map_.candidate_list = candidates;
   // candidate_map_.candidate_cohort_maps remains empty for now. It
   // will be populated by BuildCandidateMap.
@@ -53,6 +57,10 @@ bool RapporAnalyzer::AddObservation(const RapporObservation& obs) {
   return bit_counter_.AddObservation(obs);
 }
 
+bool RapporAnalyzer::Merge(const RapporAnalyzer& other) {
+  return bit_counter_.Merge(other.bit_counter_);
+}
+
 grpc::Status RapporAnalyzer::Analyze(
     std::vector<CandidateResult>* results_out) {
   CHECK(results_out);
@@ -98,7 +106,7 @@ grpc::Status RapporAnalyzer::Analyze(
   //     makes the code less understandable to define a known column vector
   //     as a matrix with a dynamic number of columns in RowMajor order.
   LabelSet as_label_set = est_bit_count_ratios;
-  LassoRunner lasso_runner(&candidate_matrix_);
+  LassoRunner lasso_runner(&candidate_matrix_->matrix);
 
   // In the first step, we compute the lasso path. That is,
   // we compute the solutions to a sequence of lasso subproblems
@@ -178,7 +186,7 @@ grpc::Status RapporAnalyzer::Analyze(
   static const double kL1FirstToSecondStep = 1e-3;
 
   // Perform initializations based on the chosen parameters.
-  const int num_candidates = candidate_matrix_.cols();
+  const int num_candidates = candidate_matrix_->matrix.cols();
   const uint32_t num_bits = config_->num_bits();
   const uint32_t num_cohorts = config_->num_cohorts();
   const uint32_t num_hashes = config_->num_hashes();
@@ -205,10 +213,10 @@ grpc::Status RapporAnalyzer::Analyze(
 
   // Build the matrix for the second step of RAPPOR.
   const uint32_t second_step_num_candidates = second_step_cols.size();
-  InstanceSet candidate_submatrix_second_step(candidate_matrix_.rows(),
-                                              second_step_num_candidates);
+  InstanceSet candidate_submatrix_second_step(
+      candidate_matrix_->matrix.rows(), second_step_num_candidates);
   PrepareSecondRapporStepMatrix(&candidate_submatrix_second_step,
-                                second_step_cols, candidate_matrix_,
+                                second_step_cols, candidate_matrix_->matrix,
                                 num_cohorts, num_hashes);
 
   // We can now run the second step of RAPPOR.
@@ -379,9 +387,6 @@ grpc::Status RapporAnalyzer::BuildCandidateMap() {
                         "list was specified.");
   }
 
-  // TODO(rudominer) We should cache candidate_matrix_ rather than recomputing
-  // candidate_map_ and candidate_matrix_ each time.
-
   const uint32_t num_bits = config_->num_bits();
   const uint32_t num_cohorts = config_->num_cohorts();
   const uint32_t num_hashes = config_->num_hashes();
@@ -399,11 +404,59 @@ grpc::Status RapporAnalyzer::BuildCandidateMap() {
             << " candidates.";
   }
 
-  candidate_matrix_.resize(num_cohorts * num_bits, num_candidates);
-  std::vector<Eigen::Triplet<double>> sparse_matrix_triplets;
-  sparse_matrix_triplets.reserve(num_candidates * num_cohorts * num_hashes);
+  candidate_map_.candidate_cohort_maps.clear();
+  candidate_matrix_.reset();
+  std::string cache_key;
+  if (candidate_matrix_cache_) {
+    cache_key = CandidateMatrixCache::MakeKey(
+        num_bits, num_cohorts, num_hashes, *candidate_map_.candidate_list);
+    candidate_matrix_ = candidate_matrix_cache_->Get(
+        cache_key, num_bits, num_cohorts, num_hashes, num_candidates);
+    if (candidate_matrix_ != nullptr) {
+      return grpc::Status::OK;
+    }
+  }
+
+  auto candidate_matrix = std::make_shared<CandidateMatrix>(
+      num_bits, num_cohorts, num_hashes, num_candidates);
+  auto status = HashCandidates(candidate_matrix.get());
+  if (!status.ok()) {
+    return status;
+  }
+  candidate_matrix->BuildMatrix();
+  if (candidate_matrix_cache_) {
+    candidate_matrix_cache_->Put(cache_key, candidate_matrix);
+  }
+  candidate_matrix_ = std::move(candidate_matrix);
+
+  return grpc::Status::OK;
+}
 
-  int column = 0;
+const RapporAnalyzer::CandidateMap& RapporAnalyzer::candidate_map() {
+  if (candidate_matrix_ == nullptr ||
+      !candidate_map_.candidate_cohort_maps.empty()) {
+    return candidate_map_;
+  }
+  const uint32_t num_cohorts = candidate_matrix_->num_cohorts;
+  const uint32_t num_hashes = candidate_matrix_->num_hashes;
+  const uint32_t num_candidates = candidate_matrix_->num_candidates;
+  candidate_map_.candidate_cohort_maps.resize(num_candidates);
+  for (uint32_t candidate = 0; candidate < num_candidates; candidate++) {
+    CohortMap& cohort_map = candidate_map_.candidate_cohort_maps[candidate];
+    cohort_map.cohort_hashes.resize(num_cohorts);
+    for (uint32_t cohort = 0; cohort < num_cohorts; cohort++) {
+      const uint16_t* bit_indices =
+          &candidate_matrix_->bit_index(candidate, cohort, 0);
+      cohort_map.cohort_hashes[cohort].bit_indices.assign(
+          bit_indices, bit_indices + num_hashes);
+    }
+  }
+  return candidate_map_;
+}
+
+grpc::Status RapporAnalyzer::HashCandidates(
+    CandidateMatrix* candidate_matrix) {
+  uint32_t column = 0;
   for (const std::string& candidate :
        candidate_map_.candidate_list->candidates()) {
     // In rappor_encoder.cc it is not std::strings that are encoded but rather
@@ -414,62 +467,32 @@ grpc::Status RapporAnalyzer::BuildCandidateMap() {
     std::string serialized_candidate;
     candidate_as_value_part.SerializeToString(&serialized_candidate);
 
-    // Append a CohortMap for this candidate.
-    candidate_map_.candidate_cohort_maps.emplace_back();
-    CohortMap& cohort_map = candidate_map_.candidate_cohort_maps.back();
-
     // Iterate through the cohorts.
-    int row_block_base = 0;
-    for (size_t cohort = 0; cohort < num_cohorts; cohort++) {
-      // Append an instance of |Hashes| for this cohort.
-      cohort_map.cohort_hashes.emplace_back();
-      Hashes& hashes = cohort_map.cohort_hashes.back();
-
+    for (uint32_t cohort = 0; cohort < candidate_matrix->num_cohorts;
+         cohort++) {
       // Form one big hashed value of the serialized_candidate. This will be
       // used to obtain multiple bit indices.
       byte hashed_value[crypto::hash::DIGEST_SIZE];
       if (!RapporEncoder::HashValueAndCohort(serialized_candidate, cohort,
-                                             num_hashes, hashed_value)) {
+                                             candidate_matrix->num_hashes,
+                                             hashed_value)) {
         return grpc::Status(grpc::INTERNAL,
                             "Hash operation failed unexpectedly.");
       }
 
-      // bloom_filter is indexed "from the left". That is bloom_filter[0]
-      // corresponds to the most significant bit of the first byte of the
-      // Bloom filter.
-      std::vector<bool> bloom_filter(num_bits, false);
-
       // Extract one bit index for each of the hashes in the Bloom filter.
-      for (size_t hash_index = 0; hash_index < num_hashes; hash_index++) {
-        uint32_t bit_index =
-            RapporEncoder::ExtractBitIndex(hashed_value, hash_index, num_bits);
-        hashes.bit_indices.push_back(bit_index);
-        // |bit_index| is an index "from the right".
-        bloom_filter[num_bits - 1 - bit_index] = true;
-      }
-
-      // Add triplets to the sparse matrix representation. For the current
-      // column and the current block of rows we add a 1 into the row
-      // corresponding to the index of each set bit in the Bloom filter.
-      for (size_t bloom_index = 0; bloom_index < num_bits; bloom_index++) {
-        if (bloom_filter[bloom_index]) {
-          int row = row_block_base + bloom_index;
-          sparse_matrix_triplets.emplace_back(row, column, 1.0);
-        }
+      // Each is an index "from the right".
+      for (uint32_t hash_index = 0; hash_index < candidate_matrix->num_hashes;
+           hash_index++) {
+        candidate_matrix->bit_index(column, cohort, hash_index) =
+            RapporEncoder::ExtractBitIndex(hashed_value, hash_index,
+                                           candidate_matrix->num_bits);
       }
-
-      // In our sparse matrix representation each cohort corresponds to a block
-      // of |num_bits| rows.
-      row_block_base += num_bits;
     }
     // In our sparse matrix representation a column corresponds to a candidate.
     column++;
-    row_block_base = 0;
   }
 
-  candidate_matrix_.setFromTriplets(sparse_matrix_triplets.begin(),
-                                    sparse_matrix_triplets.end());
-
   return grpc::Status::OK;
 }
 
@@ -489,8 +512,8 @@ Here we justify the use of the formula
      est_bit_count_ratios[i*k +j] = est_count_i_j / n_i.
 
 Let A be the binary sparse matrix produced by the method BuildCandidateMap()
-and stored in candidate_matrix_. Let b be the column vector produced by
-the method ExtractEstimatedBitCountRatiosAndStdErrors() and stored in the
+and stored in candidate_matrix_->matrix. Let b be the column vector produced
+by the method ExtractEstimatedBitCountRatiosAndStdErrors() and stored in the
 variable est_bit_count_ratios.  In RapporAnalyzer::Analyze() we compute an
 estimate of a solution to the equation Ax = b. The question we want to address
 here is how do we know we are using the correct value of b? In particular, why
@@ -22,6 +22,7 @@
 
 #include "./observation.pb.h"
 #include "algorithms/rappor/bloom_bit_counter.h"
+#include "algorithms/rappor/candidate_matrix_cache.h"
 #include "algorithms/rappor/lasso_runner.h"
 #include "algorithms/rappor/rappor_analyzer_utils.h"
 #include "algorithms/rappor/rappor_config_validator.h"
@@ -70,9 +71,15 @@ class RapporAnalyzer {
   // If |candidates| is NULL or empty then AddObservation() may still succeed
   // but Analyze() will return INVALID_ARGUMENT.
   //
+  // If |candidate_matrix_cache| is not null, Analyze() looks up the candidate
+  // matrix for |config| and |candidates| in it before hashing the
+  // candidates, and adds the matrix to it otherwise. The cache may be shared
+  // by many RapporAnalyzers.
+  //
   // TODO(rudominer) Enhance this API to also accept DP release parameters.
-  explicit RapporAnalyzer(const RapporConfig& config,
-                          const RapporCandidateList* candidates);
+  explicit RapporAnalyzer(
+      const RapporConfig& config, const RapporCandidateList* candidates,
+      std::shared_ptr<CandidateMatrixCache> candidate_matrix_cache = nullptr);
 
   // Adds an additional observation to be analyzed. The observation must have
   // been encoded using the RapporConfig passed to the constructor.
@@ -80,6 +87,14 @@ class RapporAnalyzer {
   // Returns true to indicate the observation was added without error.
   bool AddObservation(const RapporObservation& obs);
 
+  // Adds the observations that were added to |other| to this RapporAnalyzer,
+  // as if they had been added to it via AddObservation(). See
+  // BloomBitCounter::Merge(). The candidates of |other| are not used.
+  //
+  // Returns false, and leaves this RapporAnalyzer unchanged, if the
+  // RapporConfigs of the two analyzers are invalid or incompatible.
+  bool Merge(const RapporAnalyzer& other);
+
   // Performs the string RAPPOR analysis and writes the results to
   // |results_out|. Return OK for success or an error status.
   //
@@ -96,10 +111,13 @@ class RapporAnalyzer {
  private:
   friend class RapporAnalyzerTest;
 
-  // Builds the RAPPOR CandidateMap and the associated sparse matrix based on
-  // the data passed to the constructor.
+  // Builds the sparse matrix candidate_matrix_ based on the data passed to
+  // the constructor, or shares it with the candidate_matrix_cache_.
   grpc::Status BuildCandidateMap();
 
+  // Hashes the candidates into the bit indices of |candidate_matrix|.
+  grpc::Status HashCandidates(CandidateMatrix* candidate_matrix);
+
   // An instance of Hashes is implicitly associated with a given
   // (candidate, cohort) pair and gives the list of hash values for that pair
   // under each of several hash functions. Each of the hash values is a
@@ -139,6 +157,11 @@ class RapporAnalyzer {
     std::vector<CohortMap> candidate_cohort_maps;
   };
 
+  // Returns candidate_map_. Its candidate_cohort_maps are filled from
+  // candidate_matrix_ on the first call after BuildCandidateMap(). Analyze()
+  // only needs candidate_matrix_, so this is used by the tests alone.
+  const CandidateMap& candidate_map();
+
   // Computes the column vector est_bit_count_ratios as well as a vector
   // est_std_errors of the corresponding standard errors. This method should be
   // invoked after all Observations have been added via AddObservation().
@@ -172,8 +195,8 @@ class RapporAnalyzer {
 
   CandidateMap candidate_map_;
 
-  // candidate_matrix_ is a representation of candidate_map_ as a sparse matrix.
-  // It is an (m * k) X s sparse binary matrix, where
+  // candidate_matrix_->matrix is a representation of candidate_map_ as a
+  // sparse matrix. It is an (m * k) X s sparse binary matrix, where
   // m = # of cohorts
   // k = # of Bloom filter bits per cohort
   // s = # of candidates
@@ -188,7 +211,12 @@ class RapporAnalyzer {
   //
   // The expression (k - j) above is due to the fact that
   // candidate_map_ indexes bits from the right instead of from the left.
-  Eigen::SparseMatrix<double, Eigen::RowMajor> candidate_matrix_;
+  //
+  // The CandidateMatrix is shared with the candidate_matrix_cache_, if any,
+  // and must not be modified.
+  std::shared_ptr<const CandidateMatrix> candidate_matrix_;
+
+  std::shared_ptr<CandidateMatrixCache> candidate_matrix_cache_;
 };
 
 }  // namespace rappor
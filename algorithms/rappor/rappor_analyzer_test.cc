@@ -25,34 +25,35 @@ void RapporAnalyzerTest::SetAnalyzer(uint32_t num_candidates,
   PopulateRapporCandidateList(num_candidates, &candidate_list_);
   config_ = Config(num_bloom_bits, num_cohorts, num_hashes, prob_0_becomes_1_,
                    prob_1_stays_1_);
-  analyzer_.reset(new RapporAnalyzer(config_, &candidate_list_));
+  analyzer_.reset(
+      new RapporAnalyzer(config_, &candidate_list_, candidate_matrix_cache_));
 }
 
 void RapporAnalyzerTest::BuildCandidateMap() {
   EXPECT_EQ(grpc::OK, analyzer_->BuildCandidateMap().error_code());
 
   const uint32_t num_candidates =
-      analyzer_->candidate_map_.candidate_list->candidates_size();
+      analyzer_->candidate_map().candidate_list->candidates_size();
   const uint32_t num_cohorts = analyzer_->config_->num_cohorts();
   const uint32_t num_hashes = analyzer_->config_->num_hashes();
   const uint32_t num_bits = analyzer_->config_->num_bits();
 
   // Expect the number of candidates to be correct,
   EXPECT_EQ(num_candidates,
-            analyzer_->candidate_map_.candidate_cohort_maps.size());
+            analyzer_->candidate_map().candidate_cohort_maps.size());
 
   // and for each candidate...
   for (size_t candidate = 0; candidate < num_candidates; candidate++) {
     // expect the number of cohorts to be correct,
     EXPECT_EQ(num_cohorts,
-              analyzer_->candidate_map_.candidate_cohort_maps[candidate]
+              analyzer_->candidate_map().candidate_cohort_maps[candidate]
                   .cohort_hashes.size());
 
     // and for each cohort...
     for (size_t cohort = 0; cohort < num_cohorts; cohort++) {
       // expect the number of hashes to be correct,
       EXPECT_EQ(num_hashes,
-                analyzer_->candidate_map_.candidate_cohort_maps[candidate]
+                analyzer_->candidate_map().candidate_cohort_maps[candidate]
                     .cohort_hashes[cohort]
                     .bit_indices.size());
 
@@ -77,16 +78,16 @@ void RapporAnalyzerTest::BuildCandidateMap() {
 uint16_t RapporAnalyzerTest::GetCandidateMapValue(uint16_t candidate_index,
                                                   uint16_t cohort_index,
                                                   uint16_t hash_index) {
-  EXPECT_GT(analyzer_->candidate_map_.candidate_cohort_maps.size(),
+  EXPECT_GT(analyzer_->candidate_map().candidate_cohort_maps.size(),
             candidate_index);
-  EXPECT_GT(analyzer_->candidate_map_.candidate_cohort_maps[candidate_index]
+  EXPECT_GT(analyzer_->candidate_map().candidate_cohort_maps[candidate_index]
                 .cohort_hashes.size(),
             cohort_index);
-  EXPECT_GT(analyzer_->candidate_map_.candidate_cohort_maps[candidate_index]
+  EXPECT_GT(analyzer_->candidate_map().candidate_cohort_maps[candidate_index]
                 .cohort_hashes[cohort_index]
                 .bit_indices.size(),
             hash_index);
-  return analyzer_->candidate_map_.candidate_cohort_maps[candidate_index]
+  return analyzer_->candidate_map().candidate_cohort_maps[candidate_index]
       .cohort_hashes[cohort_index]
       .bit_indices[hash_index];
 }
@@ -95,7 +96,7 @@ std::string RapporAnalyzerTest::BuildBitString(uint16_t candidate_index,
                                                uint16_t cohort_index) {
   return BuildBinaryString(
       analyzer_->config_->num_bits(),
-      analyzer_->candidate_map_.candidate_cohort_maps[candidate_index]
+      analyzer_->candidate_map().candidate_cohort_maps[candidate_index]
           .cohort_hashes[cohort_index]
           .bit_indices);
 }
@@ -193,9 +194,9 @@ void RapporAnalyzerTest::CheckExactSolution(
   Eigen::VectorXd est_bit_count_ratios;
   ExtractEstimatedBitCountRatios(&est_bit_count_ratios);
   Eigen::VectorXd exact_count_vector = VectorFromCounts(exact_candidate_counts);
-  EXPECT_EQ(analyzer_->candidate_matrix_.cols(),
+  EXPECT_EQ(candidate_matrix().cols(),
             static_cast<const int64_t>(exact_candidate_counts.size()));
-  Eigen::VectorXd rhs = analyzer_->candidate_matrix_ * exact_count_vector;
+  Eigen::VectorXd rhs = candidate_matrix() * exact_count_vector;
   rhs /= exact_count_vector.sum();
   Eigen::VectorXd difference = rhs - est_bit_count_ratios;
   LOG(ERROR)
@@ -285,7 +286,7 @@ grpc::Status RapporAnalyzerTest::ComputeLeastSquaresFitQR(
     std::vector<CandidateResult>* results) {
   // cast from smaller to larger type for comparisons
   const size_t num_candidates =
-      static_cast<const size_t>(analyzer_->candidate_matrix_.cols());
+      static_cast<const size_t>(candidate_matrix().cols());
   EXPECT_EQ(results->size(), num_candidates);
   // define the QR solver and perform the QR decomposition followed by
   // least squares solve
@@ -293,14 +294,14 @@ grpc::Status RapporAnalyzerTest::ComputeLeastSquaresFitQR(
                   Eigen::COLAMDOrdering<int>>
       qrsolver;
 
-  EXPECT_EQ(analyzer_->candidate_matrix_.rows(), est_bit_count_ratios.size());
-  EXPECT_GT(analyzer_->candidate_matrix_.rows(), 0);
-  // explicitly construct Eigen::ColMajor matrix from candidate_matrix_
+  EXPECT_EQ(candidate_matrix().rows(), est_bit_count_ratios.size());
+  EXPECT_GT(candidate_matrix().rows(), 0);
+  // explicitly construct Eigen::ColMajor matrix from candidate_matrix()
   // (the documentation for Eigen::SparseQR requires it)
   // compute() as well as Eigen::COLAMDOrdering require compressed
   // matrix
   Eigen::SparseMatrix<double, Eigen::ColMajor> candidate_matrix_col_major =
-      analyzer_->candidate_matrix_;
+      candidate_matrix();
   candidate_matrix_col_major.makeCompressed();
   qrsolver.compute(candidate_matrix_col_major);
   if (qrsolver.info() != Eigen::Success) {
@@ -31,7 +31,7 @@ class RapporAnalyzerTest : public ::testing::Test {
  protected:
   // Sets the member variable analyzer_ to a new RapporAnalyzer configured
   // with the given arguments and the current values of prob_0_becomes_1_,
-  // prob_1_stays_1_.
+  // prob_1_stays_1_ and candidate_matrix_cache_.
   void SetAnalyzer(uint32_t num_candidates, uint32_t num_bloom_bits,
                    uint32_t num_cohorts, uint32_t num_hashes);
 
@@ -49,7 +49,7 @@ class RapporAnalyzerTest : public ::testing::Test {
   std::string BuildBitString(uint16_t candidate_index, uint16_t cohort_index);
 
   const Eigen::SparseMatrix<double, Eigen::RowMajor>& candidate_matrix() {
-    return analyzer_->candidate_matrix_;
+    return analyzer_->candidate_matrix_->matrix;
   }
 
   void AddObservation(uint32_t cohort, std::string binary_string);
@@ -82,7 +82,7 @@ class RapporAnalyzerTest : public ::testing::Test {
   // of the equation solved by Analyze(). The function prints the value of
   // d == || A * x_s - b || / || b || where x_s == |exact_candidate_counts| /
   // num_observations, b is the vector of the estimated bit count ratios from
-  // ExactEstimatedBitCountRatios(), and A == analyzer_->candidate_matrix_ (it
+  // ExactEstimatedBitCountRatios(), and A == candidate_matrix() (it
   // must be valid, the function does not build A).
   // The purpose of this function is to assess how much information is lost by
   // both encoding and the assumption that cohorts have equal ratios. d == 0
@@ -164,6 +164,10 @@ class RapporAnalyzerTest : public ::testing::Test {
 
   RapporCandidateList candidate_list_;
 
+  // The cache passed to the analyzer by SetAnalyzer(). By default there is
+  // none. Individual tests may override this.
+  std::shared_ptr<CandidateMatrixCache> candidate_matrix_cache_;
+
   // By default this test uses p=0, q=1. Individual tests may override this.
   double prob_0_becomes_1_ = 0.0;
   double prob_1_stays_1_ = 1.0;
@@ -187,6 +187,55 @@ TEST_F(RapporAnalyzerTest, BuildCandidateMapCompareWithEncoder) {
   }
 }
 
+// Tests the function BuildCandidateMap with a CandidateMatrixCache. We test
+// that the CandidateMap and the sparse matrix are the same whether they are
+// built or taken from the cache, and that analyzers with the same config
+// and candidates hit the cache and share its matrix.
+TEST_F(RapporAnalyzerTest, BuildCandidateMapWithCache) {
+  static const uint32_t kNumCandidates = 10;
+  static const uint32_t kNumCohorts = 20;
+  static const uint32_t kNumHashes = 5;
+  static const uint32_t kNumBloomBits = 64;
+
+  SetAnalyzer(kNumCandidates, kNumBloomBits, kNumCohorts, kNumHashes);
+  BuildCandidateMap();
+  Eigen::SparseMatrix<double, Eigen::RowMajor> expected_matrix =
+      candidate_matrix();
+  std::vector<std::string> expected_bit_strings;
+  for (size_t candidate = 0; candidate < kNumCandidates; candidate++) {
+    for (size_t cohort = 0; cohort < kNumCohorts; cohort++) {
+      expected_bit_strings.push_back(BuildBitString(candidate, cohort));
+    }
+  }
+
+  candidate_matrix_cache_ = std::make_shared<CandidateMatrixCache>(2);
+  const Eigen::SparseMatrix<double, Eigen::RowMajor>* cached_matrix = nullptr;
+  for (size_t expected_hits : {0, 1, 2}) {
+    SetAnalyzer(kNumCandidates, kNumBloomBits, kNumCohorts, kNumHashes);
+    BuildCandidateMap();
+    EXPECT_EQ(expected_hits, candidate_matrix_cache_->hits());
+    EXPECT_EQ(1u, candidate_matrix_cache_->misses());
+    if (expected_hits == 0) {
+      cached_matrix = &candidate_matrix();
+    } else {
+      EXPECT_EQ(cached_matrix, &candidate_matrix());
+    }
+    EXPECT_EQ(0, (candidate_matrix() - expected_matrix).norm());
+    EXPECT_EQ(expected_matrix.nonZeros(), candidate_matrix().nonZeros());
+    size_t i = 0;
+    for (size_t candidate = 0; candidate < kNumCandidates; candidate++) {
+      for (size_t cohort = 0; cohort < kNumCohorts; cohort++) {
+        EXPECT_EQ(expected_bit_strings[i++], BuildBitString(candidate, cohort));
+      }
+    }
+  }
+
+  // A different number of hashes misses the cache.
+  SetAnalyzer(kNumCandidates, kNumBloomBits, kNumCohorts, kNumHashes - 1);
+  BuildCandidateMap();
+  EXPECT_EQ(2u, candidate_matrix_cache_->misses());
+}
+
 // Tests the function ExtractEstimatedBitCountRatios(). We build one small
 // estimated bit count ratio vector and explicitly check its values. We
 // use no-randomness: p = 0, q = 1 so that the estimated bit counts are
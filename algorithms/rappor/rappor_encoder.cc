@@ -58,22 +58,44 @@ std::string DebugString(const ValuePart& value) {
 //
 // p = prob_0_becomes_1
 // q = prob_1_stays_1
+//
+// The random data for all of |data| is obtained with a single call to
+// RandomWords(), and the masks are computed from it and applied in a single
+// pass. Bit i of byte j of the p mask is decided by the (8 * j + i)-th word
+// and that of the q mask by the (8 * (num_bytes + j) + i)-th word.
 void FlipBits(double p, double q, crypto::Random* random, std::string* data) {
-  for (size_t i = 0; i < data->size(); i++) {
-    byte p_mask = random->RandomBits(p);
-    byte q_mask = random->RandomBits(q);
-    data->at(i) = (p_mask & ~data->at(i)) | (q_mask & data->at(i));
+  size_t num_bytes = data->size();
+  uint64_t p_threshold = crypto::Random::BitThreshold(p);
+  uint64_t q_threshold = crypto::Random::BitThreshold(q);
+  const uint32_t* p_words = random->RandomWords(16 * num_bytes);
+  const uint32_t* q_words = p_words + 8 * num_bytes;
+  char* bytes = &(*data)[0];
+  for (size_t j = 0; j < num_bytes; j++) {
+    byte p_mask = crypto::Random::BitsBelowThreshold(p_threshold, p_words);
+    byte q_mask = crypto::Random::BitsBelowThreshold(q_threshold, q_words);
+    bytes[j] = (p_mask & ~bytes[j]) | (q_mask & bytes[j]);
+    p_words += 8;
+    q_words += 8;
   }
 }
 
 }  // namespace
 
+const size_t RapporEncoder::kDefaultBloomBitsCacheSize;
+
 RapporEncoder::RapporEncoder(const RapporConfig& config,
-                             ClientSecret client_secret)
+                             ClientSecret client_secret,
+                             std::shared_ptr<BloomBitsCache> bloom_bits_cache)
     : config_(new RapporConfigValidator(config)),
       random_(new crypto::Random()),
       client_secret_(std::move(client_secret)),
-      cohort_num_(DeriveCohortFromSecret()) {}
+      cohort_num_(DeriveCohortFromSecret()),
+      bloom_bits_cache_(std::move(bloom_bits_cache)) {
+  if (!bloom_bits_cache_) {
+    bloom_bits_cache_ =
+        std::make_shared<BloomBitsCache>(kDefaultBloomBitsCacheSize);
+  }
+}
 
 RapporEncoder::~RapporEncoder() {}
 
@@ -106,13 +128,17 @@ uint32_t RapporEncoder::ExtractBitIndex(
 }
 
 std::string RapporEncoder::MakeBloomBits(const ValuePart& value) {
+  std::string serialized_value;
+  value.SerializeToString(&serialized_value);
+  return MakeBloomBitsFromSerialized(serialized_value);
+}
+
+std::string RapporEncoder::MakeBloomBitsFromSerialized(
+    const std::string& serialized_value) {
   uint32_t num_bits = config_->num_bits();
   uint32_t num_bytes = (num_bits + 7) / 8;
   uint32_t num_hashes = config_->num_hashes();
 
-  std::string serialized_value;
-  value.SerializeToString(&serialized_value);
-
   byte hashed_value[crypto::hash::DIGEST_SIZE];
   if (!HashValueAndCohort(serialized_value, cohort_num_, num_hashes,
                           hashed_value)) {
@@ -195,10 +221,19 @@ Status RapporEncoder::Encode(const ValuePart& value,
     return kInvalidConfig;
   }
 
-  std::string data = MakeBloomBits(value);
-  if (data.empty()) {
-    LOG(ERROR) << "MakeBloomBits failed on input: " << DebugString(value);
-    return kInvalidInput;
+  std::string serialized_value;
+  value.SerializeToString(&serialized_value);
+  std::string cache_key =
+      BloomBitsCache::MakeKey(serialized_value, cohort_num_,
+                              config_->num_bits(), config_->num_hashes());
+  std::string data;
+  if (!bloom_bits_cache_->Get(cache_key, &data)) {
+    data = MakeBloomBitsFromSerialized(serialized_value);
+    if (data.empty()) {
+      LOG(ERROR) << "MakeBloomBits failed on input: " << DebugString(value);
+      return kInvalidInput;
+    }
+    bloom_bits_cache_->Put(cache_key, data);
   }
 
   // TODO(rudominer) Consider supporting prr in future versions of Cobalt.
@@ -261,6 +296,49 @@ Status BasicRapporEncoder::Encode(const ValuePart& value,
   return kOK;
 }
 
+Status BasicRapporEncoder::EncodeIndices(
+    const std::vector<uint32_t>& indices,
+    BasicRapporObservation* observation_out) {
+  if (!config_->valid()) {
+    return kInvalidConfig;
+  }
+  if (!client_secret_.valid()) {
+    LOG(ERROR) << "client_secret is not valid";
+    return kInvalidConfig;
+  }
+
+  uint32_t num_bytes = (config_->num_bits() + 7) / 8;
+
+  // Initialize data to a string of all zero bytes.
+  std::string data(num_bytes, static_cast<char>(0));
+
+  // Set the bit of each of the categories.
+  ValuePart index_value;
+  for (auto index : indices) {
+    index_value.set_index_value(index);
+    auto bit_index = config_->bit_index(index_value);
+    if (bit_index == -1) {
+      LOG(ERROR) << "BasicRapporEncoder::EncodeIndices(): The given index "
+                 << index << " was not the index of a category.";
+      return kInvalidInput;
+    }
+    // Indexed from the right, i.e. the least-significant bit.
+    data[num_bytes - (bit_index / 8 + 1)] |= 1 << (bit_index % 8);
+  }
+
+  // Randomly flip some of the bits based on the probabilities p and q.
+  FlipBits(config_->prob_0_becomes_1(), config_->prob_1_stays_1(),
+           random_.get(), &data);
+
+  observation_out->set_data(data);
+  return kOK;
+}
+
+Status BasicRapporEncoder::EncodeNullObservation(
+    BasicRapporObservation* observation_out) {
+  return EncodeIndices(std::vector<uint32_t>(), observation_out);
+}
+
 }  // namespace rappor
 
 }  // namespace cobalt
@@ -18,8 +18,10 @@
 #include <memory>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include "./observation.pb.h"
+#include "algorithms/rappor/bloom_bits_cache.h"
 #include "algorithms/rappor/rappor_config_validator.h"
 #include "config/encodings.pb.h"
 #include "encoder/client_secret.h"
@@ -36,12 +38,26 @@ enum Status {
 };
 
 // Performs String RAPPOR encoding.
+//
+// The Bloom filters of the values that are encoded are kept in a
+// BloomBitsCache, so that encoding a value again only runs the randomized
+// response step.
 class RapporEncoder {
  public:
+  // The capacity of the BloomBitsCache of a RapporEncoder that is not given
+  // one.
+  static const size_t kDefaultBloomBitsCacheSize = 256;
+
   // Constructor.
   // The |client_secret| is used to determine the cohort and the PRR.
-  RapporEncoder(const RapporConfig& config,
-                encoder::ClientSecret client_secret);
+  //
+  // |bloom_bits_cache| may be shared between RapporEncoders, for example by
+  // the short-lived RapporEncoders of a longer-lived object, since its keys
+  // include the cohort and the parameters of the Bloom filter. If it is null,
+  // the RapporEncoder creates a cache of its own with a capacity of
+  // kDefaultBloomBitsCacheSize.
+  RapporEncoder(const RapporConfig& config, encoder::ClientSecret client_secret,
+                std::shared_ptr<BloomBitsCache> bloom_bits_cache = nullptr);
   virtual ~RapporEncoder();
 
   // Encodes |value| using RAPPOR encoding. Returns kOK on success, or
@@ -50,6 +66,10 @@ class RapporEncoder {
 
   uint32_t cohort() const { return cohort_num_; }
 
+  // The cache of Bloom filters, whose hits() and misses() count the calls to
+  // Encode() that did and did not find the Bloom filter of their value.
+  const BloomBitsCache& bloom_bits_cache() const { return *bloom_bits_cache_; }
+
  private:
   friend class StringRapporEncoderTest;
   friend class RapporAnalyzer;
@@ -89,6 +109,10 @@ class RapporEncoder {
   // empty string on error.
   std::string MakeBloomBits(const ValuePart& value);
 
+  // Generates the array of bloom bits derived from the serialized ValuePart
+  // |serialized_value|. Returns the empty string on error.
+  std::string MakeBloomBitsFromSerialized(const std::string& serialized_value);
+
   // Derives an integer in the range [0, config_.num_cohorts_2_power_) from
   // |client_secret_| and |attempt_number|. The distribution of values in this
   // range will be (approximately) uniform as the Client Secret and
@@ -112,6 +136,7 @@ class RapporEncoder {
   std::unique_ptr<crypto::Random> random_;
   encoder::ClientSecret client_secret_;
   uint32_t cohort_num_;
+  std::shared_ptr<BloomBitsCache> bloom_bits_cache_;
 };
 
 // Performs encoding for Basic RAPPOR, a.k.a Categorical RAPPOR. No cohorts
@@ -132,6 +157,23 @@ class BasicRapporEncoder {
   Status Encode(const ValuePart& value,
                 BasicRapporObservation* observation_out);
 
+  // Encodes a Basic RAPPOR Observation in which, before the randomized
+  // response step, the bits of all of the categories with the given |indices|
+  // are set. This is used by locally aggregated reports that report on a set
+  // of categories in a single Observation. The |config| passed to the
+  // constructor must use indexed categories. Returns kOK on success,
+  // kInvalidConfig if the |config| is not valid, and kInvalidInput if one of
+  // the |indices| is not the index of a category.
+  Status EncodeIndices(const std::vector<uint32_t>& indices,
+                       BasicRapporObservation* observation_out);
+
+  // Encodes a Basic RAPPOR Observation in which none of the categories is
+  // set, before the randomized response step. This is used to report that
+  // none of the categories occurred, for example by locally aggregated
+  // reports that send an Observation every day. Returns kOK on success or
+  // kInvalidConfig if the |config| passed to the constructor is not valid.
+  Status EncodeNullObservation(BasicRapporObservation* observation_out);
+
  private:
   friend class BasicRapporAnalyzerTest;
   friend class BasicRapporDeterministicTest;
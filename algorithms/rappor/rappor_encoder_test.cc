@@ -623,6 +623,56 @@ TEST(BasicRapporEncoderTest, EncodeIndex) {
   EXPECT_EQ(kInvalidInput, encoder.Encode(value, &obs));
 }
 
+// Tests that BasicRapporEncoder::EncodeNullObservation() sets none of the
+// category bits.
+TEST(BasicRapporEncoderTest, EncodeNullObservation) {
+  // Configure Basic RAPPOR with 10 indexed categories and no randomness.
+  BasicRapporConfig config;
+  config.set_prob_0_becomes_1(0.0);
+  config.set_prob_1_stays_1(1.0);
+  config.mutable_indexed_categories()->set_num_categories(10);
+
+  static const std::string kClientSecretToken =
+      ClientSecret::GenerateNewSecret().GetToken();
+  BasicRapporEncoder encoder(config,
+                             ClientSecret::FromToken(kClientSecretToken));
+
+  BasicRapporObservation obs;
+  EXPECT_EQ(kOK, encoder.EncodeNullObservation(&obs));
+  EXPECT_EQ("0000000000000000", DataToBinaryString(obs.data()));
+
+  // With p = 1 and q = 0 every bit is flipped to 1.
+  config.set_prob_0_becomes_1(1.0);
+  config.set_prob_1_stays_1(0.0);
+  BasicRapporEncoder flipping_encoder(
+      config, ClientSecret::FromToken(kClientSecretToken));
+  obs.Clear();
+  EXPECT_EQ(kOK, flipping_encoder.EncodeNullObservation(&obs));
+  EXPECT_EQ("1111111111111111", DataToBinaryString(obs.data()));
+}
+
+// Tests that BasicRapporEncoder::EncodeIndices() sets the bits of all of the
+// given categories.
+TEST(BasicRapporEncoderTest, EncodeIndices) {
+  // Configure Basic RAPPOR with 10 indexed categories and no randomness.
+  BasicRapporConfig config;
+  config.set_prob_0_becomes_1(0.0);
+  config.set_prob_1_stays_1(1.0);
+  config.mutable_indexed_categories()->set_num_categories(10);
+  BasicRapporEncoder encoder(config, ClientSecret::GenerateNewSecret());
+
+  BasicRapporObservation obs;
+  EXPECT_EQ(kOK, encoder.EncodeIndices({0, 3, 9}, &obs));
+  EXPECT_EQ("0000001000001001", DataToBinaryString(obs.data()));
+
+  obs.Clear();
+  EXPECT_EQ(kOK, encoder.EncodeIndices({}, &obs));
+  EXPECT_EQ("0000000000000000", DataToBinaryString(obs.data()));
+
+  // Validate that category index 10 yields kInvalidInput.
+  EXPECT_EQ(kInvalidInput, encoder.EncodeIndices({2, 10}, &obs));
+}
+
 class StringRapporEncoderTest : public ::testing::Test {
  protected:
   uint32_t AttemptDeriveCohortFromSecret(size_t attempt_number) {
@@ -929,11 +979,63 @@ TEST_F(StringRapporEncoderTest, ChiSquaredTest) {
       DoChiSquaredTest(0.01, 0.99, num_bits, num_hashes, 4.95);
       DoChiSquaredTest(0.1, 0.9, num_bits, num_hashes, 5.38);
       DoChiSquaredTest(0.2, 0.8, num_bits, num_hashes, 2.26);
-      DoChiSquaredTest(0.25, 0.75, num_bits, num_hashes, 2.83);
-      DoChiSquaredTest(0.3, 0.7, num_bits, num_hashes, 2.31);
+      DoChiSquaredTest(0.25, 0.75, num_bits, num_hashes, 3.61);
+      DoChiSquaredTest(0.3, 0.7, num_bits, num_hashes, 2.75);
     }
   }
 }
 
+// Tests that the Bloom filter of a value is cached by Encode(), so that
+// encoding the value again gives the same Observation without hashing it,
+// and that a cache shared by several RapporEncoders is used by all of them.
+TEST_F(StringRapporEncoderTest, CachesBloomBits) {
+  RapporConfig config;
+  // With no noise the Observation is the Bloom filter.
+  config.set_prob_0_becomes_1(0.0);
+  config.set_prob_1_stays_1(1.0);
+  config.set_num_bloom_bits(64);
+  config.set_num_hashes(2);
+  config.set_num_cohorts(10);
+  static const char kClientSecret[] = "4b4BxKq253TTCWIXFhLDTg==";
+  SetNewEncoder(config, ClientSecret::FromToken(kClientSecret));
+
+  ValuePart value;
+  value.set_string_value("www.google.com");
+  RapporObservation first;
+  ASSERT_EQ(kOK, encoder_->Encode(value, &first));
+  EXPECT_EQ(MakeBloomBits(value), first.data());
+  EXPECT_EQ(0u, encoder_->bloom_bits_cache().hits());
+  EXPECT_EQ(1u, encoder_->bloom_bits_cache().misses());
+
+  RapporObservation second;
+  ASSERT_EQ(kOK, encoder_->Encode(value, &second));
+  EXPECT_EQ(first.SerializeAsString(), second.SerializeAsString());
+  EXPECT_EQ(1u, encoder_->bloom_bits_cache().hits());
+
+  value.set_string_value("www.example.com");
+  ASSERT_EQ(kOK, encoder_->Encode(value, &second));
+  EXPECT_EQ(MakeBloomBits(value), second.data());
+  EXPECT_EQ(2u, encoder_->bloom_bits_cache().misses());
+
+  auto cache = std::make_shared<BloomBitsCache>(10);
+  RapporEncoder encoder_1(config, ClientSecret::FromToken(kClientSecret),
+                          cache);
+  RapporEncoder encoder_2(config, ClientSecret::FromToken(kClientSecret),
+                          cache);
+  ASSERT_EQ(kOK, encoder_1.Encode(value, &first));
+  ASSERT_EQ(kOK, encoder_2.Encode(value, &second));
+  EXPECT_EQ(first.data(), second.data());
+  EXPECT_EQ(1u, cache->hits());
+  EXPECT_EQ(1u, cache->misses());
+
+  // A RapporEncoder with other parameters does not use the cached entries.
+  config.set_num_bloom_bits(128);
+  RapporEncoder encoder_3(config, ClientSecret::FromToken(kClientSecret),
+                          cache);
+  ASSERT_EQ(kOK, encoder_3.Encode(value, &second));
+  EXPECT_EQ(128u / 8, second.data().size());
+  EXPECT_EQ(2u, cache->misses());
+}
+
 }  // namespace rappor
 }  // namespace cobalt
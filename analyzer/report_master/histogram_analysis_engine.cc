@@ -155,8 +155,10 @@ class ForculusAdapter : public DecoderAdapter {
 ///////////////////////////////////////////////////////////////////////////
 class RapporAdapter : public DecoderAdapter {
  public:
-  RapporAdapter(const ReportId& report_id, const RapporConfig& config,
-                const RapporCandidateList* candidates)
+  RapporAdapter(
+      const ReportId& report_id, const RapporConfig& config,
+      const RapporCandidateList* candidates,
+      std::shared_ptr<rappor::CandidateMatrixCache> candidate_matrix_cache)
       : report_id_(report_id) {
     // To enable end-to-end test, we introduce a case where a list composed of
     // a single candidate with a special keyword prompts creation of a number of
@@ -189,7 +191,8 @@ class RapporAdapter : public DecoderAdapter {
     if (!key_word_identified) {
       candidates_ = candidates;
     }
-    analyzer_.reset(new RapporAnalyzer(config, candidates_));
+    analyzer_.reset(new RapporAnalyzer(config, candidates_,
+                                       std::move(candidate_matrix_cache)));
   }
 
   bool ProcessObservationPart(uint32_t day_index,
@@ -443,11 +446,13 @@ class NoOpIntBucketDistributionAdapter : public DecoderAdapter {
 HistogramAnalysisEngine::HistogramAnalysisEngine(
     const ReportId& report_id, const ReportVariable* report_variable,
     const MetricPart* metric_part,
-    std::shared_ptr<AnalyzerConfig> analyzer_config)
+    std::shared_ptr<AnalyzerConfig> analyzer_config,
+    std::shared_ptr<rappor::CandidateMatrixCache> candidate_matrix_cache)
     : report_id_(report_id),
       report_variable_(report_variable),
       metric_part_(metric_part),
-      analyzer_config_(analyzer_config) {}
+      analyzer_config_(analyzer_config),
+      candidate_matrix_cache_(std::move(candidate_matrix_cache)) {}
 
 bool HistogramAnalysisEngine::ProcessObservationPart(
     uint32_t day_index, const ObservationPart& obs,
@@ -590,8 +595,9 @@ std::unique_ptr<DecoderAdapter> HistogramAnalysisEngine::NewDecoder(
                "specified for report_id="
             << ReportStore::ToString(report_id_);
       }
-      return std::unique_ptr<DecoderAdapter>(new RapporAdapter(
-          report_id_, encoding_config->rappor(), rappor_candidates));
+      return std::unique_ptr<DecoderAdapter>(
+          new RapporAdapter(report_id_, encoding_config->rappor(),
+                            rappor_candidates, candidate_matrix_cache_));
     }
     case EncodingConfig::kBasicRappor: {
       return std::unique_ptr<DecoderAdapter>(new BasicRapporAdapter(
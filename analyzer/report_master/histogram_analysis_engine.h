@@ -23,6 +23,7 @@
 #include "./encrypted_message.pb.h"
 #include "./observation.pb.h"
 #include "algorithms/forculus/forculus_analyzer.h"
+#include "algorithms/rappor/candidate_matrix_cache.h"
 #include "analyzer/report_master/report_generator.h"
 #include "analyzer/store/observation_store.h"
 #include "analyzer/store/report_store.h"
@@ -61,10 +62,16 @@ class HistogramAnalysisEngine {
   // basic RAPPOR configured with indexed categories.
   //
   // The |analyzer_config| is used to look up EncodingConfigs by their ID.
+  //
+  // The optional |candidate_matrix_cache| is passed to the String RAPPOR
+  // analyzers so that they may reuse the candidate matrices of earlier
+  // reports.
   HistogramAnalysisEngine(
       const ReportId& report_id, const ReportVariable* report_variable,
       const MetricPart* metric_part,
-      std::shared_ptr<config::AnalyzerConfig> analyzer_config);
+      std::shared_ptr<config::AnalyzerConfig> analyzer_config,
+      std::shared_ptr<rappor::CandidateMatrixCache> candidate_matrix_cache =
+          nullptr);
 
   // Process the given (day_index, ObservationPart, SystemProfile) triple. The
   // |day_index| indicates the day on which the ObservationPart was observed, as
@@ -123,6 +130,9 @@ class HistogramAnalysisEngine {
 
   // Contains the registry of EncodingConfigs.
   std::shared_ptr<config::AnalyzerConfig> analyzer_config_;
+
+  // May be null.
+  std::shared_ptr<rappor::CandidateMatrixCache> candidate_matrix_cache_;
 };
 
 // A DecoderAdapter offers a common interface for the HistogramAnalysisEngine to
@@ -97,11 +97,13 @@ ReportGenerator::ReportGenerator(
     std::shared_ptr<config::AnalyzerConfigManager> config_manager,
     std::shared_ptr<ObservationStore> observation_store,
     std::shared_ptr<ReportStore> report_store,
-    std::unique_ptr<ReportExporter> report_exporter)
+    std::unique_ptr<ReportExporter> report_exporter,
+    std::shared_ptr<rappor::CandidateMatrixCache> candidate_matrix_cache)
     : config_manager_(config_manager),
       observation_store_(observation_store),
       report_store_(report_store),
-      report_exporter_(std::move(report_exporter)) {}
+      report_exporter_(std::move(report_exporter)),
+      candidate_matrix_cache_(std::move(candidate_matrix_cache)) {}
 
 grpc::Status ReportGenerator::GenerateReport(const ReportId& report_id) {
   // Fetch ReportMetadata
@@ -276,7 +278,7 @@ grpc::Status ReportGenerator::GenerateHistogramReport(
   HistogramAnalysisEngine analysis_engine(
       report_id, variables[0].report_variable,
       &(metric.parts().at(variables[0].report_variable->metric_part())),
-      analyzer_config);
+      analyzer_config, candidate_matrix_cache_);
 
   // We query the ObservationStore for the relevant ObservationParts.
   store::ObservationStore::QueryResponse query_response;
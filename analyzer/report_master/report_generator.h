@@ -24,6 +24,7 @@
 #include "./encrypted_message.pb.h"
 #include "./observation.pb.h"
 #include "algorithms/forculus/forculus_analyzer.h"
+#include "algorithms/rappor/candidate_matrix_cache.h"
 #include "analyzer/report_master/report_exporter.h"
 #include "analyzer/report_master/report_row_iterator.h"
 #include "analyzer/store/observation_store.h"
@@ -53,10 +54,15 @@ class ReportGenerator {
  public:
   // report_exporter is allowed to be NULL, in which case no exporting will
   // occur.
+  //
+  // candidate_matrix_cache is allowed to be NULL, in which case the String
+  // RAPPOR candidate matrices are recomputed for every report.
   ReportGenerator(std::shared_ptr<config::AnalyzerConfigManager> config_manager,
                   std::shared_ptr<store::ObservationStore> observation_store,
                   std::shared_ptr<store::ReportStore> report_store,
-                  std::unique_ptr<ReportExporter> report_exporter);
+                  std::unique_ptr<ReportExporter> report_exporter,
+                  std::shared_ptr<rappor::CandidateMatrixCache>
+                      candidate_matrix_cache = nullptr);
 
   // Requests that the ReportGenerator generate the report with the given
   // |report_id|. This method is invoked by the ReportMaster after
@@ -166,6 +172,7 @@ class ReportGenerator {
   std::shared_ptr<store::ObservationStore> observation_store_;
   std::shared_ptr<store::ReportStore> report_store_;
   std::unique_ptr<ReportExporter> report_exporter_;
+  std::shared_ptr<rappor::CandidateMatrixCache> candidate_matrix_cache_;
 };
 
 }  // namespace analyzer
@@ -65,6 +65,14 @@ DEFINE_string(tls_key_file, "",
 DEFINE_bool(
     enable_report_scheduling, false,
     "Should the ReportMaster run all reports automatically on a schedule?");
+DEFINE_int32(rappor_candidate_matrix_cache_size, 16,
+             "The maximum number of String RAPPOR candidate matrices that the "
+             "ReportMaster keeps in memory for reuse by later reports. Zero "
+             "disables the in-memory cache.");
+DEFINE_string(rappor_candidate_matrix_cache_dir, "",
+              "Path to an existing directory in which the ReportMaster "
+              "persists String RAPPOR candidate matrices across restarts. "
+              "Default=\"\", in which case they are not persisted.");
 
 // Stackdriver metric constants
 namespace {
@@ -297,10 +305,17 @@ ReportMasterService::CreateFromFlagsOrDie() {
   std::unique_ptr<ReportExporter> report_exporter(
       new ReportExporter(gcs_uploader));
 
+  CHECK_GE(FLAGS_rappor_candidate_matrix_cache_size, 0)
+      << "-rappor_candidate_matrix_cache_size must not be negative";
+  auto candidate_matrix_cache = std::make_shared<rappor::CandidateMatrixCache>(
+      FLAGS_rappor_candidate_matrix_cache_size,
+      FLAGS_rappor_candidate_matrix_cache_dir);
+
   auto report_master_service =
       std::unique_ptr<ReportMasterService>(new ReportMasterService(
           FLAGS_port, observation_store, report_store, config_manager,
-          server_credentials, auth_enforcer, std::move(report_exporter)));
+          server_credentials, auth_enforcer, std::move(report_exporter),
+          candidate_matrix_cache));
 
   if (FLAGS_enable_report_scheduling) {
     LOG(INFO) << "Starting a Report Scheduler because "
@@ -330,7 +345,8 @@ ReportMasterService::ReportMasterService(
     std::shared_ptr<config::AnalyzerConfigManager> config_manager,
     std::shared_ptr<grpc::ServerCredentials> server_credentials,
     std::shared_ptr<AuthEnforcer> auth_enforcer,
-    std::unique_ptr<ReportExporter> report_exporter)
+    std::unique_ptr<ReportExporter> report_exporter,
+    std::shared_ptr<rappor::CandidateMatrixCache> candidate_matrix_cache)
     : port_(port),
       observation_store_(observation_store),
       report_store_(report_store),
@@ -338,7 +354,8 @@ ReportMasterService::ReportMasterService(
       report_executor_(new ReportExecutor(
           report_store_, std::unique_ptr<ReportGenerator>(new ReportGenerator(
                              config_manager_, observation_store_, report_store_,
-                             std::move(report_exporter))))),
+                             std::move(report_exporter),
+                             std::move(candidate_matrix_cache))))),
       server_credentials_(server_credentials),
       auth_enforcer_(auth_enforcer) {}
 
@@ -10,6 +10,7 @@
 #include <utility>
 #include <vector>
 
+#include "algorithms/rappor/candidate_matrix_cache.h"
 #include "analyzer/report_master/auth_enforcer.h"
 #include "analyzer/report_master/report_executor.h"
 #include "analyzer/report_master/report_exporter.h"
@@ -35,13 +36,18 @@ class ReportMasterService final : public ReportMaster::Service {
 
   // |report_exporter| is allowed to be NULL, in which case no exporting
   // will occur.
+  //
+  // |candidate_matrix_cache| is allowed to be NULL, in which case the String
+  // RAPPOR candidate matrices are not cached between reports.
   ReportMasterService(
       int port, std::shared_ptr<store::ObservationStore> observation_store,
       std::shared_ptr<store::ReportStore> report_store,
       std::shared_ptr<config::AnalyzerConfigManager> config_manager,
       std::shared_ptr<grpc::ServerCredentials> server_credentials,
       std::shared_ptr<AuthEnforcer> auth_enforcer,
-      std::unique_ptr<ReportExporter> report_exporter);
+      std::unique_ptr<ReportExporter> report_exporter,
+      std::shared_ptr<rappor::CandidateMatrixCache> candidate_matrix_cache =
+          nullptr);
 
   // Starts the service
   void Start();
@@ -0,0 +1,30 @@
+// Copyright 2018 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "client/benchmarks/allocation_counter.h"
+
+#include "client/benchmarks/heap_allocations.h"
+
+namespace cobalt {
+namespace benchmarks {
+
+AllocationCounter::AllocationCounter()
+    : start_num_allocations_(ThreadHeapAllocations()),
+      start_num_bytes_(ThreadHeapBytes()) {}
+
+void AllocationCounter::Report(benchmark::State* state) const {
+  if (state->iterations() == 0) {
+    return;
+  }
+  double iterations = static_cast<double>(state->iterations());
+  state->counters["allocs_per_op"] = benchmark::Counter(
+      (ThreadHeapAllocations() - start_num_allocations_) / iterations,
+      benchmark::Counter::kAvgThreads);
+  state->counters["bytes_per_op"] =
+      benchmark::Counter((ThreadHeapBytes() - start_num_bytes_) / iterations,
+                         benchmark::Counter::kAvgThreads);
+}
+
+}  // namespace benchmarks
+}  // namespace cobalt
@@ -0,0 +1,48 @@
+// Copyright 2018 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef COBALT_CLIENT_BENCHMARKS_ALLOCATION_COUNTER_H_
+#define COBALT_CLIENT_BENCHMARKS_ALLOCATION_COUNTER_H_
+
+#include <benchmark/benchmark.h>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace cobalt {
+namespace benchmarks {
+
+// The maximum number of threads used by the multi-threaded benchmarks. Each
+// of them is run with 1, 2, 4 and 8 threads.
+constexpr int kMaxThreads = 8;
+
+// Counts the heap allocations made by the current thread between its
+// construction and the call to Report(). The cobalt_client_benchmarks binary
+// links the heap_allocations library in order to do this.
+//
+// Usage:
+//   AllocationCounter allocation_counter;
+//   for (auto _ : state) {
+//     ...
+//   }
+//   allocation_counter.Report(&state);
+class AllocationCounter {
+ public:
+  AllocationCounter();
+
+  // Sets the counters "allocs_per_op" and "bytes_per_op" of |state| to the
+  // number of allocations, and of bytes allocated, per iteration of the
+  // benchmark. In a multi-threaded benchmark they are averaged over the
+  // threads.
+  void Report(benchmark::State* state) const;
+
+ private:
+  uint64_t start_num_allocations_;
+  uint64_t start_num_bytes_;
+};
+
+}  // namespace benchmarks
+}  // namespace cobalt
+
+#endif  // COBALT_CLIENT_BENCHMARKS_ALLOCATION_COUNTER_H_
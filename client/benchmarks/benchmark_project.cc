@@ -0,0 +1,177 @@
+// Copyright 2018 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "client/benchmarks/benchmark_project.h"
+
+#include <google/protobuf/text_format.h>
+
+#include <memory>
+#include <utility>
+
+#include "./logging.h"
+
+namespace cobalt {
+namespace benchmarks {
+
+using logger::ProjectContext;
+
+namespace {
+
+const uint32_t kCustomerId = 1;
+const uint32_t kProjectId = 1;
+const char kCustomerName[] = "Fuchsia";
+const char kProjectName[] = "Cobalt";
+
+const char kMetricDefinitions[] = R"(
+metric {
+  metric_name: "ErrorOccurred"
+  metric_type: EVENT_OCCURRED
+  customer_id: 1
+  project_id: 1
+  id: 1
+  max_event_code: 100
+  reports: {
+    report_name: "ErrorCountsByType"
+    id: 123
+    report_type: SIMPLE_OCCURRENCE_COUNT
+    local_privacy_noise_level: SMALL
+  }
+}
+
+metric {
+  metric_name: "ReadCacheHits"
+  metric_type: EVENT_COUNT
+  customer_id: 1
+  project_id: 1
+  id: 2
+  reports: {
+    report_name: "ReadCacheHitCounts"
+    id: 111
+    report_type: EVENT_COMPONENT_OCCURRENCE_COUNT
+  }
+}
+
+metric {
+  metric_name: "ModuleLoadTime"
+  metric_type: ELAPSED_TIME
+  customer_id: 1
+  project_id: 1
+  id: 3
+  reports: {
+    report_name: "ModuleLoadTime_Aggregated"
+    id: 121
+    report_type: NUMERIC_AGGREGATION
+  }
+  reports: {
+    report_name: "ModuleLoadTime_Histogram"
+    id: 221
+    report_type: INT_RANGE_HISTOGRAM
+  }
+  reports: {
+    report_name: "ModuleLoadTime_RawDump"
+    id: 321
+    report_type: NUMERIC_PERF_RAW_DUMP
+  }
+}
+
+metric {
+  metric_name: "LoginModuleFrameRate"
+  metric_type: FRAME_RATE
+  customer_id: 1
+  project_id: 1
+  id: 4
+  reports: {
+    report_name: "LoginModuleFrameRate_Aggregated"
+    id: 131
+    report_type: NUMERIC_AGGREGATION
+  }
+  reports: {
+    report_name: "LoginModuleFrameRate_Histogram"
+    id: 231
+    report_type: INT_RANGE_HISTOGRAM
+  }
+}
+
+metric {
+  metric_name: "LedgerMemoryUsage"
+  metric_type: MEMORY_USAGE
+  customer_id: 1
+  project_id: 1
+  id: 5
+  reports: {
+    report_name: "LedgerMemoryUsage_Aggregated"
+    id: 141
+    report_type: NUMERIC_AGGREGATION
+  }
+}
+
+metric {
+  metric_name: "FileSystemWriteTimes"
+  metric_type: INT_HISTOGRAM
+  int_buckets: {
+    linear: {
+      floor: 0
+      num_buckets: 10
+      step_size: 1
+    }
+  }
+  customer_id: 1
+  project_id: 1
+  id: 6
+  reports: {
+    report_name: "FileSystemWriteTimes_Histogram"
+    id: 151
+    report_type: INT_RANGE_HISTOGRAM
+  }
+}
+
+metric {
+  metric_name: "ModuleDownloads"
+  metric_type: STRING_USED
+  customer_id: 1
+  project_id: 1
+  id: 7
+  reports: {
+    report_name: "ModuleDownloads_HeavyHitters"
+    id: 161
+    report_type: HIGH_FREQUENCY_STRING_COUNTS
+    local_privacy_noise_level: SMALL
+    expected_population_size: 20000
+    expected_string_set_size: 10000
+  }
+  reports: {
+    report_name: "ModuleDownloads_WithThreshold"
+    id: 261
+    report_type: STRING_COUNTS_WITH_THRESHOLD
+    threshold: 200
+  }
+}
+
+metric {
+  metric_name: "ModuleInstalls"
+  metric_type: CUSTOM
+  customer_id: 1
+  project_id: 1
+  id: 8
+  reports: {
+    report_name: "ModuleInstalls_DetailedData"
+    id: 125
+    report_type: CUSTOM_RAW_DUMP
+  }
+}
+)";
+
+}  // namespace
+
+std::unique_ptr<ProjectContext> MakeBenchmarkProjectContext() {
+  auto metric_definitions = std::make_unique<MetricDefinitions>();
+  google::protobuf::TextFormat::Parser parser;
+  CHECK(parser.ParseFromString(kMetricDefinitions, metric_definitions.get()));
+  return std::make_unique<ProjectContext>(kCustomerId, kProjectId,
+                                          kCustomerName, kProjectName,
+                                          std::move(metric_definitions));
+}
+
+}  // namespace benchmarks
+}  // namespace cobalt
@@ -0,0 +1,33 @@
+// Copyright 2018 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef COBALT_CLIENT_BENCHMARKS_BENCHMARK_PROJECT_H_
+#define COBALT_CLIENT_BENCHMARKS_BENCHMARK_PROJECT_H_
+
+#include <cstdint>
+#include <memory>
+
+#include "logger/project_context.h"
+
+namespace cobalt {
+namespace benchmarks {
+
+// The IDs of the Metrics of the benchmark project. There is one Metric of each
+// MetricType, each with the Reports that are typical for that type.
+const uint32_t kErrorOccurredMetricId = 1;
+const uint32_t kReadCacheHitsMetricId = 2;
+const uint32_t kModuleLoadTimeMetricId = 3;
+const uint32_t kLoginModuleFrameRateMetricId = 4;
+const uint32_t kLedgerMemoryUsageMetricId = 5;
+const uint32_t kFileSystemWriteTimesMetricId = 6;
+const uint32_t kModuleDownloadsMetricId = 7;
+const uint32_t kModuleInstallsMetricId = 8;
+
+// Returns a ProjectContext for the benchmark project.
+std::unique_ptr<logger::ProjectContext> MakeBenchmarkProjectContext();
+
+}  // namespace benchmarks
+}  // namespace cobalt
+
+#endif  // COBALT_CLIENT_BENCHMARKS_BENCHMARK_PROJECT_H_
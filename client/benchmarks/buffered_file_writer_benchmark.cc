@@ -0,0 +1,232 @@
+// Copyright 2018 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Benchmarks of the DurabilityPolicies of util::BufferedFileWriter, both
+// directly and as used by the FileObservationStore. Besides the time per
+// record, they report the number of Write() and Sync() operations that reach
+// the file system per record as "writes_per_op" and "syncs_per_op".
+
+#include <benchmark/benchmark.h>
+
+#include <atomic>
+#include <memory>
+#include <string>
+
+#include "./encrypted_message.pb.h"
+#include "./logging.h"
+#include "./observation_batch.pb.h"
+#include "client/benchmarks/allocation_counter.h"
+#include "encoder/file_observation_store.h"
+#include "util/buffered_file_writer.h"
+#include "util/posix_file_system.h"
+
+namespace cobalt {
+
+using encoder::FileObservationStore;
+using encoder::ObservationStore;
+using util::BufferedFileWriter;
+using util::DurabilityPolicy;
+using util::PosixFileSystem;
+
+namespace benchmarks {
+
+namespace {
+
+const char kWriterFile[] = "/tmp/cobalt_client_benchmarks_writer.data";
+const char kStoreDirectory[] = "/tmp/cobalt_client_benchmarks_durability";
+
+const size_t kMaxBytesPerObservation = 10 * 1024;
+const size_t kMaxBytesPerEnvelope = 256 * 1024;
+const size_t kMaxBytesTotal = 64 * 1024 * 1024;
+
+// The size of a typical record of the FileObservationStore.
+const size_t kRecordSize = 128;
+
+// The arguments of the benchmarks.
+enum Policy {
+  kNoSync = 0,
+  kSyncEveryRecord = 1,
+  kSyncEvery64Records = 2,
+  kGroupCommit = 3,
+};
+
+DurabilityPolicy MakePolicy(int64_t policy) {
+  DurabilityPolicy durability_policy;
+  switch (policy) {
+    case kNoSync:
+      break;
+    case kSyncEveryRecord:
+      durability_policy.mode = DurabilityPolicy::kSyncEveryN;
+      durability_policy.sync_every_records = 1;
+      break;
+    case kSyncEvery64Records:
+      durability_policy.mode = DurabilityPolicy::kSyncEveryN;
+      durability_policy.sync_every_records = 64;
+      break;
+    case kGroupCommit:
+      durability_policy.mode = DurabilityPolicy::kGroupCommit;
+      durability_policy.group_commit_interval = std::chrono::milliseconds(10);
+      break;
+  }
+  return durability_policy;
+}
+
+const char* PolicyLabel(int64_t policy) {
+  switch (policy) {
+    case kNoSync:
+      return "no_sync";
+    case kSyncEveryRecord:
+      return "sync_every_record";
+    case kSyncEvery64Records:
+      return "sync_every_64_records";
+    default:
+      return "group_commit_10ms";
+  }
+}
+
+// A PosixFileSystem that counts the Write() and Sync() operations.
+class CountingFileSystem : public PosixFileSystem {
+ public:
+  bool Write(int fd, const char* data, size_t size) override {
+    num_writes_++;
+    return PosixFileSystem::Write(fd, data, size);
+  }
+
+  bool Sync(int fd) override {
+    num_syncs_++;
+    return PosixFileSystem::Sync(fd);
+  }
+
+  int64_t num_writes() const { return num_writes_; }
+  int64_t num_syncs() const { return num_syncs_; }
+
+ private:
+  std::atomic<int64_t> num_writes_{0};
+  std::atomic<int64_t> num_syncs_{0};
+};
+
+// Sets the counters "writes_per_op" and "syncs_per_op" of |state| from the
+// operations counted by |fs| since |start_num_writes| and |start_num_syncs|.
+// In a multi-threaded benchmark every thread must call this after the
+// benchmark loop, when all of the threads have finished their iterations, so
+// that they all report the same totals.
+void ReportFileSystemCounters(benchmark::State* state,
+                              const CountingFileSystem& fs,
+                              int64_t start_num_writes,
+                              int64_t start_num_syncs) {
+  // The totals are averaged over the threads, and then divided by the total
+  // number of iterations.
+  auto flags = static_cast<benchmark::Counter::Flags>(
+      benchmark::Counter::kAvgThreads | benchmark::Counter::kAvgIterations);
+  state->counters["writes_per_op"] =
+      benchmark::Counter(fs.num_writes() - start_num_writes, flags);
+  state->counters["syncs_per_op"] =
+      benchmark::Counter(fs.num_syncs() - start_num_syncs, flags);
+}
+
+// The argument of the benchmark is the Policy. kGroupCommit is omitted
+// because the group commit timer is run by the owner of the writer.
+void BM_BufferedFileWriter_AppendRecord(benchmark::State& state) {
+  CountingFileSystem fs;
+  fs.Delete(kWriterFile);
+  auto writer =
+      BufferedFileWriter::Open(&fs, kWriterFile, MakePolicy(state.range(0)));
+  if (writer == nullptr) {
+    state.SkipWithError("BufferedFileWriter::Open() failed.");
+    return;
+  }
+  const std::string record(kRecordSize, 'r');
+  for (auto _ : state) {
+    if (!writer->Append(record.data(), record.size()) ||
+        !writer->EndRecord()) {
+      state.SkipWithError("BufferedFileWriter failed.");
+      break;
+    }
+  }
+  ReportFileSystemCounters(&state, fs, 0, 0);
+  state.SetLabel(PolicyLabel(state.range(0)));
+  writer = nullptr;
+  fs.Delete(kWriterFile);
+}
+BENCHMARK(BM_BufferedFileWriter_AppendRecord)
+    ->Arg(kNoSync)
+    ->Arg(kSyncEveryRecord)
+    ->Arg(kSyncEvery64Records)
+    ->UseRealTime();
+
+// A FileObservationStore with each Policy, together with its
+// CountingFileSystem. Each is created on first use and shared by all of the
+// threads.
+struct DurabilityStore {
+  CountingFileSystem* fs;
+  ObservationStore* store;
+};
+
+DurabilityStore GetDurabilityStore(int64_t policy) {
+  static DurabilityStore* stores = [] {
+    auto* stores = new DurabilityStore[kGroupCommit + 1];
+    for (int i = kNoSync; i <= kGroupCommit; i++) {
+      std::string directory =
+          std::string(kStoreDirectory) + "/" + PolicyLabel(i);
+      auto fs = std::make_unique<CountingFileSystem>();
+      fs->MakeDirectory(kStoreDirectory);
+      auto files = fs->ListFiles(directory);
+      if (files.ok()) {
+        for (const auto& file : files.ValueOrDie()) {
+          fs->Delete(directory + "/" + file);
+        }
+      }
+      stores[i].fs = fs.get();
+      stores[i].store = new FileObservationStore(
+          kMaxBytesPerObservation, kMaxBytesPerEnvelope, kMaxBytesTotal,
+          std::move(fs), directory, MakePolicy(i));
+    }
+    return stores;
+  }();
+  return stores[policy];
+}
+
+// The argument of the benchmark is the Policy of the FileObservationStore.
+// The store is emptied, outside of the timed region, whenever it fills up.
+void BM_FileObservationStore_Durability(benchmark::State& state) {
+  DurabilityStore durability_store = GetDurabilityStore(state.range(0));
+  ObservationStore* store = durability_store.store;
+  const int64_t start_num_writes = durability_store.fs->num_writes();
+  const int64_t start_num_syncs = durability_store.fs->num_syncs();
+  const std::string ciphertext(kRecordSize, 'c');
+  for (auto _ : state) {
+    auto message = std::make_unique<EncryptedMessage>();
+    message->set_ciphertext(ciphertext);
+    auto metadata = std::make_unique<ObservationMetadata>();
+    metadata->set_customer_id(1);
+    metadata->set_project_id(1);
+    metadata->set_metric_id(1);
+    auto status =
+        store->AddEncryptedObservation(std::move(message), std::move(metadata));
+    if (status == ObservationStore::kStoreFull) {
+      state.PauseTiming();
+      while (store->TakeNextEnvelopeHolder() != nullptr) {
+      }
+      state.ResumeTiming();
+    } else if (status != ObservationStore::kOk) {
+      state.SkipWithError("AddEncryptedObservation() failed.");
+      break;
+    }
+  }
+  ReportFileSystemCounters(&state, *durability_store.fs, start_num_writes,
+                           start_num_syncs);
+  state.SetLabel(PolicyLabel(state.range(0)));
+}
+BENCHMARK(BM_FileObservationStore_Durability)
+    ->Arg(kNoSync)
+    ->Arg(kSyncEveryRecord)
+    ->Arg(kSyncEvery64Records)
+    ->Arg(kGroupCommit)
+    ->ThreadRange(1, kMaxThreads)
+    ->UseRealTime();
+
+}  // namespace
+
+}  // namespace benchmarks
+}  // namespace cobalt
@@ -0,0 +1,202 @@
+// Copyright 2018 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Benchmarks of the Encode*Observation() methods of logger::Encoder, using
+// the Metrics and Reports of the benchmark project.
+
+#include <benchmark/benchmark.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "client/benchmarks/allocation_counter.h"
+#include "client/benchmarks/benchmark_project.h"
+#include "encoder/client_secret.h"
+#include "logger/encoder.h"
+#include "logger/project_context.h"
+
+namespace cobalt {
+
+using encoder::ClientSecret;
+using logger::Encoder;
+using logger::EventValuesPtr;
+using logger::HistogramPtr;
+using logger::MetricRef;
+using logger::ProjectContext;
+
+namespace benchmarks {
+
+namespace {
+
+const uint32_t kDayIndex = 17000;
+
+// An Encoder together with the benchmark project. A single instance is shared
+// by all of the benchmarks and all of their threads.
+class EncoderEnvironment {
+ public:
+  static EncoderEnvironment* Get() {
+    static EncoderEnvironment* environment = new EncoderEnvironment();
+    return environment;
+  }
+
+  const Encoder& encoder() const { return encoder_; }
+
+  MetricRef metric(uint32_t metric_id) const {
+    return project_context_->RefMetric(project_context_->GetMetric(metric_id));
+  }
+
+  // Returns the Report with the given |report_index| within the Metric with
+  // the given |metric_id|.
+  const ReportDefinition* report(uint32_t metric_id,
+                                 int report_index = 0) const {
+    return &project_context_->GetMetric(metric_id)->reports(report_index);
+  }
+
+ private:
+  EncoderEnvironment()
+      : project_context_(MakeBenchmarkProjectContext()),
+        encoder_(ClientSecret::GenerateNewSecret(), nullptr) {}
+
+  std::unique_ptr<ProjectContext> project_context_;
+  Encoder encoder_;
+};
+
+void BM_EncodeBasicRapporObservation(benchmark::State& state) {
+  auto* environment = EncoderEnvironment::Get();
+  auto metric = environment->metric(kErrorOccurredMetricId);
+  auto* report = environment->report(kErrorOccurredMetricId);
+  AllocationCounter allocation_counter;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(
+        environment->encoder().EncodeBasicRapporObservation(
+            metric, report, kDayIndex, 42, 101));
+  }
+  allocation_counter.Report(&state);
+}
+BENCHMARK(BM_EncodeBasicRapporObservation)
+    ->ThreadRange(1, kMaxThreads)
+    ->UseRealTime();
+
+void BM_EncodeUniqueActivesObservation(benchmark::State& state) {
+  auto* environment = EncoderEnvironment::Get();
+  auto metric = environment->metric(kErrorOccurredMetricId);
+  auto* report = environment->report(kErrorOccurredMetricId);
+  const std::vector<uint32_t> active_event_codes = {42};
+  AllocationCounter allocation_counter;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(
+        environment->encoder().EncodeUniqueActivesObservation(
+            metric, report, kDayIndex, active_event_codes, 1, 101));
+  }
+  allocation_counter.Report(&state);
+}
+BENCHMARK(BM_EncodeUniqueActivesObservation)
+    ->ThreadRange(1, kMaxThreads)
+    ->UseRealTime();
+
+void BM_EncodeIntegerEventObservation(benchmark::State& state) {
+  auto* environment = EncoderEnvironment::Get();
+  auto metric = environment->metric(kModuleLoadTimeMetricId);
+  auto* report = environment->report(kModuleLoadTimeMetricId);
+  const std::string component = "component";
+  AllocationCounter allocation_counter;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(
+        environment->encoder().EncodeIntegerEventObservation(
+            metric, report, kDayIndex, 1, component, 4004));
+  }
+  allocation_counter.Report(&state);
+}
+BENCHMARK(BM_EncodeIntegerEventObservation)
+    ->ThreadRange(1, kMaxThreads)
+    ->UseRealTime();
+
+// The histogram passed to each call is created outside of the timed region,
+// but its allocations are included in the allocation counters.
+void BM_EncodeHistogramObservation(benchmark::State& state) {
+  auto* environment = EncoderEnvironment::Get();
+  auto metric = environment->metric(kFileSystemWriteTimesMetricId);
+  auto* report = environment->report(kFileSystemWriteTimesMetricId);
+  const std::string component = "component";
+  AllocationCounter allocation_counter;
+  for (auto _ : state) {
+    state.PauseTiming();
+    auto histogram = std::make_unique<
+        google::protobuf::RepeatedPtrField<HistogramBucket>>();
+    for (uint32_t index = 0; index < 10; index++) {
+      auto* bucket = histogram->Add();
+      bucket->set_index(index);
+      bucket->set_count(index + 1);
+    }
+    state.ResumeTiming();
+    benchmark::DoNotOptimize(environment->encoder().EncodeHistogramObservation(
+        metric, report, kDayIndex, 1, component, std::move(histogram)));
+  }
+  allocation_counter.Report(&state);
+}
+BENCHMARK(BM_EncodeHistogramObservation)
+    ->ThreadRange(1, kMaxThreads)
+    ->UseRealTime();
+
+// As for BM_EncodeHistogramObservation, the allocations of the Event values
+// created outside of the timed region are included in the allocation
+// counters.
+void BM_EncodeCustomObservation(benchmark::State& state) {
+  auto* environment = EncoderEnvironment::Get();
+  auto metric = environment->metric(kModuleInstallsMetricId);
+  auto* report = environment->report(kModuleInstallsMetricId);
+  AllocationCounter allocation_counter;
+  for (auto _ : state) {
+    state.PauseTiming();
+    auto event_values = std::make_unique<
+        google::protobuf::Map<std::string, CustomDimensionValue>>();
+    (*event_values)["module_name"].set_string_value("login_module");
+    (*event_values)["install_time"].set_int_value(1234);
+    state.ResumeTiming();
+    benchmark::DoNotOptimize(environment->encoder().EncodeCustomObservation(
+        metric, report, kDayIndex, std::move(event_values)));
+  }
+  allocation_counter.Report(&state);
+}
+BENCHMARK(BM_EncodeCustomObservation)
+    ->ThreadRange(1, kMaxThreads)
+    ->UseRealTime();
+
+void BM_EncodeRapporObservation(benchmark::State& state) {
+  auto* environment = EncoderEnvironment::Get();
+  auto metric = environment->metric(kModuleDownloadsMetricId);
+  auto* report = environment->report(kModuleDownloadsMetricId, 0);
+  const std::string str = "www.mymodule.com";
+  AllocationCounter allocation_counter;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(environment->encoder().EncodeRapporObservation(
+        metric, report, kDayIndex, str));
+  }
+  allocation_counter.Report(&state);
+}
+BENCHMARK(BM_EncodeRapporObservation)
+    ->ThreadRange(1, kMaxThreads)
+    ->UseRealTime();
+
+void BM_EncodeForculusObservation(benchmark::State& state) {
+  auto* environment = EncoderEnvironment::Get();
+  auto metric = environment->metric(kModuleDownloadsMetricId);
+  auto* report = environment->report(kModuleDownloadsMetricId, 1);
+  const std::string str = "www.mymodule.com";
+  AllocationCounter allocation_counter;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(environment->encoder().EncodeForculusObservation(
+        metric, report, kDayIndex, str));
+  }
+  allocation_counter.Report(&state);
+}
+BENCHMARK(BM_EncodeForculusObservation)
+    ->ThreadRange(1, kMaxThreads)
+    ->UseRealTime();
+
+}  // namespace
+
+}  // namespace benchmarks
+}  // namespace cobalt
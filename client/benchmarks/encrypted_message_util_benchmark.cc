@@ -0,0 +1,76 @@
+// Copyright 2018 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Benchmarks of EncryptedMessageMaker::Encrypt(), as used by the
+// ObservationWriter to encrypt each Observation, with each of the encryption
+// schemes.
+
+#include <benchmark/benchmark.h>
+
+#include <string>
+
+#include "./encrypted_message.pb.h"
+#include "./logging.h"
+#include "./observation2.pb.h"
+#include "client/benchmarks/allocation_counter.h"
+#include "util/crypto_util/cipher.h"
+#include "util/encrypted_message_util.h"
+
+namespace cobalt {
+
+using crypto::HybridCipher;
+using util::EncryptedMessageMaker;
+
+namespace benchmarks {
+
+namespace {
+
+// Returns a typical Observation: a Basic RAPPOR Observation of a Metric with
+// 100 event codes.
+Observation2 MakeObservation() {
+  Observation2 observation;
+  observation.set_random_id(std::string(8, 'r'));
+  observation.mutable_basic_rappor()->set_data(std::string(13, 'd'));
+  return observation;
+}
+
+// Returns an EncryptedMessageMaker for |scheme|. An instance for each scheme
+// is created on first use and shared by all of the threads.
+const EncryptedMessageMaker& GetEncryptedMessageMaker(
+    EncryptedMessage::EncryptionScheme scheme) {
+  static const EncryptedMessageMaker* none_maker =
+      new EncryptedMessageMaker("", EncryptedMessage::NONE);
+  static const EncryptedMessageMaker* hybrid_maker = [] {
+    std::string public_key_pem;
+    std::string private_key_pem;
+    CHECK(HybridCipher::GenerateKeyPairPEM(&public_key_pem, &private_key_pem));
+    return new EncryptedMessageMaker(public_key_pem,
+                                     EncryptedMessage::HYBRID_ECDH_V1);
+  }();
+  return scheme == EncryptedMessage::NONE ? *none_maker : *hybrid_maker;
+}
+
+// The argument of the benchmark is the EncryptionScheme.
+void BM_Encrypt(benchmark::State& state) {
+  auto scheme = static_cast<EncryptedMessage::EncryptionScheme>(state.range(0));
+  const EncryptedMessageMaker& maker = GetEncryptedMessageMaker(scheme);
+  const Observation2 observation = MakeObservation();
+  EncryptedMessage encrypted_message;
+  AllocationCounter allocation_counter;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(maker.Encrypt(observation, &encrypted_message));
+  }
+  allocation_counter.Report(&state);
+  state.SetLabel(scheme == EncryptedMessage::NONE ? "NONE" : "HYBRID_ECDH_V1");
+}
+BENCHMARK(BM_Encrypt)
+    ->Arg(EncryptedMessage::NONE)
+    ->Arg(EncryptedMessage::HYBRID_ECDH_V1)
+    ->ThreadRange(1, kMaxThreads)
+    ->UseRealTime();
+
+}  // namespace
+
+}  // namespace benchmarks
+}  // namespace cobalt
@@ -0,0 +1,42 @@
+// Copyright 2018 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "client/benchmarks/heap_allocations.h"
+
+#include <cstdlib>
+#include <new>
+
+namespace {
+
+// The number of heap allocations, and of bytes allocated, by the current
+// thread since it started. These are thread-local so that counting does not
+// itself introduce contention between threads.
+thread_local uint64_t num_allocations = 0;
+thread_local uint64_t num_bytes = 0;
+
+}  // namespace
+
+void* operator new(size_t size) {
+  num_allocations++;
+  num_bytes += size;
+  void* ptr = std::malloc(size == 0 ? 1 : size);
+  if (ptr == nullptr) {
+    throw std::bad_alloc();
+  }
+  return ptr;
+}
+
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+
+void operator delete(void* ptr, size_t size) noexcept { std::free(ptr); }
+
+namespace cobalt {
+namespace benchmarks {
+
+uint64_t ThreadHeapAllocations() { return num_allocations; }
+
+uint64_t ThreadHeapBytes() { return num_bytes; }
+
+}  // namespace benchmarks
+}  // namespace cobalt
@@ -0,0 +1,29 @@
+// Copyright 2018 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef COBALT_CLIENT_BENCHMARKS_HEAP_ALLOCATIONS_H_
+#define COBALT_CLIENT_BENCHMARKS_HEAP_ALLOCATIONS_H_
+
+#include <cstdint>
+
+namespace cobalt {
+namespace benchmarks {
+
+// The heap_allocations library replaces the global operator new of the binary
+// that links it with one that counts the heap allocations made by each
+// thread. It is used by the benchmarks and by the tests that check that a
+// code path does not allocate.
+
+// Returns the number of heap allocations made by the current thread since it
+// started.
+uint64_t ThreadHeapAllocations();
+
+// Returns the number of bytes allocated on the heap by the current thread
+// since it started.
+uint64_t ThreadHeapBytes();
+
+}  // namespace benchmarks
+}  // namespace cobalt
+
+#endif  // COBALT_CLIENT_BENCHMARKS_HEAP_ALLOCATIONS_H_
@@ -0,0 +1,216 @@
+// Copyright 2018 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Benchmarks of the Log*() methods of the Logger. Each benchmark logs Events
+// for one of the Metrics of the benchmark project, through the whole logging
+// pipeline down to an Observation Store that discards the Observations. The
+// Observations are not encrypted: the cost of the encryption is measured by
+// the benchmarks in encrypted_message_util_benchmark.cc.
+
+#include <benchmark/benchmark.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "client/benchmarks/allocation_counter.h"
+#include "client/benchmarks/benchmark_project.h"
+#include "encoder/client_secret.h"
+#include "encoder/no_op_observation_store.h"
+#include "logger/encoder.h"
+#include "logger/logger.h"
+#include "logger/observation_writer.h"
+#include "logger/project_context.h"
+#include "util/encrypted_message_util.h"
+
+namespace cobalt {
+
+using encoder::ClientSecret;
+using encoder::NoOpObservationStore;
+using encoder::NoOpUpdateRecipient;
+using logger::Encoder;
+using logger::EventValuesPtr;
+using logger::HistogramPtr;
+using logger::Logger;
+using logger::ObservationWriter;
+using logger::ProjectContext;
+using util::EncryptedMessageMaker;
+
+namespace benchmarks {
+
+namespace {
+
+// A Logger together with everything it depends on. A single instance is
+// shared by all of the benchmarks and all of their threads.
+class LoggerEnvironment {
+ public:
+  static LoggerEnvironment* Get() {
+    static LoggerEnvironment* environment = new LoggerEnvironment();
+    return environment;
+  }
+
+  Logger* logger() { return logger_.get(); }
+
+ private:
+  LoggerEnvironment()
+      : project_context_(MakeBenchmarkProjectContext()),
+        observation_encrypter_("", EncryptedMessage::NONE),
+        observation_writer_(&observation_store_, &update_recipient_,
+                            &observation_encrypter_),
+        encoder_(ClientSecret::GenerateNewSecret(), nullptr),
+        logger_(new Logger(&encoder_, &observation_writer_,
+                           project_context_.get())) {}
+
+  std::unique_ptr<ProjectContext> project_context_;
+  NoOpObservationStore observation_store_;
+  NoOpUpdateRecipient update_recipient_;
+  EncryptedMessageMaker observation_encrypter_;
+  ObservationWriter observation_writer_;
+  Encoder encoder_;
+  std::unique_ptr<Logger> logger_;
+};
+
+HistogramPtr NewHistogram() {
+  auto histogram = std::make_unique<
+      google::protobuf::RepeatedPtrField<HistogramBucket>>();
+  for (uint32_t index = 0; index < 10; index++) {
+    auto* bucket = histogram->Add();
+    bucket->set_index(index);
+    bucket->set_count(index + 1);
+  }
+  return histogram;
+}
+
+EventValuesPtr NewCustomEvent() {
+  auto event_values = std::make_unique<
+      google::protobuf::Map<std::string, CustomDimensionValue>>();
+  (*event_values)["module_name"].set_string_value("login_module");
+  (*event_values)["install_time"].set_int_value(1234);
+  return event_values;
+}
+
+void BM_LogEvent(benchmark::State& state) {
+  Logger* logger = LoggerEnvironment::Get()->logger();
+  AllocationCounter allocation_counter;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(logger->LogEvent(kErrorOccurredMetricId, 42));
+  }
+  allocation_counter.Report(&state);
+}
+BENCHMARK(BM_LogEvent)->ThreadRange(1, kMaxThreads)->UseRealTime();
+
+void BM_LogEventCount(benchmark::State& state) {
+  Logger* logger = LoggerEnvironment::Get()->logger();
+  const std::string component = "component";
+  AllocationCounter allocation_counter;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(
+        logger->LogEventCount(kReadCacheHitsMetricId, 1, component, 0, 303));
+  }
+  allocation_counter.Report(&state);
+}
+BENCHMARK(BM_LogEventCount)->ThreadRange(1, kMaxThreads)->UseRealTime();
+
+void BM_LogElapsedTime(benchmark::State& state) {
+  Logger* logger = LoggerEnvironment::Get()->logger();
+  const std::string component = "component";
+  AllocationCounter allocation_counter;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(logger->LogElapsedTime(kModuleLoadTimeMetricId,
+                                                    1, component, 4004));
+  }
+  allocation_counter.Report(&state);
+}
+BENCHMARK(BM_LogElapsedTime)->ThreadRange(1, kMaxThreads)->UseRealTime();
+
+void BM_LogFrameRate(benchmark::State& state) {
+  Logger* logger = LoggerEnvironment::Get()->logger();
+  const std::string component = "component";
+  AllocationCounter allocation_counter;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(logger->LogFrameRate(
+        kLoginModuleFrameRateMetricId, 1, component, 59.9));
+  }
+  allocation_counter.Report(&state);
+}
+BENCHMARK(BM_LogFrameRate)->ThreadRange(1, kMaxThreads)->UseRealTime();
+
+void BM_LogMemoryUsage(benchmark::State& state) {
+  Logger* logger = LoggerEnvironment::Get()->logger();
+  const std::string component = "component";
+  AllocationCounter allocation_counter;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(logger->LogMemoryUsage(kLedgerMemoryUsageMetricId,
+                                                    1, component, 606));
+  }
+  allocation_counter.Report(&state);
+}
+BENCHMARK(BM_LogMemoryUsage)->ThreadRange(1, kMaxThreads)->UseRealTime();
+
+// Builds the histogram that BM_LogIntHistogram passes to each call. The
+// Logger takes ownership of the histogram, so a new one is needed for every
+// iteration.
+void BM_NewHistogram(benchmark::State& state) {
+  AllocationCounter allocation_counter;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(NewHistogram());
+  }
+  allocation_counter.Report(&state);
+}
+BENCHMARK(BM_NewHistogram)->ThreadRange(1, kMaxThreads)->UseRealTime();
+
+// The time and the allocations of each iteration include building the
+// histogram, which are measured on their own by BM_NewHistogram. Pausing the
+// timer around the construction instead would cost more than the
+// construction itself.
+void BM_LogIntHistogram(benchmark::State& state) {
+  Logger* logger = LoggerEnvironment::Get()->logger();
+  const std::string component = "component";
+  AllocationCounter allocation_counter;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(logger->LogIntHistogram(
+        kFileSystemWriteTimesMetricId, 1, component, NewHistogram()));
+  }
+  allocation_counter.Report(&state);
+}
+BENCHMARK(BM_LogIntHistogram)->ThreadRange(1, kMaxThreads)->UseRealTime();
+
+void BM_LogString(benchmark::State& state) {
+  Logger* logger = LoggerEnvironment::Get()->logger();
+  const std::string str = "www.mymodule.com";
+  AllocationCounter allocation_counter;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(logger->LogString(kModuleDownloadsMetricId, str));
+  }
+  allocation_counter.Report(&state);
+}
+BENCHMARK(BM_LogString)->ThreadRange(1, kMaxThreads)->UseRealTime();
+
+// Builds the Event values that BM_LogCustomEvent passes to each call.
+void BM_NewCustomEvent(benchmark::State& state) {
+  AllocationCounter allocation_counter;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(NewCustomEvent());
+  }
+  allocation_counter.Report(&state);
+}
+BENCHMARK(BM_NewCustomEvent)->ThreadRange(1, kMaxThreads)->UseRealTime();
+
+// As for BM_LogIntHistogram, each iteration includes building the Event
+// values, which is measured on its own by BM_NewCustomEvent.
+void BM_LogCustomEvent(benchmark::State& state) {
+  Logger* logger = LoggerEnvironment::Get()->logger();
+  AllocationCounter allocation_counter;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(
+        logger->LogCustomEvent(kModuleInstallsMetricId, NewCustomEvent()));
+  }
+  allocation_counter.Report(&state);
+}
+BENCHMARK(BM_LogCustomEvent)->ThreadRange(1, kMaxThreads)->UseRealTime();
+
+}  // namespace
+
+}  // namespace benchmarks
+}  // namespace cobalt
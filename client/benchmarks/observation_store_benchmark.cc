@@ -0,0 +1,178 @@
+// Copyright 2018 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Benchmarks of AddEncryptedObservation() of the MemoryObservationStore, with
+// and without shards, and the FileObservationStore. Each iteration also
+// creates the EncryptedMessage and the ObservationMetadata that are added, as
+// the ObservationWriter does.
+
+#include <benchmark/benchmark.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "./encrypted_message.pb.h"
+#include "./logging.h"
+#include "./observation_batch.pb.h"
+#include "client/benchmarks/allocation_counter.h"
+#include "encoder/file_observation_store.h"
+#include "encoder/memory_observation_store.h"
+#include "encoder/observation_store.h"
+#include "util/posix_file_system.h"
+
+namespace cobalt {
+
+using encoder::FileObservationStore;
+using encoder::MemoryObservationStore;
+using encoder::ObservationStore;
+using util::PosixFileSystem;
+
+namespace benchmarks {
+
+namespace {
+
+const size_t kMaxBytesPerObservation = 10 * 1024;
+const size_t kMaxBytesPerEnvelope = 256 * 1024;
+const size_t kMaxBytesTotal = 64 * 1024 * 1024;
+// The stores are emptied, outside of the timed region, whenever they hold
+// more than this many bytes, so that they never become full.
+const size_t kDrainThresholdBytes = 16 * 1024 * 1024;
+// How often, in iterations, each thread checks the size of the store.
+const int kDrainCheckInterval = 1024;
+
+const char kFileStoreDirectory[] = "/tmp/cobalt_client_benchmarks_store";
+
+// The size of the ciphertext of a typical encrypted Observation.
+const size_t kCiphertextSize = 120;
+
+ObservationStore* GetMemoryObservationStore() {
+  static ObservationStore* store = new MemoryObservationStore(
+      kMaxBytesPerObservation, kMaxBytesPerEnvelope, kMaxBytesTotal);
+  return store;
+}
+
+ObservationStore* GetShardedMemoryObservationStore() {
+  static ObservationStore* store =
+      new MemoryObservationStore(kMaxBytesPerObservation, kMaxBytesPerEnvelope,
+                                 kMaxBytesTotal, kMaxThreads);
+  return store;
+}
+
+ObservationStore* GetFileObservationStore() {
+  static ObservationStore* store = [] {
+    auto fs = std::make_unique<PosixFileSystem>();
+    auto files = fs->ListFiles(kFileStoreDirectory);
+    if (files.ok()) {
+      for (const auto& file : files.ValueOrDie()) {
+        fs->Delete(std::string(kFileStoreDirectory) + "/" + file);
+      }
+    }
+    return new FileObservationStore(kMaxBytesPerObservation,
+                                    kMaxBytesPerEnvelope, kMaxBytesTotal,
+                                    std::move(fs), kFileStoreDirectory);
+  }();
+  return store;
+}
+
+// Deletes all of the Envelopes in |store|.
+void Drain(ObservationStore* store) {
+  while (store->TakeNextEnvelopeHolder() != nullptr) {
+  }
+}
+
+// The number of distinct ObservationMetadata that are added.
+const int kNumMetrics = 8;
+
+std::unique_ptr<ObservationMetadata> MakeMetadata(int iteration) {
+  auto metadata = std::make_unique<ObservationMetadata>();
+  metadata->set_customer_id(1);
+  metadata->set_project_id(1);
+  metadata->set_metric_id(1 + iteration % kNumMetrics);
+  metadata->set_report_id(1);
+  metadata->set_day_index(17000);
+  return metadata;
+}
+
+// If |by_handle| is true the metadata is registered with the store up front
+// and the Observations are added with AddEncryptedObservationByHandle().
+void AddEncryptedObservations(benchmark::State& state, ObservationStore* store,
+                              bool by_handle = false) {
+  const std::string ciphertext(kCiphertextSize, 'c');
+  std::vector<encoder::MetadataHandle> handles;
+  for (int i = 0; by_handle && i < kNumMetrics; i++) {
+    handles.push_back(store->RegisterMetadata(*MakeMetadata(i)));
+  }
+  int iteration = 0;
+  AllocationCounter allocation_counter;
+  for (auto _ : state) {
+    auto message = std::make_unique<EncryptedMessage>();
+    message->set_ciphertext(ciphertext);
+    ObservationStore::StoreStatus status;
+    if (by_handle) {
+      status = store->AddEncryptedObservationByHandle(
+          std::move(message), handles[iteration % kNumMetrics]);
+    } else {
+      status = store->AddEncryptedObservation(std::move(message),
+                                              MakeMetadata(iteration));
+    }
+    if (status != ObservationStore::kOk) {
+      state.SkipWithError("AddEncryptedObservation() failed.");
+      break;
+    }
+    if (++iteration % kDrainCheckInterval == 0 &&
+        store->Size() > kDrainThresholdBytes) {
+      state.PauseTiming();
+      Drain(store);
+      state.ResumeTiming();
+    }
+  }
+  allocation_counter.Report(&state);
+}
+
+void BM_MemoryObservationStore_AddEncryptedObservation(
+    benchmark::State& state) {
+  AddEncryptedObservations(state, GetMemoryObservationStore());
+}
+BENCHMARK(BM_MemoryObservationStore_AddEncryptedObservation)
+    ->ThreadRange(1, kMaxThreads)
+    ->UseRealTime();
+
+// With one shard per thread, the throughput should scale with the number of
+// threads, unlike that of BM_MemoryObservationStore_AddEncryptedObservation.
+void BM_ShardedMemoryObservationStore_AddEncryptedObservation(
+    benchmark::State& state) {
+  AddEncryptedObservations(state, GetShardedMemoryObservationStore());
+}
+BENCHMARK(BM_ShardedMemoryObservationStore_AddEncryptedObservation)
+    ->ThreadRange(1, kMaxThreads)
+    ->UseRealTime();
+
+void BM_ShardedMemoryObservationStore_AddEncryptedObservationByHandle(
+    benchmark::State& state) {
+  AddEncryptedObservations(state, GetShardedMemoryObservationStore(), true);
+}
+BENCHMARK(BM_ShardedMemoryObservationStore_AddEncryptedObservationByHandle)
+    ->ThreadRange(1, kMaxThreads)
+    ->UseRealTime();
+
+void BM_FileObservationStore_AddEncryptedObservation(benchmark::State& state) {
+  AddEncryptedObservations(state, GetFileObservationStore());
+}
+BENCHMARK(BM_FileObservationStore_AddEncryptedObservation)
+    ->ThreadRange(1, kMaxThreads)
+    ->UseRealTime();
+
+void BM_FileObservationStore_AddEncryptedObservationByHandle(
+    benchmark::State& state) {
+  AddEncryptedObservations(state, GetFileObservationStore(), true);
+}
+BENCHMARK(BM_FileObservationStore_AddEncryptedObservationByHandle)
+    ->ThreadRange(1, kMaxThreads)
+    ->UseRealTime();
+
+}  // namespace
+
+}  // namespace benchmarks
+}  // namespace cobalt
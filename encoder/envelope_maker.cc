@@ -68,6 +68,46 @@ ObservationStore::StoreStatus EnvelopeMaker::AddEncryptedObservation(
   return ObservationStore::kOk;
 }
 
+ObservationStore::StoreStatus EnvelopeMaker::AddEncryptedObservation(
+    std::unique_ptr<EncryptedMessage> message, MetadataHandle handle,
+    const MetadataRegistry::Entry& entry) {
+  auto status = CanAddObservation(*message);
+  if (status != ObservationStore::kOk) {
+    return status;
+  }
+
+  // "+1" below is for the |scheme| field of EncryptedMessage.
+  num_bytes_ += message->ciphertext().size() +
+                message->public_key_fingerprint().size() + 1;
+  GetBatch(handle, entry)->add_encrypted_observation()->Swap(message.get());
+  return ObservationStore::kOk;
+}
+
+ObservationBatch* EnvelopeMaker::GetBatch(
+    MetadataHandle handle, const MetadataRegistry::Entry& entry) {
+  if (handle < handle_batches_.size() && handle_batches_[handle] != nullptr) {
+    return handle_batches_[handle];
+  }
+
+  // The first time a handle is seen, its batch is found by the serialized
+  // metadata, since it may already hold Observations that were added without
+  // the handle.
+  ObservationBatch* observation_batch;
+  auto iter = batch_map_.find(entry.serialized_metadata);
+  if (iter != batch_map_.end()) {
+    observation_batch = iter->second;
+  } else {
+    observation_batch = envelope_.add_batch();
+    *observation_batch->mutable_meta_data() = entry.metadata;
+    batch_map_[entry.serialized_metadata] = observation_batch;
+  }
+  if (handle >= handle_batches_.size()) {
+    handle_batches_.resize(handle + 1, nullptr);
+  }
+  handle_batches_[handle] = observation_batch;
+  return observation_batch;
+}
+
 ObservationBatch* EnvelopeMaker::GetBatch(
     std::unique_ptr<ObservationMetadata> metadata) {
   // Serialize metadata.
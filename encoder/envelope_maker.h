@@ -18,10 +18,12 @@
 #include <memory>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 #include "./encrypted_message.pb.h"
 #include "./logging.h"
 #include "./observation.pb.h"
+#include "encoder/metadata_registry.h"
 #include "encoder/observation_store.h"
 #include "util/encrypted_message_util.h"
 
@@ -78,6 +80,15 @@ class EnvelopeMaker : public ObservationStore::EnvelopeHolder {
       std::unique_ptr<EncryptedMessage> message,
       std::unique_ptr<ObservationMetadata> metadata);
 
+  // AddEncryptedObservation adds a message whose metadata is the |entry| of
+  // the given |handle| in a MetadataRegistry. After the first Observation
+  // with a given handle, the ObservationBatch is found by the handle rather
+  // than by the serialized metadata. All of the handles passed to an
+  // EnvelopeMaker must come from the same MetadataRegistry.
+  ObservationStore::StoreStatus AddEncryptedObservation(
+      std::unique_ptr<EncryptedMessage> message, MetadataHandle handle,
+      const MetadataRegistry::Entry& entry);
+
   const Envelope& GetEnvelope() override { return envelope_; }
 
   bool Empty() const { return envelope_.batch_size() == 0; }
@@ -85,6 +96,7 @@ class EnvelopeMaker : public ObservationStore::EnvelopeHolder {
   void Clear() {
     envelope_.Clear();
     batch_map_.clear();
+    handle_batches_.clear();
     num_bytes_ = 0;
   }
 
@@ -106,12 +118,21 @@ class EnvelopeMaker : public ObservationStore::EnvelopeHolder {
   // new ObservationBatch is created.
   ObservationBatch* GetBatch(std::unique_ptr<ObservationMetadata> metadata);
 
+  // Returns the ObservationBatch containing the metadata of |entry|, which is
+  // registered as |handle|.
+  ObservationBatch* GetBatch(MetadataHandle handle,
+                             const MetadataRegistry::Entry& entry);
+
   Envelope envelope_;
 
   // The keys of the map are serialized ObservationMetadata. The values
   // are the ObservationBatch containing that Metadata
   std::unordered_map<std::string, ObservationBatch*> batch_map_;
 
+  // The ObservationBatch of each MetadataHandle that has been added, indexed
+  // by handle, or nullptr for the handles that have not been added.
+  std::vector<ObservationBatch*> handle_batches_;
+
   // Keeps a running total of the sum of the sizes of the encrypted Observations
   // contained in |envelope_|;
   size_t num_bytes_ = 0;
@@ -2,19 +2,23 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#include <cstring>
 #include <ctime>
+#include <iterator>
 #include <regex>
 #include <utility>
 
 #include "./logging.h"
 #include "encoder/file_observation_store.h"
 #include "encoder/file_observation_store_internal.pb.h"
-#include "third_party/protobuf/src/google/protobuf/util/delimited_message_util.h"
+#include "third_party/protobuf/src/google/protobuf/io/coded_stream.h"
 
 namespace cobalt {
 namespace encoder {
 
 using tensorflow_statusor::StatusOr;
+using util::BufferedFileWriter;
+using util::DurabilityPolicy;
 using util::FileSystem;
 using util::Status;
 using util::StatusCode;
@@ -28,17 +32,19 @@ const char kActiveFileName[] = "in_progress.data";
 // range 1000000-9999999.
 const std::regex kFinalizedFileRegex(R"(\d{13}-\d{7}.data)");
 
-FileObservationStore::FileObservationStore(size_t max_bytes_per_observation,
-                                           size_t max_bytes_per_envelope,
-                                           size_t max_bytes_total,
-                                           std::unique_ptr<FileSystem> fs,
-                                           const std::string &root_directory)
+FileObservationStore::FileObservationStore(
+    size_t max_bytes_per_observation, size_t max_bytes_per_envelope,
+    size_t max_bytes_total, std::unique_ptr<FileSystem> fs,
+    const std::string &root_directory, DurabilityPolicy durability_policy,
+    CompressionPolicy compression_policy)
     : ObservationStore(max_bytes_per_observation, max_bytes_per_envelope,
                        max_bytes_total),
       fs_(std::move(fs)),
       root_directory_(root_directory),
       active_file_name_(FullPath(kActiveFileName)),
-      random_int_(1000000, 9999999) {
+      random_int_(1000000, 9999999),
+      durability_policy_(durability_policy),
+      compression_policy_(compression_policy) {
   CHECK(fs_);
 
   // Check if root_directory_ already exists.
@@ -54,8 +60,10 @@ FileObservationStore::FileObservationStore(size_t max_bytes_per_observation,
     fields->finalized_bytes = 0;
 
     for (auto file : ListFinalizedFiles()) {
-      fields->finalized_bytes +=
-          fs_->FileSize(FullPath(file)).ConsumeValueOr(0);
+      FinalizedFile finalized_file = ReadFinalizedFile(file);
+      fields->finalized_files[file] = finalized_file;
+      fields->finalized_bytes += finalized_file.file_size;
+      RecordAdded(finalized_file.usage);
     }
 
     // If there exists an active file, it likely means that the process
@@ -68,19 +76,98 @@ FileObservationStore::FileObservationStore(size_t max_bytes_per_observation,
     VLOG(4) << "Attempting to rename a (potentially nonexistant) file";
     FinalizeActiveFile(&fields);
   }
+
+  if (durability_policy_.mode == DurabilityPolicy::kGroupCommit) {
+    group_commit_thread_ = std::thread([this] { RunGroupCommit(); });
+  }
+}
+
+FileObservationStore::~FileObservationStore() {
+  if (group_commit_thread_.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(group_commit_mutex_);
+      shut_down_ = true;
+    }
+    group_commit_notifier_.notify_all();
+    group_commit_thread_.join();
+  }
+  // The writer uses |fs_|, which is destroyed before |protected_fields_|.
+  auto fields = protected_fields_.lock();
+  fields->active_file = nullptr;
+}
+
+void FileObservationStore::RunGroupCommit() {
+  std::unique_lock<std::mutex> lock(group_commit_mutex_);
+  while (!group_commit_notifier_.wait_for(
+      lock, durability_policy_.group_commit_interval,
+      [this] { return shut_down_; })) {
+    auto fields = protected_fields_.lock();
+    if (fields->active_file && (!fields->active_file->FlushBlock() ||
+                                !fields->active_file->file()->SyncIfDirty())) {
+      LOG(WARNING) << "Unable to commit `" << active_file_name_ << "`";
+    }
+  }
 }
 
 ObservationStore::StoreStatus FileObservationStore::AddEncryptedObservation(
     std::unique_ptr<EncryptedMessage> message,
     std::unique_ptr<ObservationMetadata> metadata) {
+  std::string serialized_metadata = metadata->SerializeAsString();
+  auto fields = protected_fields_.lock();
+  return AddEncryptedObservationLocked(*message, *metadata, serialized_metadata,
+                                       kNoMetadataHandle, &fields);
+}
+
+ObservationStore::StoreStatus FileObservationStore::AddEncryptedObservations(
+    std::vector<EncryptedObservation> observations, size_t *num_added) {
+  CHECK(num_added);
+  *num_added = 0;
+  StoreStatus first_failure = kOk;
+  // The registered metadata are looked up before the lock is taken, so that
+  // only the records are written under it.
+  std::vector<const MetadataRegistry::Entry *> entries;
+  entries.reserve(observations.size());
+  for (const auto &observation : observations) {
+    entries.push_back(GetRegisteredMetadata(observation.metadata));
+  }
   auto fields = protected_fields_.lock();
+  for (size_t i = 0; i < observations.size(); i++) {
+    StoreStatus status = kWriteFailed;
+    if (entries[i] != nullptr) {
+      status = AddEncryptedObservationLocked(
+          *observations[i].message, entries[i]->metadata,
+          entries[i]->serialized_metadata, observations[i].metadata, &fields);
+    }
+    if (status == kOk) {
+      (*num_added)++;
+    } else if (first_failure == kOk) {
+      first_failure = status;
+    }
+  }
+  return first_failure;
+}
+
+ObservationStore::StoreStatus
+FileObservationStore::AddEncryptedObservationByHandle(
+    std::unique_ptr<EncryptedMessage> message, MetadataHandle metadata) {
+  auto entry = GetRegisteredMetadata(metadata);
+  if (entry == nullptr) {
+    return kWriteFailed;
+  }
+  auto fields = protected_fields_.lock();
+  return AddEncryptedObservationLocked(*message, entry->metadata,
+                                       entry->serialized_metadata, metadata,
+                                       &fields);
+}
 
-  auto active_file = GetActiveFile(&fields);
-  auto metadata_str = metadata->SerializeAsString();
+ObservationStore::StoreStatus
+FileObservationStore::AddEncryptedObservationLocked(
+    const EncryptedMessage &message, const ObservationMetadata &metadata,
+    const std::string &serialized_metadata, MetadataHandle handle,
+    util::ProtectedFields<Fields>::LockedFieldsPtr *fields_ptr) {
+  auto &fields = *fields_ptr;
 
-  // "+1" below is for the |scheme| field of EncryptedMessage.
-  size_t obs_size = message->ciphertext().size() +
-                    message->public_key_fingerprint().size() + 1;
+  size_t obs_size = ObservationSize(message);
   if (obs_size > max_bytes_per_observation_) {
     LOG(WARNING) << "An observation that was too big was passed in to "
                     "FileObservationStore::AddEncryptedObservation(): "
@@ -88,42 +175,38 @@ ObservationStore::StoreStatus FileObservationStore::AddEncryptedObservation(
     return kObservationTooBig;
   }
 
-  size_t new_num_bytes = active_file->ByteCount() + obs_size;
-  VLOG(4) << "new_num_bytes(" << new_num_bytes << ") > max_bytes_total_("
-          << max_bytes_total_ << ")";
-  if (new_num_bytes > max_bytes_total_) {
-    VLOG(4) << "The observation store is full.";
+  if (!ReserveProjectBytes(metadata, obs_size)) {
     return kStoreFull;
   }
 
-  if (!fields->metadata_written ||
-      metadata_str != fields->last_written_metadata) {
-    ObservationStoreRecord stored_metadata;
-    stored_metadata.mutable_meta_data()->Swap(metadata.get());
-    if (!google::protobuf::util::SerializeDelimitedToZeroCopyStream(
-            stored_metadata, active_file)) {
-      LOG(WARNING) << "Unable to write metadata to `" << active_file_name_
-                   << "`";
-      return kWriteFailed;
-    }
-    fields->metadata_written = true;
-    fields->last_written_metadata = metadata_str;
+  if (!EvictLowerPriorityLocked(GetPriority(metadata), obs_size, fields_ptr)) {
+    VLOG(4) << "FileObservationStore::AddEncryptedObservation(): Rejecting "
+               "observation because the store is full.";
+    UnreserveProjectBytes(metadata, obs_size, true);
+    return kStoreFull;
   }
 
-  ObservationStoreRecord stored_message;
-  stored_message.mutable_encrypted_observation()->Swap(message.get());
-  if (!google::protobuf::util::SerializeDelimitedToZeroCopyStream(
-          stored_message, active_file)) {
+  // The active file is only opened once there is an Observation to write to
+  // it, so that it never holds a header alone.
+  auto active_file = GetActiveFile(fields_ptr);
+  if (active_file == nullptr) {
+    UnreserveProjectBytes(metadata, obs_size, false);
+    return kWriteFailed;
+  }
+  if (!active_file->Append(message, serialized_metadata, handle)) {
     LOG(WARNING) << "Unable to write encrypted_observation to `"
                  << active_file_name_ << "`";
+    UnreserveProjectBytes(metadata, obs_size, false);
     return kWriteFailed;
   }
+  fields->active_file_usage.Add(metadata, obs_size);
 
-  if (active_file->ByteCount() >= (int64_t)max_bytes_per_envelope_) {
-    VLOG(4) << "In-progress file contains " << active_file->ByteCount()
-            << " bytes (>= " << max_bytes_per_envelope_ << "). Finalizing it.";
+  if (active_file->UncompressedByteCount() >= max_bytes_per_envelope_) {
+    VLOG(4) << "In-progress file contains "
+            << active_file->UncompressedByteCount() << " bytes (>= "
+            << max_bytes_per_envelope_ << "). Finalizing it.";
 
-    if (!FinalizeActiveFile(&fields)) {
+    if (!FinalizeActiveFile(fields_ptr)) {
       LOG(WARNING) << "Unable to finalize `" << active_file_name_;
       return kWriteFailed;
     }
@@ -132,38 +215,148 @@ ObservationStore::StoreStatus FileObservationStore::AddEncryptedObservation(
   return kOk;
 }
 
-bool FileObservationStore::FinalizeActiveFile(
+bool FileObservationStore::EvictLowerPriorityLocked(
+    Priority priority, size_t num_bytes,
     util::ProtectedFields<Fields>::LockedFieldsPtr *fields) {
   auto &f = *fields;
+  size_t active_file_bytes = f->active_file ? f->active_file->ByteCount() : 0;
+  auto file = f->finalized_files.begin();
+  while (f->finalized_bytes + active_file_bytes + num_bytes >
+             max_bytes_total_ &&
+         file != f->finalized_files.end()) {
+    if (GetPriority(file->second.usage) >= priority) {
+      ++file;
+      continue;
+    }
+    VLOG(4) << "Evicting `" << file->first << "` to make room.";
+    fs_->Delete(FullPath(file->first));
+    f->finalized_bytes -= file->second.file_size;
+    RecordRemoved(file->second.usage, true);
+    file = f->finalized_files.erase(file);
+  }
+  return f->finalized_bytes + active_file_bytes + num_bytes <=
+         max_bytes_total_;
+}
+
+bool FileObservationStore::FinalizeActiveFile(
+    util::ProtectedFields<Fields>::LockedFieldsPtr *fields,
+    std::string *finalized_name) {
+  auto &f = *fields;
 
-  // Close the current file (if it is open).
-  f->active_file = nullptr;
-  if (f->active_fstream.is_open()) {
-    f->active_fstream.close();
+  // Write the footer and close the current file (if it is open). Otherwise
+  // the file, if there is one, was left behind by a previous instance of the
+  // store and has no footer.
+  bool had_active_file = f->active_file != nullptr;
+  bool has_footer = false;
+  size_t envelope_size = 0;
+  Usage usage = std::move(f->active_file_usage);
+  f->active_file_usage = Usage();
+  if (had_active_file) {
+    envelope_size = f->active_file->footer().envelope_bytes();
+    has_footer = f->active_file->Finish(ToMetricUsages(usage));
+    f->uncompressed_block_bytes += f->active_file->uncompressed_block_bytes();
+    f->compressed_block_bytes += f->active_file->compressed_block_bytes();
+    f->active_file = nullptr;
   }
-  f->metadata_written = false;
 
   auto filesize = fs_->FileSize(active_file_name_);
-  if (filesize.ok()) {
-    if (filesize.ConsumeValueOrDie() == 0) {
-      // File exists, but is empty. Let's just delete it instead of renaming.
-      fs_->Delete(active_file_name_);
-      return false;
-    }
-  } else {
+  if (!filesize.ok()) {
     // if !filesize.ok(), the file likely doesn't even exist.
     return false;
   }
+  size_t file_size = filesize.ConsumeValueOrDie();
+  if (file_size == 0) {
+    // File exists, but is empty. Let's just delete it instead of renaming.
+    fs_->Delete(active_file_name_);
+    return false;
+  }
 
-  auto new_name = FullPath(GenerateFinalizedName());
-  if (!fs_->Rename(active_file_name_, new_name)) {
+  auto new_name = GenerateFinalizedName();
+  if (!fs_->Rename(active_file_name_, FullPath(new_name))) {
     return false;
   }
 
-  f->finalized_bytes += fs_->FileSize(new_name).ConsumeValueOr(0);
+  if (had_active_file) {
+    f->finalized_files[new_name] = {
+        file_size, has_footer ? envelope_size : file_size, std::move(usage)};
+  } else {
+    // The file was left behind by a previous instance of the store, which
+    // also left its Observations uncounted.
+    f->finalized_files[new_name] = ReadFinalizedFile(new_name);
+    RecordAdded(f->finalized_files[new_name].usage);
+  }
+  f->finalized_bytes += file_size;
+  if (finalized_name) {
+    *finalized_name = new_name;
+  }
   return true;
 }
 
+FileObservationStore::FinalizedFile FileObservationStore::ReadFinalizedFile(
+    const std::string &file_name) const {
+  FinalizedFile finalized_file;
+  finalized_file.file_size =
+      fs_->FileSize(FullPath(file_name)).ConsumeValueOr(0);
+  finalized_file.envelope_size = finalized_file.file_size;
+  auto contents_or = fs_->MapFile(FullPath(file_name));
+  if (contents_or.ok()) {
+    SegmentReader reader(*contents_or.ValueOrDie());
+    const SegmentFooter *footer = reader.footer();
+    if (footer != nullptr) {
+      finalized_file.envelope_size = footer->envelope_bytes();
+      if (footer->usage_size() > 0 ||
+          footer->num_encrypted_observations() == 0) {
+        finalized_file.usage = FromMetricUsages(footer->usage());
+        return finalized_file;
+      }
+    }
+    SegmentRecord record;
+    // The ObservationMetadata of each metadata id of the file.
+    std::vector<ObservationMetadata> metadata;
+    EncryptedMessage message;
+    while (reader.Next(&record)) {
+      if (record.field_number == ObservationStoreRecord::kMetaDataFieldNumber) {
+        if (record.metadata_id >= metadata.size()) {
+          metadata.resize(record.metadata_id + 1);
+        }
+        metadata[record.metadata_id].ParseFromArray(record.payload,
+                                                    record.payload_size);
+      } else if (record.metadata_id < metadata.size() &&
+                 message.ParseFromArray(record.payload, record.payload_size)) {
+        finalized_file.usage.Add(metadata[record.metadata_id],
+                                 ObservationSize(message));
+      }
+    }
+  }
+  return finalized_file;
+}
+
+MetricUsages FileObservationStore::ToMetricUsages(const Usage &usage) {
+  MetricUsages metric_usages;
+  for (const auto &metric : usage.metrics) {
+    auto *metric_usage = metric_usages.Add();
+    metric_usage->set_customer_id(std::get<0>(metric.first));
+    metric_usage->set_project_id(std::get<1>(metric.first));
+    metric_usage->set_metric_id(std::get<2>(metric.first));
+    metric_usage->set_num_observations(metric.second.num_observations);
+    metric_usage->set_bytes(metric.second.bytes);
+  }
+  return metric_usages;
+}
+
+ObservationStore::Usage FileObservationStore::FromMetricUsages(
+    const MetricUsages &metric_usages) {
+  Usage usage;
+  for (const auto &metric_usage : metric_usages) {
+    auto &count = usage.metrics[MetricKey(metric_usage.customer_id(),
+                                          metric_usage.project_id(),
+                                          metric_usage.metric_id())];
+    count.num_observations += metric_usage.num_observations();
+    count.bytes += metric_usage.bytes();
+  }
+  return usage;
+}
+
 std::string FileObservationStore::GenerateFinalizedName() const {
   auto now = std::chrono::duration_cast<std::chrono::milliseconds>(
                  std::chrono::system_clock::now().time_since_epoch())
@@ -182,16 +375,20 @@ std::string FileObservationStore::FileEnvelopeHolder::FullPath(
   return root_directory_ + "/" + filename;
 }
 
-google::protobuf::io::OstreamOutputStream *FileObservationStore::GetActiveFile(
+SegmentWriter *FileObservationStore::GetActiveFile(
     util::ProtectedFields<Fields>::LockedFieldsPtr *fields) {
   auto &f = *fields;
 
   if (f->active_file == nullptr) {
-    f->active_fstream.open(active_file_name_);
-    CHECK(f->active_fstream.is_open()) << "Failed to open " << active_file_name_
-                                       << ": " << std::strerror(errno);
-    f->active_file.reset(
-        new google::protobuf::io::OstreamOutputStream(&f->active_fstream));
+    auto file = BufferedFileWriter::Open(fs_.get(), active_file_name_,
+                                         durability_policy_);
+    if (file != nullptr) {
+      f->active_file =
+          SegmentWriter::Create(std::move(file), compression_policy_);
+    }
+    if (f->active_file == nullptr) {
+      LOG(ERROR) << "Failed to open " << active_file_name_;
+    }
   }
   return f->active_file.get();
 }
@@ -211,29 +408,16 @@ StatusOr<std::string> FileObservationStore::GetOldestFinalizedFile(
     util::ProtectedFields<Fields>::LockedFieldsPtr *fields) {
   auto &f = *fields;
 
-  std::string found_file_name;
-  for (auto file : ListFinalizedFiles()) {
-    if (f->files_taken.find(file) == f->files_taken.end()) {
-      if (found_file_name == "") {
-        found_file_name = file;
-      } else {
-        // We compare the file names to try to find the oldest one. This works
-        // because file names are prefixed with the timestamp when they were
-        // finalized and that timestamp is always 13 digits long.
-        //
-        // A lexigraphic order of fixed length number strings is identical to
-        // ordering their numerical values.
-        auto result = strcmp(file.c_str(), found_file_name.c_str());
-        if (result < 0) {
-          found_file_name = file;
-        }
-      }
-    }
-  }
-  if (found_file_name == "") {
+  // The catalog is ordered by file name. This is the order of the files' ages
+  // because file names are prefixed with the timestamp when they were
+  // finalized and that timestamp is always 13 digits long.
+  //
+  // A lexigraphic order of fixed length number strings is identical to
+  // ordering their numerical values.
+  if (f->finalized_files.empty()) {
     return Status(StatusCode::NOT_FOUND, "No finalized file");
   }
-  return found_file_name;
+  return f->finalized_files.begin()->first;
 }
 
 std::unique_ptr<ObservationStore::EnvelopeHolder>
@@ -257,11 +441,47 @@ FileObservationStore::TakeNextEnvelopeHolder() {
   }
 
   auto oldest_file_name = oldest_file_name_or.ConsumeValueOrDie();
-  fields->files_taken.insert(oldest_file_name);
-  fields->finalized_bytes -=
-      fs_->FileSize(FullPath(oldest_file_name)).ConsumeValueOr(0);
-  return std::make_unique<FileEnvelopeHolder>(fs_.get(), root_directory_,
-                                              oldest_file_name);
+  auto holder = TakeFinalizedFileLocked(
+      fields->finalized_files.find(oldest_file_name), &fields);
+  size_t envelope_size = holder->Size();
+
+  // Pack the other finalized files that fit, oldest first.
+  auto file = fields->finalized_files.begin();
+  while (file != fields->finalized_files.end() &&
+         envelope_size < max_bytes_per_envelope_) {
+    auto next_file = std::next(file);
+    if (envelope_size + file->second.envelope_size <= max_bytes_per_envelope_) {
+      envelope_size += file->second.envelope_size;
+      holder->MergeWith(TakeFinalizedFileLocked(file, &fields));
+    }
+    file = next_file;
+  }
+
+  // Then the active file, if it fits.
+  if (fields->active_file && fields->active_file->ByteCount() > 0 &&
+      envelope_size + fields->active_file->footer().envelope_bytes() <=
+          max_bytes_per_envelope_) {
+    std::string active_file_name;
+    if (FinalizeActiveFile(&fields, &active_file_name)) {
+      holder->MergeWith(TakeFinalizedFileLocked(
+          fields->finalized_files.find(active_file_name), &fields));
+    }
+  }
+  return std::move(holder);
+}
+
+std::unique_ptr<FileObservationStore::FileEnvelopeHolder>
+FileObservationStore::TakeFinalizedFileLocked(
+    std::map<std::string, FinalizedFile>::iterator file,
+    util::ProtectedFields<Fields>::LockedFieldsPtr *fields) {
+  auto &f = *fields;
+  auto holder = std::make_unique<FileEnvelopeHolder>(
+      fs_.get(), root_directory_, file->first, file->second.envelope_size);
+  f->finalized_bytes -= file->second.file_size;
+  RecordRemoved(file->second.usage, false);
+  f->files_taken.insert(*file);
+  f->finalized_files.erase(file);
+  return holder;
 }
 
 void FileObservationStore::ReturnEnvelopeHolder(
@@ -272,9 +492,17 @@ void FileObservationStore::ReturnEnvelopeHolder(
 
   auto fields = protected_fields_.lock();
   for (auto file_name : env->file_names()) {
-    fields->files_taken.erase(file_name);
-    fields->finalized_bytes +=
-        fs_->FileSize(FullPath(file_name)).ConsumeValueOr(0);
+    FinalizedFile finalized_file;
+    auto taken_file = fields->files_taken.find(file_name);
+    if (taken_file != fields->files_taken.end()) {
+      finalized_file = taken_file->second;
+      fields->files_taken.erase(taken_file);
+    } else {
+      finalized_file = ReadFinalizedFile(file_name);
+    }
+    fields->finalized_bytes += finalized_file.file_size;
+    RecordAdded(finalized_file.usage);
+    fields->finalized_files[file_name] = std::move(finalized_file);
   }
   env->clear();
 }
@@ -291,7 +519,27 @@ size_t FileObservationStore::Size() const {
 
 bool FileObservationStore::Empty() const { return Size() == 0; }
 
+double FileObservationStore::compression_ratio() const {
+  auto fields = protected_fields_.const_lock();
+  size_t uncompressed_bytes = fields->uncompressed_block_bytes;
+  size_t compressed_bytes = fields->compressed_block_bytes;
+  if (fields->active_file) {
+    uncompressed_bytes += fields->active_file->uncompressed_block_bytes();
+    compressed_bytes += fields->active_file->compressed_block_bytes();
+  }
+  if (compressed_bytes == 0) {
+    return 1.0;
+  }
+  return static_cast<double>(uncompressed_bytes) / compressed_bytes;
+}
+
 void FileObservationStore::Delete() {
+  {
+    auto fields = protected_fields_.lock();
+    fields->finalized_files.clear();
+    fields->files_taken.clear();
+    fields->finalized_bytes = 0;
+  }
   auto files = fs_->ListFiles(root_directory_).ConsumeValueOr({});
   for (auto file : files) {
     fs_->Delete(FullPath(file));
@@ -313,76 +561,181 @@ void FileObservationStore::FileEnvelopeHolder::MergeWith(
   file_names_.insert(file_container->file_names_.begin(),
                      file_container->file_names_.end());
 
-  file_container->file_names_.clear();
+  envelope_size_ += file_container->envelope_size_;
+  file_container->clear();
 
-  envelope_.Clear();
-  cached_file_size_ = 0;
-  envelope_read_ = false;
+  envelope_ = nullptr;
+  arena_.Reset();
 }
 
-const Envelope &FileObservationStore::FileEnvelopeHolder::GetEnvelope() {
-  if (envelope_read_) {
-    return envelope_;
+namespace {
+
+const uint32_t kWireTypeLengthDelimited = 2;
+
+void LogCorruptFile(const std::string &file_name) {
+  VLOG(1) << "WARNING: Trying to read from `" << file_name
+          << "` encountered a corrupted message. Returning the envelope that "
+             "has been read so far.";
+}
+
+void LogSkippedRecords(const std::string &file_name,
+                       const SegmentReader &reader) {
+  if (reader.num_skipped_records() > 0) {
+    VLOG(1) << "WARNING: Skipped " << reader.num_skipped_records()
+            << " corrupted records of `" << file_name << "`.";
   }
+}
 
-  std::string serialized_metadata;
-  std::unordered_map<std::string, ObservationBatch *> batch_map;
-  ObservationBatch *current_batch;
+// Records in |*batch_ids| that the ObservationMetadata of the metadata id
+// defined by |record| belongs to the batch |batch_id|.
+template <class BatchId>
+void SetBatchId(const SegmentRecord &record, BatchId batch_id,
+                std::vector<BatchId> *batch_ids) {
+  if (record.metadata_id >= batch_ids->size()) {
+    batch_ids->resize(record.metadata_id + 1);
+  }
+  (*batch_ids)[record.metadata_id] = batch_id;
+}
 
-  ObservationStoreRecord stored;
+}  // namespace
 
-  for (auto file_name : file_names_) {
-    std::ifstream ifs(FullPath(file_name), std::ifstream::in);
-    google::protobuf::io::IstreamInputStream iis(&ifs);
+const Envelope &FileObservationStore::FileEnvelopeHolder::GetEnvelope() {
+  if (envelope_ != nullptr) {
+    return *envelope_;
+  }
+  envelope_ = google::protobuf::Arena::CreateMessage<Envelope>(&arena_);
 
-    bool clean_eof;
-    while (google::protobuf::util::ParseDelimitedFromZeroCopyStream(
-        &stored, &iis, &clean_eof)) {
-      if (stored.has_meta_data()) {
-        std::unique_ptr<ObservationMetadata> current_metadata(
-            stored.release_meta_data());
-        current_metadata->SerializeToString(&serialized_metadata);
+  std::unordered_map<std::string, ObservationBatch *> batch_map;
 
+  for (auto file_name : file_names_) {
+    auto contents_or = fs_->MapFile(FullPath(file_name));
+    if (!contents_or.ok()) {
+      LOG(WARNING) << contents_or.status().error_message();
+      continue;
+    }
+    auto contents = contents_or.ConsumeValueOrDie();
+    SegmentReader reader(*contents);
+    SegmentRecord record;
+    // The batch of each metadata id of the file.
+    std::vector<ObservationBatch *> batches;
+    bool corrupt = false;
+    while (!corrupt && reader.Next(&record)) {
+      if (record.field_number == ObservationStoreRecord::kMetaDataFieldNumber) {
+        std::string serialized_metadata(record.payload, record.payload_size);
         auto iter = batch_map.find(serialized_metadata);
+        ObservationBatch *batch;
         if (iter != batch_map.end()) {
-          current_batch = iter->second;
+          batch = iter->second;
         } else {
-          current_batch = envelope_.add_batch();
-          current_batch->set_allocated_meta_data(current_metadata.release());
-          batch_map[serialized_metadata] = current_batch;
+          batch = envelope_->add_batch();
+          corrupt = !batch->mutable_meta_data()->ParseFromArray(
+              record.payload, record.payload_size);
+          batch_map[serialized_metadata] = batch;
         }
-      } else if (stored.has_encrypted_observation()) {
-        current_batch->add_encrypted_observation()->Swap(
-            stored.mutable_encrypted_observation());
+        SetBatchId(record, batch, &batches);
       } else {
-        clean_eof = false;
-        break;
+        corrupt = !batches[record.metadata_id]
+                       ->add_encrypted_observation()
+                       ->ParseFromArray(record.payload, record.payload_size);
       }
     }
 
-    if (!clean_eof) {
-      VLOG(1)
-          << "WARNING: Trying to read from `" << file_name
-          << "` encountered a corrupted message. Returning the envelope that "
-             "has been read so far.";
+    LogSkippedRecords(file_name, reader);
+    if (corrupt || reader.corrupt() || reader.version() == 0) {
+      LogCorruptFile(file_name);
       break;
     }
   }
 
-  envelope_read_ = true;
-  return envelope_;
+  return *envelope_;
 }
 
-size_t FileObservationStore::FileEnvelopeHolder::Size() {
-  if (cached_file_size_ > 0) {
-    return cached_file_size_;
+bool FileObservationStore::FileEnvelopeHolder::SerializeEnvelope(
+    std::string *serialized_envelope) {
+  if (envelope_ != nullptr) {
+    return envelope_->SerializeToString(serialized_envelope);
   }
 
-  cached_file_size_ = 0;
+  // The fields of an ObservationBatch, which point into the mapped files.
+  struct Batch {
+    SegmentRecord meta_data;
+    std::vector<SegmentRecord> encrypted_observations;
+    size_t size;
+  };
+  std::vector<Batch> batches;
+  std::unordered_map<std::string, size_t> batch_map;
+
+  // The files must remain mapped, and their readers, which hold the
+  // decompressed blocks of compressed files, must remain alive until the
+  // Envelope has been written.
+  std::vector<std::unique_ptr<util::FileContents>> mapped_files;
+  std::vector<std::unique_ptr<SegmentReader>> readers;
   for (auto file_name : file_names_) {
-    cached_file_size_ += fs_->FileSize(FullPath(file_name)).ConsumeValueOr(0);
+    auto contents_or = fs_->MapFile(FullPath(file_name));
+    if (!contents_or.ok()) {
+      LOG(WARNING) << contents_or.status().error_message();
+      continue;
+    }
+    mapped_files.push_back(contents_or.ConsumeValueOrDie());
+    readers.push_back(std::make_unique<SegmentReader>(*mapped_files.back()));
+    SegmentReader &reader = *readers.back();
+    SegmentRecord record;
+    // The index in |batches| of each metadata id of the file.
+    std::vector<size_t> batch_indices;
+    while (reader.Next(&record)) {
+      if (record.field_number == ObservationStoreRecord::kMetaDataFieldNumber) {
+        std::string serialized_metadata(record.payload, record.payload_size);
+        auto iter = batch_map.find(serialized_metadata);
+        size_t batch_index;
+        if (iter != batch_map.end()) {
+          batch_index = iter->second;
+        } else {
+          batch_index = batches.size();
+          batch_map[serialized_metadata] = batch_index;
+          batches.push_back({record, {}, record.field_size});
+        }
+        SetBatchId(record, batch_index, &batch_indices);
+      } else {
+        Batch &batch = batches[batch_indices[record.metadata_id]];
+        batch.encrypted_observations.push_back(record);
+        batch.size += record.field_size;
+      }
+    }
+
+    LogSkippedRecords(file_name, reader);
+    if (reader.corrupt() || reader.version() == 0) {
+      LogCorruptFile(file_name);
+      break;
+    }
   }
-  return cached_file_size_;
+
+  using google::protobuf::io::CodedOutputStream;
+  const uint32_t batch_tag =
+      (Envelope::kBatchFieldNumber << 3) | kWireTypeLengthDelimited;
+  size_t envelope_size = 0;
+  for (const auto &batch : batches) {
+    envelope_size += CodedOutputStream::VarintSize32(batch_tag) +
+                     CodedOutputStream::VarintSize32(batch.size) + batch.size;
+  }
+  serialized_envelope->resize(envelope_size);
+  auto *target = reinterpret_cast<uint8_t *>(&(*serialized_envelope)[0]);
+  auto append = [&target](const SegmentRecord &record) {
+    std::memcpy(target, record.field, record.field_size);
+    target += record.field_size;
+  };
+  for (const auto &batch : batches) {
+    target = CodedOutputStream::WriteVarint32ToArray(batch_tag, target);
+    target = CodedOutputStream::WriteVarint32ToArray(batch.size, target);
+    append(batch.meta_data);
+    for (const auto &encrypted_observation : batch.encrypted_observations) {
+      append(encrypted_observation);
+    }
+  }
+  return true;
+}
+
+size_t FileObservationStore::FileEnvelopeHolder::Size() {
+  return envelope_size_;
 }
 
 }  // namespace encoder
@@ -5,19 +5,26 @@
 #ifndef COBALT_ENCODER_FILE_OBSERVATION_STORE_H_
 #define COBALT_ENCODER_FILE_OBSERVATION_STORE_H_
 
+#include <condition_variable>
 #include <deque>
-#include <fstream>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <random>
 #include <set>
 #include <string>
+#include <thread>
 #include <unordered_map>
 #include <vector>
 
+#include <google/protobuf/arena.h>
+
 #include "encoder/envelope_maker.h"
+#include "encoder/observation_segment.h"
 #include "encoder/observation_store.h"
 #include "third_party/protobuf/src/google/protobuf/io/zero_copy_stream_impl.h"
 #include "third_party/tensorflow_statusor/statusor.h"
+#include "util/buffered_file_writer.h"
 #include "util/file_system.h"
 #include "util/protected_fields.h"
 
@@ -27,7 +34,56 @@ namespace encoder {
 // FileObservationStore is an implementation of ObservationStore that persists
 // observations to a file system.
 //
+// Each file is a segment, in the format described in observation_segment.h.
+// The store writes version 2 segments, or version 3 segments if its
+// CompressionPolicy compresses them, and reads all versions. When a file is
+// finalized its footer records the size of the Envelope that it holds and
+// the usage of each metric of its Observations, so that a new instance of the
+// store catalogs the files it finds by reading their footers alone.
+//
+// With compression, the size of the store, and so Size(), IsAlmostFull() and
+// the check for kStoreFull, counts the blocks written to the files at their
+// compressed size (the pending block of the active file is counted
+// uncompressed), while files are still finalized once they hold
+// |max_bytes_per_envelope| bytes of uncompressed Observations. Compression is
+// most effective on the repeated parts of the records, such as the
+// EncryptedMessage framing and public key fingerprints, since the ciphertexts
+// themselves are not compressible.
+//
+// The store keeps an in-memory catalog of its finalized files, together with
+// their sizes and the sizes of their Envelopes. The catalog is built by listing
+// the root directory once, in the constructor, and is then kept up to date as
+// files are finalized, taken and returned, so that TakeNextEnvelopeHolder()
+// does not need to list the directory. As a consequence, finalized files that
+// are placed in the root directory by anything other than the store are only
+// noticed by the next instance of the store.
+//
+// Observations are appended to the active file through a
+// util::BufferedFileWriter, so that most of them do not cost a system call.
+// The store's DurabilityPolicy determines how many of them may be lost if the
+// device loses power:
+//   - kNoSync: everything written since the operating system last wrote the
+//     file back on its own.
+//   - kSyncEveryN: at most |sync_every_records| Observations or
+//     |sync_every_bytes| bytes.
+//   - kGroupCommit: at most |group_commit_interval| worth of Observations. The
+//     store runs a background thread that commits the active file at that
+//     interval.
+// In all cases the active file is committed when it is finalized, unless the
+// policy is kNoSync. With compression, Observations only reach the file a
+// block at a time, so up to one block of them may additionally be lost. The
+// group commit thread writes out the pending block before committing.
+//
 // The store returns FileEnvelopeHolders from calls to TakeNextEnvelopeHolder().
+// Each one packs as many files as fit in |max_bytes_per_envelope|, by the
+// sizes of their Envelopes: the oldest finalized file, then the other
+// finalized files, oldest first, that fit in the remaining space, and then the
+// active file if it is not empty and also fits, in which case it is finalized.
+// This way, the small files that are finalized whenever the store is emptied,
+// and that accumulate while uploads fail, are sent together rather than one
+// per request. The active file is otherwise only finalized when there is no
+// finalized file to take.
+//
 // As long as there are FileEnvelopeHolders that have not been returned or
 // deleted, the store should not be destroyed.
 //
@@ -38,7 +94,10 @@ class FileObservationStore : public ObservationStore {
   // ObservationStore::EnvelopeHolder.
   //
   // It represents the envelope as a list of filenames. The observations are not
-  // actually read into memory until a call to GetEnvelope() is made.
+  // actually read into memory until a call to GetEnvelope() is made. The files
+  // are mapped into memory and parsed in place, and the Envelope is allocated
+  // in an Arena. SerializeEnvelope() copies the records of the files directly
+  // into the serialized Envelope, without parsing them.
   //
   // Note: This object is not thread safe.
   class FileEnvelopeHolder : public EnvelopeHolder {
@@ -50,20 +109,27 @@ class FileObservationStore : public ObservationStore {
     // observation files are written. (e.g. /system/data/cobalt_legacy)
     //
     // |file_name|. The file name for the file containing the observations.
+    //
+    // |envelope_size|. The size of the serialized Envelope that the file
+    // holds, as recorded in its footer.
     FileEnvelopeHolder(util::FileSystem *fs, const std::string &root_directory,
-                       const std::string &file_name)
+                       const std::string &file_name, size_t envelope_size)
         : fs_(fs),
           root_directory_(root_directory),
           file_names_({file_name}),
-          envelope_read_(false) {}
+          envelope_size_(envelope_size) {}
 
     ~FileEnvelopeHolder();
 
     void MergeWith(std::unique_ptr<EnvelopeHolder> container) override;
     const Envelope &GetEnvelope() override;
+    bool SerializeEnvelope(std::string *serialized_envelope) override;
     size_t Size() override;
     const std::set<std::string> &file_names() { return file_names_; }
-    void clear() { file_names_.clear(); }
+    void clear() {
+      file_names_.clear();
+      envelope_size_ = 0;
+    }
 
    private:
     std::string FullPath(const std::string &filename) const;
@@ -75,9 +141,13 @@ class FileObservationStore : public ObservationStore {
     // These files should all be read into |envelope| when GetEnvelope is
     // called.
     std::set<std::string> file_names_;
-    bool envelope_read_;
-    Envelope envelope_;
-    size_t cached_file_size_;
+    // The sum of the Envelope sizes of the files, which is returned by Size()
+    // without reading them.
+    size_t envelope_size_;
+    // The Envelope read by GetEnvelope(), allocated in |arena_|, or nullptr if
+    // it has not been read.
+    google::protobuf::Arena arena_;
+    Envelope *envelope_ = nullptr;
   };
 
   // |fs|. An implementation of FileSystem used to interact with the system's
@@ -85,51 +155,95 @@ class FileObservationStore : public ObservationStore {
   //
   // |root_directory|. The absolute path to the directory where the observation
   // files should be written. (e.g. /system/data/cobalt_legacy)
-  FileObservationStore(size_t max_bytes_per_observation,
-                       size_t max_bytes_per_envelope, size_t max_bytes_total,
-                       std::unique_ptr<util::FileSystem> fs,
-                       const std::string &root_directory);
+  //
+  // |durability_policy|. Determines when the active file is committed to
+  // durable storage. See the class comment.
+  //
+  // |compression_policy|. Determines whether the files are compressed.
+  FileObservationStore(
+      size_t max_bytes_per_observation, size_t max_bytes_per_envelope,
+      size_t max_bytes_total, std::unique_ptr<util::FileSystem> fs,
+      const std::string &root_directory,
+      util::DurabilityPolicy durability_policy = util::DurabilityPolicy(),
+      CompressionPolicy compression_policy = CompressionPolicy());
+
+  // Stops the group commit thread, if there is one, and closes the active
+  // file.
+  ~FileObservationStore();
 
   StoreStatus AddEncryptedObservation(
       std::unique_ptr<EncryptedMessage> message,
       std::unique_ptr<ObservationMetadata> metadata) override;
+  StoreStatus AddEncryptedObservations(
+      std::vector<EncryptedObservation> observations,
+      size_t* num_added) override;
+  StoreStatus AddEncryptedObservationByHandle(
+      std::unique_ptr<EncryptedMessage> message,
+      MetadataHandle metadata) override;
   std::unique_ptr<EnvelopeHolder> TakeNextEnvelopeHolder() override;
   void ReturnEnvelopeHolder(std::unique_ptr<EnvelopeHolder> envelopes) override;
 
   size_t Size() const override;
   bool Empty() const override;
 
+  // The ratio of the size of the blocks compressed by this instance of the
+  // store to their compressed size, or 1 if it has not compressed any. This
+  // diagnostic stat is mostly useful for tuning the CompressionPolicy.
+  double compression_ratio() const;
+
   // Delete removes all of the files associated with this FileObservationStore.
   // This is useful for cleaning up after testing.
   void Delete();
 
   // ListFinalizedFiles lists all files in root directory that match the format
   // <13-digit timestamp>-<7 digit random number>.data
+  //
+  // This lists the directory. It is not used by the store itself, which
+  // consults its catalog instead.
   std::vector<std::string> ListFinalizedFiles() const;
 
  private:
+  // An entry of the catalog of finalized files.
+  struct FinalizedFile {
+    // The size of the file.
+    size_t file_size;
+    // The size of the Envelope that the file holds. For a file without a
+    // footer, the size of the file is used instead.
+    size_t envelope_size;
+    // The Observations that the file holds.
+    Usage usage;
+  };
+
   struct Fields {
-    bool metadata_written;
-    // last_written_metadata is a string encoding of the last metadata written
-    // to the active_file. If another observation comes in with an identical
-    // metadata, it is not necessary to write it again.
-    std::string last_written_metadata;
-    std::ofstream active_fstream;
-    std::unique_ptr<google::protobuf::io::OstreamOutputStream> active_file;
-    // files_taken lists the filenames that have been "Taken" from the store.
-    // These should not be used to construct EnvelopeHolders for
-    // TakeNextEnvelopeHolder(). If an EnvelopeHolder is returned, the
-    // associated file names should also be removed from this list.
-    std::set<std::string> files_taken;
+    // The active file, or nullptr if no Observation has been added since the
+    // last one was finalized. Its segment writer keeps the dictionary of the
+    // ObservationMetadata already written to the file.
+    std::unique_ptr<SegmentWriter> active_file;
+    // The Observations that have been written to the active file.
+    Usage active_file_usage;
+    // The catalog of the finalized files that have not been "Taken" from the
+    // store, mapping each file name to its FinalizedFile. The file names
+    // begin with the 13-digit timestamp at which they were finalized, so the
+    // order of the map is the order in which the files were finalized and
+    // the first entry is the oldest file.
+    std::map<std::string, FinalizedFile> finalized_files;
+    // files_taken maps the file names that have been "Taken" from the store to
+    // their FinalizedFiles. If an EnvelopeHolder is returned, the associated
+    // files are moved back into |finalized_files|.
+    std::map<std::string, FinalizedFile> files_taken;
     // The total size in bytes of the finalized files. This should be kept up to
     // date as files are added to/removed from the store.
     size_t finalized_bytes;
+    // The total sizes of the blocks of the finalized files, before and after
+    // they were compressed. See compression_ratio().
+    size_t uncompressed_block_bytes = 0;
+    size_t compressed_block_bytes = 0;
   };
 
   util::ProtectedFields<Fields> protected_fields_;
 
   // GetOldestFinalizedFile returns a file name for the oldest file in the
-  // store.
+  // store that has not been taken.
   tensorflow_statusor::StatusOr<std::string> GetOldestFinalizedFile(
       util::ProtectedFields<Fields>::LockedFieldsPtr *fields);
 
@@ -142,19 +256,72 @@ class FileObservationStore : public ObservationStore {
   // name with the root directory.
   std::string FullPath(const std::string &filename) const;
 
+  // FinalizeActiveFile finalizes the active file and adds it to the catalog.
+  // If |finalized_name| is not null, it is set to the name of the finalized
+  // file.
   bool FinalizeActiveFile(
+      util::ProtectedFields<Fields>::LockedFieldsPtr *fields,
+      std::string *finalized_name = nullptr);
+
+  // TakeFinalizedFileLocked moves |file| from the catalog of finalized files
+  // to |files_taken| and returns a FileEnvelopeHolder that holds it.
+  std::unique_ptr<FileEnvelopeHolder> TakeFinalizedFileLocked(
+      std::map<std::string, FinalizedFile>::iterator file,
+      util::ProtectedFields<Fields>::LockedFieldsPtr *fields);
+
+  // ReadFinalizedFile returns the catalog entry of a finalized file that the
+  // store did not write during its lifetime. The Observations of the file are
+  // counted from the usage recorded in its footer. Only the records of a file
+  // without a footer, or whose footer predates the usage, are read.
+  FinalizedFile ReadFinalizedFile(const std::string &file_name) const;
+
+  // Returns the MetricUsages that record |usage| in a SegmentFooter.
+  static MetricUsages ToMetricUsages(const Usage &usage);
+
+  // Returns the Usage recorded in a SegmentFooter as |metric_usages|.
+  static Usage FromMetricUsages(const MetricUsages &metric_usages);
+
+  // AddEncryptedObservationLocked implements AddEncryptedObservation() for a
+  // caller that already holds the lock on |fields|. |serialized_metadata| is
+  // the serialization of |metadata|, and |handle| is the MetadataHandle of the
+  // metadata, or kNoMetadataHandle if it was not registered.
+  StoreStatus AddEncryptedObservationLocked(
+      const EncryptedMessage &message, const ObservationMetadata &metadata,
+      const std::string &serialized_metadata, MetadataHandle handle,
+      util::ProtectedFields<Fields>::LockedFieldsPtr *fields);
+
+  // EvictLowerPriorityLocked deletes the oldest finalized files whose
+  // Observations all have a lower priority than |priority| until the store
+  // has room for |num_bytes| more bytes, or there are no more such files.
+  // Returns true if the store has room for |num_bytes| more bytes.
+  bool EvictLowerPriorityLocked(
+      Priority priority, size_t num_bytes,
       util::ProtectedFields<Fields>::LockedFieldsPtr *fields);
 
-  // GetActiveFile returns a pointer to the current OstreamOutputStream. If the
-  // file is not yet opened, it will be opened by this function.
-  google::protobuf::io::OstreamOutputStream *GetActiveFile(
+  // GetActiveFile returns a pointer to the writer of the active file. If the
+  // file is not yet opened, it will be opened, and its header written, by this
+  // function. Returns nullptr if the file could not be opened.
+  SegmentWriter *GetActiveFile(
       util::ProtectedFields<Fields>::LockedFieldsPtr *fields);
 
+  // The main method of |group_commit_thread_|. Commits the active file every
+  // |durability_policy_.group_commit_interval| until |shut_down_| is set.
+  void RunGroupCommit();
+
   const std::unique_ptr<util::FileSystem> fs_;
   const std::string root_directory_;
   const std::string active_file_name_;
   mutable std::random_device random_dev_;
   mutable std::uniform_int_distribution<uint32_t> random_int_;
+  const util::DurabilityPolicy durability_policy_;
+  const CompressionPolicy compression_policy_;
+
+  // Used to stop |group_commit_thread_|, which only runs with the
+  // kGroupCommit policy.
+  std::mutex group_commit_mutex_;
+  std::condition_variable group_commit_notifier_;
+  bool shut_down_ = false;
+  std::thread group_commit_thread_;
 };
 
 }  // namespace encoder
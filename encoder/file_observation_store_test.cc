@@ -2,8 +2,12 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#include <algorithm>
+#include <fstream>
 #include <random>
+#include <thread>
 #include <utility>
+#include <vector>
 
 #include "./gtest.h"
 #include "./logging.h"
@@ -11,6 +15,7 @@
 #include "encoder/encoder.h"
 #include "encoder/fake_system_data.h"
 #include "encoder/file_observation_store.h"
+#include "third_party/protobuf/src/google/protobuf/util/delimited_message_util.h"
 #include "util/posix_file_system.h"
 // Generated from file_observation_store_test_config.yaml
 #include "encoder/file_observation_store_test_config.h"
@@ -19,6 +24,7 @@ namespace cobalt {
 namespace encoder {
 
 using config::ClientConfig;
+using util::DurabilityPolicy;
 using util::EncryptedMessageMaker;
 using util::PosixFileSystem;
 
@@ -29,11 +35,12 @@ namespace {
 // cobalt_config_header("generate_shipping_manager_test_config") in BUILD.gn.
 const uint32_t kCustomerId = 1;
 const uint32_t kProjectId = 1;
+const ObservationStore::ProjectKey kProject(kCustomerId, kProjectId);
 
 const size_t kNoOpEncodingByteOverhead = 34;
 const size_t kMaxBytesPerObservation = 100;
 const size_t kMaxBytesPerEnvelope = 400;
-const size_t kMaxBytesTotal = 1000;
+const size_t kMaxBytesTotal = 10000;
 
 const std::string &test_dir_base = "/tmp/fos_test";
 
@@ -73,15 +80,31 @@ class FileObservationStoreTest : public ::testing::Test {
     MakeStore();
   }
 
-  void MakeStore() {
+  void MakeStore(DurabilityPolicy durability_policy = DurabilityPolicy(),
+                 CompressionPolicy compression_policy = CompressionPolicy()) {
     store_.reset(new FileObservationStore(
         kMaxBytesPerObservation, kMaxBytesPerEnvelope, kMaxBytesTotal,
-        std::make_unique<PosixFileSystem>(), test_dir_name_));
+        std::make_unique<PosixFileSystem>(), test_dir_name_,
+        durability_policy, compression_policy));
+  }
+
+  // Returns the number of bytes of the active file that are on the file
+  // system.
+  size_t ActiveFileSize() {
+    return PosixFileSystem()
+        .FileSize(test_dir_name_ + "/in_progress.data")
+        .ConsumeValueOr(0);
   }
 
   void TearDown() override { store_->Delete(); }
 
-  ObservationStore::StoreStatus AddObservation(
+  // An encrypted Observation together with its metadata.
+  struct ObservationAndMetadata {
+    std::unique_ptr<EncryptedMessage> message;
+    std::unique_ptr<ObservationMetadata> metadata;
+  };
+
+  ObservationAndMetadata MakeObservation(
       size_t num_bytes, uint32_t metric_id = kDefaultMetricId) {
     CHECK(num_bytes > kNoOpEncodingByteOverhead) << " num_bytes=" << num_bytes;
     Encoder::Result result = encoder_.EncodeString(
@@ -89,8 +112,23 @@ class FileObservationStoreTest : public ::testing::Test {
         std::string("x", num_bytes - kNoOpEncodingByteOverhead));
     auto message = std::make_unique<EncryptedMessage>();
     encrypt_to_analyzer_.Encrypt(*result.observation, message.get());
-    return store_->AddEncryptedObservation(std::move(message),
-                                           std::move(result.metadata));
+    return {std::move(message), std::move(result.metadata)};
+  }
+
+  // Returns an encrypted Observation together with the handle of its metadata
+  // in |store_|.
+  ObservationStore::EncryptedObservation MakeObservationByHandle(
+      size_t num_bytes) {
+    auto observation = MakeObservation(num_bytes);
+    return {std::move(observation.message),
+            store_->RegisterMetadata(*observation.metadata)};
+  }
+
+  ObservationStore::StoreStatus AddObservation(
+      size_t num_bytes, uint32_t metric_id = kDefaultMetricId) {
+    auto observation = MakeObservation(num_bytes, metric_id);
+    return store_->AddEncryptedObservation(std::move(observation.message),
+                                           std::move(observation.metadata));
   }
 
  private:
@@ -126,6 +164,44 @@ TEST_F(FileObservationStoreTest, AddRetrieveFullEnvelope) {
   EXPECT_EQ(read_env.batch(0).encrypted_observation_size(), 4);
 }
 
+TEST_F(FileObservationStoreTest, AddObservationsBatch) {
+  std::vector<ObservationStore::EncryptedObservation> observations;
+  for (int i = 0; i < 4; i++) {
+    observations.push_back(MakeObservationByHandle(100));
+  }
+  size_t num_added = 0;
+  EXPECT_EQ(ObservationStore::kOk,
+            store_->AddEncryptedObservations(std::move(observations),
+                                             &num_added));
+  EXPECT_EQ(4u, num_added);
+
+  auto envelope = store_->TakeNextEnvelopeHolder();
+  ASSERT_NE(envelope, nullptr);
+  auto read_env = envelope->GetEnvelope();
+  EXPECT_EQ(read_env.batch_size(), 1);
+  EXPECT_EQ(read_env.batch(0).encrypted_observation_size(), 4);
+}
+
+TEST_F(FileObservationStoreTest, AddObservationsBatchWithFailure) {
+  std::vector<ObservationStore::EncryptedObservation> observations;
+  observations.push_back(MakeObservationByHandle(50));
+  observations.push_back(MakeObservationByHandle(2 * kMaxBytesPerObservation));
+  observations.push_back(MakeObservationByHandle(50));
+  observations.push_back(
+      {std::make_unique<EncryptedMessage>(), kNoMetadataHandle});
+  size_t num_added = 0;
+  EXPECT_EQ(ObservationStore::kObservationTooBig,
+            store_->AddEncryptedObservations(std::move(observations),
+                                             &num_added));
+  EXPECT_EQ(2u, num_added);
+
+  auto envelope = store_->TakeNextEnvelopeHolder();
+  ASSERT_NE(envelope, nullptr);
+  auto read_env = envelope->GetEnvelope();
+  EXPECT_EQ(read_env.batch_size(), 1);
+  EXPECT_EQ(read_env.batch(0).encrypted_observation_size(), 2);
+}
+
 TEST_F(FileObservationStoreTest, AddRetrieveMultipleFullEnvelopes) {
   for (int i = 0; i < 5 * 4; i++) {
     EXPECT_EQ(ObservationStore::kOk, AddObservation(100));
@@ -190,16 +266,21 @@ TEST_F(FileObservationStoreTest, RecoverAfterCrash) {
   EXPECT_EQ(store_->ListFinalizedFiles().size(), 1u);
 }
 
+// The store only catalogs the files in its directory when it is constructed,
+// so the tests below that place files in the directory recreate the store.
 TEST_F(FileObservationStoreTest, IgnoresUnexpectedFiles) {
   { std::ofstream dummy(test_dir_name_ + "/BAD_FILE"); }
+  MakeStore();
   EXPECT_EQ(store_->ListFinalizedFiles().size(), 0u);
   EXPECT_EQ(store_->TakeNextEnvelopeHolder(), nullptr);
 
   { std::ofstream empty_invalid(test_dir_name_ + "/10000000-100000.data"); }
+  MakeStore();
   EXPECT_EQ(store_->ListFinalizedFiles().size(), 0u);
   EXPECT_EQ(store_->TakeNextEnvelopeHolder(), nullptr);
 
   { std::ofstream empty_valid(test_dir_name_ + "/1234567890123-1234567.data"); }
+  MakeStore();
   EXPECT_EQ(store_->ListFinalizedFiles().size(), 1u);
   EXPECT_NE(store_->TakeNextEnvelopeHolder(), nullptr);
 }
@@ -209,14 +290,439 @@ TEST_F(FileObservationStoreTest, HandlesCorruptFiles) {
     std::ofstream file(test_dir_name_ + "/1234567890123-1234567.data");
     file << "CORRUPT DATA!!!";
   }
+  MakeStore();
   EXPECT_EQ(store_->ListFinalizedFiles().size(), 1u);
   auto env = store_->TakeNextEnvelopeHolder();
   ASSERT_NE(env, nullptr);
 
+  std::string serialized_envelope;
+  ASSERT_TRUE(env->SerializeEnvelope(&serialized_envelope));
+  EXPECT_TRUE(serialized_envelope.empty());
   auto read_env = env->GetEnvelope();
   EXPECT_EQ(read_env.batch_size(), 0);
 }
 
+// Tests that SerializeEnvelope() produces the serialization of the Envelope
+// returned by GetEnvelope(), for Observations with several metadata spread
+// over several files.
+TEST_F(FileObservationStoreTest, SerializeEnvelope) {
+  for (int i = 0; i < 3 * 4; i++) {
+    auto observation = MakeObservation(100);
+    observation.metadata->set_day_index(i % 3);
+    ASSERT_EQ(ObservationStore::kOk,
+              store_->AddEncryptedObservation(std::move(observation.message),
+                                              std::move(observation.metadata)));
+  }
+  EXPECT_EQ(3u, store_->ListFinalizedFiles().size());
+  auto envelope = store_->TakeNextEnvelopeHolder();
+  ASSERT_NE(envelope, nullptr);
+  while (auto next = store_->TakeNextEnvelopeHolder()) {
+    envelope->MergeWith(std::move(next));
+  }
+
+  std::string streamed_envelope;
+  ASSERT_TRUE(envelope->SerializeEnvelope(&streamed_envelope));
+  const Envelope &read_env = envelope->GetEnvelope();
+  ASSERT_EQ(read_env.batch_size(), 3);
+  for (const auto &batch : read_env.batch()) {
+    EXPECT_EQ(batch.encrypted_observation_size(), 4);
+  }
+  EXPECT_EQ(read_env.SerializeAsString(), streamed_envelope);
+
+  std::string serialized_envelope;
+  ASSERT_TRUE(envelope->SerializeEnvelope(&serialized_envelope));
+  EXPECT_EQ(streamed_envelope, serialized_envelope);
+}
+
+// Tests that the size of an EnvelopeHolder is the size of the Envelope that it
+// holds, as recorded in the footers of its files, including for the files
+// found at startup.
+TEST_F(FileObservationStoreTest, EnvelopeHolderSize) {
+  for (int i = 0; i < 2 * 4; i++) {
+    auto observation = MakeObservation(100);
+    observation.metadata->set_day_index(i / 4);
+    ASSERT_EQ(ObservationStore::kOk,
+              store_->AddEncryptedObservation(std::move(observation.message),
+                                              std::move(observation.metadata)));
+  }
+  auto envelope = store_->TakeNextEnvelopeHolder();
+  ASSERT_NE(envelope, nullptr);
+  EXPECT_EQ(envelope->GetEnvelope().ByteSizeLong(), envelope->Size());
+  store_->ReturnEnvelopeHolder(std::move(envelope));
+
+  MakeStore();
+  envelope = store_->TakeNextEnvelopeHolder();
+  ASSERT_NE(envelope, nullptr);
+  auto second_envelope = store_->TakeNextEnvelopeHolder();
+  ASSERT_NE(second_envelope, nullptr);
+  envelope->MergeWith(std::move(second_envelope));
+  // The files have different metadata, so their batches are not merged.
+  EXPECT_EQ(envelope->GetEnvelope().batch_size(), 2);
+  EXPECT_EQ(envelope->GetEnvelope().ByteSizeLong(), envelope->Size());
+}
+
+// Tests that the files written in the format that preceded segment headers
+// can still be read.
+TEST_F(FileObservationStoreTest, ReadsVersion1Files) {
+  auto observation = MakeObservation(100);
+  {
+    std::ofstream file(test_dir_name_ + "/1234567890123-1234567.data",
+                       std::ios::binary);
+    ObservationStoreRecord record;
+    *record.mutable_meta_data() = *observation.metadata;
+    ASSERT_TRUE(
+        google::protobuf::util::SerializeDelimitedToOstream(record, &file));
+    for (int i = 0; i < 2; i++) {
+      record.Clear();
+      *record.mutable_encrypted_observation() = *observation.message;
+      ASSERT_TRUE(
+          google::protobuf::util::SerializeDelimitedToOstream(record, &file));
+    }
+  }
+  MakeStore();
+  auto envelope = store_->TakeNextEnvelopeHolder();
+  ASSERT_NE(envelope, nullptr);
+
+  std::string serialized_envelope;
+  ASSERT_TRUE(envelope->SerializeEnvelope(&serialized_envelope));
+  const Envelope &read_env = envelope->GetEnvelope();
+  ASSERT_EQ(read_env.batch_size(), 1);
+  EXPECT_EQ(read_env.batch(0).encrypted_observation_size(), 2);
+  EXPECT_EQ(read_env.SerializeAsString(), serialized_envelope);
+}
+
+// Tests that a corrupt record is skipped, and the rest of the file is read.
+TEST_F(FileObservationStoreTest, SkipsCorruptRecords) {
+  for (int i = 0; i < 4; i++) {
+    EXPECT_EQ(ObservationStore::kOk, AddObservation(100));
+  }
+  auto files = store_->ListFinalizedFiles();
+  ASSERT_EQ(files.size(), 1u);
+  std::string file_name = test_dir_name_ + "/" + files[0];
+
+  // Flip the last byte of the second Observation.
+  size_t offset;
+  {
+    auto contents = PosixFileSystem().MapFile(file_name).ConsumeValueOrDie();
+    SegmentReader reader(*contents);
+    SegmentRecord record;
+    int num_observations = 0;
+    while (num_observations < 2 && reader.Next(&record)) {
+      if (record.field_number ==
+          ObservationStoreRecord::kEncryptedObservationFieldNumber) {
+        num_observations++;
+      }
+    }
+    ASSERT_EQ(num_observations, 2);
+    offset = record.payload + record.payload_size - 1 - contents->data();
+  }
+  {
+    std::fstream file(file_name,
+                      std::ios::in | std::ios::out | std::ios::binary);
+    file.seekg(offset);
+    char byte = file.get();
+    file.seekp(offset);
+    file.put(~byte);
+  }
+
+  auto envelope = store_->TakeNextEnvelopeHolder();
+  ASSERT_NE(envelope, nullptr);
+  std::string serialized_envelope;
+  ASSERT_TRUE(envelope->SerializeEnvelope(&serialized_envelope));
+  const Envelope &read_env = envelope->GetEnvelope();
+  ASSERT_EQ(read_env.batch_size(), 1);
+  EXPECT_EQ(read_env.batch(0).encrypted_observation_size(), 3);
+  EXPECT_EQ(read_env.SerializeAsString(), serialized_envelope);
+}
+
+// Tests that compressed files are finalized when they hold a full Envelope,
+// that the size of the store counts their compressed size, and that they are
+// read back, including by a store that does not compress its files.
+TEST_F(FileObservationStoreTest, Compression) {
+  CompressionPolicy compression_policy;
+  compression_policy.mode = CompressionPolicy::kZlib;
+  MakeStore(DurabilityPolicy(), compression_policy);
+  EXPECT_EQ(1.0, store_->compression_ratio());
+  for (int i = 0; i < 2 * 4; i++) {
+    auto observation = MakeObservation(100);
+    observation.message->set_public_key_fingerprint(std::string(32, 'f'));
+    ASSERT_EQ(ObservationStore::kOk,
+              store_->AddEncryptedObservation(std::move(observation.message),
+                                              std::move(observation.metadata)));
+  }
+  auto files = store_->ListFinalizedFiles();
+  ASSERT_EQ(files.size(), 2u);
+  EXPECT_GT(store_->compression_ratio(), 1.0);
+  size_t file_sizes = 0;
+  for (const auto &file : files) {
+    file_sizes += PosixFileSystem()
+                      .FileSize(test_dir_name_ + "/" + file)
+                      .ConsumeValueOr(0);
+  }
+  EXPECT_EQ(file_sizes, store_->Size());
+
+  MakeStore();
+  size_t envelope_sizes = 0;
+  while (auto envelope = store_->TakeNextEnvelopeHolder()) {
+    std::string serialized_envelope;
+    ASSERT_TRUE(envelope->SerializeEnvelope(&serialized_envelope));
+    const Envelope &read_env = envelope->GetEnvelope();
+    ASSERT_EQ(read_env.batch_size(), 1);
+    EXPECT_EQ(read_env.batch(0).encrypted_observation_size(), 4);
+    EXPECT_EQ(read_env.SerializeAsString(), serialized_envelope);
+    EXPECT_EQ(read_env.ByteSizeLong(), envelope->Size());
+    envelope_sizes += envelope->Size();
+  }
+  EXPECT_GT(envelope_sizes, file_sizes);
+}
+
+// Tests that Observations added by MetadataHandle are written with their
+// registered metadata, into the same ObservationBatch as the Observations
+// added with equal metadata.
+TEST_F(FileObservationStoreTest, AddByHandle) {
+  auto observation = MakeObservation(50);
+  auto handle = store_->RegisterMetadata(*observation.metadata);
+  EXPECT_EQ(handle, store_->RegisterMetadata(*observation.metadata));
+  ObservationMetadata other_metadata = *observation.metadata;
+  other_metadata.set_day_index(other_metadata.day_index() + 1);
+  auto other_handle = store_->RegisterMetadata(other_metadata);
+  EXPECT_NE(handle, other_handle);
+
+  EXPECT_EQ(ObservationStore::kOk,
+            store_->AddEncryptedObservationByHandle(
+                std::move(observation.message), handle));
+  EXPECT_EQ(ObservationStore::kOk, AddObservation(50));
+  EXPECT_EQ(ObservationStore::kOk,
+            store_->AddEncryptedObservationByHandle(
+                std::move(MakeObservation(50).message), handle));
+  EXPECT_EQ(ObservationStore::kOk,
+            store_->AddEncryptedObservationByHandle(
+                std::move(MakeObservation(50).message), other_handle));
+  EXPECT_EQ(ObservationStore::kWriteFailed,
+            store_->AddEncryptedObservationByHandle(
+                std::move(MakeObservation(50).message), other_handle + 1));
+
+  auto envelope = store_->TakeNextEnvelopeHolder();
+  ASSERT_NE(envelope, nullptr);
+  EXPECT_EQ(store_->TakeNextEnvelopeHolder(), nullptr);
+  const Envelope &read_env = envelope->GetEnvelope();
+  ASSERT_EQ(read_env.batch_size(), 2);
+  EXPECT_EQ(read_env.batch(0).encrypted_observation_size(), 3);
+  EXPECT_EQ(read_env.batch(1).meta_data().SerializeAsString(),
+            other_metadata.SerializeAsString());
+  EXPECT_EQ(read_env.batch(1).encrypted_observation_size(), 1);
+}
+
+// Tests that the finalized files found in the directory at startup are taken
+// oldest first, with their sizes accounted for, and that a returned file is
+// taken again before any newer one. The files are too large for two of them
+// to be packed into one EnvelopeHolder.
+TEST_F(FileObservationStoreTest, TakesOldestFileFirst) {
+  const std::vector<std::string> file_names = {
+      "1500000000002-1000000.data", "1500000000000-9999999.data",
+      "1500000000001-5555555.data"};
+  const size_t kFileSize = 300;
+  for (const auto &file_name : file_names) {
+    std::ofstream file(test_dir_name_ + "/" + file_name);
+    file << std::string(kFileSize, '0');
+  }
+  MakeStore();
+  EXPECT_EQ(3 * kFileSize, store_->Size());
+
+  auto TakeFileName = [this]() -> std::string {
+    auto holder = store_->TakeNextEnvelopeHolder();
+    if (holder == nullptr) {
+      return "";
+    }
+    auto *file_holder =
+        static_cast<FileObservationStore::FileEnvelopeHolder *>(holder.get());
+    std::string file_name = *file_holder->file_names().begin();
+    store_->ReturnEnvelopeHolder(std::move(holder));
+    return file_name;
+  };
+  EXPECT_EQ(file_names[1], TakeFileName());
+  EXPECT_EQ(file_names[1], TakeFileName());
+  EXPECT_EQ(3 * kFileSize, store_->Size());
+
+  auto oldest = store_->TakeNextEnvelopeHolder();
+  EXPECT_EQ(2 * kFileSize, store_->Size());
+  auto second = store_->TakeNextEnvelopeHolder();
+  auto *second_holder =
+      static_cast<FileObservationStore::FileEnvelopeHolder *>(second.get());
+  EXPECT_EQ(file_names[2], *second_holder->file_names().begin());
+  store_->ReturnEnvelopeHolder(std::move(second));
+  EXPECT_EQ(file_names[2], TakeFileName());
+  oldest = nullptr;
+  EXPECT_EQ(2 * kFileSize, store_->Size());
+}
+
+// Tests that the small files that are finalized whenever the store is emptied
+// are packed into one EnvelopeHolder, together with the active file.
+TEST_F(FileObservationStoreTest, PacksSmallFiles) {
+  std::vector<std::unique_ptr<ObservationStore::EnvelopeHolder>> holders;
+  for (int i = 0; i < 3; i++) {
+    EXPECT_EQ(ObservationStore::kOk, AddObservation(50));
+    holders.push_back(store_->TakeNextEnvelopeHolder());
+    ASSERT_NE(holders.back(), nullptr);
+  }
+  for (auto &holder : holders) {
+    store_->ReturnEnvelopeHolder(std::move(holder));
+  }
+  EXPECT_EQ(3u, store_->ListFinalizedFiles().size());
+  EXPECT_EQ(ObservationStore::kOk, AddObservation(50));
+
+  auto envelope = store_->TakeNextEnvelopeHolder();
+  ASSERT_NE(envelope, nullptr);
+  EXPECT_EQ(4u, static_cast<FileObservationStore::FileEnvelopeHolder *>(
+                    envelope.get())
+                    ->file_names()
+                    .size());
+  EXPECT_LE(envelope->Size(), kMaxBytesPerEnvelope);
+  const Envelope &read_env = envelope->GetEnvelope();
+  ASSERT_EQ(read_env.batch_size(), 1);
+  EXPECT_EQ(read_env.batch(0).encrypted_observation_size(), 4);
+  EXPECT_TRUE(store_->Empty());
+  EXPECT_EQ(store_->TakeNextEnvelopeHolder(), nullptr);
+}
+
+// Tests that a project cannot add Observations beyond its quota, and that its
+// bytes are accounted for as its files are taken and returned.
+TEST_F(FileObservationStoreTest, ProjectQuota) {
+  EXPECT_EQ(ObservationStore::kOk, AddObservation(50));
+  const size_t kObservationBytes = store_->GetProjectStats()[kProject].bytes;
+  ObservationStore::QuotaPolicy policy;
+  policy.max_bytes_per_project = 2 * kObservationBytes;
+  store_->SetQuotaPolicy(policy);
+
+  EXPECT_EQ(ObservationStore::kOk, AddObservation(50));
+  EXPECT_EQ(ObservationStore::kStoreFull, AddObservation(50));
+  auto stats = store_->GetProjectStats()[kProject];
+  EXPECT_EQ(2 * kObservationBytes, stats.bytes);
+  EXPECT_EQ(1u, stats.num_dropped);
+
+  auto holder = store_->TakeNextEnvelopeHolder();
+  ASSERT_NE(holder, nullptr);
+  EXPECT_EQ(0u, store_->GetProjectStats()[kProject].bytes);
+  EXPECT_EQ(ObservationStore::kOk, AddObservation(50));
+  store_->ReturnEnvelopeHolder(std::move(holder));
+  EXPECT_EQ(3 * kObservationBytes, store_->GetProjectStats()[kProject].bytes);
+
+  // The Observations of the files found at startup are counted.
+  store_ = nullptr;
+  MakeStore();
+  EXPECT_EQ(3 * kObservationBytes, store_->GetProjectStats()[kProject].bytes);
+}
+
+// Tests that the Observations of a finalized file are counted from its footer
+// when the store is constructed, without reading its records.
+TEST_F(FileObservationStoreTest, CountsObservationsFromFooter) {
+  for (int i = 0; i < 4; i++) {
+    EXPECT_EQ(ObservationStore::kOk, AddObservation(100));
+  }
+  auto files = store_->ListFinalizedFiles();
+  ASSERT_EQ(1u, files.size());
+  const size_t kBytes = store_->GetProjectStats()[kProject].bytes;
+  EXPECT_GT(kBytes, 0u);
+  store_ = nullptr;
+
+  // Corrupt the records of the file, but not its footer.
+  std::string file_name = test_dir_name_ + "/" + files[0];
+  size_t file_size = PosixFileSystem().FileSize(file_name).ConsumeValueOr(0);
+  {
+    std::fstream file(file_name,
+                      std::ios::binary | std::ios::in | std::ios::out);
+    file.seekp(file_size / 2);
+    file << std::string(16, '\xff');
+  }
+
+  MakeStore();
+  EXPECT_EQ(kBytes, store_->GetProjectStats()[kProject].bytes);
+}
+
+// Tests that once the store is full, an Observation of a higher priority
+// evicts the oldest files of lower-priority Observations, while one of the
+// same priority is rejected.
+TEST_F(FileObservationStoreTest, EvictsLowerPriorityFiles) {
+  ObservationStore::QuotaPolicy policy;
+  policy.metric_priorities[ObservationStore::MetricKey(
+      kCustomerId, kProjectId, kDefaultMetricId)] =
+      ObservationStore::kLowPriority;
+  policy.metric_priorities[ObservationStore::MetricKey(
+      kCustomerId, kProjectId, kImportantMetricId)] =
+      ObservationStore::kHighPriority;
+  store_->SetQuotaPolicy(policy);
+
+  size_t num_added = 0;
+  ObservationStore::StoreStatus status;
+  while ((status = AddObservation(100)) == ObservationStore::kOk) {
+    num_added++;
+  }
+  EXPECT_EQ(ObservationStore::kStoreFull, status);
+  EXPECT_LE(store_->Size(), kMaxBytesTotal);
+  auto files = store_->ListFinalizedFiles();
+  std::sort(files.begin(), files.end());
+  ASSERT_FALSE(files.empty());
+
+  EXPECT_EQ(ObservationStore::kStoreFull, AddObservation(100));
+  EXPECT_EQ(0u, store_->GetProjectStats()[kProject].num_evicted);
+  auto remaining_files = store_->ListFinalizedFiles();
+  std::sort(remaining_files.begin(), remaining_files.end());
+  EXPECT_EQ(files, remaining_files);
+
+  EXPECT_EQ(ObservationStore::kOk, AddObservation(100, kImportantMetricId));
+  num_added++;
+  remaining_files = store_->ListFinalizedFiles();
+  std::sort(remaining_files.begin(), remaining_files.end());
+  EXPECT_EQ(std::vector<std::string>(files.begin() + 1, files.end()),
+            remaining_files);
+  EXPECT_LE(store_->Size(), kMaxBytesTotal);
+
+  auto stats = store_->GetProjectStats()[kProject];
+  EXPECT_GT(stats.num_evicted, 0u);
+  size_t num_taken = 0;
+  while (auto holder = store_->TakeNextEnvelopeHolder()) {
+    for (const auto &batch : holder->GetEnvelope().batch()) {
+      num_taken += batch.encrypted_observation_size();
+    }
+  }
+  EXPECT_EQ(num_added - stats.num_evicted, num_taken);
+  EXPECT_EQ(0u, store_->GetProjectStats()[kProject].bytes);
+}
+
+// Tests that the active file is written out after every Observation with a
+// policy that commits every record.
+TEST_F(FileObservationStoreTest, SyncEveryObservation) {
+  DurabilityPolicy durability_policy;
+  durability_policy.mode = DurabilityPolicy::kSyncEveryN;
+  durability_policy.sync_every_records = 1;
+  MakeStore(durability_policy);
+
+  EXPECT_EQ(ObservationStore::kOk, AddObservation(50));
+  EXPECT_GT(ActiveFileSize(), 0u);
+  EXPECT_EQ(store_->Size(), ActiveFileSize());
+  EXPECT_EQ(ObservationStore::kOk, AddObservation(50));
+  EXPECT_EQ(store_->Size(), ActiveFileSize());
+}
+
+// Tests that the group commit thread writes out the active file.
+TEST_F(FileObservationStoreTest, GroupCommit) {
+  DurabilityPolicy durability_policy;
+  durability_policy.mode = DurabilityPolicy::kGroupCommit;
+  durability_policy.group_commit_interval = std::chrono::milliseconds(10);
+  MakeStore(durability_policy);
+
+  EXPECT_EQ(ObservationStore::kOk, AddObservation(50));
+  for (int i = 0; i < 100 && ActiveFileSize() == 0; i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  EXPECT_EQ(store_->Size(), ActiveFileSize());
+
+  // The store can be destroyed while the group commit thread is waiting.
+  store_ = nullptr;
+  MakeStore(durability_policy);
+  EXPECT_FALSE(store_->Empty());
+}
+
 TEST_F(FileObservationStoreTest, StressTest) {
   std::random_device rd;
   for (int i = 0; i < 5000; i++) {
@@ -2,6 +2,7 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#include <algorithm>
 #include <utility>
 
 #include "./logging.h"
@@ -10,40 +11,157 @@
 namespace cobalt {
 namespace encoder {
 
+namespace {
+
+template <class Shard>
+std::vector<std::unique_ptr<Shard>> MakeShards(size_t num_shards,
+                                               size_t max_bytes_per_observation,
+                                               size_t max_bytes_per_envelope) {
+  CHECK_GT(num_shards, 0u);
+  std::vector<std::unique_ptr<Shard>> shards;
+  for (size_t i = 0; i < num_shards; i++) {
+    shards.emplace_back(new Shard());
+    shards.back()->current_envelope.reset(
+        new EnvelopeMaker(max_bytes_per_observation, max_bytes_per_envelope));
+  }
+  return shards;
+}
+
+}  // namespace
+
 MemoryObservationStore::MemoryObservationStore(size_t max_bytes_per_observation,
                                                size_t max_bytes_per_envelope,
-                                               size_t max_bytes_total)
+                                               size_t max_bytes_total,
+                                               size_t num_shards)
     : ObservationStore(max_bytes_per_observation, max_bytes_per_envelope,
                        max_bytes_total),
       envelope_send_threshold_size_(size_t(0.6 * max_bytes_per_envelope_)),
-      current_envelope_(
-          new EnvelopeMaker(max_bytes_per_observation, max_bytes_per_envelope)),
+      shards_(MakeShards<Shard>(num_shards, max_bytes_per_observation,
+                                max_bytes_per_envelope)),
+      current_envelopes_size_(0),
       finalized_envelopes_size_(0) {}
 
+MemoryObservationStore::Shard* MemoryObservationStore::GetShard() {
+  if (shards_.size() == 1) {
+    return shards_[0].get();
+  }
+  // Threads are numbered in the order in which they first add to a sharded
+  // store, so that up to |num_shards| threads each get a shard of their own.
+  static std::atomic<size_t> next_thread_index(0);
+  thread_local size_t thread_index = next_thread_index++;
+  return shards_[thread_index % shards_.size()].get();
+}
+
 ObservationStore::StoreStatus MemoryObservationStore::AddEncryptedObservation(
     std::unique_ptr<EncryptedMessage> message,
     std::unique_ptr<ObservationMetadata> metadata) {
-  std::unique_lock<std::mutex> lock(envelope_mutex_);
+  Shard* shard = GetShard();
+  std::unique_lock<std::mutex> lock(shard->mutex);
+  const ObservationMetadata& metadata_ref = *metadata;
+  return AddEncryptedObservationLocked(shard, std::move(message), metadata_ref,
+                                       std::move(metadata));
+}
+
+ObservationStore::StoreStatus MemoryObservationStore::AddEncryptedObservations(
+    std::vector<EncryptedObservation> observations, size_t* num_added) {
+  CHECK(num_added);
+  *num_added = 0;
+  StoreStatus first_failure = kOk;
+  std::vector<const MetadataRegistry::Entry*> entries;
+  entries.reserve(observations.size());
+  for (const auto& observation : observations) {
+    entries.push_back(GetRegisteredMetadata(observation.metadata));
+  }
+  Shard* shard = GetShard();
+  std::unique_lock<std::mutex> lock(shard->mutex);
+  for (size_t i = 0; i < observations.size(); i++) {
+    StoreStatus status = kWriteFailed;
+    if (entries[i] != nullptr) {
+      status = AddEncryptedObservationLocked(
+          shard, std::move(observations[i].message), entries[i]->metadata,
+          observations[i].metadata, *entries[i]);
+    }
+    if (status == kOk) {
+      (*num_added)++;
+    } else if (first_failure == kOk) {
+      first_failure = status;
+    }
+  }
+  return first_failure;
+}
 
-  if (SizeLocked() > max_bytes_total_) {
+ObservationStore::StoreStatus
+MemoryObservationStore::AddEncryptedObservationByHandle(
+    std::unique_ptr<EncryptedMessage> message, MetadataHandle metadata) {
+  auto entry = GetRegisteredMetadata(metadata);
+  if (entry == nullptr) {
+    return kWriteFailed;
+  }
+  Shard* shard = GetShard();
+  std::unique_lock<std::mutex> lock(shard->mutex);
+  return AddEncryptedObservationLocked(shard, std::move(message),
+                                       entry->metadata, metadata, *entry);
+}
+
+template <class... Metadata>
+ObservationStore::StoreStatus
+MemoryObservationStore::AddEncryptedObservationLocked(
+    Shard* shard, std::unique_ptr<EncryptedMessage> message,
+    const ObservationMetadata& observation_metadata, Metadata&&... metadata) {
+  size_t obs_size = ObservationSize(*message);
+  if (!ReserveProjectBytes(observation_metadata, obs_size)) {
+    return kStoreFull;
+  }
+
+  if (Size() > max_bytes_total_ &&
+      !EvictLowerPriority(GetPriority(observation_metadata))) {
     VLOG(4) << "MemoryObservationStore::AddEncryptedObservation(): Rejecting "
                "observation because the store is full. ("
-            << SizeLocked() << " > " << max_bytes_total_ << ")";
+            << Size() << " > " << max_bytes_total_ << ")";
+    UnreserveProjectBytes(observation_metadata, obs_size, true);
     return kStoreFull;
   }
 
-  auto status = current_envelope_->CanAddObservation(*message);
+  auto status = shard->current_envelope->CanAddObservation(*message);
 
   if (status == kStoreFull) {
     VLOG(4) << "MemoryObservationStore::AddEncryptedObservation(): Current "
                "envelope would return kStoreFull. Swapping it out for "
                "a new EnvelopeMaker";
-    AddEnvelopeToSend(std::move(current_envelope_));
-    current_envelope_ = NewEnvelopeMaker();
+    auto full_envelope = std::move(shard->current_envelope);
+    shard->current_envelope = NewEnvelopeMaker();
+    current_envelopes_size_ -= full_envelope->Size();
+    std::unique_lock<std::mutex> lock(envelope_mutex_);
+    AddEnvelopeToSend(std::move(full_envelope));
   }
 
-  return current_envelope_->AddEncryptedObservation(std::move(message),
-                                                    std::move(metadata));
+  size_t size_before = shard->current_envelope->Size();
+  status = shard->current_envelope->AddEncryptedObservation(
+      std::move(message), std::forward<Metadata>(metadata)...);
+  current_envelopes_size_ += shard->current_envelope->Size() - size_before;
+  if (status != kOk) {
+    UnreserveProjectBytes(observation_metadata, obs_size, status == kStoreFull);
+  }
+  return status;
+}
+
+bool MemoryObservationStore::EvictLowerPriority(Priority priority) {
+  std::unique_lock<std::mutex> lock(envelope_mutex_);
+  auto envelope = finalized_envelopes_.begin();
+  while (Size() > max_bytes_total_ && envelope != finalized_envelopes_.end()) {
+    auto usage = EnvelopeUsage((*envelope)->GetEnvelope());
+    if (GetPriority(usage) >= priority) {
+      ++envelope;
+      continue;
+    }
+    VLOG(4) << "MemoryObservationStore: Evicting an envelope of "
+            << (*envelope)->Size() << " bytes to make room.";
+    finalized_envelopes_size_ -=
+        std::min<size_t>(finalized_envelopes_size_, (*envelope)->Size());
+    envelope = finalized_envelopes_.erase(envelope);
+    RecordRemoved(usage, true);
+  }
+  return Size() <= max_bytes_total_;
 }
 
 std::unique_ptr<EnvelopeMaker> MemoryObservationStore::NewEnvelopeMaker() {
@@ -55,6 +173,8 @@ std::unique_ptr<ObservationStore::EnvelopeHolder>
 MemoryObservationStore::TakeOldestEnvelopeHolderLocked() {
   auto retval = std::move(finalized_envelopes_.front());
   finalized_envelopes_.pop_front();
+  // Only |envelope_mutex_| modifies |finalized_envelopes_size_|, so it cannot
+  // change between the load and the store.
   if (retval->Size() > finalized_envelopes_size_) {
     finalized_envelopes_size_ = 0;
   } else {
@@ -75,48 +195,67 @@ void MemoryObservationStore::AddEnvelopeToSend(
 
 std::unique_ptr<ObservationStore::EnvelopeHolder>
 MemoryObservationStore::TakeNextEnvelopeHolder() {
-  std::unique_lock<std::mutex> lock(envelope_mutex_);
-
   auto retval = NewEnvelopeMaker();
   size_t retval_size = 0;
-  while (!finalized_envelopes_.empty() &&
-         (retval_size == 0 ||
-          (retval_size + finalized_envelopes_.front()->Size() <=
-           max_bytes_per_envelope_))) {
-    retval->MergeWith(TakeOldestEnvelopeHolderLocked());
-    retval_size = retval->Size();
+  {
+    std::unique_lock<std::mutex> lock(envelope_mutex_);
+    while (!finalized_envelopes_.empty() &&
+           (retval_size == 0 ||
+            (retval_size + finalized_envelopes_.front()->Size() <=
+             max_bytes_per_envelope_))) {
+      retval->MergeWith(TakeOldestEnvelopeHolderLocked());
+      retval_size = retval->Size();
+    }
   }
 
-  if (retval_size + current_envelope_->Size() <= max_bytes_per_envelope_) {
-    retval->MergeWith(std::move(current_envelope_));
-    current_envelope_ = NewEnvelopeMaker();
+  // The shards are locked one at a time, and without |envelope_mutex_|, so
+  // that threads adding to the other shards are not blocked.
+  for (auto& shard : shards_) {
+    std::unique_lock<std::mutex> lock(shard->mutex);
+    size_t shard_size = shard->current_envelope->Size();
+    if (shard->current_envelope->Empty() ||
+        retval_size + shard_size > max_bytes_per_envelope_) {
+      continue;
+    }
+    retval->MergeWith(std::move(shard->current_envelope));
+    shard->current_envelope = NewEnvelopeMaker();
+    current_envelopes_size_ -= shard_size;
+    retval_size = retval->Size();
   }
 
   if (retval->Size() == 0) {
     return nullptr;
   }
 
+  RecordRemoved(EnvelopeUsage(retval->GetEnvelope()), false);
   return retval;
 }
 
 void MemoryObservationStore::ReturnEnvelopeHolder(
     std::unique_ptr<ObservationStore::EnvelopeHolder> envelope) {
+  RecordAdded(EnvelopeUsage(envelope->GetEnvelope()));
   std::unique_lock<std::mutex> lock(envelope_mutex_);
   AddEnvelopeToSend(std::move(envelope));
 }
 
-size_t MemoryObservationStore::SizeLocked() const {
-  return current_envelope_->Size() + finalized_envelopes_size_;
-}
-
 size_t MemoryObservationStore::Size() const {
-  std::unique_lock<std::mutex> lock(envelope_mutex_);
-  return SizeLocked();
+  return current_envelopes_size_ + finalized_envelopes_size_;
 }
 
 bool MemoryObservationStore::Empty() const {
-  std::unique_lock<std::mutex> lock(envelope_mutex_);
-  return current_envelope_->Empty() && finalized_envelopes_.empty();
+  {
+    std::unique_lock<std::mutex> lock(envelope_mutex_);
+    if (!finalized_envelopes_.empty()) {
+      return false;
+    }
+  }
+  for (const auto& shard : shards_) {
+    std::unique_lock<std::mutex> lock(shard->mutex);
+    if (!shard->current_envelope->Empty()) {
+      return false;
+    }
+  }
+  return true;
 }
 
 }  // namespace encoder
@@ -5,8 +5,11 @@
 #ifndef COBALT_ENCODER_MEMORY_OBSERVATION_STORE_H_
 #define COBALT_ENCODER_MEMORY_OBSERVATION_STORE_H_
 
+#include <atomic>
 #include <deque>
 #include <memory>
+#include <mutex>
+#include <vector>
 
 #include "encoder/envelope_maker.h"
 #include "encoder/observation_store.h"
@@ -15,14 +18,33 @@ namespace cobalt {
 namespace encoder {
 
 // MemoryObservationStore is an ObservationStore that stores its data in memory.
+//
+// The store may be divided into shards, each of which collects Observations
+// into its own EnvelopeMaker under its own mutex, so that threads that add
+// Observations concurrently do not contend for a single lock. Each thread adds
+// its Observations to one shard, assigned round-robin the first time the
+// thread adds to any sharded store. The shards are only merged by
+// TakeNextEnvelopeHolder().
+//
+// This object is thread safe.
 class MemoryObservationStore : public ObservationStore {
  public:
+  // |num_shards|. The number of shards. With the default of one shard, all
+  // Observations are added under a single lock. A good value for a store that
+  // is logged to from many threads is the number of CPUs.
   MemoryObservationStore(size_t max_bytes_per_observation,
-                         size_t max_bytes_per_envelope, size_t max_bytes_total);
+                         size_t max_bytes_per_envelope, size_t max_bytes_total,
+                         size_t num_shards = 1);
 
   StoreStatus AddEncryptedObservation(
       std::unique_ptr<EncryptedMessage> message,
       std::unique_ptr<ObservationMetadata> metadata) override;
+  StoreStatus AddEncryptedObservations(
+      std::vector<EncryptedObservation> observations,
+      size_t* num_added) override;
+  StoreStatus AddEncryptedObservationByHandle(
+      std::unique_ptr<EncryptedMessage> message,
+      MetadataHandle metadata) override;
   std::unique_ptr<EnvelopeHolder> TakeNextEnvelopeHolder() override;
   void ReturnEnvelopeHolder(std::unique_ptr<EnvelopeHolder> envelopes) override;
 
@@ -30,9 +52,29 @@ class MemoryObservationStore : public ObservationStore {
   bool Empty() const override;
 
  private:
+  struct Shard {
+    // Guards |current_envelope|. Must be acquired before |envelope_mutex_|
+    // when both are held.
+    std::mutex mutex;
+    std::unique_ptr<EnvelopeMaker> current_envelope;
+  };
+
+  // Returns the shard of the calling thread.
+  Shard* GetShard();
   std::unique_ptr<EnvelopeMaker> NewEnvelopeMaker();
-  size_t SizeLocked() const;
-  void ReturnEnvelopeHolderLocked(std::unique_ptr<EnvelopeHolder> envelope);
+  // Adds |message|, whose ObservationMetadata is |observation_metadata|, to
+  // the current envelope of |shard|, passing it and |metadata| to
+  // EnvelopeMaker::AddEncryptedObservation(). Must be called with the |mutex|
+  // of |shard| held.
+  template <class... Metadata>
+  StoreStatus AddEncryptedObservationLocked(
+      Shard* shard, std::unique_ptr<EncryptedMessage> message,
+      const ObservationMetadata& observation_metadata, Metadata&&... metadata);
+
+  // Evicts the oldest finalized envelopes whose Observations all have a lower
+  // priority than |priority| until the store is no longer full. Returns false
+  // if it is still full.
+  bool EvictLowerPriority(Priority priority);
 
   std::unique_ptr<EnvelopeHolder> TakeOldestEnvelopeHolderLocked();
   void AddEnvelopeToSend(std::unique_ptr<EnvelopeHolder> holder,
@@ -40,10 +82,16 @@ class MemoryObservationStore : public ObservationStore {
 
   const size_t envelope_send_threshold_size_;
 
+  const std::vector<std::unique_ptr<Shard>> shards_;
+  // The sum of the sizes of the |current_envelope|s of the shards. It is kept
+  // outside of the shards so that the check for kStoreFull takes no other
+  // shard's lock.
+  std::atomic<size_t> current_envelopes_size_;
+
+  // Guards |finalized_envelopes_|.
   mutable std::mutex envelope_mutex_;
-  std::unique_ptr<EnvelopeMaker> current_envelope_;
   std::deque<std::unique_ptr<EnvelopeHolder>> finalized_envelopes_;
-  size_t finalized_envelopes_size_;
+  std::atomic<size_t> finalized_envelopes_size_;
 };
 
 }  // namespace encoder
@@ -0,0 +1,311 @@
+// Copyright 2018 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "encoder/memory_observation_store.h"
+
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "./gtest.h"
+#include "./logging.h"
+
+namespace cobalt {
+namespace encoder {
+
+namespace {
+
+const size_t kMaxBytesPerObservation = 100;
+const size_t kMaxBytesPerEnvelope = 400;
+const size_t kMaxBytesTotal = 100000;
+const size_t kNumShards = 4;
+
+// The (customer_id, project_id) of the Observations added by AddObservation()
+// by default.
+const ObservationStore::ProjectKey kProject(1, 1);
+
+// The size of each EncryptedMessage added by AddObservation(), as counted by
+// the EnvelopeMaker: the ciphertext and one byte for the |scheme|.
+const size_t kMessageSize = 50;
+
+// Returns the number of encrypted Observations in |envelope|.
+size_t NumObservations(const Envelope& envelope) {
+  size_t num_observations = 0;
+  for (const auto& batch : envelope.batch()) {
+    num_observations += batch.encrypted_observation_size();
+  }
+  return num_observations;
+}
+
+}  // namespace
+
+class MemoryObservationStoreTest : public ::testing::Test {
+ protected:
+  ObservationStore::StoreStatus AddObservation(ObservationStore* store,
+                                               uint32_t metric_id,
+                                               uint32_t project_id = 1) {
+    auto message = std::make_unique<EncryptedMessage>();
+    message->set_ciphertext(std::string(kMessageSize - 1, 'c'));
+    auto metadata = std::make_unique<ObservationMetadata>();
+    metadata->set_customer_id(1);
+    metadata->set_project_id(project_id);
+    metadata->set_metric_id(metric_id);
+    return store->AddEncryptedObservation(std::move(message),
+                                          std::move(metadata));
+  }
+
+  // Takes all of the EnvelopeHolders from |store| and returns the number of
+  // encrypted Observations they hold.
+  size_t TakeAll(ObservationStore* store) {
+    size_t num_observations = 0;
+    while (auto holder = store->TakeNextEnvelopeHolder()) {
+      EXPECT_LE(holder->Size(), kMaxBytesPerEnvelope);
+      num_observations += NumObservations(holder->GetEnvelope());
+    }
+    return num_observations;
+  }
+};
+
+// Tests that the Observations added from several threads to the shards of a
+// store are all merged into the EnvelopeHolders that are taken.
+TEST_F(MemoryObservationStoreTest, ShardedAddFromManyThreads) {
+  MemoryObservationStore store(kMaxBytesPerObservation, kMaxBytesPerEnvelope,
+                               kMaxBytesTotal, kNumShards);
+  const size_t kNumThreads = 2 * kNumShards;
+  const size_t kObservationsPerThread = 100;
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < kNumThreads; i++) {
+    threads.emplace_back([this, &store, i] {
+      for (size_t j = 0; j < kObservationsPerThread; j++) {
+        EXPECT_EQ(ObservationStore::kOk, AddObservation(&store, 1 + i % 3));
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  EXPECT_EQ(kNumThreads * kObservationsPerThread * kMessageSize, store.Size());
+  EXPECT_FALSE(store.Empty());
+  EXPECT_EQ(kNumThreads * kObservationsPerThread, TakeAll(&store));
+  EXPECT_EQ(0u, store.Size());
+  EXPECT_TRUE(store.Empty());
+}
+
+// Tests that TakeNextEnvelopeHolder() merges the current envelopes of several
+// shards into one EnvelopeHolder, as long as they fit.
+TEST_F(MemoryObservationStoreTest, ShardsAreMerged) {
+  MemoryObservationStore store(kMaxBytesPerObservation, kMaxBytesPerEnvelope,
+                               kMaxBytesTotal, kNumShards);
+  // Each thread adds to a different shard, since the threads are assigned
+  // shards round-robin.
+  for (size_t i = 0; i < kNumShards; i++) {
+    std::thread([this, &store] {
+      EXPECT_EQ(ObservationStore::kOk, AddObservation(&store, 1));
+    }).join();
+  }
+
+  auto holder = store.TakeNextEnvelopeHolder();
+  ASSERT_NE(nullptr, holder);
+  EXPECT_EQ(kNumShards * kMessageSize, holder->Size());
+  EXPECT_EQ(1, holder->GetEnvelope().batch_size());
+  EXPECT_EQ(kNumShards, NumObservations(holder->GetEnvelope()));
+  EXPECT_EQ(nullptr, store.TakeNextEnvelopeHolder());
+  EXPECT_TRUE(store.Empty());
+
+  // A returned EnvelopeHolder is taken again.
+  store.ReturnEnvelopeHolder(std::move(holder));
+  EXPECT_EQ(kNumShards * kMessageSize, store.Size());
+  EXPECT_EQ(kNumShards, TakeAll(&store));
+}
+
+// Tests that the store becomes full once the sum of the sizes of the shards
+// exceeds |max_bytes_total|.
+TEST_F(MemoryObservationStoreTest, ShardedStoreFull) {
+  const size_t kSmallMaxBytesTotal = 1000;
+  MemoryObservationStore store(kMaxBytesPerObservation, kMaxBytesPerEnvelope,
+                               kSmallMaxBytesTotal, kNumShards);
+  size_t num_added = 0;
+  for (size_t i = 0; i < kNumShards; i++) {
+    std::thread([this, &store, &num_added] {
+      while (AddObservation(&store, 1) == ObservationStore::kOk) {
+        num_added++;
+      }
+    }).join();
+  }
+  // The store accepts Observations until its size is greater than
+  // |max_bytes_total|.
+  EXPECT_EQ(kSmallMaxBytesTotal / kMessageSize + 1, num_added);
+  EXPECT_EQ(num_added, TakeAll(&store));
+}
+
+// Tests that Observations added by MetadataHandle, to any shard, are merged
+// into the same ObservationBatch as the Observations added with equal
+// metadata.
+TEST_F(MemoryObservationStoreTest, AddByHandle) {
+  MemoryObservationStore store(kMaxBytesPerObservation, kMaxBytesPerEnvelope,
+                               kMaxBytesTotal, kNumShards);
+  ObservationMetadata metadata;
+  metadata.set_customer_id(1);
+  metadata.set_project_id(1);
+  metadata.set_metric_id(1);
+  auto handle = store.RegisterMetadata(metadata);
+  EXPECT_EQ(handle, store.RegisterMetadata(metadata));
+  metadata.set_metric_id(2);
+  auto other_handle = store.RegisterMetadata(metadata);
+  EXPECT_NE(handle, other_handle);
+
+  for (size_t i = 0; i < kNumShards; i++) {
+    std::thread([this, &store, handle] {
+      auto message = std::make_unique<EncryptedMessage>();
+      message->set_ciphertext(std::string(kMessageSize - 1, 'c'));
+      EXPECT_EQ(ObservationStore::kOk, store.AddEncryptedObservationByHandle(
+                                           std::move(message), handle));
+    }).join();
+  }
+  EXPECT_EQ(ObservationStore::kOk, AddObservation(&store, 1));
+  EXPECT_EQ(ObservationStore::kOk,
+            store.AddEncryptedObservationByHandle(
+                std::make_unique<EncryptedMessage>(), other_handle));
+  EXPECT_EQ(ObservationStore::kWriteFailed,
+            store.AddEncryptedObservationByHandle(
+                std::make_unique<EncryptedMessage>(), other_handle + 1));
+
+  auto holder = store.TakeNextEnvelopeHolder();
+  ASSERT_NE(nullptr, holder);
+  const Envelope& envelope = holder->GetEnvelope();
+  ASSERT_EQ(2, envelope.batch_size());
+  for (const auto& batch : envelope.batch()) {
+    EXPECT_EQ(batch.meta_data().metric_id() == 1 ? kNumShards + 1 : 1,
+              batch.encrypted_observation_size());
+  }
+  EXPECT_EQ(nullptr, store.TakeNextEnvelopeHolder());
+}
+
+// Tests that a batch of Observations added by MetadataHandle is added to the
+// ObservationBatches of their metadata, and that an unknown handle fails only
+// its own Observation.
+TEST_F(MemoryObservationStoreTest, AddObservationsBatch) {
+  MemoryObservationStore store(kMaxBytesPerObservation, kMaxBytesPerEnvelope,
+                               kMaxBytesTotal);
+  ObservationMetadata metadata;
+  metadata.set_customer_id(1);
+  metadata.set_project_id(1);
+  std::vector<MetadataHandle> handles;
+  for (uint32_t metric_id = 1; metric_id <= 2; metric_id++) {
+    metadata.set_metric_id(metric_id);
+    handles.push_back(store.RegisterMetadata(metadata));
+  }
+
+  std::vector<ObservationStore::EncryptedObservation> observations;
+  for (auto handle : {handles[0], handles[1], kNoMetadataHandle, handles[0]}) {
+    auto message = std::make_unique<EncryptedMessage>();
+    message->set_ciphertext(std::string(kMessageSize - 1, 'c'));
+    observations.push_back({std::move(message), handle});
+  }
+  size_t num_added = 0;
+  EXPECT_EQ(ObservationStore::kWriteFailed,
+            store.AddEncryptedObservations(std::move(observations),
+                                           &num_added));
+  EXPECT_EQ(3u, num_added);
+
+  auto holder = store.TakeNextEnvelopeHolder();
+  ASSERT_NE(nullptr, holder);
+  const Envelope& envelope = holder->GetEnvelope();
+  ASSERT_EQ(2, envelope.batch_size());
+  for (const auto& batch : envelope.batch()) {
+    EXPECT_EQ(batch.meta_data().metric_id() == 1 ? 2 : 1,
+              batch.encrypted_observation_size());
+  }
+}
+
+// Tests that a project cannot add Observations beyond its quota, while other
+// projects can, and that taking its Observations makes room for more.
+TEST_F(MemoryObservationStoreTest, ProjectQuota) {
+  MemoryObservationStore store(kMaxBytesPerObservation, kMaxBytesPerEnvelope,
+                               kMaxBytesTotal);
+  ObservationStore::QuotaPolicy policy;
+  policy.max_bytes_per_project = 2 * kMessageSize;
+  const ObservationStore::ProjectKey kLargeProject(1, 3);
+  policy.project_max_bytes[kLargeProject] = 3 * kMessageSize;
+  store.SetQuotaPolicy(policy);
+
+  EXPECT_EQ(ObservationStore::kOk, AddObservation(&store, 1));
+  EXPECT_EQ(ObservationStore::kOk, AddObservation(&store, 2));
+  EXPECT_EQ(ObservationStore::kStoreFull, AddObservation(&store, 1));
+  for (int i = 0; i < 2; i++) {
+    EXPECT_EQ(ObservationStore::kOk, AddObservation(&store, 1, 2));
+  }
+  EXPECT_EQ(ObservationStore::kStoreFull, AddObservation(&store, 1, 2));
+  for (int i = 0; i < 3; i++) {
+    EXPECT_EQ(ObservationStore::kOk, AddObservation(&store, 1, 3));
+  }
+  EXPECT_EQ(ObservationStore::kStoreFull, AddObservation(&store, 1, 3));
+
+  auto stats = store.GetProjectStats();
+  ASSERT_EQ(3u, stats.size());
+  EXPECT_EQ(2 * kMessageSize, stats[kProject].bytes);
+  EXPECT_EQ(1u, stats[kProject].num_dropped);
+  EXPECT_EQ(3 * kMessageSize, stats[kLargeProject].bytes);
+  EXPECT_EQ(1u, stats[kLargeProject].num_dropped);
+
+  auto holder = store.TakeNextEnvelopeHolder();
+  ASSERT_NE(nullptr, holder);
+  EXPECT_EQ(0u, store.GetProjectStats()[kProject].bytes);
+  EXPECT_EQ(ObservationStore::kOk, AddObservation(&store, 1));
+
+  // A returned EnvelopeHolder is counted again, even beyond the quota.
+  store.ReturnEnvelopeHolder(std::move(holder));
+  EXPECT_EQ(3 * kMessageSize, store.GetProjectStats()[kProject].bytes);
+  EXPECT_EQ(ObservationStore::kStoreFull, AddObservation(&store, 1));
+}
+
+// Tests that when the store is full, an Observation of a higher priority
+// evicts the oldest finalized envelope of lower-priority Observations, while
+// one of the same priority is rejected.
+TEST_F(MemoryObservationStoreTest, EvictsLowerPriority) {
+  const size_t kSmallMaxBytesTotal = 1000;
+  MemoryObservationStore store(kMaxBytesPerObservation, kMaxBytesPerEnvelope,
+                               kSmallMaxBytesTotal);
+  ObservationStore::QuotaPolicy policy;
+  policy.metric_priorities[ObservationStore::MetricKey(1, 1, 1)] =
+      ObservationStore::kLowPriority;
+  store.SetQuotaPolicy(policy);
+
+  size_t num_added = 0;
+  while (AddObservation(&store, 1) == ObservationStore::kOk) {
+    num_added++;
+  }
+  EXPECT_EQ(kSmallMaxBytesTotal / kMessageSize + 1, num_added);
+  EXPECT_EQ(1u, store.GetProjectStats()[kProject].num_dropped);
+
+  // Each finalized envelope holds as many Observations as fit in
+  // |max_bytes_per_envelope|.
+  const size_t kObservationsPerEnvelope = kMaxBytesPerEnvelope / kMessageSize;
+  EXPECT_EQ(ObservationStore::kOk, AddObservation(&store, 2));
+  auto stats = store.GetProjectStats()[kProject];
+  EXPECT_EQ(kObservationsPerEnvelope, stats.num_evicted);
+  EXPECT_EQ((num_added - kObservationsPerEnvelope + 1) * kMessageSize,
+            stats.bytes);
+  EXPECT_EQ(stats.bytes, store.Size());
+  EXPECT_EQ(num_added - kObservationsPerEnvelope + 1, TakeAll(&store));
+}
+
+// Tests that data of the same priority is not evicted, so that the store
+// rejects Observations when it is full, as it does without a QuotaPolicy.
+TEST_F(MemoryObservationStoreTest, DoesNotEvictSamePriority) {
+  const size_t kSmallMaxBytesTotal = 1000;
+  MemoryObservationStore store(kMaxBytesPerObservation, kMaxBytesPerEnvelope,
+                               kSmallMaxBytesTotal);
+  while (AddObservation(&store, 1) == ObservationStore::kOk) {
+  }
+  EXPECT_EQ(ObservationStore::kStoreFull, AddObservation(&store, 2));
+  auto stats = store.GetProjectStats()[kProject];
+  EXPECT_EQ(2u, stats.num_dropped);
+  EXPECT_EQ(0u, stats.num_evicted);
+}
+
+}  // namespace encoder
+}  // namespace cobalt
@@ -0,0 +1,39 @@
+// Copyright 2018 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "encoder/metadata_registry.h"
+
+#include <utility>
+
+#include "./logging.h"
+
+namespace cobalt {
+namespace encoder {
+
+MetadataHandle MetadataRegistry::Register(
+    const ObservationMetadata& metadata) {
+  std::string serialized_metadata = metadata.SerializeAsString();
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto iter = handles_.find(serialized_metadata);
+  if (iter != handles_.end()) {
+    return iter->second;
+  }
+  CHECK_LT(entries_.size(), kNoMetadataHandle);
+  MetadataHandle handle = entries_.size();
+  handles_.emplace(serialized_metadata, handle);
+  entries_.push_back({metadata, std::move(serialized_metadata)});
+  return handle;
+}
+
+const MetadataRegistry::Entry* MetadataRegistry::Get(
+    MetadataHandle handle) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (handle >= entries_.size()) {
+    return nullptr;
+  }
+  return &entries_[handle];
+}
+
+}  // namespace encoder
+}  // namespace cobalt
@@ -0,0 +1,64 @@
+// Copyright 2018 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef COBALT_ENCODER_METADATA_REGISTRY_H_
+#define COBALT_ENCODER_METADATA_REGISTRY_H_
+
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "./observation_batch.pb.h"
+
+namespace cobalt {
+namespace encoder {
+
+// A small integer that stands for an ObservationMetadata registered with a
+// MetadataRegistry. The handles of a registry are consecutive, starting at 0.
+using MetadataHandle = uint32_t;
+
+// A value that is never returned by MetadataRegistry::Register().
+constexpr MetadataHandle kNoMetadataHandle = UINT32_MAX;
+
+// MetadataRegistry interns ObservationMetadata. Each distinct
+// ObservationMetadata that is registered is serialized once and given a
+// MetadataHandle, so that code that adds many Observations with the same
+// metadata can pass the handle instead of serializing, hashing and comparing
+// the metadata for every Observation.
+//
+// Entries are never removed, so the registry grows with the number of
+// distinct ObservationMetadata, which is the number of (customer, project,
+// metric, report, day, system profile) combinations that are logged.
+//
+// This class is thread-safe.
+class MetadataRegistry {
+ public:
+  struct Entry {
+    ObservationMetadata metadata;
+    std::string serialized_metadata;
+  };
+
+  // Returns the handle of |metadata|, registering it if an equal
+  // ObservationMetadata has not been registered before.
+  MetadataHandle Register(const ObservationMetadata& metadata);
+
+  // Returns the entry of |handle|, or nullptr if |handle| was not returned by
+  // Register(). The entry remains valid for the lifetime of the registry.
+  const Entry* Get(MetadataHandle handle) const;
+
+ private:
+  mutable std::mutex mutex_;
+  // The entries, indexed by handle. A deque does not move its elements when it
+  // grows, so pointers to them remain valid.
+  std::deque<Entry> entries_;
+  // Maps each serialized ObservationMetadata to its handle.
+  std::unordered_map<std::string, MetadataHandle> handles_;
+};
+
+}  // namespace encoder
+}  // namespace cobalt
+
+#endif  // COBALT_ENCODER_METADATA_REGISTRY_H_
@@ -0,0 +1,50 @@
+// Copyright 2018 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef COBALT_ENCODER_NO_OP_OBSERVATION_STORE_H_
+#define COBALT_ENCODER_NO_OP_OBSERVATION_STORE_H_
+
+#include <memory>
+
+#include "encoder/observation_store.h"
+#include "encoder/observation_store_update_recipient.h"
+
+namespace cobalt {
+namespace encoder {
+
+// An ObservationStoreWriterInterface that accepts and discards every
+// Observation. Used by tests and benchmarks that measure the cost of logging
+// without the cost of storing.
+class NoOpObservationStore : public ObservationStoreWriterInterface {
+ public:
+  StoreStatus AddEncryptedObservation(
+      std::unique_ptr<EncryptedMessage> message,
+      std::unique_ptr<ObservationMetadata> metadata) override {
+    return kOk;
+  }
+
+  // Every ObservationMetadata is given the same handle, which is never looked
+  // up.
+  MetadataHandle RegisterMetadata(
+      const ObservationMetadata& metadata) override {
+    return 0;
+  }
+
+  StoreStatus AddEncryptedObservationByHandle(
+      std::unique_ptr<EncryptedMessage> message,
+      MetadataHandle metadata) override {
+    return kOk;
+  }
+};
+
+// An ObservationStoreUpdateRecipient that ignores the notifications.
+class NoOpUpdateRecipient : public ObservationStoreUpdateRecipient {
+ public:
+  void NotifyObservationsAdded() override {}
+};
+
+}  // namespace encoder
+}  // namespace cobalt
+
+#endif  // COBALT_ENCODER_NO_OP_OBSERVATION_STORE_H_
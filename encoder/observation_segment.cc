@@ -0,0 +1,456 @@
+// Copyright 2018 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "encoder/observation_segment.h"
+
+#include <cstring>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include <zlib.h>
+
+#include "./envelope.pb.h"
+#include "./logging.h"
+#include "third_party/protobuf/src/google/protobuf/io/coded_stream.h"
+#include "util/crc32c.h"
+
+namespace cobalt {
+namespace encoder {
+
+using google::protobuf::io::CodedInputStream;
+using google::protobuf::io::CodedOutputStream;
+using util::BufferedFileWriter;
+
+namespace {
+
+constexpr uint32_t kMetaDataField =
+    ObservationStoreRecord::kMetaDataFieldNumber;
+constexpr uint32_t kEncryptedObservationField =
+    ObservationStoreRecord::kEncryptedObservationFieldNumber;
+static_assert(kMetaDataField == ObservationBatch::kMetaDataFieldNumber,
+              "Field numbers of ObservationStoreRecord have changed.");
+static_assert(kEncryptedObservationField ==
+                  ObservationBatch::kEncryptedObservationFieldNumber,
+              "Field numbers of ObservationStoreRecord have changed.");
+
+const uint32_t kWireTypeLengthDelimited = 2;
+
+// The size of the fixed32 size, the fixed32 checksum and the magic bytes that
+// follow the SegmentFooter.
+const size_t kFooterTrailerSize = 4 + 4 + kSegmentMagicSize;
+
+uint32_t LengthDelimitedTag(uint32_t field_number) {
+  return (field_number << 3) | kWireTypeLengthDelimited;
+}
+
+// Returns the size of a length-delimited field with the given |payload_size|.
+size_t FieldSize(uint32_t field_number, size_t payload_size) {
+  return CodedOutputStream::VarintSize32(LengthDelimitedTag(field_number)) +
+         CodedOutputStream::VarintSize32(payload_size) + payload_size;
+}
+
+void AppendVarint32(uint32_t value, std::string *out) {
+  uint8_t buffer[5];
+  uint8_t *end = CodedOutputStream::WriteVarint32ToArray(value, buffer);
+  out->append(reinterpret_cast<char *>(buffer), end - buffer);
+}
+
+void AppendFixed32(uint32_t value, std::string *out) {
+  uint8_t buffer[4];
+  CodedOutputStream::WriteLittleEndian32ToArray(value, buffer);
+  out->append(reinterpret_cast<char *>(buffer), sizeof(buffer));
+}
+
+const uint8_t *Bytes(const char *data) {
+  return reinterpret_cast<const uint8_t *>(data);
+}
+
+uint32_t ReadFixed32(const char *data) {
+  uint32_t value;
+  CodedInputStream::ReadLittleEndian32FromArray(Bytes(data), &value);
+  return value;
+}
+
+}  // namespace
+
+std::unique_ptr<SegmentWriter> SegmentWriter::Create(
+    std::unique_ptr<BufferedFileWriter> file,
+    CompressionPolicy compression_policy) {
+  CHECK(file);
+  SegmentHeader header;
+  if (compression_policy.mode == CompressionPolicy::kZlib) {
+    header.set_version(kCompressedSegmentVersion);
+    header.set_compression(SegmentHeader::ZLIB);
+  } else {
+    header.set_version(kSegmentVersion);
+  }
+  std::string serialized_header(kSegmentMagic, kSegmentMagicSize);
+  AppendVarint32(header.ByteSizeLong(), &serialized_header);
+  header.AppendToString(&serialized_header);
+  if (!file->Append(serialized_header.data(), serialized_header.size())) {
+    return nullptr;
+  }
+  return std::unique_ptr<SegmentWriter>(new SegmentWriter(
+      std::move(file), compression_policy, serialized_header.size()));
+}
+
+SegmentWriter::SegmentWriter(std::unique_ptr<BufferedFileWriter> file,
+                             CompressionPolicy compression_policy,
+                             size_t header_size)
+    : file_(std::move(file)),
+      compression_policy_(compression_policy),
+      header_size_(header_size) {}
+
+constexpr uint32_t SegmentWriter::kNoMetadataId;
+
+bool SegmentWriter::Append(const EncryptedMessage &message,
+                           const std::string &serialized_metadata,
+                           MetadataHandle handle) {
+  uint32_t metadata_id = kNoMetadataId;
+  if (handle < handle_metadata_ids_.size()) {
+    metadata_id = handle_metadata_ids_[handle];
+  }
+  if (metadata_id == kNoMetadataId) {
+    auto iter = metadata_ids_.find(serialized_metadata);
+    if (iter != metadata_ids_.end()) {
+      metadata_id = iter->second;
+    } else {
+      metadata_id = batch_bytes_.size();
+      if (!WriteFrame(kMetaDataField, metadata_id, serialized_metadata)) {
+        return false;
+      }
+      metadata_ids_[serialized_metadata] = metadata_id;
+      batch_bytes_.push_back(
+          FieldSize(kMetaDataField, serialized_metadata.size()));
+    }
+    if (handle != kNoMetadataHandle) {
+      if (handle >= handle_metadata_ids_.size()) {
+        handle_metadata_ids_.resize(handle + 1, kNoMetadataId);
+      }
+      handle_metadata_ids_[handle] = metadata_id;
+    }
+  }
+
+  message.SerializeToString(&payload_);
+  if (!WriteFrame(kEncryptedObservationField, metadata_id, payload_)) {
+    return false;
+  }
+  batch_bytes_[metadata_id] +=
+      FieldSize(kEncryptedObservationField, payload_.size());
+  num_encrypted_observations_++;
+  return true;
+}
+
+bool SegmentWriter::WriteFrame(uint32_t field_number, uint32_t metadata_id,
+                               const std::string &payload) {
+  frame_.clear();
+  AppendVarint32(metadata_id, &frame_);
+  AppendVarint32(LengthDelimitedTag(field_number), &frame_);
+  AppendVarint32(payload.size(), &frame_);
+  uint32_t crc = util::Crc32cExtend(util::Crc32c(frame_.data(), frame_.size()),
+                                    payload.data(), payload.size());
+
+  std::string frame_header;
+  AppendVarint32(frame_.size() + payload.size(), &frame_header);
+  AppendFixed32(crc, &frame_header);
+  if (!AppendFrameBytes(frame_header.data(), frame_header.size()) ||
+      !AppendFrameBytes(frame_.data(), frame_.size()) ||
+      !AppendFrameBytes(payload.data(), payload.size())) {
+    return false;
+  }
+  frame_bytes_ += frame_header.size() + frame_.size() + payload.size();
+
+  if (compression_policy_.mode == CompressionPolicy::kNone) {
+    return file_->EndRecord();
+  }
+  if (block_.size() >= compression_policy_.block_size) {
+    return FlushBlock();
+  }
+  return true;
+}
+
+bool SegmentWriter::AppendFrameBytes(const char *data, size_t size) {
+  if (compression_policy_.mode == CompressionPolicy::kNone) {
+    return file_->Append(data, size);
+  }
+  block_.append(data, size);
+  return true;
+}
+
+bool SegmentWriter::FlushBlock() {
+  if (block_.empty()) {
+    return true;
+  }
+  uLongf compressed_size = compressBound(block_.size());
+  compressed_block_.resize(compressed_size);
+  if (compress2(reinterpret_cast<Bytef *>(&compressed_block_[0]),
+                &compressed_size,
+                reinterpret_cast<const Bytef *>(block_.data()), block_.size(),
+                compression_policy_.level) != Z_OK) {
+    LOG(ERROR) << "Unable to compress a block of " << block_.size()
+               << " bytes";
+    return false;
+  }
+  compressed_block_.resize(compressed_size);
+
+  std::string block_header;
+  AppendVarint32(compressed_block_.size(), &block_header);
+  AppendVarint32(block_.size(), &block_header);
+  AppendFixed32(
+      util::Crc32c(compressed_block_.data(), compressed_block_.size()),
+      &block_header);
+  if (!file_->Append(block_header.data(), block_header.size()) ||
+      !file_->Append(compressed_block_.data(), compressed_block_.size()) ||
+      !file_->EndRecord()) {
+    return false;
+  }
+  uncompressed_block_bytes_ += block_.size();
+  compressed_block_bytes_ += block_header.size() + compressed_block_.size();
+  block_.clear();
+  return true;
+}
+
+SegmentFooter SegmentWriter::footer() const {
+  SegmentFooter footer;
+  footer.set_num_meta_data(batch_bytes_.size());
+  footer.set_num_encrypted_observations(num_encrypted_observations_);
+  uint64_t envelope_bytes = 0;
+  for (size_t batch_bytes : batch_bytes_) {
+    envelope_bytes += FieldSize(Envelope::kBatchFieldNumber, batch_bytes);
+  }
+  footer.set_envelope_bytes(envelope_bytes);
+  return footer;
+}
+
+bool SegmentWriter::Finish(const MetricUsages &usage) {
+  SegmentFooter segment_footer = footer();
+  *segment_footer.mutable_usage() = usage;
+  std::string serialized_footer = segment_footer.SerializeAsString();
+  uint32_t crc =
+      util::Crc32c(serialized_footer.data(), serialized_footer.size());
+  uint32_t footer_size = serialized_footer.size();
+  AppendFixed32(footer_size, &serialized_footer);
+  AppendFixed32(crc, &serialized_footer);
+  serialized_footer.append(kSegmentFooterMagic, kSegmentMagicSize);
+  bool ok = FlushBlock() &&
+            file_->Append(serialized_footer.data(), serialized_footer.size());
+  return file_->Close() && ok;
+}
+
+SegmentReader::SegmentReader(const util::FileContents &contents)
+    : position_(contents.data()), end_(contents.data() + contents.size()) {
+  if (contents.size() < kSegmentMagicSize ||
+      std::memcmp(position_, kSegmentMagic, kSegmentMagicSize) != 0) {
+    version_ = 1;
+    return;
+  }
+
+  position_ += kSegmentMagicSize;
+  CodedInputStream input(Bytes(position_), end_ - position_);
+  uint32_t header_size;
+  SegmentHeader header;
+  if (!input.ReadVarint32(&header_size) ||
+      header_size > static_cast<size_t>(input.BytesUntilLimit())) {
+    Corrupt();
+    return;
+  }
+  position_ += input.CurrentPosition();
+  if (!header.ParseFromArray(position_, header_size)) {
+    Corrupt();
+    return;
+  }
+  position_ += header_size;
+  bool supported =
+      (header.version() == kSegmentVersion &&
+       header.compression() == SegmentHeader::NONE) ||
+      (header.version() == kCompressedSegmentVersion &&
+       header.compression() == SegmentHeader::ZLIB);
+  if (!supported) {
+    LOG(ERROR) << "Unsupported segment version " << header.version()
+               << " with compression " << header.compression();
+    Corrupt();
+    return;
+  }
+  version_ = header.version();
+
+  if (static_cast<size_t>(end_ - position_) < kFooterTrailerSize ||
+      std::memcmp(end_ - kSegmentMagicSize, kSegmentFooterMagic,
+                  kSegmentMagicSize) != 0) {
+    return;
+  }
+  const char *trailer = end_ - kFooterTrailerSize;
+  uint32_t footer_size = ReadFixed32(trailer);
+  uint32_t footer_crc = ReadFixed32(trailer + 4);
+  if (footer_size > static_cast<size_t>(trailer - position_)) {
+    return;
+  }
+  const char *footer_start = trailer - footer_size;
+  if (util::Crc32c(footer_start, footer_size) == footer_crc &&
+      footer_.ParseFromArray(footer_start, footer_size)) {
+    has_footer_ = true;
+    end_ = footer_start;
+  }
+}
+
+bool SegmentReader::Next(SegmentRecord *record) {
+  if (version_ == kCompressedSegmentVersion && !blocks_read_) {
+    ReadBlocks();
+  }
+  bool found = false;
+  if (!corrupt_ && position_ < end_) {
+    switch (version_) {
+      case 1:
+        found = NextV1(record);
+        break;
+      case kSegmentVersion:
+      case kCompressedSegmentVersion:
+        found = NextV2(record);
+        break;
+      default:
+        break;
+    }
+  }
+  // The frames of the blocks that were read intact are read before the
+  // corruption of the blocks is reported.
+  if (!found && blocks_corrupt_) {
+    corrupt_ = true;
+  }
+  return found;
+}
+
+void SegmentReader::ReadBlocks() {
+  blocks_read_ = true;
+  const char *position = position_;
+  while (position < end_) {
+    CodedInputStream input(Bytes(position), end_ - position);
+    uint32_t compressed_size;
+    uint32_t uncompressed_size;
+    if (!input.ReadVarint32(&compressed_size) ||
+        !input.ReadVarint32(&uncompressed_size)) {
+      blocks_corrupt_ = true;
+      break;
+    }
+    const char *crc_start = position + input.CurrentPosition();
+    if (end_ - crc_start < 4 ||
+        compressed_size > static_cast<size_t>(end_ - crc_start - 4)) {
+      blocks_corrupt_ = true;
+      break;
+    }
+    const char *block = crc_start + 4;
+    position = block + compressed_size;
+    if (util::Crc32c(block, compressed_size) != ReadFixed32(crc_start)) {
+      num_skipped_records_++;
+      continue;
+    }
+
+    size_t offset = blocks_.size();
+    blocks_.resize(offset + uncompressed_size);
+    uLongf size = uncompressed_size;
+    if (uncompress(reinterpret_cast<Bytef *>(&blocks_[offset]), &size,
+                   reinterpret_cast<const Bytef *>(block),
+                   compressed_size) != Z_OK ||
+        size != uncompressed_size) {
+      blocks_.resize(offset);
+      num_skipped_records_++;
+    }
+  }
+  position_ = blocks_.data();
+  end_ = position_ + blocks_.size();
+}
+
+bool SegmentReader::NextV1(SegmentRecord *record) {
+  CodedInputStream input(Bytes(position_), end_ - position_);
+  uint32_t record_size;
+  if (!input.ReadVarint32(&record_size) ||
+      record_size > static_cast<size_t>(input.BytesUntilLimit())) {
+    return Corrupt();
+  }
+  const char *record_start = position_ + input.CurrentPosition();
+  position_ = record_start + record_size;
+  if (!ReadRecord(record_start, position_, record)) {
+    return Corrupt();
+  }
+  if (record->field_number == kMetaDataField) {
+    record->metadata_id = num_metadata_ids_++;
+  } else if (num_metadata_ids_ == 0) {
+    return Corrupt();
+  } else {
+    record->metadata_id = num_metadata_ids_ - 1;
+  }
+  return true;
+}
+
+bool SegmentReader::NextV2(SegmentRecord *record) {
+  while (position_ < end_) {
+    CodedInputStream input(Bytes(position_), end_ - position_);
+    uint32_t frame_size;
+    if (!input.ReadVarint32(&frame_size)) {
+      return Corrupt();
+    }
+    const char *crc_start = position_ + input.CurrentPosition();
+    if (end_ - crc_start < 4 ||
+        frame_size > static_cast<size_t>(end_ - crc_start - 4)) {
+      return Corrupt();
+    }
+    const char *frame = crc_start + 4;
+    position_ = frame + frame_size;
+    if (util::Crc32c(frame, frame_size) != ReadFixed32(crc_start)) {
+      num_skipped_records_++;
+      continue;
+    }
+
+    CodedInputStream frame_input(Bytes(frame), position_ - frame);
+    uint32_t metadata_id;
+    if (!frame_input.ReadVarint32(&metadata_id) ||
+        !ReadRecord(frame + frame_input.CurrentPosition(), position_,
+                    record)) {
+      num_skipped_records_++;
+      continue;
+    }
+    record->metadata_id = metadata_id;
+    if (record->field_number == kMetaDataField) {
+      metadata_ids_read_.insert(metadata_id);
+    } else if (metadata_ids_read_.count(metadata_id) == 0) {
+      num_skipped_records_++;
+      continue;
+    }
+    return true;
+  }
+  return false;
+}
+
+bool SegmentReader::ReadRecord(const char *start, const char *end,
+                               SegmentRecord *record) {
+  CodedInputStream input(Bytes(start), end - start);
+  uint32_t tag = input.ReadTag();
+  uint32_t payload_size;
+  if ((tag & 7) != kWireTypeLengthDelimited ||
+      !input.ReadVarint32(&payload_size)) {
+    return false;
+  }
+  const char *payload = start + input.CurrentPosition();
+  // Each record holds exactly one field.
+  if (payload_size != static_cast<size_t>(end - payload)) {
+    return false;
+  }
+  record->field_number = tag >> 3;
+  if (record->field_number != kMetaDataField &&
+      record->field_number != kEncryptedObservationField) {
+    return false;
+  }
+  record->field = start;
+  record->field_size = end - start;
+  record->payload = payload;
+  record->payload_size = payload_size;
+  return true;
+}
+
+bool SegmentReader::Corrupt() {
+  corrupt_ = true;
+  return false;
+}
+
+}  // namespace encoder
+}  // namespace cobalt
@@ -0,0 +1,269 @@
+// Copyright 2018 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef COBALT_ENCODER_OBSERVATION_SEGMENT_H_
+#define COBALT_ENCODER_OBSERVATION_SEGMENT_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "./encrypted_message.pb.h"
+#include "./observation_batch.pb.h"
+#include "encoder/file_observation_store_internal.pb.h"
+#include "encoder/metadata_registry.h"
+#include "util/buffered_file_writer.h"
+#include "util/file_system.h"
+
+namespace cobalt {
+namespace encoder {
+
+// A segment is a file of Observations written by the FileObservationStore.
+//
+// Version 1 segments are a bare sequence of length-delimited
+// ObservationStoreRecords, in which a meta_data record applies to the
+// encrypted_observation records that follow it.
+//
+// Version 2 segments consist of:
+//   - A header: the 4 bytes of kSegmentMagic, followed by a length-delimited
+//     SegmentHeader.
+//   - A sequence of frames, each of which holds one record:
+//       varint32   The size of the rest of the frame after the checksum.
+//       fixed32    The CRC-32C of the rest of the frame.
+//       varint32   The metadata id of the record.
+//       bytes      The ObservationStoreRecord.
+//     The meta_data records form a dictionary of the segment: each of them
+//     defines a new metadata id, and each encrypted_observation record refers
+//     to the metadata id of its ObservationMetadata. So every
+//     ObservationMetadata is written once per segment.
+//   - A footer, if the segment was finalized: a SegmentFooter, the fixed32
+//     size of the SegmentFooter, the fixed32 CRC-32C of the SegmentFooter and
+//     the 4 bytes of kSegmentFooterMagic.
+//
+// Version 3 segments are version 2 segments whose frames are compressed, as
+// given by the |compression| of their SegmentHeader. The frames are grouped
+// into blocks, each of which is stored as:
+//       varint32   The size of the compressed block.
+//       varint32   The size of the uncompressed block.
+//       fixed32    The CRC-32C of the compressed block.
+//       bytes      The compressed block.
+// The header and the footer are not compressed, so the footer of a version 3
+// segment can be read without decompressing it.
+//
+// A version 1 segment never starts with kSegmentMagic, whose 4th byte is not
+// a valid tag of an ObservationStoreRecord.
+constexpr char kSegmentMagic[] = "\xc0\xba\x17\x5e";
+constexpr char kSegmentFooterMagic[] = "\x5e\x17\xba\xc0";
+constexpr size_t kSegmentMagicSize = 4;
+constexpr uint32_t kSegmentVersion = 2;
+constexpr uint32_t kCompressedSegmentVersion = 3;
+
+// Determines whether the frames of a segment are compressed.
+struct CompressionPolicy {
+  enum Mode {
+    // Write version 2 segments.
+    kNone,
+    // Write version 3 segments, whose blocks are compressed with zlib.
+    kZlib,
+  };
+  Mode mode = kNone;
+
+  // The number of bytes of frames that are compressed together. Frames are
+  // only written to the file once their block is full, or the segment is
+  // finished, or SegmentWriter::FlushBlock() is called.
+  size_t block_size = 32 * 1024;
+
+  // The zlib compression level, from 1 (fastest) to 9 (smallest).
+  int level = 6;
+};
+
+// The usage of each metric of the Observations in a segment, as recorded in
+// its SegmentFooter.
+using MetricUsages =
+    google::protobuf::RepeatedPtrField<SegmentFooter::MetricUsage>;
+
+// SegmentWriter writes a version 2 segment, or a version 3 segment if it
+// compresses its frames. The footer is written by Finish(). A segment that is
+// never finished can still be read, without its footer.
+//
+// When the frames are compressed, util::BufferedFileWriter::EndRecord() is
+// called for each block rather than for each frame, so the DurabilityPolicy
+// of the file counts blocks.
+//
+// This class is not thread-safe.
+class SegmentWriter {
+ public:
+  // Writes the header of a new segment to |file|, which must be empty.
+  // Returns nullptr if the header could not be written.
+  static std::unique_ptr<SegmentWriter> Create(
+      std::unique_ptr<util::BufferedFileWriter> file,
+      CompressionPolicy compression_policy = CompressionPolicy());
+
+  // Appends an encrypted Observation with its serialized ObservationMetadata,
+  // which is first added to the dictionary of the segment if it is not
+  // already there. Returns false if the records could not be written.
+  //
+  // If the metadata is registered in a MetadataRegistry, its |handle| may be
+  // passed too, in which case the dictionary is searched by the handle rather
+  // than by the serialized metadata after the first time. All of the handles
+  // passed to a SegmentWriter must come from the same MetadataRegistry.
+  bool Append(const EncryptedMessage &message,
+              const std::string &serialized_metadata,
+              MetadataHandle handle = kNoMetadataHandle);
+
+  // Compresses the frames appended since the last block was written, if
+  // any, and writes them as a block. Does nothing if the frames are not
+  // compressed. Returns false on failure.
+  bool FlushBlock();
+
+  // Writes the footer and closes the file. The footer also records |usage|,
+  // the usage of the metrics of the Observations appended to the segment, as
+  // counted by the writer's caller. Returns false on failure.
+  bool Finish(const MetricUsages &usage = MetricUsages());
+
+  // Returns the footer that describes the records appended so far.
+  SegmentFooter footer() const;
+
+  // The number of bytes written to the segment so far. The frames that have
+  // not yet been compressed are counted uncompressed.
+  size_t ByteCount() const { return file_->ByteCount() + block_.size(); }
+
+  // The number of bytes that the segment would have so far if its frames were
+  // not compressed.
+  size_t UncompressedByteCount() const { return header_size_ + frame_bytes_; }
+
+  // The total sizes of the blocks written so far, before and after they were
+  // compressed.
+  size_t uncompressed_block_bytes() const { return uncompressed_block_bytes_; }
+  size_t compressed_block_bytes() const { return compressed_block_bytes_; }
+
+  util::BufferedFileWriter *file() { return file_.get(); }
+
+ private:
+  SegmentWriter(std::unique_ptr<util::BufferedFileWriter> file,
+                CompressionPolicy compression_policy, size_t header_size);
+
+  // Appends |size| bytes of a frame, either to the file or to |block_|.
+  bool AppendFrameBytes(const char *data, size_t size);
+
+  // Writes a frame that holds the record with the given |field_number|,
+  // |metadata_id| and serialized |payload|.
+  bool WriteFrame(uint32_t field_number, uint32_t metadata_id,
+                  const std::string &payload);
+
+  std::unique_ptr<util::BufferedFileWriter> file_;
+  const CompressionPolicy compression_policy_;
+  const size_t header_size_;
+  size_t frame_bytes_ = 0;
+  // The frames that have not yet been compressed.
+  std::string block_;
+  std::string compressed_block_;
+  size_t uncompressed_block_bytes_ = 0;
+  size_t compressed_block_bytes_ = 0;
+  // Maps each serialized ObservationMetadata in the dictionary to its
+  // metadata id, which is its index in |batch_bytes_|.
+  std::unordered_map<std::string, uint32_t> metadata_ids_;
+  // The metadata id of each MetadataHandle passed to Append(), indexed by
+  // handle, or kNoMetadataId for the handles that have not been passed.
+  static constexpr uint32_t kNoMetadataId = UINT32_MAX;
+  std::vector<uint32_t> handle_metadata_ids_;
+  // The number of bytes of the ObservationBatch read for each metadata id.
+  std::vector<size_t> batch_bytes_;
+  uint32_t num_encrypted_observations_ = 0;
+  // Buffers that are reused for each record.
+  std::string payload_;
+  std::string frame_;
+};
+
+// A record read by a SegmentReader.
+struct SegmentRecord {
+  // ObservationStoreRecord::kMetaDataFieldNumber or
+  // ObservationStoreRecord::kEncryptedObservationFieldNumber.
+  uint32_t field_number;
+  // For a meta_data record, the metadata id it defines. For an
+  // encrypted_observation record, the metadata id of its ObservationMetadata.
+  uint32_t metadata_id;
+  // The serialized ObservationStoreRecord. Since the field numbers of
+  // ObservationStoreRecord are those of ObservationBatch, this is also the
+  // serialization of a field of an ObservationBatch.
+  const char *field;
+  size_t field_size;
+  // The serialized ObservationMetadata or EncryptedMessage.
+  const char *payload;
+  size_t payload_size;
+};
+
+// SegmentReader reads the records of a segment of any version without parsing
+// their payloads. Uncompressed segments are read in place. The blocks of a
+// compressed segment are decompressed by the first call to Next() into a
+// buffer owned by the SegmentReader.
+//
+// In a version 2 or 3 segment, frames whose checksum does not match are
+// skipped, as are the encrypted_observation records whose ObservationMetadata
+// was in such a frame. Likewise, a block whose checksum does not match is
+// skipped, and counted as a single skipped record. Reading stops at the first
+// frame or block whose size is corrupt, which is usually where an unfinished
+// segment was cut off. In a version 1 segment reading stops at the first
+// corrupt record.
+class SegmentReader {
+ public:
+  // |contents| must outlive the SegmentReader.
+  explicit SegmentReader(const util::FileContents &contents);
+
+  // Reads the next record into |record|. Returns false once there are no more
+  // records to read. The pointers in |record| remain valid as long as both the
+  // SegmentReader and the contents do.
+  bool Next(SegmentRecord *record);
+
+  // The version of the segment, or 0 if the header is corrupt or the version
+  // is not supported.
+  uint32_t version() const { return version_; }
+
+  // Returns the footer, or nullptr if the segment has no intact footer.
+  const SegmentFooter *footer() const {
+    return has_footer_ ? &footer_ : nullptr;
+  }
+
+  // Returns true if reading stopped before the end of the records.
+  bool corrupt() const { return corrupt_; }
+
+  // The number of records skipped so far.
+  size_t num_skipped_records() const { return num_skipped_records_; }
+
+ private:
+  bool NextV1(SegmentRecord *record);
+  bool NextV2(SegmentRecord *record);
+  // Decompresses the blocks of a version 3 segment into |blocks_|, and points
+  // |position_| and |end_| at them.
+  void ReadBlocks();
+  // Reads the ObservationStoreRecord in [|start|, |end|) into |record|.
+  bool ReadRecord(const char *start, const char *end, SegmentRecord *record);
+  bool Corrupt();
+
+  const char *position_;
+  const char *end_;
+  uint32_t version_ = 0;
+  // For a version 3 segment, the decompressed frames, and whether reading the
+  // blocks stopped at a corrupt one.
+  bool blocks_read_ = false;
+  bool blocks_corrupt_ = false;
+  std::string blocks_;
+  bool has_footer_ = false;
+  SegmentFooter footer_;
+  bool corrupt_ = false;
+  size_t num_skipped_records_ = 0;
+  // For a version 1 segment, the number of meta_data records read so far.
+  uint32_t num_metadata_ids_ = 0;
+  // For a version 2 or 3 segment, the metadata ids whose meta_data record was
+  // read intact.
+  std::unordered_set<uint32_t> metadata_ids_read_;
+};
+
+}  // namespace encoder
+}  // namespace cobalt
+
+#endif  // COBALT_ENCODER_OBSERVATION_SEGMENT_H_
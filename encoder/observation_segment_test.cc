@@ -0,0 +1,377 @@
+// Copyright 2018 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "encoder/observation_segment.h"
+
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "./envelope.pb.h"
+#include "./gtest.h"
+#include "third_party/protobuf/src/google/protobuf/io/coded_stream.h"
+#include "util/posix_file_system.h"
+
+namespace cobalt {
+namespace encoder {
+
+using google::protobuf::io::CodedOutputStream;
+using util::BufferedFileWriter;
+using util::DurabilityPolicy;
+using util::PosixFileSystem;
+
+namespace {
+
+ObservationMetadata MakeMetadata(uint32_t metric_id) {
+  ObservationMetadata metadata;
+  metadata.set_customer_id(1);
+  metadata.set_project_id(1);
+  metadata.set_metric_id(metric_id);
+  return metadata;
+}
+
+EncryptedMessage MakeMessage(const std::string &ciphertext) {
+  EncryptedMessage message;
+  message.set_ciphertext(ciphertext);
+  return message;
+}
+
+// Returns the serialization of |message| prefixed with its varint size.
+std::string Delimited(const google::protobuf::MessageLite &message) {
+  std::string serialized = message.SerializeAsString();
+  uint8_t size[5];
+  auto *end = CodedOutputStream::WriteVarint32ToArray(serialized.size(), size);
+  return std::string(reinterpret_cast<char *>(size), end - size) + serialized;
+}
+
+}  // namespace
+
+class ObservationSegmentTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    std::stringstream fname;
+    fname << "/tmp/observation_segment_test_"
+          << std::chrono::duration_cast<std::chrono::microseconds>(
+                 std::chrono::system_clock::now().time_since_epoch())
+                 .count();
+    file_name_ = fname.str();
+  }
+
+  void TearDown() override { fs_.Delete(file_name_); }
+
+  std::unique_ptr<SegmentWriter> CreateWriter(
+      CompressionPolicy compression_policy = CompressionPolicy()) {
+    auto writer = SegmentWriter::Create(
+        BufferedFileWriter::Open(&fs_, file_name_, DurabilityPolicy()),
+        compression_policy);
+    EXPECT_NE(nullptr, writer);
+    return writer;
+  }
+
+  // Appends one Observation for each of |metric_ids|, whose ciphertext is its
+  // index.
+  void Append(SegmentWriter *writer, const std::vector<uint32_t> &metric_ids) {
+    for (size_t i = 0; i < metric_ids.size(); i++) {
+      std::string metadata = MakeMetadata(metric_ids[i]).SerializeAsString();
+      ASSERT_TRUE(writer->Append(MakeMessage(std::to_string(i)), metadata));
+    }
+  }
+
+  std::string ReadFile() {
+    std::ifstream file(file_name_, std::ios::binary);
+    std::stringstream contents;
+    contents << file.rdbuf();
+    return contents.str();
+  }
+
+  void WriteFile(const std::string &contents) {
+    std::ofstream file(file_name_, std::ios::binary | std::ios::trunc);
+    file << contents;
+  }
+
+  std::unique_ptr<util::FileContents> MapFile() {
+    auto contents_or = fs_.MapFile(file_name_);
+    EXPECT_TRUE(contents_or.ok());
+    return contents_or.ConsumeValueOrDie();
+  }
+
+  // Reads all of the records of the segment into an Envelope, the way the
+  // FileObservationStore does. Each metadata id becomes a batch.
+  Envelope ReadEnvelope(SegmentReader *reader) {
+    Envelope envelope;
+    std::vector<ObservationBatch *> batches;
+    SegmentRecord record;
+    while (reader->Next(&record)) {
+      if (record.field_number == ObservationStoreRecord::kMetaDataFieldNumber) {
+        EXPECT_EQ(batches.size(), record.metadata_id);
+        batches.push_back(envelope.add_batch());
+        EXPECT_TRUE(batches.back()->mutable_meta_data()->ParseFromArray(
+            record.payload, record.payload_size));
+      } else {
+        EXPECT_LT(record.metadata_id, batches.size());
+        EXPECT_TRUE(batches[record.metadata_id]
+                        ->add_encrypted_observation()
+                        ->ParseFromArray(record.payload, record.payload_size));
+      }
+    }
+    return envelope;
+  }
+
+  PosixFileSystem fs_;
+  std::string file_name_;
+};
+
+// Tests that each ObservationMetadata is written once, and that the footer
+// describes the Envelope that the segment holds.
+TEST_F(ObservationSegmentTest, RoundTrip) {
+  auto writer = CreateWriter();
+  Append(writer.get(), {1, 2, 1, 2, 2});
+  ASSERT_TRUE(writer->Finish());
+
+  auto contents = MapFile();
+  SegmentReader reader(*contents);
+  EXPECT_EQ(kSegmentVersion, reader.version());
+  ASSERT_NE(nullptr, reader.footer());
+  EXPECT_EQ(2u, reader.footer()->num_meta_data());
+  EXPECT_EQ(5u, reader.footer()->num_encrypted_observations());
+
+  Envelope envelope = ReadEnvelope(&reader);
+  EXPECT_FALSE(reader.corrupt());
+  EXPECT_EQ(0u, reader.num_skipped_records());
+  ASSERT_EQ(2, envelope.batch_size());
+  EXPECT_EQ(1u, envelope.batch(0).meta_data().metric_id());
+  ASSERT_EQ(2, envelope.batch(0).encrypted_observation_size());
+  EXPECT_EQ("0", envelope.batch(0).encrypted_observation(0).ciphertext());
+  EXPECT_EQ("2", envelope.batch(0).encrypted_observation(1).ciphertext());
+  EXPECT_EQ(2u, envelope.batch(1).meta_data().metric_id());
+  ASSERT_EQ(3, envelope.batch(1).encrypted_observation_size());
+  EXPECT_EQ("4", envelope.batch(1).encrypted_observation(2).ciphertext());
+  EXPECT_EQ(envelope.ByteSizeLong(), reader.footer()->envelope_bytes());
+}
+
+// Tests that the usage passed to Finish() is recorded in the footer.
+TEST_F(ObservationSegmentTest, FooterRecordsUsage) {
+  auto writer = CreateWriter();
+  Append(writer.get(), {1, 2, 1});
+  MetricUsages usage;
+  auto *metric_usage = usage.Add();
+  metric_usage->set_customer_id(1);
+  metric_usage->set_project_id(1);
+  metric_usage->set_metric_id(1);
+  metric_usage->set_num_observations(2);
+  metric_usage->set_bytes(10);
+  metric_usage = usage.Add();
+  metric_usage->set_customer_id(1);
+  metric_usage->set_project_id(1);
+  metric_usage->set_metric_id(2);
+  metric_usage->set_num_observations(1);
+  metric_usage->set_bytes(5);
+  ASSERT_TRUE(writer->Finish(usage));
+
+  auto contents = MapFile();
+  SegmentReader reader(*contents);
+  ASSERT_NE(nullptr, reader.footer());
+  EXPECT_EQ(3u, reader.footer()->num_encrypted_observations());
+  ASSERT_EQ(2, reader.footer()->usage_size());
+  EXPECT_EQ(usage.Get(0).SerializeAsString(),
+            reader.footer()->usage(0).SerializeAsString());
+  EXPECT_EQ(usage.Get(1).SerializeAsString(),
+            reader.footer()->usage(1).SerializeAsString());
+  EXPECT_EQ(2, ReadEnvelope(&reader).batch_size());
+}
+
+// Tests that a segment that was never finished can be read without a footer.
+TEST_F(ObservationSegmentTest, Unfinished) {
+  auto writer = CreateWriter();
+  Append(writer.get(), {1, 1, 1});
+  EXPECT_EQ(3u, writer->footer().num_encrypted_observations());
+  ASSERT_TRUE(writer->file()->Flush());
+
+  auto contents = MapFile();
+  SegmentReader reader(*contents);
+  EXPECT_EQ(nullptr, reader.footer());
+  Envelope envelope = ReadEnvelope(&reader);
+  EXPECT_FALSE(reader.corrupt());
+  ASSERT_EQ(1, envelope.batch_size());
+  EXPECT_EQ(3, envelope.batch(0).encrypted_observation_size());
+  EXPECT_EQ(envelope.ByteSizeLong(), writer->footer().envelope_bytes());
+}
+
+// Tests that a record whose checksum does not match is skipped.
+TEST_F(ObservationSegmentTest, SkipsCorruptRecord) {
+  auto writer = CreateWriter();
+  Append(writer.get(), {1, 1, 1});
+  ASSERT_TRUE(writer->Finish());
+
+  // Corrupt the ciphertext "1" of the second Observation.
+  std::string contents = ReadFile();
+  size_t position = contents.find("\x1a\x01" "1");
+  ASSERT_NE(std::string::npos, position);
+  contents[position + 2] = '9';
+  WriteFile(contents);
+
+  auto mapped_contents = MapFile();
+  SegmentReader reader(*mapped_contents);
+  Envelope envelope = ReadEnvelope(&reader);
+  EXPECT_FALSE(reader.corrupt());
+  EXPECT_EQ(1u, reader.num_skipped_records());
+  ASSERT_EQ(1, envelope.batch_size());
+  ASSERT_EQ(2, envelope.batch(0).encrypted_observation_size());
+  EXPECT_EQ("0", envelope.batch(0).encrypted_observation(0).ciphertext());
+  EXPECT_EQ("2", envelope.batch(0).encrypted_observation(1).ciphertext());
+}
+
+// Tests that the Observations whose ObservationMetadata is corrupt are
+// skipped along with it.
+TEST_F(ObservationSegmentTest, SkipsObservationsOfCorruptMetadata) {
+  auto writer = CreateWriter();
+  Append(writer.get(), {1, 2, 1, 2});
+  ASSERT_TRUE(writer->Finish());
+
+  // Corrupt the metric_id of the second ObservationMetadata.
+  std::string contents = ReadFile();
+  size_t position = contents.find("\x18\x02");
+  ASSERT_NE(std::string::npos, position);
+  contents[position + 1] = '\x03';
+  WriteFile(contents);
+
+  auto mapped_contents = MapFile();
+  SegmentReader reader(*mapped_contents);
+  SegmentRecord record;
+  int num_records = 0;
+  while (reader.Next(&record)) {
+    EXPECT_EQ(0u, record.metadata_id);
+    num_records++;
+  }
+  EXPECT_EQ(3, num_records);
+  EXPECT_EQ(3u, reader.num_skipped_records());
+  EXPECT_FALSE(reader.corrupt());
+}
+
+// Tests that reading stops where a segment was cut off.
+TEST_F(ObservationSegmentTest, Truncated) {
+  auto writer = CreateWriter();
+  Append(writer.get(), {1, 1, 1});
+  ASSERT_TRUE(writer->Finish());
+
+  std::string contents = ReadFile();
+  WriteFile(contents.substr(0, contents.find("\x1a\x01" "2") + 2));
+
+  auto mapped_contents = MapFile();
+  SegmentReader reader(*mapped_contents);
+  EXPECT_EQ(nullptr, reader.footer());
+  Envelope envelope = ReadEnvelope(&reader);
+  EXPECT_TRUE(reader.corrupt());
+  ASSERT_EQ(1, envelope.batch_size());
+  EXPECT_EQ(2, envelope.batch(0).encrypted_observation_size());
+}
+
+// Tests that a version 1 segment can still be read.
+TEST_F(ObservationSegmentTest, ReadsVersion1) {
+  std::string contents;
+  for (uint32_t metric_id : {1, 2}) {
+    ObservationStoreRecord metadata_record;
+    *metadata_record.mutable_meta_data() = MakeMetadata(metric_id);
+    contents += Delimited(metadata_record);
+    for (int i = 0; i < 2; i++) {
+      ObservationStoreRecord message_record;
+      *message_record.mutable_encrypted_observation() =
+          MakeMessage(std::to_string(i));
+      contents += Delimited(message_record);
+    }
+  }
+  WriteFile(contents);
+
+  auto mapped_contents = MapFile();
+  SegmentReader reader(*mapped_contents);
+  EXPECT_EQ(1u, reader.version());
+  EXPECT_EQ(nullptr, reader.footer());
+  Envelope envelope = ReadEnvelope(&reader);
+  EXPECT_FALSE(reader.corrupt());
+  ASSERT_EQ(2, envelope.batch_size());
+  EXPECT_EQ(2u, envelope.batch(1).meta_data().metric_id());
+  EXPECT_EQ(2, envelope.batch(1).encrypted_observation_size());
+}
+
+// Tests that a compressed segment is read back, and that its footer can be
+// read without decompressing it.
+TEST_F(ObservationSegmentTest, Compressed) {
+  CompressionPolicy compression_policy;
+  compression_policy.mode = CompressionPolicy::kZlib;
+  compression_policy.block_size = 256;
+  auto writer = CreateWriter(compression_policy);
+  std::vector<uint32_t> metric_ids;
+  for (int i = 0; i < 100; i++) {
+    metric_ids.push_back(i % 3);
+  }
+  Append(writer.get(), metric_ids);
+  EXPECT_GT(writer->compressed_block_bytes(), 0u);
+  EXPECT_LT(writer->compressed_block_bytes(),
+            writer->uncompressed_block_bytes());
+  size_t uncompressed_byte_count = writer->UncompressedByteCount();
+  ASSERT_TRUE(writer->Finish());
+  EXPECT_LT(writer->ByteCount(), uncompressed_byte_count);
+
+  auto contents = MapFile();
+  SegmentReader reader(*contents);
+  EXPECT_EQ(kCompressedSegmentVersion, reader.version());
+  ASSERT_NE(nullptr, reader.footer());
+  EXPECT_EQ(100u, reader.footer()->num_encrypted_observations());
+  Envelope envelope = ReadEnvelope(&reader);
+  EXPECT_FALSE(reader.corrupt());
+  ASSERT_EQ(3, envelope.batch_size());
+  EXPECT_EQ(34, envelope.batch(0).encrypted_observation_size());
+  EXPECT_EQ("99", envelope.batch(0).encrypted_observation(33).ciphertext());
+  EXPECT_EQ(envelope.ByteSizeLong(), reader.footer()->envelope_bytes());
+}
+
+// Tests that a compressed block whose checksum does not match is skipped, and
+// that the Observations of later blocks can refer to the ObservationMetadata
+// of earlier blocks.
+TEST_F(ObservationSegmentTest, SkipsCorruptBlock) {
+  CompressionPolicy compression_policy;
+  compression_policy.mode = CompressionPolicy::kZlib;
+  auto writer = CreateWriter(compression_policy);
+  Append(writer.get(), {1, 1});
+  ASSERT_TRUE(writer->FlushBlock());
+  size_t second_block_start = writer->ByteCount();
+  Append(writer.get(), {1, 2});
+  ASSERT_TRUE(writer->FlushBlock());
+  Append(writer.get(), {1});
+  ASSERT_TRUE(writer->Finish());
+
+  // Corrupt the compressed bytes of the second block, after its 6 byte
+  // header.
+  std::string contents = ReadFile();
+  contents[second_block_start + 8] ^= 0xff;
+  WriteFile(contents);
+
+  auto mapped_contents = MapFile();
+  SegmentReader reader(*mapped_contents);
+  Envelope envelope = ReadEnvelope(&reader);
+  EXPECT_FALSE(reader.corrupt());
+  EXPECT_EQ(1u, reader.num_skipped_records());
+  ASSERT_EQ(1, envelope.batch_size());
+  ASSERT_EQ(3, envelope.batch(0).encrypted_observation_size());
+  EXPECT_EQ("1", envelope.batch(0).encrypted_observation(1).ciphertext());
+  EXPECT_EQ("0", envelope.batch(0).encrypted_observation(2).ciphertext());
+}
+
+TEST_F(ObservationSegmentTest, UnsupportedVersion) {
+  SegmentHeader header;
+  header.set_version(kSegmentVersion + 1);
+  WriteFile(std::string(kSegmentMagic, kSegmentMagicSize) + Delimited(header));
+
+  auto mapped_contents = MapFile();
+  SegmentReader reader(*mapped_contents);
+  EXPECT_EQ(0u, reader.version());
+  SegmentRecord record;
+  EXPECT_FALSE(reader.Next(&record));
+}
+
+}  // namespace encoder
+}  // namespace cobalt
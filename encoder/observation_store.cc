@@ -2,6 +2,7 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#include <algorithm>
 #include <utility>
 
 #include "./logging.h"
@@ -22,6 +23,166 @@ ObservationStore::ObservationStore(size_t max_bytes_per_observation,
   CHECK_LE(0, max_bytes_per_envelope_);
 }
 
+ObservationStoreWriterInterface::StoreStatus
+ObservationStoreWriterInterface::AddEncryptedObservations(
+    std::vector<EncryptedObservation> observations, size_t* num_added) {
+  CHECK(num_added);
+  *num_added = 0;
+  StoreStatus first_failure = kOk;
+  for (auto& observation : observations) {
+    auto status = AddEncryptedObservationByHandle(
+        std::move(observation.message), observation.metadata);
+    if (status == kOk) {
+      (*num_added)++;
+    } else if (first_failure == kOk) {
+      first_failure = status;
+    }
+  }
+  return first_failure;
+}
+
+MetadataHandle ObservationStore::RegisterMetadata(
+    const ObservationMetadata& metadata) {
+  return metadata_registry_.Register(metadata);
+}
+
+const MetadataRegistry::Entry* ObservationStore::GetRegisteredMetadata(
+    MetadataHandle handle) const {
+  auto entry = metadata_registry_.Get(handle);
+  if (entry == nullptr) {
+    LOG(ERROR) << "An unknown metadata handle was passed to the "
+                  "ObservationStore: "
+               << handle;
+  }
+  return entry;
+}
+
+void ObservationStore::Usage::Add(const ObservationMetadata& metadata,
+                                  size_t bytes) {
+  auto& count = metrics[MetricKey(metadata.customer_id(),
+                                  metadata.project_id(), metadata.metric_id())];
+  count.num_observations++;
+  count.bytes += bytes;
+}
+
+void ObservationStore::Usage::Add(const Usage& other) {
+  for (const auto& metric : other.metrics) {
+    auto& count = metrics[metric.first];
+    count.num_observations += metric.second.num_observations;
+    count.bytes += metric.second.bytes;
+  }
+}
+
+size_t ObservationStore::ObservationSize(const EncryptedMessage& message) {
+  // "+1" below is for the |scheme| field of EncryptedMessage.
+  return message.ciphertext().size() + message.public_key_fingerprint().size() +
+         1;
+}
+
+ObservationStore::Usage ObservationStore::EnvelopeUsage(
+    const Envelope& envelope) {
+  Usage usage;
+  for (const auto& batch : envelope.batch()) {
+    for (const auto& message : batch.encrypted_observation()) {
+      usage.Add(batch.meta_data(), ObservationSize(message));
+    }
+  }
+  return usage;
+}
+
+void ObservationStore::SetQuotaPolicy(QuotaPolicy policy) {
+  std::lock_guard<std::mutex> lock(quota_mutex_);
+  quota_policy_ = std::move(policy);
+}
+
+std::map<ObservationStore::ProjectKey, ObservationStore::ProjectStats>
+ObservationStore::GetProjectStats() const {
+  std::lock_guard<std::mutex> lock(quota_mutex_);
+  return project_stats_;
+}
+
+ObservationStore::Priority ObservationStore::GetPriority(
+    const ObservationMetadata& metadata) const {
+  std::lock_guard<std::mutex> lock(quota_mutex_);
+  auto priority = quota_policy_.metric_priorities.find(MetricKey(
+      metadata.customer_id(), metadata.project_id(), metadata.metric_id()));
+  if (priority == quota_policy_.metric_priorities.end()) {
+    return kDefaultPriority;
+  }
+  return priority->second;
+}
+
+ObservationStore::Priority ObservationStore::GetPriority(
+    const Usage& usage) const {
+  if (usage.metrics.empty()) {
+    return kHighPriority;
+  }
+  std::lock_guard<std::mutex> lock(quota_mutex_);
+  Priority highest = kLowPriority;
+  for (const auto& metric : usage.metrics) {
+    auto priority = quota_policy_.metric_priorities.find(metric.first);
+    if (priority == quota_policy_.metric_priorities.end()) {
+      highest = std::max(highest, kDefaultPriority);
+    } else {
+      highest = std::max(highest, priority->second);
+    }
+  }
+  return highest;
+}
+
+bool ObservationStore::ReserveProjectBytes(const ObservationMetadata& metadata,
+                                           size_t bytes) {
+  ProjectKey project(metadata.customer_id(), metadata.project_id());
+  std::lock_guard<std::mutex> lock(quota_mutex_);
+  auto& stats = project_stats_[project];
+  size_t max_bytes = quota_policy_.max_bytes_per_project;
+  auto project_max_bytes = quota_policy_.project_max_bytes.find(project);
+  if (project_max_bytes != quota_policy_.project_max_bytes.end()) {
+    max_bytes = project_max_bytes->second;
+  }
+  if (max_bytes > 0 && stats.bytes + bytes > max_bytes) {
+    VLOG(4) << "Rejecting an Observation of project (" << project.first << ", "
+            << project.second << ") because it is over its quota. ("
+            << stats.bytes + bytes << " > " << max_bytes << ")";
+    stats.num_dropped++;
+    return false;
+  }
+  stats.bytes += bytes;
+  return true;
+}
+
+void ObservationStore::UnreserveProjectBytes(
+    const ObservationMetadata& metadata, size_t bytes, bool dropped) {
+  std::lock_guard<std::mutex> lock(quota_mutex_);
+  auto& stats = project_stats_[ProjectKey(metadata.customer_id(),
+                                          metadata.project_id())];
+  stats.bytes -= std::min(stats.bytes, bytes);
+  if (dropped) {
+    stats.num_dropped++;
+  }
+}
+
+void ObservationStore::RecordRemoved(const Usage& usage, bool evicted) {
+  std::lock_guard<std::mutex> lock(quota_mutex_);
+  for (const auto& metric : usage.metrics) {
+    auto& stats = project_stats_[ProjectKey(std::get<0>(metric.first),
+                                            std::get<1>(metric.first))];
+    stats.bytes -= std::min(stats.bytes, metric.second.bytes);
+    if (evicted) {
+      stats.num_evicted += metric.second.num_observations;
+    }
+  }
+}
+
+void ObservationStore::RecordAdded(const Usage& usage) {
+  std::lock_guard<std::mutex> lock(quota_mutex_);
+  for (const auto& metric : usage.metrics) {
+    project_stats_[ProjectKey(std::get<0>(metric.first),
+                              std::get<1>(metric.first))]
+        .bytes += metric.second.bytes;
+  }
+}
+
 bool ObservationStore::IsAlmostFull() const {
   return Size() > almost_full_threshold_;
 }
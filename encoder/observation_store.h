@@ -6,13 +6,18 @@
 #define COBALT_ENCODER_OBSERVATION_STORE_H_
 
 #include <deque>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <tuple>
+#include <utility>
 #include <vector>
 
 #include "./envelope.pb.h"
 #include "./observation.pb.h"
 #include "./observation_batch.pb.h"
+#include "encoder/metadata_registry.h"
 
 namespace cobalt {
 namespace encoder {
@@ -40,6 +45,40 @@ class ObservationStoreWriterInterface {
   virtual StoreStatus AddEncryptedObservation(
       std::unique_ptr<EncryptedMessage> message,
       std::unique_ptr<ObservationMetadata> metadata) = 0;
+
+  // Registers |metadata| with the store and returns a handle that may be
+  // passed to AddEncryptedObservationByHandle() and AddEncryptedObservations()
+  // in its place. Registering equal metadata again returns the same handle,
+  // and handles remain valid for the lifetime of the store. A writer that adds
+  // many Observations with the same metadata should register it once, which
+  // spares the store from serializing and hashing the metadata of every
+  // Observation.
+  virtual MetadataHandle RegisterMetadata(
+      const ObservationMetadata& metadata) = 0;
+
+  // Adds an encrypted Observation whose ObservationMetadata was registered as
+  // |metadata| by RegisterMetadata(). Returns kWriteFailed if |metadata| was
+  // not returned by RegisterMetadata().
+  virtual StoreStatus AddEncryptedObservationByHandle(
+      std::unique_ptr<EncryptedMessage> message, MetadataHandle metadata) = 0;
+
+  // An encrypted Observation together with the handle of its metadata.
+  struct EncryptedObservation {
+    std::unique_ptr<EncryptedMessage> message;
+    MetadataHandle metadata;
+  };
+
+  // Adds each of the given (encrypted observation, metadata handle) pairs to
+  // the store, in order. An attempt is made to add every pair even if adding
+  // an earlier one fails. Returns kOk if all of them were added and otherwise
+  // the status of the first failure. |*num_added| is set to the number of
+  // pairs that were added.
+  //
+  // The default implementation invokes AddEncryptedObservationByHandle() for
+  // each pair. Implementations should override this in order to amortize
+  // their per-call overhead, such as acquiring a lock, across the batch.
+  virtual StoreStatus AddEncryptedObservations(
+      std::vector<EncryptedObservation> observations, size_t* num_added);
 };
 
 // ObservationStore is an abstract interface to an underlying store of encrypted
@@ -56,8 +95,55 @@ class ObservationStoreWriterInterface {
 // data is also deleted. If the underlying data should not be deleted (e.g. if
 // the upload failed), the EnvelopeHolder should be placed back into the
 // ObservationStore using the ReturnEnvelopeHolder() method.
+//
+// The store may be given a QuotaPolicy, which limits the bytes of the
+// Observations of each (customer, project) in the store and assigns priorities
+// to metrics. An Observation that would take its project over its quota is
+// rejected with kStoreFull, whatever the size of the store. When the store is
+// full, an Observation is not rejected as long as room can be made for it by
+// evicting the oldest finalized Envelopes whose Observations all have a lower
+// priority than its own. The data that is being added to the next Envelope is
+// never evicted. GetProjectStats() reports the bytes that each project has in
+// the store and the number of its Observations that were rejected or evicted.
 class ObservationStore : public ObservationStoreWriterInterface {
  public:
+  // A (customer_id, project_id) pair.
+  using ProjectKey = std::pair<uint32_t, uint32_t>;
+  // A (customer_id, project_id, metric_id) triple.
+  using MetricKey = std::tuple<uint32_t, uint32_t, uint32_t>;
+
+  // The priority classes of metrics.
+  enum Priority {
+    kLowPriority = 0,
+    kDefaultPriority,
+    kHighPriority,
+  };
+
+  struct QuotaPolicy {
+    // The maximum number of bytes of the Observations of any one project in
+    // the store, or 0 for no limit.
+    size_t max_bytes_per_project = 0;
+    // Overrides |max_bytes_per_project| for particular projects.
+    std::map<ProjectKey, size_t> project_max_bytes;
+    // The priorities of particular metrics. The other metrics have
+    // kDefaultPriority.
+    std::map<MetricKey, Priority> metric_priorities;
+  };
+
+  struct ProjectStats {
+    // The number of bytes of the project's Observations in the store, counted
+    // as the EnvelopeMaker counts them. The Observations of the
+    // EnvelopeHolders that have been taken, and not returned, are not in the
+    // store.
+    size_t bytes = 0;
+    // The number of the project's Observations that were rejected with
+    // kStoreFull, because of its quota or because the store was full.
+    size_t num_dropped = 0;
+    // The number of the project's Observations that were evicted from the
+    // store to make room for Observations of a higher priority.
+    size_t num_evicted = 0;
+  };
+
   // EnvelopeHolder holds a reference to a single Envelope and its underlying
   // data storage. An instance of EnvelopeHolder is considered to own its
   // Envelope. When EnvelopeHolder is deleted, the underlying data storage for
@@ -81,6 +167,15 @@ class ObservationStore : public ObservationStoreWriterInterface {
     // disk.
     virtual const Envelope& GetEnvelope() = 0;
 
+    // Writes the serialized Envelope owned by this EnvelopeHolder to
+    // |serialized_envelope|. This is equivalent to serializing the result of
+    // GetEnvelope(), but implementations may produce the serialized Envelope
+    // without constructing it. Returns false if the Envelope could not be
+    // serialized.
+    virtual bool SerializeEnvelope(std::string* serialized_envelope) {
+      return GetEnvelope().SerializeToString(serialized_envelope);
+    }
+
     // Returns an estimated size on the wire of the resulting Envelope owned by
     // thes EnvelopeHolder.
     virtual size_t Size() = 0;
@@ -125,6 +220,9 @@ class ObservationStore : public ObservationStoreWriterInterface {
       std::unique_ptr<EncryptedMessage> message,
       std::unique_ptr<ObservationMetadata> metadata) = 0;
 
+  // Registers |metadata| with the MetadataRegistry of the store.
+  MetadataHandle RegisterMetadata(const ObservationMetadata& metadata) override;
+
   // Returns the next EnvelopeHolder from the list of EnvelopeHolders in the
   // store. If there are no more EnvelopeHolders available, this will return
   // nullptr. A given EnvelopeHolder will only be returned from this function
@@ -145,14 +243,89 @@ class ObservationStore : public ObservationStoreWriterInterface {
   // Returns an approximation of the size of all the data in the store.
   virtual size_t Size() const = 0;
 
+  size_t max_bytes_total() const { return max_bytes_total_; }
+
   // Returns wether or not the store is entirely empty.
   virtual bool Empty() const = 0;
 
+  // Replaces the QuotaPolicy of the store, which initially has no quotas and
+  // gives all metrics kDefaultPriority. The new quotas only apply to the
+  // Observations that are added afterwards.
+  void SetQuotaPolicy(QuotaPolicy policy);
+
+  // Returns the ProjectStats of each project that has added an Observation to
+  // the store.
+  std::map<ProjectKey, ProjectStats> GetProjectStats() const;
+
  protected:
+  // The number and the bytes of the Observations of each metric in a part of
+  // the store, such as an Envelope.
+  struct Usage {
+    struct Count {
+      size_t num_observations = 0;
+      size_t bytes = 0;
+    };
+
+    // Counts an Observation of |bytes| bytes with |metadata|.
+    void Add(const ObservationMetadata& metadata, size_t bytes);
+    // Counts the Observations counted by |other|.
+    void Add(const Usage& other);
+
+    std::map<MetricKey, Count> metrics;
+  };
+
+  // Returns the size of |message| as the EnvelopeMaker counts it.
+  static size_t ObservationSize(const EncryptedMessage& message);
+
+  // Returns the Usage of the Observations of |envelope|.
+  static Usage EnvelopeUsage(const Envelope& envelope);
+
+  // Returns the priority of the metric of |metadata|.
+  Priority GetPriority(const ObservationMetadata& metadata) const;
+
+  // Returns the highest priority of the metrics of |usage|. Returns
+  // kHighPriority if |usage| is empty, so that data whose Observations are
+  // unknown is never evicted.
+  Priority GetPriority(const Usage& usage) const;
+
+  // Adds |bytes| to the bytes of the project of |metadata|, unless that would
+  // take it over its quota, in which case the Observation is counted as
+  // dropped and false is returned.
+  bool ReserveProjectBytes(const ObservationMetadata& metadata, size_t bytes);
+
+  // Undoes ReserveProjectBytes(), for an Observation that was not added to the
+  // store after all. If |dropped|, it is counted as dropped.
+  void UnreserveProjectBytes(const ObservationMetadata& metadata, size_t bytes,
+                             bool dropped);
+
+  // Records that the Observations of |usage| have left the store, either
+  // because they were taken or, if |evicted|, because they were evicted.
+  void RecordRemoved(const Usage& usage, bool evicted);
+
+  // Records that the Observations of |usage| are in the store again, or were
+  // found in it.
+  void RecordAdded(const Usage& usage);
+
+  // Returns the entry of the metadata that was registered as |handle| by
+  // RegisterMetadata(), or nullptr, after logging an error, if |handle| was
+  // not returned by RegisterMetadata().
+  const MetadataRegistry::Entry* GetRegisteredMetadata(
+      MetadataHandle handle) const;
+
   const size_t max_bytes_per_observation_;
   const size_t max_bytes_per_envelope_;
   const size_t max_bytes_total_;
   const size_t almost_full_threshold_;
+
+  // The metadata registered with RegisterMetadata().
+  MetadataRegistry metadata_registry_;
+
+ private:
+  // Guards |quota_policy_| and |project_stats_|. It is never held while
+  // acquiring another lock.
+  mutable std::mutex quota_mutex_;
+  QuotaPolicy quota_policy_;
+  std::map<ProjectKey, ProjectStats> project_stats_;
 };
 
 }  // namespace encoder
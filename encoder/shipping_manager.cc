@@ -2,8 +2,14 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#include <condition_variable>
+#include <deque>
+#include <map>
 #include <mutex>
+#include <string>
+#include <thread>
 #include <utility>
+#include <vector>
 
 #include "./clearcut_extensions.pb.h"
 #include "./logging.h"
@@ -36,12 +42,18 @@ grpc::Status CobaltStatusToGrpcStatus(util::Status status) {
 ShippingManager::ShippingManager(
     const UploadScheduler& upload_scheduler,
     ObservationStore* observation_store,
-    util::EncryptedMessageMaker* encrypt_to_shuffler)
+    util::EncryptedMessageMaker* encrypt_to_shuffler,
+    size_t max_concurrent_sends)
     : upload_scheduler_(upload_scheduler),
       next_scheduled_send_time_(std::chrono::system_clock::now() +
                                 upload_scheduler_.Interval()),
-      encrypt_to_shuffler_(encrypt_to_shuffler) {
+      encrypt_to_shuffler_(encrypt_to_shuffler),
+      max_concurrent_sends_(max_concurrent_sends) {
   CHECK(observation_store);
+  CHECK_GT(max_concurrent_sends_, 0u);
+  for (size_t i = 0; i < max_concurrent_sends_; i++) {
+    cancel_handles_.emplace_back(new send_retryer::CancelHandle());
+  }
   _mutex_protected_fields_do_not_access_directly_.observation_store =
       observation_store;
 }
@@ -53,6 +65,17 @@ ShippingManager::~ShippingManager() {
   ShutDown();
   VLOG(4) << "ShippingManager waiting for worker thread to exit...";
   worker_thread_.join();
+
+  // The worker thread no longer hands out jobs, so the sender threads exit
+  // once they have finished the jobs they were given.
+  {
+    std::lock_guard<std::mutex> lock(pipeline_.mutex);
+    pipeline_.shut_down = true;
+    pipeline_.job_available.notify_all();
+  }
+  for (auto& sender_thread : sender_threads_) {
+    sender_thread.join();
+  }
 }
 
 void ShippingManager::Start() {
@@ -65,6 +88,14 @@ void ShippingManager::Start() {
     locked->fields->waiting_for_schedule = false;
   }
 
+  if (max_concurrent_sends_ > 1) {
+    for (auto& cancel_handle : cancel_handles_) {
+      auto cancel_handle_ptr = cancel_handle.get();
+      sender_threads_.emplace_back(
+          [this, cancel_handle_ptr] { this->RunSender(cancel_handle_ptr); });
+    }
+  }
+
   std::thread t([this] { this->Run(); });
   worker_thread_ = std::move(t);
 }
@@ -124,7 +155,9 @@ bool ShippingManager::shut_down() { return lock()->fields->shut_down; }
 void ShippingManager::ShutDown() {
   {
     auto locked = lock();
-    cancel_handle_.TryCancel();
+    for (auto& cancel_handle : cancel_handles_) {
+      cancel_handle->TryCancel();
+    }
     locked->fields->shut_down = true;
     locked->fields->shutdown_notifier.notify_all();
     locked->fields->add_observation_notifier.notify_all();
@@ -200,11 +233,19 @@ void ShippingManager::Run() {
           locked->fields->expedited_send_requested) {
         VLOG(4) << "ShippingManager worker: time to send now.";
         locked->fields->expedited_send_requested = false;
+        upload_scheduler_.RecordStoreSize(
+            locked->fields->observation_store->Size(),
+            locked->fields->observation_store->max_bytes_total());
         locked->lock.unlock();
-        SendAllEnvelopes();
+        auto send_start_time = std::chrono::steady_clock::now();
+        bool success = SendAllEnvelopes();
+        auto latency = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - send_start_time);
+        locked->lock.lock();
+        upload_scheduler_.RecordSendResult(
+            success, latency, locked->fields->observation_store->Size());
         next_scheduled_send_time_ =
             std::chrono::system_clock::now() + upload_scheduler_.Interval();
-        locked->lock.lock();
       } else {
         // Wait until the next scheduled send time or until notified of
         // a new request for an expedited send or we are shut down.
@@ -225,8 +266,15 @@ void ShippingManager::Run() {
   }
 }
 
-void ShippingManager::SendAllEnvelopes() {
+bool ShippingManager::SendAllEnvelopes() {
   VLOG(5) << "ShippingManager: SendAllEnvelopes().";
+  if (max_concurrent_sends_ > 1) {
+    bool success = SendAllEnvelopesPipelined();
+    auto locked = lock();
+    InvokeSendCallbacksLockHeld(locked->fields, success);
+    return success;
+  }
+
   bool success = true;
   size_t failures_without_success = 0;
   // Loop through all envelopes in the ObservationStore.
@@ -236,7 +284,8 @@ void ShippingManager::SendAllEnvelopes() {
       // No more envelopes in the store, we can exit the loop.
       break;
     }
-    auto failed_holder = SendEnvelopeToBackend(std::move(holder));
+    auto failed_holder =
+        SendEnvelopeToBackend(std::move(holder), cancel_handles_[0].get());
     if (failed_holder == nullptr) {
       // The send succeeded.
       failures_without_success = 0;
@@ -260,6 +309,83 @@ void ShippingManager::SendAllEnvelopes() {
     auto locked = lock();
     InvokeSendCallbacksLockHeld(locked->fields, success);
   }
+  return success;
+}
+
+bool ShippingManager::SendAllEnvelopesPipelined() {
+  bool success = true;
+  size_t failures_without_success = 0;
+  uint64_t next_job = 0;
+  uint64_t next_to_retire = 0;
+  std::unique_lock<std::mutex> lock(pipeline_.mutex);
+  while (true) {
+    // Retire the results that are ready, in order.
+    while (!pipeline_.results.empty() &&
+           pipeline_.results.begin()->first == next_to_retire) {
+      auto failed_holder = std::move(pipeline_.results.begin()->second);
+      pipeline_.results.erase(pipeline_.results.begin());
+      next_to_retire++;
+      if (failed_holder == nullptr) {
+        failures_without_success = 0;
+      } else {
+        success = false;
+        failures_without_success++;
+        this->lock()->fields->observation_store->ReturnEnvelopeHolder(
+            std::move(failed_holder));
+      }
+    }
+    size_t num_in_flight = next_job - next_to_retire;
+
+    if (failures_without_success >= kMaxFailuresWithoutSuccess) {
+      VLOG(4) << "ShippingManager::SendAllEnvelopes(): failed too many times ("
+              << failures_without_success << "). Stopping uploads.";
+      if (num_in_flight == 0) {
+        break;
+      }
+    } else if (num_in_flight < max_concurrent_sends_) {
+      lock.unlock();
+      auto holder =
+          this->lock()->fields->observation_store->TakeNextEnvelopeHolder();
+      lock.lock();
+      if (holder != nullptr) {
+        pipeline_.jobs.emplace_back(next_job++, std::move(holder));
+        pipeline_.job_available.notify_one();
+        continue;
+      }
+      if (num_in_flight == 0) {
+        // No more envelopes in the store and none in flight.
+        break;
+      }
+      // The store may be given back an Envelope whose send fails, so it is
+      // consulted again once the next result has been retired.
+    }
+
+    pipeline_.send_finished.wait(lock, [this, next_to_retire] {
+      return !pipeline_.results.empty() &&
+             pipeline_.results.begin()->first == next_to_retire;
+    });
+  }
+  return success;
+}
+
+void ShippingManager::RunSender(send_retryer::CancelHandle* cancel_handle) {
+  std::unique_lock<std::mutex> lock(pipeline_.mutex);
+  while (true) {
+    pipeline_.job_available.wait(lock, [this] {
+      return pipeline_.shut_down || !pipeline_.jobs.empty();
+    });
+    if (pipeline_.jobs.empty()) {
+      return;
+    }
+    auto job = std::move(pipeline_.jobs.front());
+    pipeline_.jobs.pop_front();
+    lock.unlock();
+    auto failed_holder =
+        SendEnvelopeToBackend(std::move(job.second), cancel_handle);
+    lock.lock();
+    pipeline_.results.emplace(job.first, std::move(failed_holder));
+    pipeline_.send_finished.notify_all();
+  }
 }
 
 void ShippingManager::InvokeSendCallbacksLockHeld(MutexProtectedFields* fields,
@@ -277,18 +403,22 @@ LegacyShippingManager::LegacyShippingManager(
     ObservationStore* observation_store,
     util::EncryptedMessageMaker* encrypt_to_shuffler,
     const SendRetryerParams send_retryer_params,
-    SendRetryerInterface* send_retryer)
-    : ShippingManager(upload_scheduler, observation_store, encrypt_to_shuffler),
+    SendRetryerInterface* send_retryer, size_t max_concurrent_sends)
+    : ShippingManager(upload_scheduler, observation_store, encrypt_to_shuffler,
+                      max_concurrent_sends),
       send_retryer_params_(send_retryer_params),
       send_retryer_(send_retryer) {
   CHECK(send_retryer_);
 }
 
 std::unique_ptr<EnvelopeHolder> LegacyShippingManager::SendEnvelopeToBackend(
-    std::unique_ptr<EnvelopeHolder> envelope_to_send) {
+    std::unique_ptr<EnvelopeHolder> envelope_to_send,
+    send_retryer::CancelHandle* cancel_handle) {
+  std::string serialized_envelope;
   EncryptedMessage encrypted_envelope;
-  if (!encrypt_to_shuffler_->Encrypt(envelope_to_send->GetEnvelope(),
-                                     &encrypted_envelope)) {
+  if (!envelope_to_send->SerializeEnvelope(&serialized_envelope) ||
+      !encrypt_to_shuffler_->EncryptSerialized(std::move(serialized_envelope),
+                                               &encrypted_envelope)) {
     // TODO(rudominer) log
     // Drop on floor.
     return nullptr;
@@ -297,7 +427,7 @@ std::unique_ptr<EnvelopeHolder> LegacyShippingManager::SendEnvelopeToBackend(
           << envelope_to_send->Size() << " bytes to legacy backend.";
   auto status = send_retryer_->SendToShuffler(
       send_retryer_params_.initial_rpc_deadline_,
-      send_retryer_params_.deadline_per_send_attempt_, &cancel_handle_,
+      send_retryer_params_.deadline_per_send_attempt_, cancel_handle,
       encrypted_envelope);
   {
     auto locked = lock();
@@ -322,16 +452,21 @@ ClearcutV1ShippingManager::ClearcutV1ShippingManager(
     const UploadScheduler& upload_scheduler,
     ObservationStore* observation_store,
     util::EncryptedMessageMaker* encrypt_to_shuffler,
-    std::unique_ptr<clearcut::ClearcutUploader> clearcut)
-    : ShippingManager(upload_scheduler, observation_store, encrypt_to_shuffler),
+    std::unique_ptr<clearcut::ClearcutUploader> clearcut,
+    size_t max_concurrent_sends)
+    : ShippingManager(upload_scheduler, observation_store, encrypt_to_shuffler,
+                      max_concurrent_sends),
       clearcut_(std::move(clearcut)) {}
 
 std::unique_ptr<EnvelopeHolder>
 ClearcutV1ShippingManager::SendEnvelopeToBackend(
-    std::unique_ptr<EnvelopeHolder> envelope_to_send) {
+    std::unique_ptr<EnvelopeHolder> envelope_to_send,
+    send_retryer::CancelHandle* cancel_handle) {
+  std::string serialized_envelope;
   auto log_extension = std::make_unique<LogEventExtension>();
-  if (!encrypt_to_shuffler_->Encrypt(
-          envelope_to_send->GetEnvelope(),
+  if (!envelope_to_send->SerializeEnvelope(&serialized_envelope) ||
+      !encrypt_to_shuffler_->EncryptSerialized(
+          std::move(serialized_envelope),
           log_extension->mutable_cobalt_encrypted_envelope())) {
     // TODO(rudominer) log
     // Drop on floor.
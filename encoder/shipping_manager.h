@@ -9,6 +9,7 @@
 #include <chrono>
 #include <condition_variable>
 #include <deque>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <string>
@@ -48,6 +49,17 @@ using send_retryer::SendRetryerInterface;
 // Usually a single ShippingManager will be constructed for each shuffler
 // backend the client device wants to send to. All applications running on that
 // device use the same set of ShippingManagers.
+//
+// By default the worker thread sends one Envelope at a time: it reads the
+// Envelope from the ObservationStore, encrypts it, sends it and waits for the
+// result before it takes the next one. Optionally the sends are pipelined: a
+// pool of |max_concurrent_sends| sender threads, started by Start(), encrypts
+// and sends the Envelopes that the worker thread reads, so that the next
+// Envelopes are read and encrypted while earlier ones are in flight. The
+// sender threads live as long as the ShippingManager. The results are handled
+// in the order in which the Envelopes were taken from the store, so failed
+// Envelopes are returned to the store in the same order as they would be by
+// sequential sends.
 class ShippingManager : public ObservationStoreUpdateRecipient {
  public:
   // Constructor
@@ -59,17 +71,25 @@ class ShippingManager : public ObservationStoreUpdateRecipient {
   // observations.
   //
   // encrypt_to_shuffler: An util::EncryptedMessageMaker used to encrypt
-  // messages to the shuffler and the analyzer.
+  // messages to the shuffler and the analyzer. If |max_concurrent_sends| is
+  // greater than one it is invoked concurrently by the sender threads, which
+  // EncryptedMessageMaker supports.
+  //
+  // max_concurrent_sends: The maximum number of Envelopes that are being
+  // read, encrypted or sent at the same time. With the default of one, the
+  // Envelopes are sent sequentially by the worker thread.
   ShippingManager(const UploadScheduler& upload_scheduler,
                   ObservationStore* observation_store,
-                  util::EncryptedMessageMaker* encrypt_to_shuffler);
+                  util::EncryptedMessageMaker* encrypt_to_shuffler,
+                  size_t max_concurrent_sends = 1);
 
-  // The destructor will stop the worker thread and wait for it to stop
-  // before exiting.
+  // The destructor will stop the worker thread and the sender threads and wait
+  // for them to stop before exiting.
   virtual ~ShippingManager();
 
-  // Starts the worker thread. Destruct this object to stop the worker thread.
-  // This method must be invoked exactly once.
+  // Starts the worker thread, and the sender threads if |max_concurrent_sends|
+  // is greater than one. Destruct this object to stop them. This method must be
+  // invoked exactly once.
   void Start();
 
   void NotifyObservationsAdded() override;
@@ -128,13 +148,30 @@ class ShippingManager : public ObservationStoreUpdateRecipient {
   // exits when ShutDown() is invoked.
   void Run();
 
-  // Helper method used by Run(). Does not assume mutex_ lock is held.
-  void SendAllEnvelopes();
-
-  // Helper method used by Run(). Does not assume mutex_ lock is held.
+  // Helper method used by Run(). Does not assume mutex_ lock is held. Returns
+  // true if all of the sends succeeded.
+  bool SendAllEnvelopes();
+
+  // Implements SendAllEnvelopes() when |max_concurrent_sends_| is greater
+  // than one by handing the Envelopes to the sender threads. Returns true if
+  // all of the sends succeeded.
+  bool SendAllEnvelopesPipelined();
+
+  // The method run by each of the sender threads. |cancel_handle| is passed
+  // to SendEnvelopeToBackend(). Exits when |pipeline_.shut_down| is set and
+  // there are no more jobs.
+  void RunSender(send_retryer::CancelHandle* cancel_handle);
+
+  // Helper method used by SendAllEnvelopes(). Does not assume mutex_ lock is
+  // held. |cancel_handle| is used to cancel the send when the ShippingManager
+  // is shut down. Returns nullptr if the send succeeded, and otherwise the
+  // EnvelopeHolder that failed to be sent. If |max_concurrent_sends_| is
+  // greater than one, this is invoked concurrently, with a different
+  // |cancel_handle| for each concurrent invocation.
   virtual std::unique_ptr<ObservationStore::EnvelopeHolder>
   SendEnvelopeToBackend(
-      std::unique_ptr<ObservationStore::EnvelopeHolder> envelope_to_send) = 0;
+      std::unique_ptr<ObservationStore::EnvelopeHolder> envelope_to_send,
+      send_retryer::CancelHandle* cancel_handle) = 0;
 
   UploadScheduler upload_scheduler_;
 
@@ -145,13 +182,44 @@ class ShippingManager : public ObservationStoreUpdateRecipient {
  protected:
   util::EncryptedMessageMaker* encrypt_to_shuffler_;
 
-  send_retryer::CancelHandle cancel_handle_;  // Not protected by a mutex. Only
-                                              // accessed by the worker thread.
-
  private:
+  const size_t max_concurrent_sends_;
+
+  // One CancelHandle for each of the |max_concurrent_sends_| concurrent sends.
+  // These are not protected by a mutex. They are created by the constructor
+  // and are thread-safe.
+  std::vector<std::unique_ptr<send_retryer::CancelHandle>> cancel_handles_;
+
+  // The state shared by the worker thread and the sender threads. The worker
+  // thread takes the Envelopes from the store and hands them to the sender
+  // threads as jobs, numbered in the order in which they were taken. The
+  // sender threads post their results, which the worker thread retires in the
+  // same order.
+  struct SendPipeline {
+    typedef ObservationStore::EnvelopeHolder EnvelopeHolder;
+
+    // Protects access to all variables below.
+    std::mutex mutex;
+    std::condition_variable job_available;
+    std::condition_variable send_finished;
+    std::deque<std::pair<uint64_t, std::unique_ptr<EnvelopeHolder>>> jobs;
+    // The results of the sends that have not been retired, keyed by job
+    // number. A result is the EnvelopeHolder that failed to be sent, or
+    // nullptr if the send succeeded.
+    std::map<uint64_t, std::unique_ptr<EnvelopeHolder>> results;
+    // Set by the destructor, once the worker thread has exited, in order to
+    // stop the sender threads.
+    bool shut_down = false;
+  };
+  SendPipeline pipeline_;
+
   // The background worker thread that runs the method "Run()."
   std::thread worker_thread_;
 
+  // The |max_concurrent_sends_| sender threads that run "RunSender()", if
+  // |max_concurrent_sends_| is greater than one.
+  std::vector<std::thread> sender_threads_;
+
   // A struct that contains a mutex and all the fields we want to protect
   // with that mutex.
   struct MutexProtectedFields {
@@ -263,11 +331,15 @@ class LegacyShippingManager : public ShippingManager {
   // send_retryer: The instance of |SendRetryerInterface| encapsulated by
   // this ShippingManager. ShippingManager does not take ownership of
   // send_retryer which must outlive ShippingManager.
+  //
+  // max_concurrent_sends: See ShippingManager. |send_retryer| must support
+  // that many concurrent invocations of SendToShuffler().
   LegacyShippingManager(const UploadScheduler& upload_scheduler,
                         ObservationStore* observation_store,
                         util::EncryptedMessageMaker* encrypt_to_shuffler,
                         const SendRetryerParams send_retryer_params,
-                        SendRetryerInterface* send_retryer);
+                        SendRetryerInterface* send_retryer,
+                        size_t max_concurrent_sends = 1);
 
  private:
   const SendRetryerParams send_retryer_params_;
@@ -275,20 +347,27 @@ class LegacyShippingManager : public ShippingManager {
   SendRetryerInterface* send_retryer_;  // not owned
 
   std::unique_ptr<ObservationStore::EnvelopeHolder> SendEnvelopeToBackend(
-      std::unique_ptr<ObservationStore::EnvelopeHolder> envelope_to_send);
+      std::unique_ptr<ObservationStore::EnvelopeHolder> envelope_to_send,
+      send_retryer::CancelHandle* cancel_handle);
 };
 
+// ClearcutV1ShippingManager uses a ClearcutUploader to send Observations to
+// Clearcut. The uploads themselves are serialized, so with
+// |max_concurrent_sends| greater than one only the reading and encryption of
+// the Envelopes overlap with the uploads.
 class ClearcutV1ShippingManager : public ShippingManager {
  public:
   ClearcutV1ShippingManager(
       const UploadScheduler& upload_scheduler,
       ObservationStore* observation_store,
       util::EncryptedMessageMaker* encrypt_to_shuffler,
-      std::unique_ptr<::clearcut::ClearcutUploader> clearcut);
+      std::unique_ptr<::clearcut::ClearcutUploader> clearcut,
+      size_t max_concurrent_sends = 1);
 
  private:
   std::unique_ptr<ObservationStore::EnvelopeHolder> SendEnvelopeToBackend(
-      std::unique_ptr<ObservationStore::EnvelopeHolder> envelope_to_send);
+      std::unique_ptr<ObservationStore::EnvelopeHolder> envelope_to_send,
+      send_retryer::CancelHandle* cancel_handle);
 
   std::mutex clearcut_mutex_;
   std::unique_ptr<::clearcut::ClearcutUploader> clearcut_;
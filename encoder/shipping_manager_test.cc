@@ -25,6 +25,7 @@
 #include "encoder/shipping_manager_test_config.h"
 #include "third_party/clearcut/clearcut.pb.h"
 #include "third_party/gflags/include/gflags/gflags.h"
+#include "util/crypto_util/cipher.h"
 
 namespace cobalt {
 namespace encoder {
@@ -71,17 +72,22 @@ std::shared_ptr<ProjectContext> GetTestProject() {
 }
 
 struct FakeSendRetryer : public SendRetryerInterface {
-  explicit FakeSendRetryer(uint32_t metric_id = kDefaultMetricId)
-      : SendRetryerInterface(), metric_id(metric_id) {}
+  // |private_key_pem| is used to decrypt the Envelopes. It is empty if the
+  // NONE encryption scheme is used.
+  explicit FakeSendRetryer(uint32_t metric_id = kDefaultMetricId,
+                           const std::string& private_key_pem = "")
+      : SendRetryerInterface(),
+        metric_id(metric_id),
+        private_key_pem(private_key_pem) {}
 
   grpc::Status SendToShuffler(
       std::chrono::seconds initial_rpc_deadline,
       std::chrono::seconds overerall_deadline,
       send_retryer::CancelHandle* cancel_handle,
       const EncryptedMessage& encrypted_message) override {
-    // Decrypt encrypted_message. (No actual decryption is involved since
-    // we used the NONE encryption scheme.)
-    util::MessageDecrypter decrypter("");
+    // Decrypt encrypted_message. (No actual decryption is involved unless
+    // the test uses the HYBRID_ECDH_V1 encryption scheme.)
+    util::MessageDecrypter decrypter(private_key_pem);
     Envelope recovered_envelope;
     EXPECT_TRUE(
         decrypter.DecryptMessage(encrypted_message, &recovered_envelope));
@@ -115,6 +121,7 @@ struct FakeSendRetryer : public SendRetryerInterface {
   int send_call_count = 0;
   int observation_count = 0;
   uint32_t metric_id;
+  std::string private_key_pem;
 };
 
 class FakeHTTPClient : public clearcut::HTTPClient {
@@ -160,7 +167,8 @@ class FakeHTTPClient : public clearcut::HTTPClient {
 class ShippingManagerTest : public ::testing::Test {
  public:
   ShippingManagerTest()
-      : encrypt_to_shuffler_("", EncryptedMessage::NONE),
+      : encrypt_to_shuffler_(
+            new EncryptedMessageMaker("", EncryptedMessage::NONE)),
         encrypt_to_analyzer_("", EncryptedMessage::NONE),
         observation_store_(kMaxBytesPerObservation, kMaxBytesPerEnvelope,
                            kMaxBytesTotal),
@@ -170,26 +178,40 @@ class ShippingManagerTest : public ::testing::Test {
  protected:
   void Init(std::chrono::seconds schedule_interval,
             std::chrono::seconds min_interval,
-            uint32_t metric_id = kDefaultMetricId) {
-    send_retryer_.reset(new FakeSendRetryer(metric_id));
+            uint32_t metric_id = kDefaultMetricId,
+            size_t max_concurrent_sends = 1) {
+    send_retryer_.reset(
+        new FakeSendRetryer(metric_id, shuffler_private_key_pem_));
     UploadScheduler upload_scheduler(schedule_interval, min_interval);
     LegacyShippingManager::SendRetryerParams send_retryer_params(
         kInitialRpcDeadline, kDeadlinePerSendAttempt);
     if (metric_id == kDefaultMetricId) {
       shipping_manager_.reset(new LegacyShippingManager(
-          upload_scheduler, &observation_store_, &encrypt_to_shuffler_,
-          send_retryer_params, send_retryer_.get()));
+          upload_scheduler, &observation_store_, encrypt_to_shuffler_.get(),
+          send_retryer_params, send_retryer_.get(), max_concurrent_sends));
     } else {
       auto http_client = std::make_unique<FakeHTTPClient>();
       http_client_ = http_client.get();
       shipping_manager_.reset(new ClearcutV1ShippingManager(
-          upload_scheduler, &observation_store_, &encrypt_to_shuffler_,
+          upload_scheduler, &observation_store_, encrypt_to_shuffler_.get(),
           std::make_unique<clearcut::ClearcutUploader>(
-              "https://test.com", std::move(http_client))));
+              "https://test.com", std::move(http_client)),
+          max_concurrent_sends));
     }
     shipping_manager_->Start();
   }
 
+  // Makes the next invocation of Init() construct a ShippingManager that
+  // encrypts the Envelopes to the Shuffler using the HYBRID_ECDH_V1 scheme,
+  // and a FakeSendRetryer that decrypts them.
+  void UseHybridEncryption() {
+    std::string public_key_pem;
+    ASSERT_TRUE(crypto::HybridCipher::GenerateKeyPairPEM(
+        &public_key_pem, &shuffler_private_key_pem_));
+    encrypt_to_shuffler_.reset(new EncryptedMessageMaker(
+        public_key_pem, EncryptedMessage::HYBRID_ECDH_V1));
+  }
+
   ObservationStore::StoreStatus AddObservation(
       size_t num_bytes, uint32_t metric_id = kDefaultMetricId) {
     CHECK(num_bytes > kNoOpEncodingByteOverhead) << " num_bytes=" << num_bytes;
@@ -218,7 +240,8 @@ class ShippingManagerTest : public ::testing::Test {
     EXPECT_EQ(expected_observation_count, http_client_->observation_count);
   }
 
-  EncryptedMessageMaker encrypt_to_shuffler_;
+  std::unique_ptr<EncryptedMessageMaker> encrypt_to_shuffler_;
+  std::string shuffler_private_key_pem_;
   EncryptedMessageMaker encrypt_to_analyzer_;
   MemoryObservationStore observation_store_;
   FakeSystemData system_data_;
@@ -299,6 +322,79 @@ TEST_F(ShippingManagerTest, SendTwo) {
   CheckCallCount(1, 2);
 }
 
+// We add enough Observations to fill three Envelopes and send them with three
+// concurrent sends. We confirm that all of the Observations were sent.
+TEST_F(ShippingManagerTest, SendPipelined) {
+  Init(kMaxSeconds, std::chrono::seconds::zero(), kDefaultMetricId, 3);
+  for (int i = 0; i < 12; i++) {
+    EXPECT_EQ(ObservationStore::kOk, AddObservation(40));
+  }
+  CheckCallCount(0, 0);
+
+  shipping_manager_->RequestSendSoon();
+  shipping_manager_->WaitUntilIdle(kMaxSeconds);
+
+  EXPECT_EQ(3u, shipping_manager_->num_send_attempts());
+  EXPECT_EQ(0u, shipping_manager_->num_failed_attempts());
+  CheckCallCount(3, 12);
+  EXPECT_TRUE(observation_store_.Empty());
+}
+
+// Tests the concurrent sends with the HYBRID_ECDH_V1 encryption scheme, so
+// that the sender threads encrypt concurrently with a single
+// EncryptedMessageMaker. FakeSendRetryer checks that each Envelope decrypts.
+TEST_F(ShippingManagerTest, SendPipelinedHybridEncryption) {
+  UseHybridEncryption();
+  Init(kMaxSeconds, std::chrono::seconds::zero(), kDefaultMetricId, 3);
+  for (int i = 0; i < 12; i++) {
+    EXPECT_EQ(ObservationStore::kOk, AddObservation(40));
+  }
+
+  shipping_manager_->RequestSendSoon();
+  shipping_manager_->WaitUntilIdle(kMaxSeconds);
+
+  EXPECT_EQ(3u, shipping_manager_->num_send_attempts());
+  EXPECT_EQ(0u, shipping_manager_->num_failed_attempts());
+  CheckCallCount(3, 12);
+  EXPECT_TRUE(observation_store_.Empty());
+}
+
+// Tests that when the concurrent sends fail, the Envelopes are returned to the
+// ObservationStore and are sent once the sends start succeeding.
+TEST_F(ShippingManagerTest, SendPipelinedFailure) {
+  Init(kMaxSeconds, std::chrono::seconds::zero(), kDefaultMetricId, 3);
+  {
+    std::unique_lock<std::mutex> lock(send_retryer_->mutex);
+    send_retryer_->status_to_return = grpc::Status::CANCELLED;
+  }
+  for (int i = 0; i < 12; i++) {
+    EXPECT_EQ(ObservationStore::kOk, AddObservation(40));
+  }
+  size_t store_size = observation_store_.Size();
+
+  shipping_manager_->RequestSendSoon();
+  shipping_manager_->WaitUntilWorkerWaiting(kMaxSeconds);
+
+  // The number of attempts depends on the interleaving of the concurrent
+  // sends, but none of them succeeded and no Observation was lost.
+  EXPECT_LT(0u, shipping_manager_->num_send_attempts());
+  EXPECT_EQ(shipping_manager_->num_send_attempts(),
+            shipping_manager_->num_failed_attempts());
+  EXPECT_EQ(store_size, observation_store_.Size());
+
+  {
+    std::unique_lock<std::mutex> lock(send_retryer_->mutex);
+    send_retryer_->status_to_return = grpc::Status::OK;
+    send_retryer_->observation_count = 0;
+  }
+  shipping_manager_->RequestSendSoon();
+  shipping_manager_->WaitUntilIdle(kMaxSeconds);
+
+  std::unique_lock<std::mutex> lock(send_retryer_->mutex);
+  EXPECT_EQ(12, send_retryer_->observation_count);
+  EXPECT_TRUE(observation_store_.Empty());
+}
+
 // Trys to add an Observation that is too big. Tests that kObservationTooBig
 // is returned.
 TEST_F(ShippingManagerTest, ObservationTooBig) {
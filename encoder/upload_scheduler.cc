@@ -4,9 +4,21 @@
 
 #include "encoder/upload_scheduler.h"
 
+#include <algorithm>
+
 namespace cobalt {
 namespace encoder {
 
+namespace {
+
+// Returns the moving average |average| updated with |sample|, which has weight
+// |weight|.
+double MovingAverage(double average, double sample, double weight) {
+  return weight * sample + (1 - weight) * average;
+}
+
+}  // namespace
+
 // Definition of the static constant declared in shipping_manager.h.
 // This must be less than 2^31. There appears to be a bug in
 // std::condition_variable::wait_for() in which setting the wait time to
@@ -29,6 +41,23 @@ UploadScheduler::UploadScheduler(std::chrono::seconds target_interval,
                                  std::chrono::seconds min_interval)
     : UploadScheduler(target_interval, min_interval, target_interval) {}
 
+UploadScheduler::UploadScheduler(std::chrono::seconds target_interval,
+                                 std::chrono::seconds min_interval,
+                                 std::chrono::seconds initial_interval,
+                                 const AdaptivePolicy& policy)
+    : UploadScheduler(target_interval, min_interval, initial_interval) {
+  CHECK_GT(policy.target_fill_fraction, 0);
+  CHECK_LE(policy.target_fill_fraction, 1);
+  CHECK_GE(policy.jitter, 0);
+  CHECK_LT(policy.jitter, 1);
+  CHECK_GT(policy.smoothing, 0);
+  CHECK_LE(policy.smoothing, 1);
+  adaptive_ = true;
+  policy_ = policy;
+  clock_.reset(new util::SystemClock());
+  random_.seed(std::random_device()());
+}
+
 std::chrono::seconds UploadScheduler::Interval() {
   auto interval = current_interval_;
   if (current_interval_ < target_interval_) {
@@ -37,7 +66,89 @@ std::chrono::seconds UploadScheduler::Interval() {
       current_interval_ = target_interval_;
     }
   }
-  return interval;
+  if (!adaptive_) {
+    return interval;
+  }
+  if (consecutive_failures_ > 0) {
+    return BackOff(interval);
+  }
+  return ShortenUnderPressure(interval);
+}
+
+void UploadScheduler::RecordStoreSize(size_t store_bytes,
+                                      size_t capacity_bytes) {
+  if (!adaptive_) {
+    return;
+  }
+  store_bytes_ = store_bytes;
+  capacity_bytes_ = capacity_bytes;
+  if (!have_last_send_) {
+    return;
+  }
+  double seconds =
+      std::chrono::duration<double>(clock_->now() - last_send_time_).count();
+  if (seconds <= 0) {
+    return;
+  }
+  double added_bytes = store_bytes > last_send_store_bytes_
+                           ? store_bytes - last_send_store_bytes_
+                           : 0;
+  add_rate_ = MovingAverage(add_rate_, added_bytes / seconds,
+                            have_add_rate_ ? policy_.smoothing : 1);
+  have_add_rate_ = true;
+}
+
+void UploadScheduler::RecordSendResult(bool success,
+                                       std::chrono::milliseconds latency,
+                                       size_t store_bytes) {
+  if (!adaptive_) {
+    return;
+  }
+  latency_seconds_ =
+      MovingAverage(latency_seconds_,
+                    std::chrono::duration<double>(latency).count(),
+                    have_last_send_ ? policy_.smoothing : 1);
+  consecutive_failures_ = success ? 0 : consecutive_failures_ + 1;
+  store_bytes_ = store_bytes;
+  last_send_store_bytes_ = store_bytes;
+  last_send_time_ = clock_->now();
+  have_last_send_ = true;
+}
+
+std::chrono::seconds UploadScheduler::ShortenUnderPressure(
+    std::chrono::seconds interval) {
+  if (capacity_bytes_ == 0 || add_rate_ <= 0) {
+    return interval;
+  }
+  double target_bytes = policy_.target_fill_fraction * capacity_bytes_;
+  double seconds_to_target =
+      (target_bytes - store_bytes_) / add_rate_ - latency_seconds_;
+  if (seconds_to_target >= interval.count()) {
+    return interval;
+  }
+  return std::max(std::chrono::seconds(static_cast<int64_t>(
+                      std::max(seconds_to_target, 0.0))),
+                  min_interval_);
+}
+
+std::chrono::seconds UploadScheduler::BackOff(std::chrono::seconds interval) {
+  double max_backoff_seconds =
+      std::max(policy_.max_backoff_interval, target_interval_).count();
+  double backoff_seconds = interval.count();
+  for (size_t i = 1;
+       i < consecutive_failures_ && backoff_seconds < max_backoff_seconds;
+       i++) {
+    backoff_seconds *= 2;
+  }
+  backoff_seconds = std::min(backoff_seconds, max_backoff_seconds);
+  std::uniform_real_distribution<double> jitter(-policy_.jitter,
+                                                policy_.jitter);
+  backoff_seconds *= 1 + jitter(random_);
+  backoff_seconds =
+      std::max(backoff_seconds, static_cast<double>(min_interval_.count()));
+  backoff_seconds =
+      std::min(backoff_seconds, static_cast<double>(kMaxSeconds.count()));
+  return std::chrono::seconds(static_cast<int64_t>(backoff_seconds));
 }
 
 }  // namespace encoder
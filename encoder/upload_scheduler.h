@@ -6,8 +6,11 @@
 #define COBALT_ENCODER_UPLOAD_SCHEDULER_H_
 
 #include <chrono>
+#include <memory>
+#include <random>
 
 #include "./logging.h"
+#include "util/clock.h"
 
 namespace cobalt {
 namespace encoder {
@@ -18,6 +21,25 @@ namespace encoder {
 // is equal to target_interval. This allows us to start a cobalt client that
 // does its first upload quickly, but in the steady state uploads infrequently,
 // since the longer a device is up, the more likely it is to remain up.
+//
+// If it is given an AdaptivePolicy, Interval() also takes into account the
+// recent state of the ObservationStore and the outcome of the recent sends,
+// which ShippingManager reports through RecordStoreSize() and
+// RecordSendResult():
+//   - Under pressure, when the Observations are being added fast enough that
+//     the store is expected to fill beyond |target_fill_fraction| of its
+//     capacity before the next send, the interval is shortened so that the
+//     next send starts, allowing for the recent send latency, before that
+//     happens. It is never shortened below |min_interval|.
+//   - After consecutive failed sends the interval is doubled for each failure
+//     after the first, up to |max_backoff_interval|, and randomly perturbed by
+//     up to |jitter| of its value so that the clients that failed together do
+//     not retry together.
+// The rate at which Observations are added and the latency of the sends are
+// exponentially weighted moving averages of the reported samples.
+//
+// This object is not thread safe. ShippingManager only uses it from its worker
+// thread.
 class UploadScheduler {
  public:
   // Use this constant instead of std::chrono::seconds::max() in
@@ -48,13 +70,75 @@ class UploadScheduler {
   UploadScheduler(std::chrono::seconds target_interval,
                   std::chrono::seconds min_interval);
 
+  struct AdaptivePolicy {
+    // The fraction of the capacity of the store that it should not be
+    // expected to exceed by the time of the next send.
+    double target_fill_fraction = 0.5;
+    // The longest interval that consecutive failures back off to. It is
+    // raised to |target_interval| if it is shorter.
+    std::chrono::seconds max_backoff_interval = std::chrono::hours(4);
+    // The largest fraction of the interval by which it is perturbed after a
+    // failure. In [0, 1).
+    double jitter = 0.1;
+    // The weight of each new sample in the moving averages of the add rate
+    // and the send latency. In (0, 1].
+    double smoothing = 0.5;
+  };
+
+  // Constructs an adaptive UploadScheduler. See the class comment.
+  UploadScheduler(std::chrono::seconds target_interval,
+                  std::chrono::seconds min_interval,
+                  std::chrono::seconds initial_interval,
+                  const AdaptivePolicy& policy);
+
   std::chrono::seconds MinInterval() const { return min_interval_; }
   std::chrono::seconds Interval();
 
+  // Reports |store_bytes|, the size of the ObservationStore, and
+  // |capacity_bytes|, its capacity, just before a send. The Observations added
+  // since the end of the previous send give a sample of the add rate.
+  void RecordStoreSize(size_t store_bytes, size_t capacity_bytes);
+
+  // Reports the outcome of a send, which took |latency|, and the size of the
+  // ObservationStore, |store_bytes|, after it.
+  void RecordSendResult(bool success, std::chrono::milliseconds latency,
+                        size_t store_bytes);
+
+  void SetClockForTesting(std::shared_ptr<util::ClockInterface> clock) {
+    clock_ = clock;
+  }
+
+  void SetRandomSeedForTesting(uint32_t seed) { random_.seed(seed); }
+
  private:
+  // Returns |interval| shortened so that the store is not expected to exceed
+  // its target fill before the next send.
+  std::chrono::seconds ShortenUnderPressure(std::chrono::seconds interval);
+
+  // Returns |interval| backed off for |consecutive_failures_|.
+  std::chrono::seconds BackOff(std::chrono::seconds interval);
+
   std::chrono::seconds current_interval_;
   std::chrono::seconds target_interval_;
   std::chrono::seconds min_interval_;
+
+  // The state of the adaptive policy.
+  bool adaptive_ = false;
+  AdaptivePolicy policy_;
+  std::shared_ptr<util::ClockInterface> clock_;
+  std::mt19937 random_;
+  size_t store_bytes_ = 0;
+  size_t capacity_bytes_ = 0;
+  // The size of the store and the time at the end of the previous send.
+  size_t last_send_store_bytes_ = 0;
+  std::chrono::system_clock::time_point last_send_time_;
+  bool have_last_send_ = false;
+  // Moving averages of the add rate, in bytes per second, and of the send
+  // latency.
+  double add_rate_ = 0;
+  bool have_add_rate_ = false;
+  double latency_seconds_ = 0;
+  size_t consecutive_failures_ = 0;
 };
 
 }  // namespace encoder
@@ -4,11 +4,86 @@
 
 #include "encoder/upload_scheduler.h"
 
+#include <functional>
+#include <memory>
+#include <utility>
+#include <vector>
+
 #include "./gtest.h"
+#include "util/clock.h"
 
 namespace cobalt {
 namespace encoder {
 
+namespace {
+
+// UploadSimulation simulates a client whose ObservationStore is filled at a
+// constant rate and is emptied by the successful sends that |scheduler|
+// schedules. Time is driven by a util::IncrementingClock, in steps of one
+// second.
+class UploadSimulation {
+ public:
+  UploadSimulation(UploadScheduler scheduler, size_t capacity_bytes,
+                   size_t bytes_added_per_second,
+                   std::chrono::milliseconds send_latency)
+      : scheduler_(std::move(scheduler)),
+        clock_(new util::IncrementingClock()),
+        capacity_bytes_(capacity_bytes),
+        bytes_added_per_second_(bytes_added_per_second),
+        send_latency_(send_latency) {
+    clock_->set_increment(std::chrono::seconds(0));
+    scheduler_.SetClockForTesting(clock_);
+    scheduler_.SetRandomSeedForTesting(42);
+  }
+
+  // Runs the simulation for |duration|. |send_succeeds| is invoked for each
+  // send and returns whether it succeeds.
+  void Run(std::chrono::seconds duration,
+           std::function<bool()> send_succeeds = [] { return true; }) {
+    auto next_send_time = clock_->peek_now() + scheduler_.Interval();
+    for (int64_t i = 0; i < duration.count(); i++) {
+      clock_->set_time(clock_->peek_now() + std::chrono::seconds(1));
+      if (store_bytes_ + bytes_added_per_second_ > capacity_bytes_) {
+        dropped_bytes_ += bytes_added_per_second_;
+      } else {
+        store_bytes_ += bytes_added_per_second_;
+      }
+      max_store_bytes_ = std::max(max_store_bytes_, store_bytes_);
+      if (clock_->peek_now() < next_send_time) {
+        continue;
+      }
+      scheduler_.RecordStoreSize(store_bytes_, capacity_bytes_);
+      bool success = send_succeeds();
+      if (success) {
+        store_bytes_ = 0;
+      }
+      scheduler_.RecordSendResult(success, send_latency_, store_bytes_);
+      intervals_.push_back(scheduler_.Interval());
+      next_send_time = clock_->peek_now() + intervals_.back();
+    }
+  }
+
+  size_t dropped_bytes() const { return dropped_bytes_; }
+  size_t max_store_bytes() const { return max_store_bytes_; }
+  // The intervals returned by the scheduler after each send.
+  const std::vector<std::chrono::seconds>& intervals() const {
+    return intervals_;
+  }
+
+ private:
+  UploadScheduler scheduler_;
+  std::shared_ptr<util::IncrementingClock> clock_;
+  const size_t capacity_bytes_;
+  const size_t bytes_added_per_second_;
+  const std::chrono::milliseconds send_latency_;
+  size_t store_bytes_ = 0;
+  size_t max_store_bytes_ = 0;
+  size_t dropped_bytes_ = 0;
+  std::vector<std::chrono::seconds> intervals_;
+};
+
+}  // namespace
+
 TEST(UploadScheduler, NoBackoff) {
   auto scheduler =
       UploadScheduler(std::chrono::hours(1), std::chrono::seconds(0));
@@ -55,5 +130,78 @@ TEST(UploadScheduler, LongBackoff) {
   EXPECT_EQ(scheduler.Interval(), std::chrono::seconds(3600));
 }
 
+// Tests that on a busy client, the adaptive UploadScheduler shortens the
+// interval so that the store does not fill up, while with the same parameters
+// the non-adaptive UploadScheduler lets the store fill up and drop
+// Observations.
+TEST(UploadScheduler, AdaptiveShortensIntervalUnderPressure) {
+  const size_t kCapacityBytes = 100000;
+  const size_t kBytesAddedPerSecond = 100;
+  const std::chrono::milliseconds kSendLatency(5000);
+
+  UploadSimulation fixed(
+      UploadScheduler(std::chrono::hours(1), std::chrono::seconds(10),
+                      std::chrono::minutes(1)),
+      kCapacityBytes, kBytesAddedPerSecond, kSendLatency);
+  fixed.Run(std::chrono::hours(24));
+  EXPECT_GT(fixed.dropped_bytes(), 0u);
+
+  UploadScheduler::AdaptivePolicy policy;
+  UploadSimulation adaptive(
+      UploadScheduler(std::chrono::hours(1), std::chrono::seconds(10),
+                      std::chrono::minutes(1), policy),
+      kCapacityBytes, kBytesAddedPerSecond, kSendLatency);
+  adaptive.Run(std::chrono::hours(24));
+  EXPECT_EQ(0u, adaptive.dropped_bytes());
+  EXPECT_LE(adaptive.max_store_bytes(),
+            policy.target_fill_fraction * kCapacityBytes);
+  // The store is expected to reach its target fill in 500 seconds, and the
+  // send takes 5 seconds.
+  EXPECT_EQ(std::chrono::seconds(495), adaptive.intervals().back());
+}
+
+// Tests that on an idle client the adaptive UploadScheduler keeps to the
+// target interval.
+TEST(UploadScheduler, AdaptiveIdle) {
+  UploadSimulation adaptive(
+      UploadScheduler(std::chrono::hours(1), std::chrono::seconds(10),
+                      std::chrono::minutes(1),
+                      UploadScheduler::AdaptivePolicy()),
+      100000, 0, std::chrono::milliseconds(5000));
+  adaptive.Run(std::chrono::hours(24));
+  ASSERT_FALSE(adaptive.intervals().empty());
+  EXPECT_EQ(std::chrono::seconds(3600), adaptive.intervals().back());
+}
+
+// Tests that the adaptive UploadScheduler backs off exponentially, with
+// jitter, after consecutive failures, up to |max_backoff_interval|, and
+// returns to the target interval after a success.
+TEST(UploadScheduler, AdaptiveBackOffWithJitter) {
+  UploadScheduler::AdaptivePolicy policy;
+  policy.max_backoff_interval = std::chrono::seconds(4800);
+  policy.jitter = 0.1;
+  UploadSimulation adaptive(
+      UploadScheduler(std::chrono::seconds(600), std::chrono::seconds(10),
+                      std::chrono::seconds(600), policy),
+      100000, 0, std::chrono::milliseconds(5000));
+  const int kNumFailures = 6;
+  int num_sends = 0;
+  adaptive.Run(std::chrono::hours(24),
+               [&num_sends] { return ++num_sends > kNumFailures; });
+
+  const auto& intervals = adaptive.intervals();
+  ASSERT_GT(intervals.size(), static_cast<size_t>(kNumFailures));
+  const int64_t kExpectedSeconds[kNumFailures] = {600,  1200, 2400,
+                                                  4800, 4800, 4800};
+  for (int i = 0; i < kNumFailures; i++) {
+    EXPECT_GE(intervals[i].count(), 0.9 * kExpectedSeconds[i]) << i;
+    EXPECT_LE(intervals[i].count(), 1.1 * kExpectedSeconds[i]) << i;
+  }
+  // The capped intervals are perturbed differently.
+  EXPECT_NE(intervals[3], intervals[4]);
+  EXPECT_EQ(std::chrono::seconds(600), intervals[kNumFailures]);
+  EXPECT_EQ(std::chrono::seconds(600), intervals.back());
+}
+
 }  // namespace encoder
 }  // namespace cobalt
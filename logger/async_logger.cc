@@ -0,0 +1,274 @@
+// Copyright 2018 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "logger/async_logger.h"
+
+#include <cmath>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "./logging.h"
+
+namespace cobalt {
+namespace logger {
+
+using ::cobalt::util::SystemClock;
+
+AsyncLogger::AsyncLogger(LoggerInterface* logger, size_t queue_capacity,
+                         OverflowPolicy overflow_policy,
+                         size_t num_worker_threads, size_t max_batch_size)
+    : logger_(logger),
+      overflow_policy_(overflow_policy),
+      num_worker_threads_(num_worker_threads),
+      max_batch_size_(max_batch_size),
+      clock_(new SystemClock()),
+      queue_(queue_capacity),
+      num_accepted_(0),
+      num_dropped_(0),
+      next_sequence_number_(0),
+      num_waiting_workers_(0),
+      num_waiting_producers_(0),
+      num_waiting_flushes_(0) {
+  CHECK(logger_);
+  CHECK_GT(num_worker_threads_, 0u);
+  CHECK_GT(max_batch_size_, 0u);
+}
+
+AsyncLogger::~AsyncLogger() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    shut_down_ = true;
+  }
+  not_empty_notifier_.notify_all();
+  for (auto& worker_thread : worker_threads_) {
+    worker_thread.join();
+  }
+}
+
+void AsyncLogger::Start() {
+  CHECK(worker_threads_.empty());
+  for (size_t i = 0; i < num_worker_threads_; i++) {
+    worker_threads_.emplace_back([this] { Run(); });
+  }
+}
+
+void AsyncLogger::Flush() {
+  uint64_t watermark_to_reach = next_sequence_number_;
+  std::unique_lock<std::mutex> lock(mutex_);
+  num_waiting_flushes_++;
+  completed_notifier_.wait(lock, [this, watermark_to_reach] {
+    return completed_watermark_ >= watermark_to_reach;
+  });
+  num_waiting_flushes_--;
+}
+
+Status AsyncLogger::LogEvent(uint32_t metric_id, uint32_t event_code) {
+  EventSpec event_spec;
+  event_spec.metric_id = metric_id;
+  auto* occurrence_event = event_spec.event.mutable_occurrence_event();
+  occurrence_event->set_event_code(event_code);
+  return Enqueue(std::move(event_spec));
+}
+
+Status AsyncLogger::LogEventCount(uint32_t metric_id, uint32_t event_code,
+                                  const std::string& component,
+                                  int64_t period_duration_micros,
+                                  uint32_t count) {
+  EventSpec event_spec;
+  event_spec.metric_id = metric_id;
+  auto* count_event = event_spec.event.mutable_count_event();
+  count_event->set_event_code(event_code);
+  count_event->set_component(component);
+  count_event->set_period_duration_micros(period_duration_micros);
+  count_event->set_count(count);
+  return Enqueue(std::move(event_spec));
+}
+
+Status AsyncLogger::LogElapsedTime(uint32_t metric_id, uint32_t event_code,
+                                   const std::string& component,
+                                   int64_t elapsed_micros) {
+  EventSpec event_spec;
+  event_spec.metric_id = metric_id;
+  auto* elapsed_time_event = event_spec.event.mutable_elapsed_time_event();
+  elapsed_time_event->set_event_code(event_code);
+  elapsed_time_event->set_component(component);
+  elapsed_time_event->set_elapsed_micros(elapsed_micros);
+  return Enqueue(std::move(event_spec));
+}
+
+Status AsyncLogger::LogFrameRate(uint32_t metric_id, uint32_t event_code,
+                                 const std::string& component, float fps) {
+  EventSpec event_spec;
+  event_spec.metric_id = metric_id;
+  auto* frame_rate_event = event_spec.event.mutable_frame_rate_event();
+  frame_rate_event->set_event_code(event_code);
+  frame_rate_event->set_component(component);
+  frame_rate_event->set_frames_per_1000_seconds(std::round(fps * 1000.0));
+  return Enqueue(std::move(event_spec));
+}
+
+Status AsyncLogger::LogMemoryUsage(uint32_t metric_id, uint32_t event_code,
+                                   const std::string& component,
+                                   int64_t bytes) {
+  EventSpec event_spec;
+  event_spec.metric_id = metric_id;
+  auto* memory_usage_event = event_spec.event.mutable_memory_usage_event();
+  memory_usage_event->set_event_code(event_code);
+  memory_usage_event->set_component(component);
+  memory_usage_event->set_bytes(bytes);
+  return Enqueue(std::move(event_spec));
+}
+
+Status AsyncLogger::LogIntHistogram(uint32_t metric_id, uint32_t event_code,
+                                    const std::string& component,
+                                    HistogramPtr histogram) {
+  EventSpec event_spec;
+  event_spec.metric_id = metric_id;
+  auto* int_histogram_event = event_spec.event.mutable_int_histogram_event();
+  int_histogram_event->set_event_code(event_code);
+  int_histogram_event->set_component(component);
+  int_histogram_event->mutable_buckets()->Swap(histogram.get());
+  return Enqueue(std::move(event_spec));
+}
+
+Status AsyncLogger::LogString(uint32_t metric_id, const std::string& str) {
+  EventSpec event_spec;
+  event_spec.metric_id = metric_id;
+  event_spec.event.mutable_string_used_event()->set_str(str);
+  return Enqueue(std::move(event_spec));
+}
+
+Status AsyncLogger::LogCustomEvent(uint32_t metric_id,
+                                   EventValuesPtr event_values) {
+  EventSpec event_spec;
+  event_spec.metric_id = metric_id;
+  event_spec.event.mutable_custom_event()->mutable_values()->swap(
+      *event_values);
+  return Enqueue(std::move(event_spec));
+}
+
+Status AsyncLogger::LogEvents(std::vector<EventSpec> events) {
+  Status status = kOK;
+  for (auto& event_spec : events) {
+    if (Enqueue(std::move(event_spec)) != kOK) {
+      status = kFull;
+    }
+  }
+  return status;
+}
+
+Status AsyncLogger::Enqueue(EventSpec event_spec) {
+  event_spec.time = clock_->now();
+  QueuedEvent queued_event{next_sequence_number_++, std::move(event_spec)};
+  if (!queue_.TryPush(std::move(queued_event))) {
+    switch (overflow_policy_) {
+      case kDropNewest:
+        num_dropped_++;
+        Complete({queued_event.sequence_number});
+        return kFull;
+
+      case kDropOldest: {
+        QueuedEvent oldest;
+        while (!queue_.TryPush(std::move(queued_event))) {
+          if (queue_.TryPop(&oldest)) {
+            num_dropped_++;
+            Complete({oldest.sequence_number});
+          } else {
+            // Another thread is in the middle of pushing or popping the
+            // cell that we need. Let it finish.
+            std::this_thread::yield();
+          }
+        }
+        break;
+      }
+
+      case kBlock: {
+        std::unique_lock<std::mutex> lock(mutex_);
+        num_waiting_producers_++;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        while (!queue_.TryPush(std::move(queued_event))) {
+          not_full_notifier_.wait(lock);
+        }
+        num_waiting_producers_--;
+        break;
+      }
+    }
+  }
+  num_accepted_++;
+  NotifyNotEmpty();
+  return kOK;
+}
+
+bool AsyncLogger::PopOrWait(QueuedEvent* queued_event) {
+  if (queue_.TryPop(queued_event)) {
+    return true;
+  }
+  std::unique_lock<std::mutex> lock(mutex_);
+  num_waiting_workers_++;
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  bool popped;
+  while (!(popped = queue_.TryPop(queued_event)) && !shut_down_) {
+    not_empty_notifier_.wait(lock);
+  }
+  num_waiting_workers_--;
+  return popped;
+}
+
+void AsyncLogger::Complete(const std::vector<uint64_t>& sequence_numbers) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (uint64_t sequence_number : sequence_numbers) {
+    completed_out_of_order_.push(sequence_number);
+  }
+  while (!completed_out_of_order_.empty() &&
+         completed_out_of_order_.top() == completed_watermark_) {
+    completed_out_of_order_.pop();
+    completed_watermark_++;
+  }
+  if (num_waiting_flushes_ > 0) {
+    completed_notifier_.notify_all();
+  }
+}
+
+// The fences below pair with the fences that follow the increments of the
+// num_waiting_* counters: either the waiting thread sees the change to the
+// queue before it waits, or this thread sees the counter and notifies.
+void AsyncLogger::NotifyNotEmpty() {
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (num_waiting_workers_ > 0) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    not_empty_notifier_.notify_one();
+  }
+}
+
+void AsyncLogger::NotifyNotFull() {
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (num_waiting_producers_ > 0) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    not_full_notifier_.notify_all();
+  }
+}
+
+void AsyncLogger::Run() {
+  std::vector<EventSpec> batch;
+  std::vector<uint64_t> sequence_numbers;
+  QueuedEvent queued_event;
+  while (PopOrWait(&queued_event)) {
+    do {
+      sequence_numbers.push_back(queued_event.sequence_number);
+      batch.push_back(std::move(queued_event.event_spec));
+    } while (batch.size() < max_batch_size_ && queue_.TryPop(&queued_event));
+    NotifyNotFull();
+
+    logger_->LogEvents(std::move(batch));
+    batch.clear();
+
+    Complete(sequence_numbers);
+    sequence_numbers.clear();
+  }
+}
+
+}  // namespace logger
+}  // namespace cobalt
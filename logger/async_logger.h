@@ -0,0 +1,218 @@
+// Copyright 2018 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef COBALT_LOGGER_ASYNC_LOGGER_H_
+#define COBALT_LOGGER_ASYNC_LOGGER_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <functional>
+#include <queue>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "logger/logger_interface.h"
+#include "logger/status.h"
+#include "util/bounded_queue.h"
+#include "util/clock.h"
+
+namespace cobalt {
+namespace logger {
+
+// AsyncLogger is an implementation of LoggerInterface that does not do any of
+// the work of logging an Event on the calling thread. Each Log*() method
+// captures its arguments and the current time into an Event, adds the Event
+// to a bounded lock-free queue and returns. Background worker threads remove
+// the Events from the queue in batches and pass each batch to the LogEvents()
+// method of a wrapped LoggerInterface, usually a Logger, which then encodes,
+// encrypts and stores the Observations.
+//
+// Because the Events are logged later, a Log*() method returning kOK only
+// means that the Event was accepted. Errors found while logging the Event,
+// for example an invalid |metric_id|, are reported in the error log by the
+// wrapped Logger.
+//
+// When the queue is full the behavior of the Log*() methods is determined by
+// the OverflowPolicy passed to the constructor.
+//
+// Usage: Construct an AsyncLogger wrapping a Logger and invoke Start() once.
+// Events logged before Start() is invoked remain in the queue. The wrapped
+// Logger must be thread-safe if more than one worker thread is used.
+//
+// All public methods of this class are thread-safe. No method may be invoked
+// while the AsyncLogger is being destroyed.
+class AsyncLogger : public LoggerInterface {
+ public:
+  // What a Log*() method does when the queue is full.
+  enum OverflowPolicy {
+    // The new Event is dropped and the Log*() method returns kFull.
+    kDropNewest,
+    // The oldest Event in the queue is dropped to make room for the new
+    // Event, and the Log*() method returns kOK.
+    kDropOldest,
+    // The Log*() method blocks until a worker thread has made room in the
+    // queue.
+    kBlock,
+  };
+
+  // Constructor
+  //
+  // |logger| The Logger that logs the Events on the worker threads. This must
+  // remain valid as long as the AsyncLogger is being used.
+  //
+  // |queue_capacity| The maximum number of Events waiting in the queue. It is
+  // rounded up to a power of 2.
+  //
+  // |overflow_policy| What to do when the queue is full.
+  //
+  // |num_worker_threads| The number of worker threads started by Start().
+  // With more than one worker thread Events are not necessarily logged in the
+  // order in which they were accepted.
+  //
+  // |max_batch_size| The maximum number of Events passed to a single call to
+  // LogEvents() of |logger|.
+  AsyncLogger(LoggerInterface* logger, size_t queue_capacity = 1024,
+              OverflowPolicy overflow_policy = kDropNewest,
+              size_t num_worker_threads = 1, size_t max_batch_size = 64);
+
+  // Waits for the worker threads to log all of the Events in the queue and
+  // then stops them.
+  ~AsyncLogger() override;
+
+  // Starts the worker threads. This method must be invoked at most once.
+  void Start();
+
+  // Blocks until every Event that was accepted before Flush() was invoked has
+  // been logged by the wrapped Logger, or dropped because of the kDropOldest
+  // policy, whichever worker thread it was taken by. Start() must have been
+  // invoked.
+  void Flush();
+
+  // Returns the number of Events waiting in the queue. This is only an
+  // estimate if other threads are using the AsyncLogger.
+  size_t queue_depth() const { return queue_.size(); }
+
+  // Returns the number of Events that were dropped because the queue was
+  // full.
+  uint64_t num_dropped() const { return num_dropped_; }
+
+  // Returns the number of Events that have been accepted for logging.
+  uint64_t num_accepted() const { return num_accepted_; }
+
+  Status LogEvent(uint32_t metric_id, uint32_t event_code) override;
+
+  Status LogEventCount(uint32_t metric_id, uint32_t event_code,
+                       const std::string& component,
+                       int64_t period_duration_micros, uint32_t count) override;
+
+  Status LogElapsedTime(uint32_t metric_id, uint32_t event_code,
+                        const std::string& component,
+                        int64_t elapsed_micros) override;
+
+  Status LogFrameRate(uint32_t metric_id, uint32_t event_code,
+                      const std::string& component, float fps) override;
+
+  Status LogMemoryUsage(uint32_t metric_id, uint32_t event_code,
+                        const std::string& component, int64_t bytes) override;
+
+  Status LogIntHistogram(uint32_t metric_id, uint32_t event_code,
+                         const std::string& component,
+                         HistogramPtr histogram) override;
+
+  Status LogString(uint32_t metric_id, const std::string& str) override;
+
+  Status LogCustomEvent(uint32_t metric_id,
+                        EventValuesPtr event_values) override;
+
+  // Enqueues each of the |events|. Returns kOK if all of them were accepted,
+  // otherwise kFull.
+  Status LogEvents(std::vector<EventSpec> events) override;
+
+  // Sets the clock used to timestamp the accepted Events. This must be
+  // invoked before any Events are logged. It is intended for use in tests.
+  void SetClock(std::unique_ptr<util::ClockInterface> clock) {
+    clock_ = std::move(clock);
+  }
+
+ private:
+  // An Event in the queue, along with the sequence number that was assigned
+  // to it by Enqueue().
+  struct QueuedEvent {
+    uint64_t sequence_number;
+    EventSpec event_spec;
+  };
+
+  // Sets the time of |event_spec| and adds it to the queue, applying the
+  // OverflowPolicy if the queue is full.
+  Status Enqueue(EventSpec event_spec);
+
+  // Pops an Event from the queue into |queued_event|. If the queue is empty
+  // waits until it is not, or until the AsyncLogger is shut down in which case
+  // false is returned.
+  bool PopOrWait(QueuedEvent* queued_event);
+
+  // Records that the Events with the given |sequence_numbers| have been
+  // logged or dropped, and wakes up the Flush() calls that were waiting for
+  // them.
+  void Complete(const std::vector<uint64_t>& sequence_numbers);
+
+  // Wakes up the worker threads waiting in PopOrWait(), if there are any.
+  void NotifyNotEmpty();
+
+  // Wakes up the Log*() calls waiting for room in the queue because of the
+  // kBlock policy, if there are any.
+  void NotifyNotFull();
+
+  // The main method run by each worker thread.
+  void Run();
+
+  LoggerInterface* logger_;  // not owned
+  const OverflowPolicy overflow_policy_;
+  const size_t num_worker_threads_;
+  const size_t max_batch_size_;
+  std::unique_ptr<util::ClockInterface> clock_;
+  util::BoundedQueue<QueuedEvent> queue_;
+
+  std::atomic<uint64_t> num_accepted_;
+  std::atomic<uint64_t> num_dropped_;
+  // The sequence number of the next Event passed to Enqueue().
+  std::atomic<uint64_t> next_sequence_number_;
+
+  // The lock-free fast path of the Log*() methods never touches |mutex_|. It
+  // is used by threads that must wait: worker threads when the queue is
+  // empty, Log*() calls when the queue is full and the policy is kBlock, and
+  // Flush(). The worker threads also acquire it once per batch in order to
+  // record the completed Events, and so do the Log*() calls that drop an
+  // Event. A waiting thread increments the corresponding counter before it
+  // checks the queue and waits, so that a thread that changes the queue knows
+  // whether it has to acquire |mutex_| and notify.
+  std::mutex mutex_;
+  std::condition_variable not_empty_notifier_;
+  std::condition_variable not_full_notifier_;
+  std::condition_variable completed_notifier_;
+  std::atomic<size_t> num_waiting_workers_;
+  std::atomic<size_t> num_waiting_producers_;
+  std::atomic<size_t> num_waiting_flushes_;
+  bool shut_down_ = false;
+
+  // Every Event with a sequence number less than |completed_watermark_| has
+  // been logged or dropped. Protected by |mutex_|.
+  uint64_t completed_watermark_ = 0;
+  // The sequence numbers of the completed Events that are at least
+  // |completed_watermark_|, because an Event with a smaller sequence number,
+  // taken by another worker thread, has not been completed yet. Protected by
+  // |mutex_|.
+  std::priority_queue<uint64_t, std::vector<uint64_t>, std::greater<uint64_t>>
+      completed_out_of_order_;
+
+  std::vector<std::thread> worker_threads_;
+};
+
+}  // namespace logger
+}  // namespace cobalt
+
+#endif  // COBALT_LOGGER_ASYNC_LOGGER_H_
@@ -0,0 +1,311 @@
+// Copyright 2018 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "logger/async_logger.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "./gtest.h"
+#include "util/clock.h"
+
+namespace cobalt {
+
+using util::IncrementingClock;
+
+namespace logger {
+
+namespace {
+
+// A LoggerInterface that records the Events passed to LogEvents(). While it is
+// paused LogEvents() blocks, which lets a test fill up the AsyncLogger's queue.
+// A batch that contains the held event code, if any, also blocks until
+// Resume() is invoked.
+class FakeLogger : public LoggerInterface {
+ public:
+  Status LogEvent(uint32_t metric_id, uint32_t event_code) override {
+    return kOK;
+  }
+  Status LogEventCount(uint32_t metric_id, uint32_t event_code,
+                       const std::string& component,
+                       int64_t period_duration_micros,
+                       uint32_t count) override {
+    return kOK;
+  }
+  Status LogElapsedTime(uint32_t metric_id, uint32_t event_code,
+                        const std::string& component,
+                        int64_t elapsed_micros) override {
+    return kOK;
+  }
+  Status LogFrameRate(uint32_t metric_id, uint32_t event_code,
+                      const std::string& component, float fps) override {
+    return kOK;
+  }
+  Status LogMemoryUsage(uint32_t metric_id, uint32_t event_code,
+                        const std::string& component, int64_t bytes) override {
+    return kOK;
+  }
+  Status LogIntHistogram(uint32_t metric_id, uint32_t event_code,
+                         const std::string& component,
+                         HistogramPtr histogram) override {
+    return kOK;
+  }
+  Status LogString(uint32_t metric_id, const std::string& str) override {
+    return kOK;
+  }
+  Status LogCustomEvent(uint32_t metric_id,
+                        EventValuesPtr event_values) override {
+    return kOK;
+  }
+
+  Status LogEvents(std::vector<EventSpec> events) override {
+    std::unique_lock<std::mutex> lock(mutex_);
+    num_calls_++;
+    calls_changed_.notify_all();
+    resumed_.wait(lock,
+                  [this, &events] { return !paused_ && !IsHeld(events); });
+    for (auto& event_spec : events) {
+      logged_.push_back(std::move(event_spec));
+    }
+    return kOK;
+  }
+
+  void Pause() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    paused_ = true;
+  }
+
+  void Hold(uint32_t event_code) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    held_event_code_ = event_code;
+  }
+
+  void Resume() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    paused_ = false;
+    held_event_code_ = -1;
+    resumed_.notify_all();
+  }
+
+  // Waits until LogEvents() has been invoked |num_calls| times.
+  void WaitForCalls(size_t num_calls) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    calls_changed_.wait(lock,
+                        [this, num_calls] { return num_calls_ >= num_calls; });
+  }
+
+  std::vector<EventSpec> TakeLogged() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return std::move(logged_);
+  }
+
+ private:
+  bool IsHeld(const std::vector<EventSpec>& events) {
+    for (const auto& event_spec : events) {
+      if (held_event_code_ ==
+          event_spec.event.occurrence_event().event_code()) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  std::mutex mutex_;
+  std::condition_variable resumed_;
+  std::condition_variable calls_changed_;
+  bool paused_ = false;
+  int64_t held_event_code_ = -1;
+  size_t num_calls_ = 0;
+  std::vector<EventSpec> logged_;
+};
+
+// Returns the event codes of the occurrence events in |logged|.
+std::vector<uint32_t> EventCodes(const std::vector<EventSpec>& logged) {
+  std::vector<uint32_t> event_codes;
+  for (const auto& event_spec : logged) {
+    event_codes.push_back(event_spec.event.occurrence_event().event_code());
+  }
+  return event_codes;
+}
+
+}  // namespace
+
+// Tests that each of the Log*() methods captures its arguments and the time
+// into an Event that is passed to the wrapped Logger.
+TEST(AsyncLoggerTest, LogsEvents) {
+  FakeLogger fake_logger;
+  AsyncLogger async_logger(&fake_logger);
+  auto clock = std::make_unique<IncrementingClock>();
+  clock->set_time(std::chrono::system_clock::time_point(std::chrono::hours(1)));
+  clock->set_increment(std::chrono::seconds(0));
+  async_logger.SetClock(std::move(clock));
+  async_logger.Start();
+
+  EXPECT_EQ(kOK, async_logger.LogEvent(1, 2));
+  EXPECT_EQ(kOK, async_logger.LogEventCount(3, 4, "component", 5, 6));
+  EXPECT_EQ(kOK, async_logger.LogFrameRate(7, 8, "", 9.5));
+  EXPECT_EQ(kOK, async_logger.LogString(10, "str"));
+  async_logger.Flush();
+
+  auto logged = fake_logger.TakeLogged();
+  ASSERT_EQ(4u, logged.size());
+  EXPECT_EQ(1u, logged[0].metric_id);
+  EXPECT_EQ(2u, logged[0].event.occurrence_event().event_code());
+  EXPECT_EQ(3u, logged[1].metric_id);
+  EXPECT_EQ("component", logged[1].event.count_event().component());
+  EXPECT_EQ(6u, logged[1].event.count_event().count());
+  EXPECT_EQ(9500, logged[2].event.frame_rate_event().frames_per_1000_seconds());
+  EXPECT_EQ("str", logged[3].event.string_used_event().str());
+  for (const auto& event_spec : logged) {
+    EXPECT_EQ(std::chrono::system_clock::time_point(std::chrono::hours(1)),
+              event_spec.time);
+  }
+  EXPECT_EQ(4u, async_logger.num_accepted());
+  EXPECT_EQ(0u, async_logger.num_dropped());
+  EXPECT_EQ(0u, async_logger.queue_depth());
+}
+
+// Tests that Events logged before Start() is invoked are kept in the queue.
+TEST(AsyncLoggerTest, LogBeforeStart) {
+  FakeLogger fake_logger;
+  AsyncLogger async_logger(&fake_logger);
+  for (uint32_t i = 0; i < 10; i++) {
+    EXPECT_EQ(kOK, async_logger.LogEvent(1, i));
+  }
+  EXPECT_EQ(10u, async_logger.queue_depth());
+  async_logger.Start();
+  async_logger.Flush();
+  EXPECT_EQ(0u, async_logger.queue_depth());
+  EXPECT_EQ(std::vector<uint32_t>({0, 1, 2, 3, 4, 5, 6, 7, 8, 9}),
+            EventCodes(fake_logger.TakeLogged()));
+}
+
+// Tests that with the kDropNewest policy the Events that do not fit in the
+// queue are rejected.
+TEST(AsyncLoggerTest, DropNewest) {
+  FakeLogger fake_logger;
+  AsyncLogger async_logger(&fake_logger, 4, AsyncLogger::kDropNewest);
+  for (uint32_t i = 0; i < 6; i++) {
+    EXPECT_EQ(i < 4 ? kOK : kFull, async_logger.LogEvent(1, i));
+  }
+  EXPECT_EQ(4u, async_logger.queue_depth());
+  EXPECT_EQ(2u, async_logger.num_dropped());
+  EXPECT_EQ(4u, async_logger.num_accepted());
+  async_logger.Start();
+  async_logger.Flush();
+  EXPECT_EQ(std::vector<uint32_t>({0, 1, 2, 3}),
+            EventCodes(fake_logger.TakeLogged()));
+}
+
+// Tests that with the kDropOldest policy the oldest Events in the queue are
+// replaced by the new ones.
+TEST(AsyncLoggerTest, DropOldest) {
+  FakeLogger fake_logger;
+  AsyncLogger async_logger(&fake_logger, 4, AsyncLogger::kDropOldest);
+  for (uint32_t i = 0; i < 6; i++) {
+    EXPECT_EQ(kOK, async_logger.LogEvent(1, i));
+  }
+  EXPECT_EQ(4u, async_logger.queue_depth());
+  EXPECT_EQ(2u, async_logger.num_dropped());
+  EXPECT_EQ(6u, async_logger.num_accepted());
+  async_logger.Start();
+  async_logger.Flush();
+  EXPECT_EQ(std::vector<uint32_t>({2, 3, 4, 5}),
+            EventCodes(fake_logger.TakeLogged()));
+}
+
+// Tests that with the kBlock policy a Log*() call waits for room in the
+// queue instead of dropping an Event.
+TEST(AsyncLoggerTest, Block) {
+  FakeLogger fake_logger;
+  AsyncLogger async_logger(&fake_logger, 2, AsyncLogger::kBlock,
+                           /*num_worker_threads=*/1, /*max_batch_size=*/1);
+  fake_logger.Pause();
+  async_logger.Start();
+  // The worker takes the first Event and blocks in LogEvents(). The next two
+  // Events fill up the queue.
+  EXPECT_EQ(kOK, async_logger.LogEvent(1, 0));
+  fake_logger.WaitForCalls(1);
+  EXPECT_EQ(kOK, async_logger.LogEvent(1, 1));
+  EXPECT_EQ(kOK, async_logger.LogEvent(1, 2));
+  EXPECT_EQ(2u, async_logger.queue_depth());
+
+  std::thread producer([&async_logger] {
+    EXPECT_EQ(kOK, async_logger.LogEvent(1, 3));
+  });
+  fake_logger.Resume();
+  producer.join();
+  async_logger.Flush();
+  EXPECT_EQ(0u, async_logger.num_dropped());
+  EXPECT_EQ(std::vector<uint32_t>({0, 1, 2, 3}),
+            EventCodes(fake_logger.TakeLogged()));
+}
+
+// Tests that with several worker threads Flush() waits for an Event that was
+// accepted before it was invoked, even when Events accepted later have
+// already been logged by another worker thread.
+TEST(AsyncLoggerTest, FlushWaitsForEveryWorker) {
+  FakeLogger fake_logger;
+  AsyncLogger async_logger(&fake_logger, 16, AsyncLogger::kDropNewest,
+                           /*num_worker_threads=*/2, /*max_batch_size=*/1);
+  async_logger.Start();
+  fake_logger.Hold(0);
+  EXPECT_EQ(kOK, async_logger.LogEvent(1, 0));
+  fake_logger.WaitForCalls(1);
+
+  std::atomic<bool> flushed(false);
+  std::thread flush_thread([&async_logger, &flushed] {
+    async_logger.Flush();
+    flushed = true;
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  for (uint32_t event_code = 1; event_code <= 3; event_code++) {
+    EXPECT_EQ(kOK, async_logger.LogEvent(1, event_code));
+  }
+  fake_logger.WaitForCalls(4);
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  EXPECT_FALSE(flushed);
+
+  fake_logger.Resume();
+  flush_thread.join();
+  EXPECT_TRUE(flushed);
+  async_logger.Flush();
+  EXPECT_EQ(4u, fake_logger.TakeLogged().size());
+}
+
+// Tests that Events logged concurrently from several threads and processed by
+// several worker threads are all logged.
+TEST(AsyncLoggerTest, ConcurrentProducers) {
+  const int kNumProducers = 4;
+  const uint32_t kNumEventsPerProducer = 1000;
+  FakeLogger fake_logger;
+  AsyncLogger async_logger(&fake_logger, 64, AsyncLogger::kBlock,
+                           /*num_worker_threads=*/3);
+  async_logger.Start();
+  std::vector<std::thread> producers;
+  for (int p = 0; p < kNumProducers; p++) {
+    producers.emplace_back([&async_logger] {
+      for (uint32_t i = 0; i < kNumEventsPerProducer; i++) {
+        EXPECT_EQ(kOK, async_logger.LogEvent(1, i));
+      }
+    });
+  }
+  for (auto& producer : producers) {
+    producer.join();
+  }
+  async_logger.Flush();
+  EXPECT_EQ(kNumProducers * kNumEventsPerProducer,
+            fake_logger.TakeLogged().size());
+  EXPECT_EQ(0u, async_logger.num_dropped());
+}
+
+}  // namespace logger
+}  // namespace cobalt
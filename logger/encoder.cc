@@ -10,7 +10,6 @@
 #include "./logging.h"
 #include "./observation2.pb.h"
 #include "algorithms/forculus/forculus_encrypter.h"
-#include "algorithms/rappor/rappor_config_helper.h"
 #include "algorithms/rappor/rappor_encoder.h"
 #include "logger/project_context.h"
 
@@ -23,7 +22,6 @@ using ::cobalt::encoder::ClientSecret;
 using ::cobalt::encoder::SystemDataInterface;
 using ::cobalt::forculus::ForculusEncrypter;
 using ::cobalt::rappor::BasicRapporEncoder;
-using ::cobalt::rappor::RapporConfigHelper;
 using ::cobalt::rappor::RapporEncoder;
 
 namespace {
@@ -45,28 +43,84 @@ bool HashComponentNameIfNotEmpty(const std::string& component,
       reinterpret_cast<const byte*>(component.data()), component.size(),
       reinterpret_cast<byte*>(&hash_out->front()));
 }
+
+// The per-thread pool of Observations holds at most one Observation. An
+// Observation taken from the pool keeps its type and the storage of its
+// fields, so an Encode*() method that produces the same type of Observation
+// as the previous one on the thread does not allocate them again.
+thread_local std::unique_ptr<Observation2> observation_pool;
+
+// Clears the fields of |observation| without releasing their storage. The
+// random_id is not cleared because MakeObservation() overwrites it.
+void ClearPooledObservation(Observation2* observation) {
+  switch (observation->observation_type_case()) {
+    case Observation2::kNumericEvent:
+      observation->mutable_numeric_event()->Clear();
+      break;
+    case Observation2::kHistogram:
+      observation->mutable_histogram()->Clear();
+      break;
+    case Observation2::kBasicRappor:
+      observation->mutable_basic_rappor()->Clear();
+      break;
+    case Observation2::kStringRappor:
+      observation->mutable_string_rappor()->Clear();
+      break;
+    case Observation2::kForculus:
+      observation->mutable_forculus()->Clear();
+      break;
+    case Observation2::kUniqueActives:
+      observation->mutable_unique_actives()->Clear();
+      break;
+    case Observation2::kCustom:
+      observation->mutable_custom()->Clear();
+      break;
+    case Observation2::OBSERVATION_TYPE_NOT_SET:
+      break;
+  }
+}
+
+std::unique_ptr<Observation2> TakePooledObservation() {
+  if (!observation_pool) {
+    return std::make_unique<Observation2>();
+  }
+  auto observation = std::move(observation_pool);
+  ClearPooledObservation(observation.get());
+  return observation;
+}
+
 }  // namespace
 
+const size_t Encoder::kRapporBloomBitsCacheSize;
+
+Encoder::Result::~Result() {
+  if (observation && !observation_pool) {
+    observation_pool = std::move(observation);
+  }
+}
+
 Encoder::Encoder(ClientSecret client_secret,
                  const encoder::SystemDataInterface* system_data)
-    : client_secret_(client_secret), system_data_(system_data) {}
+    : client_secret_(client_secret),
+      system_data_(system_data),
+      rappor_bloom_bits_cache_(std::make_shared<rappor::BloomBitsCache>(
+          kRapporBloomBitsCacheSize)) {}
 
 Encoder::Result Encoder::EncodeBasicRapporObservation(
     MetricRef metric, const ReportDefinition* report, uint32_t day_index,
     uint32_t value_index, uint32_t num_categories) const {
+  return EncodeBasicRapporObservation(
+      metric, report, day_index, value_index,
+      MakeBasicRapporConfig(metric, *report, num_categories));
+}
+
+Encoder::Result Encoder::EncodeBasicRapporObservation(
+    MetricRef metric, const ReportDefinition* report, uint32_t day_index,
+    uint32_t value_index, const BasicRapporConfig& basic_rappor_config) const {
   auto result = MakeObservation(metric, report, day_index);
   auto* observation = result.observation.get();
   auto* basic_rappor_observation = observation->mutable_basic_rappor();
 
-  BasicRapporConfig basic_rappor_config;
-  basic_rappor_config.set_prob_rr(RapporConfigHelper::kProbRR);
-  basic_rappor_config.mutable_indexed_categories()->set_num_categories(
-      num_categories);
-  float prob_bit_flip =
-      RapporConfigHelper::ProbBitFlip(*report, metric.FullyQualifiedName());
-  basic_rappor_config.set_prob_0_becomes_1(prob_bit_flip);
-  basic_rappor_config.set_prob_1_stays_1(1.0 - prob_bit_flip);
-
   // TODO(rudominer) Stop copying the client_secret_ on each Encode*()
   // operation.
   BasicRapporEncoder basic_rappor_encoder(basic_rappor_config, client_secret_);
@@ -95,27 +149,60 @@ Encoder::Result Encoder::EncodeBasicRapporObservation(
   return result;
 }
 
+Encoder::Result Encoder::EncodeUniqueActivesObservation(
+    MetricRef metric, const ReportDefinition* report, uint32_t day_index,
+    const std::vector<uint32_t>& active_event_codes, uint32_t window_size,
+    uint32_t num_categories) const {
+  auto result = MakeObservation(metric, report, day_index);
+  auto* observation = result.observation.get();
+  auto* unique_actives_observation = observation->mutable_unique_actives();
+  unique_actives_observation->set_window_size(window_size);
+  auto* basic_rappor_observation =
+      unique_actives_observation->mutable_basic_rappor_obs();
+
+  BasicRapporEncoder basic_rappor_encoder(
+      MakeBasicRapporConfig(metric, *report, num_categories), client_secret_);
+  switch (basic_rappor_encoder.EncodeIndices(active_event_codes,
+                                              basic_rappor_observation)) {
+    case rappor::kOK:
+      break;
+
+    case rappor::kInvalidConfig:
+      LOG(ERROR) << "BasicRapporEncoder returned kInvalidConfig for: Report "
+                 << report->report_name() << " for metric "
+                 << metric.metric_name() << " in project "
+                 << metric.ProjectDebugString() << ".";
+      result.status = kInvalidConfig;
+      return result;
+
+    case rappor::kInvalidInput:
+      LOG(ERROR) << "BasicRapporEncoder returned kInvalidInput for: Report "
+                 << report->report_name() << " for metric "
+                 << metric.metric_name() << " in project "
+                 << metric.ProjectDebugString() << ".";
+      result.status = kInvalidArguments;
+      return result;
+  }
+  return result;
+}
+
 Encoder::Result Encoder::EncodeRapporObservation(MetricRef metric,
                                                  const ReportDefinition* report,
                                                  uint32_t day_index,
                                                  const std::string& str) const {
+  return EncodeRapporObservation(metric, report, day_index, str,
+                                 MakeStringRapporConfig(metric, *report));
+}
+
+Encoder::Result Encoder::EncodeRapporObservation(
+    MetricRef metric, const ReportDefinition* report, uint32_t day_index,
+    const std::string& str, const RapporConfig& rappor_config) const {
   auto result = MakeObservation(metric, report, day_index);
   auto* observation = result.observation.get();
   auto* rappor_observation = observation->mutable_string_rappor();
 
-  RapporConfig rappor_config;
-  rappor_config.set_num_hashes(RapporConfigHelper::kNumHashes);
-  rappor_config.set_num_cohorts(
-      RapporConfigHelper::StringRapporNumCohorts(*report));
-  rappor_config.set_num_bloom_bits(
-      RapporConfigHelper::StringRapporNumBloomBits(*report));
-  rappor_config.set_prob_rr(RapporConfigHelper::kProbRR);
-  float prob_bit_flip =
-      RapporConfigHelper::ProbBitFlip(*report, metric.FullyQualifiedName());
-  rappor_config.set_prob_0_becomes_1(prob_bit_flip);
-  rappor_config.set_prob_1_stays_1(1.0 - prob_bit_flip);
-
-  RapporEncoder rappor_encoder(rappor_config, client_secret_);
+  RapporEncoder rappor_encoder(rappor_config, client_secret_,
+                               rappor_bloom_bits_cache_);
   ValuePart string_value;
   string_value.set_string_value(str);
   switch (rappor_encoder.Encode(string_value, rappor_observation)) {
@@ -242,7 +329,7 @@ Encoder::Result Encoder::MakeObservation(MetricRef metric,
                                          uint32_t day_index) const {
   Result result;
   result.status = kOK;
-  result.observation = std::make_unique<Observation2>();
+  result.observation = TakePooledObservation();
   auto* observation = result.observation.get();
   result.metadata = std::make_unique<ObservationMetadata>();
   auto* metadata = result.metadata.get();
@@ -252,7 +339,7 @@ Encoder::Result Encoder::MakeObservation(MetricRef metric,
   // random_id is used by the Analyzer Service as part of a unique row key
   // for the observation in the Observation Store.
   static const size_t kNumRandomBytes = 8;
-  observation->set_allocated_random_id(new std::string(kNumRandomBytes, 0));
+  observation->mutable_random_id()->resize(kNumRandomBytes);
   random_.RandomString(observation->mutable_random_id());
 
   metadata->set_customer_id(metric.project().customer_id());
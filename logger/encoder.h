@@ -7,9 +7,12 @@
 
 #include <memory>
 #include <string>
+#include <vector>
 
 #include "./event.pb.h"
 #include "./observation2.pb.h"
+#include "algorithms/rappor/bloom_bits_cache.h"
+#include "config/encodings.pb.h"
 #include "config/metric_definition.pb.h"
 #include "config/report_definition.pb.h"
 #include "encoder/client_secret.h"
@@ -111,7 +114,21 @@ class Encoder {
   // The output of the Encode*() methods is a triple consisting of a status
   // and, if the status is kOK, a new observation and its metadata. The
   // observation will have been assigned a new quasi-unique |random_id|.
+  //
+  // The observation is taken from a per-thread pool. If the Result still owns
+  // it when the Result is destroyed, as it does after the observation has been
+  // passed to ObservationWriter::WriteObservation(), the observation goes back
+  // to the pool of the destroying thread and is reused, together with the
+  // storage of its fields, by a later Encode*() call on that thread. The
+  // metadata is not pooled. It is passed to
+  // ObservationWriter::RegisterMetadata() for the handle with which the
+  // observation is written.
   struct Result {
+    Result() = default;
+    Result(Result&&) = default;
+    Result& operator=(Result&&) = default;
+    ~Result();
+
     Status status;
     std::unique_ptr<Observation2> observation;
     std::unique_ptr<ObservationMetadata> metadata;
@@ -139,6 +156,43 @@ class Encoder {
                                       uint32_t day_index, uint32_t value_index,
                                       uint32_t num_categories) const;
 
+  // Encodes an Observation of type BasicRapporObservation as above, using the
+  // given |basic_rappor_config| instead of computing one from |report|. This
+  // allows the caller to compute the config once for many Observations. See
+  // ReportPlan.
+  Result EncodeBasicRapporObservation(
+      MetricRef metric, const ReportDefinition* report, uint32_t day_index,
+      uint32_t value_index, const BasicRapporConfig& basic_rappor_config) const;
+
+  // Encodes an Observation of type UniqueActivesObservation. This is a
+  // locally aggregated Observation that is generated by the EventAggregator
+  // once per day for each window size.
+  //
+  // metric: Provides access to the names and IDs of the customer, project and
+  // metric associated with the Observation being encoded.
+  //
+  // report: The definition of the Report associated with the Observation being
+  // encoded. In addition to the common fields always required, this method also
+  // requires that the |local_privacy_noise_level| field be set. This is used to
+  // determine the p and q values for Basic RAPPOR.
+  //
+  // day_index: The day index associated with the Observation being encoded.
+  // This is the last day of the window.
+  //
+  // active_event_codes: The event codes of the events that occurred at least
+  // once during the window of |window_size| days ending on |day_index|. The
+  // bits for these event codes, and no others, are set prior to applying
+  // randomized response. Each must be in the range [0, num_categories - 1].
+  //
+  // window_size: The size of the window, in days.
+  //
+  // num_categories: The number of categories to use in the Basic RAPPOR
+  // encoding.
+  Result EncodeUniqueActivesObservation(
+      MetricRef metric, const ReportDefinition* report, uint32_t day_index,
+      const std::vector<uint32_t>& active_event_codes, uint32_t window_size,
+      uint32_t num_categories) const;
+
   // Encodes an Observation of type IntegerEventObservation.
   //
   // metric: Provides access to the names and IDs of the customer, project and
@@ -226,6 +280,13 @@ class Encoder {
                                  uint32_t day_index,
                                  const std::string& str) const;
 
+  // Encodes an Observation of type RapporObservation as above, using the given
+  // |rappor_config| instead of computing one from |report|. See ReportPlan.
+  Result EncodeRapporObservation(MetricRef metric,
+                                 const ReportDefinition* report,
+                                 uint32_t day_index, const std::string& str,
+                                 const RapporConfig& rappor_config) const;
+
   // Encodes an Observation of type ForculusObservation.
   //
   // metric: Provides access to the names and IDs of the customer, project and
@@ -244,7 +305,18 @@ class Encoder {
                                    uint32_t day_index,
                                    const std::string& str) const;
 
+  // The cache of the Bloom filters of the strings encoded by
+  // EncodeRapporObservation(), which is shared by all of the metrics. Its
+  // hits() and misses() count the encodings that did and did not find the
+  // Bloom filter of their string.
+  const rappor::BloomBitsCache& rappor_bloom_bits_cache() const {
+    return *rappor_bloom_bits_cache_;
+  }
+
  private:
+  // The capacity of |rappor_bloom_bits_cache_|.
+  static const size_t kRapporBloomBitsCacheSize = 1024;
+
   // Makes an Observation and ObservationMetadata with all information that
   // is independent of which Encode*() method is being invoked.
   Result MakeObservation(MetricRef metric, const ReportDefinition* report,
@@ -253,6 +325,7 @@ class Encoder {
   const encoder::ClientSecret client_secret_;
   const encoder::SystemDataInterface* system_data_;
   mutable crypto::Random random_;
+  const std::shared_ptr<rappor::BloomBitsCache> rappor_bloom_bits_cache_;
 };
 
 }  // namespace logger
@@ -322,6 +322,43 @@ TEST_F(EncoderTest, EncodeHistogramObservation) {
   }
 }
 
+// Tests that the Observation of a destroyed Result is reused by the next
+// Encode*() call on the same thread, and that none of its fields are carried
+// over to the new Observation.
+TEST_F(EncoderTest, ReusesPooledObservation) {
+  auto pair = GetMetricAndReport("FileSystemWriteTimes",
+                                 "FileSystemWriteTimes_Histogram");
+  const Observation2* pooled_observation;
+  std::string pooled_random_id;
+  {
+    auto result = encoder_->EncodeHistogramObservation(
+        project_context_->RefMetric(pair.first), pair.second, 111, 9,
+        "My Component", NewHistogram({0, 1, 2}, {100, 200, 300}));
+    ASSERT_EQ(kOK, result.status);
+    pooled_observation = result.observation.get();
+    pooled_random_id = result.observation->random_id();
+  }
+
+  auto result = encoder_->EncodeHistogramObservation(
+      project_context_->RefMetric(pair.first), pair.second, 111, 7, "",
+      NewHistogram({3}, {400}));
+  CheckResult(result, 6, 151, 111);
+  EXPECT_EQ(pooled_observation, result.observation.get());
+  EXPECT_NE(pooled_random_id, result.observation->random_id());
+  const HistogramObservation& obs = result.observation->histogram();
+  EXPECT_EQ(7u, obs.event_code());
+  EXPECT_TRUE(obs.component_name_hash().empty());
+  ASSERT_EQ(1, obs.buckets_size());
+  EXPECT_EQ(3u, obs.buckets(0).index());
+  EXPECT_EQ(400u, obs.buckets(0).count());
+
+  // While the Result owns the pooled Observation the next one is new.
+  auto other_result = encoder_->EncodeHistogramObservation(
+      project_context_->RefMetric(pair.first), pair.second, 111, 7, "",
+      NewHistogram({3}, {400}));
+  EXPECT_NE(result.observation.get(), other_result.observation.get());
+}
+
 TEST_F(EncoderTest, EncodeRapporObservation) {
   const char kMetricName[] = "ModuleDownloads";
   const char kReportName[] = "ModuleDownloads_HeavyHitters";
@@ -349,6 +386,29 @@ TEST_F(EncoderTest, EncodeRapporObservation) {
   EXPECT_EQ(kInvalidConfig, result.status);
 }
 
+// Tests that the Bloom filters of the strings encoded by
+// EncodeRapporObservation() are cached across calls.
+TEST_F(EncoderTest, EncodeRapporObservationCachesBloomBits) {
+  auto pair =
+      GetMetricAndReport("ModuleDownloads", "ModuleDownloads_HeavyHitters");
+  const auto& cache = encoder_->rappor_bloom_bits_cache();
+  for (int i = 0; i < 3; i++) {
+    auto result = encoder_->EncodeRapporObservation(
+        project_context_->RefMetric(pair.first), pair.second, 111,
+        "Supercalifragilistic");
+    EXPECT_EQ(kOK, result.status);
+  }
+  EXPECT_EQ(2u, cache.hits());
+  EXPECT_EQ(1u, cache.misses());
+
+  EXPECT_EQ(kOK, encoder_
+                     ->EncodeRapporObservation(
+                         project_context_->RefMetric(pair.first), pair.second,
+                         111, "Expialidocious")
+                     .status);
+  EXPECT_EQ(2u, cache.misses());
+}
+
 TEST_F(EncoderTest, EncodeCustomObservation) {
   const char kMetricName[] = "ModuleInstalls";
   const char kReportName[] = "ModuleInstalls_DetailedData";
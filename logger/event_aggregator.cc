@@ -0,0 +1,542 @@
+// Copyright 2018 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "logger/event_aggregator.h"
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "./logging.h"
+#include "algorithms/rappor/rappor_config_helper.h"
+#include "util/datetime_util.h"
+
+namespace cobalt {
+namespace logger {
+
+using ::cobalt::rappor::RapporConfigHelper;
+using ::cobalt::util::ClockInterface;
+using ::cobalt::util::TimeToDayIndex;
+
+namespace {
+
+// Sets |*key| to the key of the given Report in the LocalAggregateStore. The
+// previous contents of |*key| are discarded but its storage is reused.
+void MakeReportKey(uint32_t customer_id, uint32_t project_id,
+                   uint32_t metric_id, uint32_t report_id, std::string* key) {
+  key->clear();
+  for (auto id : {customer_id, project_id, metric_id, report_id}) {
+    if (!key->empty()) {
+      key->push_back(':');
+    }
+    key->append(std::to_string(id));
+  }
+}
+
+std::string MakeReportKey(uint32_t customer_id, uint32_t project_id,
+                          uint32_t metric_id, uint32_t report_id) {
+  std::string key;
+  MakeReportKey(customer_id, project_id, metric_id, report_id, &key);
+  return key;
+}
+
+// Returns the size in days of the largest window of |report|, or zero if
+// |report| has no valid window sizes.
+uint32_t MaxWindowSize(const ReportDefinition& report) {
+  uint32_t max_window_size = 0;
+  for (const auto window_size : report.window_size()) {
+    max_window_size =
+        std::max(max_window_size, static_cast<uint32_t>(window_size));
+  }
+  return max_window_size;
+}
+
+}  // namespace
+
+// An Observation collected by CollectObservationsLocked() that is to be
+// encoded and written by WritePendingObservation() after |mutex_| has been
+// released.
+struct EventAggregator::PendingObservation {
+  uint32_t day_index = 0;
+
+  // Used for EVENT_COMPONENT_OCCURRENCE_COUNT reports.
+  uint32_t event_code = 0;
+  std::string component;
+  int64_t count = 0;
+
+  // Used for UNIQUE_N_DAY_ACTIVES reports.
+  uint32_t window_size = 0;
+  std::vector<uint32_t> active_event_codes;
+};
+
+// The Observations collected by CollectObservationsLocked() for a single
+// Report. For UNIQUE_N_DAY_ACTIVES reports they are ordered by day_index.
+struct EventAggregator::PendingReport {
+  std::string report_key;
+  AggregationConfig config;
+  uint32_t final_day_index = 0;
+  std::vector<PendingObservation> observations;
+};
+
+EventAggregator::EventAggregator(
+    const Encoder* encoder, const ObservationWriter* observation_writer,
+    util::ConsistentProtoStore* local_aggregate_proto_store,
+    size_t backfill_days, std::chrono::seconds aggregate_backup_interval)
+    : encoder_(encoder),
+      observation_writer_(observation_writer),
+      local_aggregate_proto_store_(local_aggregate_proto_store),
+      backfill_days_(backfill_days),
+      aggregate_backup_interval_(aggregate_backup_interval) {
+  CHECK(encoder_);
+  CHECK(observation_writer_);
+  CHECK(local_aggregate_proto_store_);
+  auto status = local_aggregate_proto_store_->Read(&local_aggregate_store_);
+  if (!status.ok()) {
+    // This is expected the first time the EventAggregator is used on a
+    // device.
+    VLOG(1) << "Unable to restore the LocalAggregateStore: "
+            << status.error_message() << ". Starting with an empty store.";
+    local_aggregate_store_.Clear();
+  }
+}
+
+EventAggregator::~EventAggregator() {
+  {
+    std::lock_guard<std::mutex> lock(shut_down_mutex_);
+    shut_down_ = true;
+  }
+  shut_down_notifier_.notify_all();
+  if (worker_thread_.joinable()) {
+    worker_thread_.join();
+  }
+}
+
+void EventAggregator::Start(std::unique_ptr<ClockInterface> clock) {
+  CHECK(clock);
+  CHECK(!worker_thread_.joinable());
+  clock_ = std::move(clock);
+  worker_thread_ = std::thread([this]() { this->Run(); });
+}
+
+bool EventAggregator::IsLocallyAggregated(
+    MetricDefinition::MetricType metric_type,
+    ReportDefinition::ReportType report_type) {
+  switch (report_type) {
+    case ReportDefinition::UNIQUE_N_DAY_ACTIVES:
+      return metric_type == MetricDefinition::EVENT_OCCURRED;
+    case ReportDefinition::EVENT_COMPONENT_OCCURRENCE_COUNT:
+      return metric_type == MetricDefinition::EVENT_COUNT;
+    default:
+      return false;
+  }
+}
+
+Status EventAggregator::UpdateAggregationConfigs(
+    const ProjectContext& project_context) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  const auto& project = project_context.project();
+  for (const auto& metric : project_context.metrics().metric()) {
+    if (metric.customer_id() != project.customer_id() ||
+        metric.project_id() != project.project_id()) {
+      continue;
+    }
+    for (const auto& report : metric.reports()) {
+      if (!IsLocallyAggregated(metric.metric_type(), report.report_type())) {
+        continue;
+      }
+      auto key = MakeReportKey(project.customer_id(), project.project_id(),
+                               metric.id(), report.id());
+      auto* config = (*local_aggregate_store_.mutable_by_report_key())[key]
+                         .mutable_aggregation_config();
+      *config->mutable_project() = project;
+      *config->mutable_metric() = metric;
+      // The reports are available via |report|. There is no need to store a
+      // second copy of them with the MetricDefinition.
+      config->mutable_metric()->clear_reports();
+      *config->mutable_report() = report;
+    }
+  }
+  return kOK;
+}
+
+Status EventAggregator::LogUniqueActivesEvent(MetricRef metric,
+                                              const ReportDefinition& report,
+                                              const Event& event) {
+  if (!event.has_occurrence_event()) {
+    LOG(ERROR) << "EventAggregator::LogUniqueActivesEvent() requires an "
+                  "OccurrenceEvent.";
+    return kInvalidArguments;
+  }
+  return AddToTally(metric, report, event.day_index(),
+                    event.occurrence_event().event_code(), "", 1);
+}
+
+Status EventAggregator::LogCountEvent(MetricRef metric,
+                                      const ReportDefinition& report,
+                                      const Event& event) {
+  if (!event.has_count_event()) {
+    LOG(ERROR) << "EventAggregator::LogCountEvent() requires a CountEvent.";
+    return kInvalidArguments;
+  }
+  const auto& count_event = event.count_event();
+  return AddToTally(metric, report, event.day_index(), count_event.event_code(),
+                    count_event.component(), count_event.count());
+}
+
+Status EventAggregator::AddToTally(MetricRef metric,
+                                   const ReportDefinition& report,
+                                   uint32_t day_index, uint32_t event_code,
+                                   const std::string& component,
+                                   int64_t delta) {
+  // The key is built in a per-thread buffer so that, in the steady state,
+  // logging an Event does not allocate.
+  thread_local std::string key;
+  MakeReportKey(metric.project().customer_id(), metric.project().project_id(),
+                metric.metric_id(), report.id(), &key);
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto* by_report_key = local_aggregate_store_.mutable_by_report_key();
+  auto iter = by_report_key->find(key);
+  if (iter == by_report_key->end()) {
+    LOG(ERROR) << "The Report " << report.report_name() << " of Metric "
+               << metric.metric_name() << " in project "
+               << metric.ProjectDebugString()
+               << " has not been registered with the EventAggregator.";
+    return kInvalidArguments;
+  }
+  auto& report_aggregates = iter->second;
+  if (report_aggregates.last_generated_day_index() != 0 &&
+      day_index <= report_aggregates.last_generated_day_index()) {
+    // Observations for this day have already been sent.
+    VLOG(1) << "Dropping an Event for Report " << report.report_name()
+            << " with day_index " << day_index
+            << " because Observations have already been generated for that "
+               "day.";
+    return kOK;
+  }
+  (*(*(*report_aggregates.mutable_by_day_index())[day_index]
+          .mutable_by_event_code())[event_code]
+        .mutable_by_component())[component] += delta;
+  return kOK;
+}
+
+Status EventAggregator::GenerateObservations(uint32_t final_day_index_utc,
+                                             uint32_t final_day_index_local) {
+  if (final_day_index_local == 0) {
+    final_day_index_local = final_day_index_utc;
+  }
+  std::lock_guard<std::mutex> generate_lock(generate_mutex_);
+  std::vector<PendingReport> pending_reports;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto& pair : local_aggregate_store_.by_report_key()) {
+      const auto& report_aggregates = pair.second;
+      uint32_t final_day_index =
+          report_aggregates.aggregation_config().metric().time_zone_policy() ==
+                  MetricDefinition::LOCAL
+              ? final_day_index_local
+              : final_day_index_utc;
+      if (report_aggregates.last_generated_day_index() >= final_day_index) {
+        continue;
+      }
+      PendingReport pending;
+      pending.report_key = pair.first;
+      pending.final_day_index = final_day_index;
+      CollectObservationsLocked(report_aggregates, &pending);
+      pending_reports.push_back(std::move(pending));
+    }
+  }
+
+  // Encode and write the Observations without holding |mutex_| so that
+  // concurrent logging is not blocked. The Observations of each Report are
+  // written in order until the first failure, so that those that were
+  // written can be committed by CommitObservationsLocked().
+  Status status = kOK;
+  std::vector<size_t> num_written(pending_reports.size(), 0);
+  for (size_t i = 0; i < pending_reports.size(); i++) {
+    for (const auto& observation : pending_reports[i].observations) {
+      auto write_status =
+          WritePendingObservation(pending_reports[i].config, observation);
+      if (write_status != kOK) {
+        if (status == kOK) {
+          status = write_status;
+        }
+        break;
+      }
+      num_written[i]++;
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto* by_report_key = local_aggregate_store_.mutable_by_report_key();
+  for (size_t i = 0; i < pending_reports.size(); i++) {
+    auto iter = by_report_key->find(pending_reports[i].report_key);
+    if (iter != by_report_key->end()) {
+      CommitObservationsLocked(pending_reports[i], num_written[i],
+                               &iter->second);
+    }
+  }
+  return status;
+}
+
+void EventAggregator::CollectObservationsLocked(
+    const ReportAggregates& report_aggregates, PendingReport* pending) {
+  pending->config = report_aggregates.aggregation_config();
+  const auto& report = pending->config.report();
+  const auto& by_day_index = report_aggregates.by_day_index();
+  uint32_t final_day_index = pending->final_day_index;
+
+  switch (report.report_type()) {
+    case ReportDefinition::EVENT_COMPONENT_OCCURRENCE_COUNT: {
+      // One Observation for each (day_index, event_code, component) that
+      // has ended.
+      for (const auto& day_pair : by_day_index) {
+        if (day_pair.first > final_day_index) {
+          continue;
+        }
+        for (const auto& event_code_pair : day_pair.second.by_event_code()) {
+          for (const auto& component_pair :
+               event_code_pair.second.by_component()) {
+            PendingObservation observation;
+            observation.day_index = day_pair.first;
+            observation.event_code = event_code_pair.first;
+            observation.component = component_pair.first;
+            observation.count = component_pair.second;
+            pending->observations.push_back(std::move(observation));
+          }
+        }
+      }
+      break;
+    }
+
+    case ReportDefinition::UNIQUE_N_DAY_ACTIVES: {
+      // One Observation for each day and window size, whether or not any
+      // event occurred, except for those that were written by an earlier
+      // invocation that was interrupted.
+      uint32_t first_day_index =
+          final_day_index -
+          std::min(static_cast<uint32_t>(backfill_days_), final_day_index);
+      if (report_aggregates.last_generated_day_index() >= first_day_index) {
+        first_day_index = report_aggregates.last_generated_day_index() + 1;
+      }
+      const auto& generated_window_sizes =
+          report_aggregates.generated_window_sizes();
+      uint32_t num_event_codes = pending->config.metric().max_event_code() + 1;
+      std::vector<bool> was_active(num_event_codes);
+      for (uint32_t day_index = first_day_index; day_index <= final_day_index;
+           day_index++) {
+        for (const auto window_size : report.window_size()) {
+          if (window_size == WindowSize::UNSET) {
+            continue;
+          }
+          if (day_index == report_aggregates.partially_generated_day_index() &&
+              std::find(generated_window_sizes.begin(),
+                        generated_window_sizes.end(),
+                        static_cast<uint32_t>(window_size)) !=
+                  generated_window_sizes.end()) {
+            continue;
+          }
+          uint32_t window_start = day_index - std::min(
+              static_cast<uint32_t>(window_size) - 1, day_index);
+          std::fill(was_active.begin(), was_active.end(), false);
+          for (uint32_t d = window_start; d <= day_index; d++) {
+            auto day_iter = by_day_index.find(d);
+            if (day_iter == by_day_index.end()) {
+              continue;
+            }
+            for (const auto& event_code_pair :
+                 day_iter->second.by_event_code()) {
+              if (event_code_pair.first < num_event_codes) {
+                was_active[event_code_pair.first] = true;
+              }
+            }
+          }
+          PendingObservation observation;
+          observation.day_index = day_index;
+          observation.window_size = window_size;
+          for (uint32_t event_code = 0; event_code < num_event_codes;
+               event_code++) {
+            if (was_active[event_code]) {
+              observation.active_event_codes.push_back(event_code);
+            }
+          }
+          pending->observations.push_back(std::move(observation));
+        }
+      }
+      break;
+    }
+
+    default:
+      break;
+  }
+}
+
+void EventAggregator::CommitObservationsLocked(
+    const PendingReport& pending, size_t num_written,
+    ReportAggregates* report_aggregates) {
+  const auto& observations = pending.observations;
+  bool all_written = num_written == observations.size();
+  auto* by_day_index = report_aggregates->mutable_by_day_index();
+
+  switch (pending.config.report().report_type()) {
+    case ReportDefinition::EVENT_COMPONENT_OCCURRENCE_COUNT: {
+      // Subtract the counts that were written, rather than discarding the
+      // tallies, so that counts logged since the Observations were collected
+      // are sent next time.
+      for (size_t i = 0; i < num_written; i++) {
+        const auto& observation = observations[i];
+        auto day_iter = by_day_index->find(observation.day_index);
+        if (day_iter == by_day_index->end()) {
+          continue;
+        }
+        auto* by_event_code = day_iter->second.mutable_by_event_code();
+        auto event_code_iter = by_event_code->find(observation.event_code);
+        if (event_code_iter == by_event_code->end()) {
+          continue;
+        }
+        auto* by_component = event_code_iter->second.mutable_by_component();
+        auto component_iter = by_component->find(observation.component);
+        if (component_iter == by_component->end()) {
+          continue;
+        }
+        component_iter->second -= observation.count;
+        if (component_iter->second == 0) {
+          by_component->erase(component_iter);
+        }
+        if (by_component->empty()) {
+          by_event_code->erase(event_code_iter);
+        }
+        if (by_event_code->empty()) {
+          by_day_index->erase(day_iter);
+        }
+      }
+      if (all_written) {
+        report_aggregates->set_last_generated_day_index(
+            pending.final_day_index);
+      }
+      break;
+    }
+
+    case ReportDefinition::UNIQUE_N_DAY_ACTIVES: {
+      uint32_t last_generated_day_index =
+          report_aggregates->last_generated_day_index();
+      if (all_written) {
+        last_generated_day_index = pending.final_day_index;
+      } else {
+        // The days before that of the first Observation that was not written
+        // are complete. Of that day, remember the window sizes that were.
+        uint32_t day_index = observations[num_written].day_index;
+        if (day_index > observations[0].day_index) {
+          last_generated_day_index = day_index - 1;
+        }
+        if (report_aggregates->partially_generated_day_index() != day_index) {
+          report_aggregates->set_partially_generated_day_index(day_index);
+          report_aggregates->clear_generated_window_sizes();
+        }
+        for (size_t i = 0; i < num_written; i++) {
+          if (observations[i].day_index == day_index) {
+            report_aggregates->add_generated_window_sizes(
+                observations[i].window_size);
+          }
+        }
+      }
+      report_aggregates->set_last_generated_day_index(last_generated_day_index);
+      if (report_aggregates->partially_generated_day_index() <=
+          last_generated_day_index) {
+        report_aggregates->set_partially_generated_day_index(0);
+        report_aggregates->clear_generated_window_sizes();
+      }
+
+      // Discard the tallies for days that fall outside of all future windows.
+      uint32_t max_window_size = MaxWindowSize(pending.config.report());
+      for (auto day_iter = by_day_index->begin();
+           day_iter != by_day_index->end();) {
+        if (day_iter->first + max_window_size <= last_generated_day_index + 1) {
+          day_iter = by_day_index->erase(day_iter);
+        } else {
+          ++day_iter;
+        }
+      }
+      break;
+    }
+
+    default:
+      report_aggregates->set_last_generated_day_index(pending.final_day_index);
+      break;
+  }
+}
+
+Status EventAggregator::WritePendingObservation(
+    const AggregationConfig& config, const PendingObservation& pending) {
+  MetricRef metric_ref(&config.project(), &config.metric());
+  Encoder::Result encoder_result;
+  switch (config.report().report_type()) {
+    case ReportDefinition::EVENT_COMPONENT_OCCURRENCE_COUNT:
+      encoder_result = encoder_->EncodeIntegerEventObservation(
+          metric_ref, &config.report(), pending.day_index, pending.event_code,
+          pending.component, pending.count);
+      break;
+
+    case ReportDefinition::UNIQUE_N_DAY_ACTIVES:
+      encoder_result = encoder_->EncodeUniqueActivesObservation(
+          metric_ref, &config.report(), pending.day_index,
+          pending.active_event_codes, pending.window_size,
+          RapporConfigHelper::BasicRapporNumCategories(config.metric()));
+      break;
+
+    default:
+      LOG(ERROR) << "Report " << config.report().report_name()
+                 << " is not locally aggregated.";
+      return kInvalidConfig;
+  }
+  if (encoder_result.status != kOK) {
+    return encoder_result.status;
+  }
+  return observation_writer_->WriteObservation(
+      *encoder_result.observation,
+      observation_writer_->RegisterMetadata(*encoder_result.metadata));
+}
+
+Status EventAggregator::BackUpLocalAggregateStore() {
+  LocalAggregateStore snapshot = CopyLocalAggregateStore();
+  auto status = local_aggregate_proto_store_->Write(snapshot);
+  if (!status.ok()) {
+    LOG(ERROR) << "Failed to back up the LocalAggregateStore: "
+               << status.error_message();
+    return kOther;
+  }
+  return kOK;
+}
+
+LocalAggregateStore EventAggregator::CopyLocalAggregateStore() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return local_aggregate_store_;
+}
+
+void EventAggregator::Run() {
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(shut_down_mutex_);
+      shut_down_notifier_.wait_for(lock, aggregate_backup_interval_,
+                                   [this]() { return shut_down_; });
+      if (shut_down_) {
+        break;
+      }
+    }
+    // Generate Observations for the day that ended before the current day.
+    auto now = std::chrono::system_clock::to_time_t(clock_->now());
+    uint32_t today_utc = TimeToDayIndex(now, MetricDefinition::UTC);
+    uint32_t today_local = TimeToDayIndex(now, MetricDefinition::LOCAL);
+    if (today_utc > 0 && today_local > 0) {
+      GenerateObservations(today_utc - 1, today_local - 1);
+    }
+    BackUpLocalAggregateStore();
+  }
+  // Save the latest tallies before exiting.
+  BackUpLocalAggregateStore();
+}
+
+}  // namespace logger
+}  // namespace cobalt
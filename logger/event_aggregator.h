@@ -0,0 +1,207 @@
+// Copyright 2018 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef COBALT_LOGGER_EVENT_AGGREGATOR_H_
+#define COBALT_LOGGER_EVENT_AGGREGATOR_H_
+
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "./event.pb.h"
+#include "config/metric_definition.pb.h"
+#include "config/report_definition.pb.h"
+#include "logger/encoder.h"
+#include "logger/local_aggregation.pb.h"
+#include "logger/observation_writer.h"
+#include "logger/project_context.h"
+#include "logger/status.h"
+#include "util/clock.h"
+#include "util/consistent_proto_store.h"
+
+namespace cobalt {
+namespace logger {
+
+// The EventAggregator performs on-device local aggregation of logged Events
+// for those Reports whose Observations are not generated immediately when an
+// Event is logged.
+//
+// The EventAggregator keeps, for each locally aggregated Report, a running
+// tally for each (event_code, component, day_index). Once a day has ended the
+// EventAggregator generates Observations from the tallies and writes them to
+// the ObservationStore via the ObservationWriter. The tallies are periodically
+// backed up to a ConsistentProtoStore so that they survive a restart.
+//
+// The following (Metric type, Report type) pairs are locally aggregated:
+//
+// - (EVENT_OCCURRED, UNIQUE_N_DAY_ACTIVES): For each day and for each window
+//   size listed in the ReportDefinition, one UniqueActivesObservation is
+//   generated. Its Basic RAPPOR bit vector has one bit for each event code,
+//   which is set if the event occurred on the device during the window ending
+//   on that day.
+//
+// - (EVENT_COUNT, EVENT_COMPONENT_OCCURRENCE_COUNT): For each day, one
+//   IntegerEventObservation is generated for each (event_code, component)
+//   that was logged on that day. Its value is the sum of the logged counts.
+//   Because the analyzer sums the values of these Observations this yields
+//   the same report as sending one Observation per logged Event.
+//
+// A system has a single instance of EventAggregator which is shared by all
+// of the Loggers. Usage: Construct an EventAggregator, pass it to the
+// constructor of each Logger and invoke Start() once. Alternatively the
+// embedder may drive the EventAggregator directly by periodically invoking
+// GenerateObservations() and BackUpLocalAggregateStore().
+//
+// All public methods of this class are thread-safe.
+class EventAggregator {
+ public:
+  // Constructor
+  //
+  // |encoder| The singleton instance of Encoder on the system. This must
+  // remain valid as long as the EventAggregator is being used.
+  //
+  // |observation_writer| Used to write the locally aggregated Observations to
+  // the ObservationStore. This must remain valid as long as the
+  // EventAggregator is being used.
+  //
+  // |local_aggregate_proto_store| A ConsistentProtoStore used to persist the
+  // aggregation state. The state is read from this store during construction.
+  // This must remain valid as long as the EventAggregator is being used.
+  //
+  // |backfill_days| The number of days prior to the final day index passed to
+  // GenerateObservations() for which the EventAggregator should also generate
+  // UniqueActivesObservations if it has not already done so, for example
+  // because the device was asleep at the end of those days.
+  //
+  // |aggregate_backup_interval| How often the worker thread started by Start()
+  // wakes up in order to back up the aggregation state and to check for a day
+  // rollover.
+  EventAggregator(const Encoder* encoder,
+                  const ObservationWriter* observation_writer,
+                  util::ConsistentProtoStore* local_aggregate_proto_store,
+                  size_t backfill_days = 0,
+                  std::chrono::seconds aggregate_backup_interval =
+                      std::chrono::seconds(60));
+
+  // Stops the worker thread, if it was started, and waits for it to exit.
+  ~EventAggregator();
+
+  // Starts the worker thread. The worker thread uses |clock| to determine the
+  // current day index. Every |aggregate_backup_interval| it generates the
+  // Observations for any days that have ended and backs up the aggregation
+  // state. This method must be invoked at most once.
+  void Start(std::unique_ptr<util::ClockInterface> clock);
+
+  // Registers each of the locally aggregated Reports of |project_context| with
+  // the EventAggregator. Existing tallies for a Report that was previously
+  // registered are kept. This is invoked by the Logger constructor.
+  Status UpdateAggregationConfigs(const ProjectContext& project_context);
+
+  // Records in the tally for |report| that the occurrence event in |event|
+  // happened on the Event's day_index. |report| must be of type
+  // UNIQUE_N_DAY_ACTIVES and must have been registered via
+  // UpdateAggregationConfigs().
+  Status LogUniqueActivesEvent(MetricRef metric, const ReportDefinition& report,
+                               const Event& event);
+
+  // Adds the count in the count event in |event| to the tally for |report|
+  // for the Event's (event_code, component, day_index). |report| must be of
+  // type EVENT_COMPONENT_OCCURRENCE_COUNT and must have been registered via
+  // UpdateAggregationConfigs().
+  Status LogCountEvent(MetricRef metric, const ReportDefinition& report,
+                       const Event& event);
+
+  // Generates the locally aggregated Observations for all days up to and
+  // including the given final day index, for which they have not yet been
+  // generated, and writes them to the ObservationStore. Tallies that are no
+  // longer needed are discarded.
+  //
+  // The aggregation state records only those Observations that were written.
+  // If a write fails, for example because the ObservationStore is full, the
+  // Observations of that Report that were not written are generated again by
+  // the next invocation.
+  //
+  // |final_day_index_utc| is used for Metrics with a UTC time zone policy and
+  // |final_day_index_local| is used for Metrics with a LOCAL time zone policy.
+  // If |final_day_index_local| is zero then |final_day_index_utc| is used for
+  // all Metrics.
+  //
+  // Returns kOK if all Observations were written successfully, otherwise the
+  // status of the first failure.
+  Status GenerateObservations(uint32_t final_day_index_utc,
+                              uint32_t final_day_index_local = 0);
+
+  // Writes a snapshot of the aggregation state to the ConsistentProtoStore.
+  Status BackUpLocalAggregateStore();
+
+  // Returns a copy of the current aggregation state. This is mostly useful
+  // in tests.
+  LocalAggregateStore CopyLocalAggregateStore();
+
+  // Returns true iff the EventAggregator performs local aggregation for
+  // Reports of type |report_type| belonging to Metrics of type |metric_type|.
+  static bool IsLocallyAggregated(MetricDefinition::MetricType metric_type,
+                                  ReportDefinition::ReportType report_type);
+
+ private:
+  struct PendingObservation;
+  struct PendingReport;
+
+  // Adds |delta| to the tally for (|event_code|, |component|, |day_index|) of
+  // the given Report.
+  Status AddToTally(MetricRef metric, const ReportDefinition& report,
+                    uint32_t day_index, uint32_t event_code,
+                    const std::string& component, int64_t delta);
+
+  // Invoked by GenerateObservations() while holding |mutex_|. Appends to
+  // |pending->observations| the Observations that should be generated for
+  // |report_aggregates| up to and including |pending->final_day_index|.
+  void CollectObservationsLocked(const ReportAggregates& report_aggregates,
+                                 PendingReport* pending);
+
+  // Invoked by GenerateObservations() while holding |mutex_|, once the first
+  // |num_written| of the Observations in |pending| have been written. Updates
+  // |report_aggregates| to record that those Observations were generated and
+  // discards the tallies that are no longer needed.
+  void CommitObservationsLocked(const PendingReport& pending,
+                                size_t num_written,
+                                ReportAggregates* report_aggregates);
+
+  // Encodes and writes a single Observation for the Report of |config|.
+  Status WritePendingObservation(const AggregationConfig& config,
+                                 const PendingObservation& pending);
+
+  // The main method run by the worker thread.
+  void Run();
+
+  const Encoder* encoder_;                                   // not owned
+  const ObservationWriter* observation_writer_;              // not owned
+  util::ConsistentProtoStore* local_aggregate_proto_store_;  // not owned
+  const size_t backfill_days_;
+  const std::chrono::seconds aggregate_backup_interval_;
+
+  // Serializes the invocations of GenerateObservations() so that the same
+  // Observations are not generated twice.
+  std::mutex generate_mutex_;
+
+  // Protects |local_aggregate_store_|.
+  std::mutex mutex_;
+  LocalAggregateStore local_aggregate_store_;
+
+  // Used by the worker thread.
+  std::unique_ptr<util::ClockInterface> clock_;
+  std::thread worker_thread_;
+  std::mutex shut_down_mutex_;
+  std::condition_variable shut_down_notifier_;
+  bool shut_down_ = false;
+};
+
+}  // namespace logger
+}  // namespace cobalt
+
+#endif  // COBALT_LOGGER_EVENT_AGGREGATOR_H_
@@ -0,0 +1,448 @@
+// Copyright 2018 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "logger/event_aggregator.h"
+
+#include <google/protobuf/text_format.h>
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "./gtest.h"
+#include "./observation2.pb.h"
+#include "encoder/client_secret.h"
+#include "encoder/observation_store.h"
+#include "encoder/observation_store_update_recipient.h"
+#include "logger/encoder.h"
+#include "logger/project_context.h"
+#include "logger/status.h"
+#include "util/consistent_proto_store.h"
+#include "util/encrypted_message_util.h"
+#include "util/posix_file_system.h"
+
+namespace cobalt {
+
+using encoder::ClientSecret;
+using encoder::MetadataHandle;
+using encoder::MetadataRegistry;
+using encoder::ObservationStoreUpdateRecipient;
+using encoder::ObservationStoreWriterInterface;
+using util::ConsistentProtoStore;
+using util::EncryptedMessageMaker;
+using util::MessageDecrypter;
+using util::PosixFileSystem;
+
+namespace logger {
+
+namespace {
+static const uint32_t kCustomerId = 1;
+static const uint32_t kProjectId = 1;
+static const char kCustomerName[] = "Fuchsia";
+static const char kProjectName[] = "Cobalt";
+
+static const char kAggregateStoreFile[] = "/tmp/event_aggregator_test_store";
+
+// Metric IDs
+const uint32_t kDeviceBootsMetricId = 1;
+const uint32_t kReadCacheHitsMetricId = 2;
+
+// Report IDs
+const uint32_t kDeviceBootsUniqueActivesReportId = 11;
+const uint32_t kReadCacheHitsCountsReportId = 21;
+
+static const char kMetricDefinitions[] = R"(
+metric {
+  metric_name: "DeviceBoots"
+  metric_type: EVENT_OCCURRED
+  customer_id: 1
+  project_id: 1
+  id: 1
+  max_event_code: 2
+  reports: {
+    report_name: "DeviceBoots_UniqueDevices"
+    id: 11
+    report_type: UNIQUE_N_DAY_ACTIVES
+    local_privacy_noise_level: NONE
+    window_size: WINDOW_1_DAY
+    window_size: WINDOW_7_DAYS
+  }
+}
+
+metric {
+  metric_name: "ReadCacheHits"
+  metric_type: EVENT_COUNT
+  customer_id: 1
+  project_id: 1
+  id: 2
+  reports: {
+    report_name: "ReadCacheHitCounts"
+    id: 21
+    report_type: EVENT_COMPONENT_OCCURRENCE_COUNT
+  }
+}
+)";
+
+bool PopulateMetricDefinitions(MetricDefinitions* metric_definitions) {
+  google::protobuf::TextFormat::Parser parser;
+  return parser.ParseFromString(kMetricDefinitions, metric_definitions);
+}
+
+class FakeObservationStore : public ObservationStoreWriterInterface {
+ public:
+  StoreStatus AddEncryptedObservation(
+      std::unique_ptr<EncryptedMessage> message,
+      std::unique_ptr<ObservationMetadata> metadata) override {
+    if (messages_received.size() >= capacity) {
+      return kStoreFull;
+    }
+    messages_received.emplace_back(std::move(message));
+    metadata_received.emplace_back(std::move(metadata));
+    return kOk;
+  }
+
+  MetadataHandle RegisterMetadata(
+      const ObservationMetadata& metadata) override {
+    return metadata_registry_.Register(metadata);
+  }
+
+  StoreStatus AddEncryptedObservationByHandle(
+      std::unique_ptr<EncryptedMessage> message,
+      MetadataHandle metadata) override {
+    auto entry = metadata_registry_.Get(metadata);
+    if (entry == nullptr) {
+      return kWriteFailed;
+    }
+    return AddEncryptedObservation(
+        std::move(message),
+        std::make_unique<ObservationMetadata>(entry->metadata));
+  }
+
+  // The number of Observations after which kStoreFull is returned.
+  size_t capacity = SIZE_MAX;
+  std::vector<std::unique_ptr<EncryptedMessage>> messages_received;
+  std::vector<std::unique_ptr<ObservationMetadata>> metadata_received;
+
+ private:
+  MetadataRegistry metadata_registry_;
+};
+
+class TestUpdateRecipient : public ObservationStoreUpdateRecipient {
+ public:
+  void NotifyObservationsAdded() override { invocation_count++; }
+
+  int invocation_count = 0;
+};
+
+}  // namespace
+
+class EventAggregatorTest : public ::testing::Test {
+ protected:
+  void SetUp() {
+    PosixFileSystem fs;
+    fs.Delete(kAggregateStoreFile);
+    auto metric_definitions = std::make_unique<MetricDefinitions>();
+    ASSERT_TRUE(PopulateMetricDefinitions(metric_definitions.get()));
+    project_context_.reset(new ProjectContext(kCustomerId, kProjectId,
+                                              kCustomerName, kProjectName,
+                                              std::move(metric_definitions)));
+    observation_store_.reset(new FakeObservationStore);
+    update_recipient_.reset(new TestUpdateRecipient);
+    observation_encrypter_.reset(
+        new EncryptedMessageMaker("", EncryptedMessage::NONE));
+    observation_writer_.reset(
+        new ObservationWriter(observation_store_.get(), update_recipient_.get(),
+                              observation_encrypter_.get()));
+    encoder_.reset(new Encoder(ClientSecret::GenerateNewSecret(), nullptr));
+    proto_store_ = MakeProtoStore();
+    event_aggregator_ = MakeEventAggregator(proto_store_.get());
+  }
+
+  void TearDown() {
+    event_aggregator_.reset();
+    PosixFileSystem fs;
+    fs.Delete(kAggregateStoreFile);
+  }
+
+  std::unique_ptr<ConsistentProtoStore> MakeProtoStore() {
+    return std::make_unique<ConsistentProtoStore>(
+        kAggregateStoreFile, std::make_unique<PosixFileSystem>());
+  }
+
+  std::unique_ptr<EventAggregator> MakeEventAggregator(
+      ConsistentProtoStore* proto_store) {
+    auto event_aggregator = std::make_unique<EventAggregator>(
+        encoder_.get(), observation_writer_.get(), proto_store);
+    EXPECT_EQ(kOK, event_aggregator->UpdateAggregationConfigs(
+                       *project_context_));
+    return event_aggregator;
+  }
+
+  Status LogOccurrence(uint32_t day_index, uint32_t event_code) {
+    Event event;
+    event.set_day_index(day_index);
+    event.mutable_occurrence_event()->set_event_code(event_code);
+    return event_aggregator_->LogUniqueActivesEvent(
+        project_context_->RefMetric(
+            project_context_->GetMetric(kDeviceBootsMetricId)),
+        project_context_->GetMetric(kDeviceBootsMetricId)->reports(0),
+        event);
+  }
+
+  Status LogCount(uint32_t day_index, uint32_t event_code,
+                  const std::string& component, int32_t count) {
+    Event event;
+    event.set_day_index(day_index);
+    auto* count_event = event.mutable_count_event();
+    count_event->set_event_code(event_code);
+    count_event->set_component(component);
+    count_event->set_count(count);
+    return event_aggregator_->LogCountEvent(
+        project_context_->RefMetric(
+            project_context_->GetMetric(kReadCacheHitsMetricId)),
+        project_context_->GetMetric(kReadCacheHitsMetricId)->reports(0),
+        event);
+  }
+
+  // Decrypts the Observations for the Report |report_id| received by the
+  // FakeObservationStore, checks their day index against
+  // |expected_day_index| and appends them to |observations|.
+  void FetchObservations(uint32_t report_id, uint32_t expected_day_index,
+                         std::vector<Observation2>* observations) {
+    ASSERT_EQ(observation_store_->messages_received.size(),
+              observation_store_->metadata_received.size());
+    MessageDecrypter message_decrypter("");
+    for (auto i = 0u; i < observation_store_->messages_received.size(); i++) {
+      const auto& metadata = *observation_store_->metadata_received[i];
+      if (metadata.report_id() != report_id) {
+        continue;
+      }
+      EXPECT_EQ(expected_day_index, metadata.day_index());
+      Observation2 observation;
+      ASSERT_TRUE(message_decrypter.DecryptMessage(
+          *observation_store_->messages_received[i], &observation));
+      observations->push_back(observation);
+    }
+  }
+
+  // Returns the set of (window_size, event_code) pairs that are marked as
+  // active in |observations|, all of which must be UniqueActivesObservations.
+  // The local privacy noise level is NONE so the data is exact. With 3
+  // categories the BasicRapporObservation consists of a single byte in which
+  // bit i is set iff event code i was active.
+  std::set<std::pair<uint32_t, uint32_t>> ActiveWindows(
+      const std::vector<Observation2>& observations) {
+    std::set<std::pair<uint32_t, uint32_t>> active;
+    for (const auto& observation : observations) {
+      EXPECT_TRUE(observation.has_unique_actives());
+      const auto& unique_actives = observation.unique_actives();
+      const auto& rappor_data = unique_actives.basic_rappor_obs().data();
+      EXPECT_EQ(1u, rappor_data.size());
+      if (rappor_data.size() != 1) {
+        continue;
+      }
+      for (uint32_t event_code = 0; event_code < 3; event_code++) {
+        if (rappor_data[0] & (1 << event_code)) {
+          active.insert({unique_actives.window_size(), event_code});
+        }
+      }
+    }
+    return active;
+  }
+
+  void ClearReceived() {
+    observation_store_->messages_received.clear();
+    observation_store_->metadata_received.clear();
+    update_recipient_->invocation_count = 0;
+  }
+
+  std::unique_ptr<ProjectContext> project_context_;
+  std::unique_ptr<FakeObservationStore> observation_store_;
+  std::unique_ptr<TestUpdateRecipient> update_recipient_;
+  std::unique_ptr<EncryptedMessageMaker> observation_encrypter_;
+  std::unique_ptr<ObservationWriter> observation_writer_;
+  std::unique_ptr<Encoder> encoder_;
+  std::unique_ptr<ConsistentProtoStore> proto_store_;
+  std::unique_ptr<EventAggregator> event_aggregator_;
+};
+
+// Tests that the counts logged for each (event_code, component) are summed
+// into a single IntegerEventObservation.
+TEST_F(EventAggregatorTest, CountEvents) {
+  const uint32_t kDayIndex = 17000;
+  EXPECT_EQ(kOK, LogCount(kDayIndex, 1, "a", 3));
+  EXPECT_EQ(kOK, LogCount(kDayIndex, 1, "a", 4));
+  EXPECT_EQ(kOK, LogCount(kDayIndex, 1, "b", 2));
+  EXPECT_EQ(kOK, LogCount(kDayIndex, 2, "", 5));
+  EXPECT_TRUE(observation_store_->messages_received.empty());
+
+  EXPECT_EQ(kOK, event_aggregator_->GenerateObservations(kDayIndex));
+  std::vector<Observation2> observations;
+  FetchObservations(kReadCacheHitsCountsReportId, kDayIndex, &observations);
+  ASSERT_EQ(3u, observations.size());
+  // The unique actives Report also generates one Observation per window size.
+  EXPECT_EQ(5, update_recipient_->invocation_count);
+
+  std::map<uint32_t, int64_t> sum_by_event_code;
+  int num_with_component = 0;
+  for (const auto& observation : observations) {
+    ASSERT_TRUE(observation.has_numeric_event());
+    const auto& numeric_event = observation.numeric_event();
+    sum_by_event_code[numeric_event.event_code()] += numeric_event.value();
+    if (!numeric_event.component_name_hash().empty()) {
+      num_with_component++;
+    }
+  }
+  EXPECT_EQ(9, sum_by_event_code[1]);
+  EXPECT_EQ(5, sum_by_event_code[2]);
+  EXPECT_EQ(2, num_with_component);
+
+  // The tallies have been discarded, so nothing more is generated.
+  ClearReceived();
+  EXPECT_EQ(kOK, event_aggregator_->GenerateObservations(kDayIndex + 1));
+  observations.clear();
+  FetchObservations(kReadCacheHitsCountsReportId, kDayIndex + 1,
+                    &observations);
+  EXPECT_TRUE(observations.empty());
+}
+
+// Tests that one UniqueActivesObservation is generated for each window size,
+// and that it indicates which events occurred during the window.
+TEST_F(EventAggregatorTest, UniqueActives) {
+  const uint32_t kDayIndex = 17000;
+  EXPECT_EQ(kOK, LogOccurrence(kDayIndex, 1));
+  EXPECT_EQ(kOK, LogOccurrence(kDayIndex, 1));
+  EXPECT_EQ(kOK, LogOccurrence(kDayIndex + 1, 2));
+  EXPECT_TRUE(observation_store_->messages_received.empty());
+
+  EXPECT_EQ(kOK, event_aggregator_->GenerateObservations(kDayIndex + 1));
+  std::vector<Observation2> observations;
+  FetchObservations(kDeviceBootsUniqueActivesReportId, kDayIndex + 1,
+                    &observations);
+  // One for each of the 2 window sizes.
+  ASSERT_EQ(2u, observations.size());
+
+  auto active = ActiveWindows(observations);
+  EXPECT_EQ(3u, active.size());
+  EXPECT_EQ(1u, active.count({WINDOW_1_DAY, 2}));
+  EXPECT_EQ(1u, active.count({WINDOW_7_DAYS, 1}));
+  EXPECT_EQ(1u, active.count({WINDOW_7_DAYS, 2}));
+
+  // Events for a day for which Observations have already been generated are
+  // dropped. Event code 1 from the first day is still in the 7-day window.
+  ClearReceived();
+  EXPECT_EQ(kOK, LogOccurrence(kDayIndex + 1, 0));
+  EXPECT_EQ(kOK, event_aggregator_->GenerateObservations(kDayIndex + 2));
+  observations.clear();
+  FetchObservations(kDeviceBootsUniqueActivesReportId, kDayIndex + 2,
+                    &observations);
+  ASSERT_EQ(2u, observations.size());
+  active = ActiveWindows(observations);
+  EXPECT_EQ(2u, active.size());
+  EXPECT_EQ(1u, active.count({WINDOW_7_DAYS, 1}));
+  EXPECT_EQ(1u, active.count({WINDOW_7_DAYS, 2}));
+}
+
+// Tests that counts are not lost when the ObservationStore is full, and that
+// counts logged after a failed attempt are included in the next one.
+TEST_F(EventAggregatorTest, CountEventsStoreFull) {
+  const uint32_t kDayIndex = 17000;
+  EXPECT_EQ(kOK, LogCount(kDayIndex, 1, "a", 3));
+  observation_store_->capacity = 0;
+  EXPECT_EQ(kFull, event_aggregator_->GenerateObservations(kDayIndex));
+  EXPECT_TRUE(observation_store_->messages_received.empty());
+
+  EXPECT_EQ(kOK, LogCount(kDayIndex, 1, "a", 4));
+  observation_store_->capacity = SIZE_MAX;
+  EXPECT_EQ(kOK, event_aggregator_->GenerateObservations(kDayIndex));
+  std::vector<Observation2> observations;
+  FetchObservations(kReadCacheHitsCountsReportId, kDayIndex, &observations);
+  ASSERT_EQ(1u, observations.size());
+  ASSERT_TRUE(observations[0].has_numeric_event());
+  EXPECT_EQ(7, observations[0].numeric_event().value());
+
+  ClearReceived();
+  EXPECT_EQ(kOK, event_aggregator_->GenerateObservations(kDayIndex + 1));
+  observations.clear();
+  FetchObservations(kReadCacheHitsCountsReportId, kDayIndex + 1,
+                    &observations);
+  EXPECT_TRUE(observations.empty());
+}
+
+// Tests that when the ObservationStore becomes full part of the way through
+// a day, the UniqueActivesObservations that were not written are generated
+// by the next attempt and those that were written are not generated again.
+TEST_F(EventAggregatorTest, UniqueActivesStoreFull) {
+  const uint32_t kDayIndex = 17000;
+  EXPECT_EQ(kOK, LogOccurrence(kDayIndex, 1));
+  observation_store_->capacity = 1;
+  EXPECT_EQ(kFull, event_aggregator_->GenerateObservations(kDayIndex + 1));
+  EXPECT_EQ(1u, observation_store_->messages_received.size());
+
+  observation_store_->capacity = SIZE_MAX;
+  EXPECT_EQ(kOK, event_aggregator_->GenerateObservations(kDayIndex + 1));
+  std::vector<Observation2> observations;
+  FetchObservations(kDeviceBootsUniqueActivesReportId, kDayIndex + 1,
+                    &observations);
+  ASSERT_EQ(2u, observations.size());
+  std::set<uint32_t> window_sizes;
+  for (const auto& observation : observations) {
+    window_sizes.insert(observation.unique_actives().window_size());
+  }
+  EXPECT_EQ(std::set<uint32_t>({WINDOW_1_DAY, WINDOW_7_DAYS}), window_sizes);
+  auto active = ActiveWindows(observations);
+  EXPECT_EQ(1u, active.size());
+  EXPECT_EQ(1u, active.count({WINDOW_7_DAYS, 1}));
+
+  ClearReceived();
+  EXPECT_EQ(kOK, event_aggregator_->GenerateObservations(kDayIndex + 1));
+  EXPECT_TRUE(observation_store_->messages_received.empty());
+}
+
+// Tests that logging for a Report that is not locally aggregated fails.
+TEST_F(EventAggregatorTest, UnregisteredReport) {
+  Event event;
+  event.set_day_index(17000);
+  event.mutable_occurrence_event()->set_event_code(1);
+  ReportDefinition report;
+  report.set_id(999);
+  report.set_report_type(ReportDefinition::UNIQUE_N_DAY_ACTIVES);
+  EXPECT_EQ(kInvalidArguments,
+            event_aggregator_->LogUniqueActivesEvent(
+                project_context_->RefMetric(
+                    project_context_->GetMetric(kDeviceBootsMetricId)),
+                report, event));
+}
+
+// Tests that the aggregation state survives the destruction of the
+// EventAggregator if it was backed up.
+TEST_F(EventAggregatorTest, BackUpAndRestore) {
+  const uint32_t kDayIndex = 17000;
+  EXPECT_EQ(kOK, LogCount(kDayIndex, 1, "a", 3));
+  EXPECT_EQ(kOK, LogOccurrence(kDayIndex, 1));
+  EXPECT_EQ(kOK, event_aggregator_->BackUpLocalAggregateStore());
+  auto expected = event_aggregator_->CopyLocalAggregateStore();
+  EXPECT_EQ(2, expected.by_report_key_size());
+
+  proto_store_ = MakeProtoStore();
+  event_aggregator_ = MakeEventAggregator(proto_store_.get());
+  auto restored = event_aggregator_->CopyLocalAggregateStore();
+  EXPECT_EQ(2, restored.by_report_key_size());
+  for (const auto& pair : expected.by_report_key()) {
+    ASSERT_EQ(1u, restored.by_report_key().count(pair.first));
+    EXPECT_EQ(pair.second.by_day_index_size(),
+              restored.by_report_key().at(pair.first).by_day_index_size());
+  }
+
+  EXPECT_EQ(kOK, event_aggregator_->GenerateObservations(kDayIndex));
+  // One count Observation and 2 unique actives Observations.
+  EXPECT_EQ(3u, observation_store_->messages_received.size());
+}
+
+}  // namespace logger
+}  // namespace cobalt
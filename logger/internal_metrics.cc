@@ -4,8 +4,10 @@
 
 #include "logger/internal_metrics.h"
 
-#include <memory>
-#include <string>
+#include <algorithm>
+#include <condition_variable>
+#include <limits>
+#include <thread>
 #include <utility>
 
 #include "./logging.h"
@@ -13,14 +15,148 @@
 namespace cobalt {
 namespace logger {
 
-InternalMetricsImpl::InternalMetricsImpl(LoggerInterface* logger)
-    : logger_(logger) {
+namespace {
+
+// FlushThread is the single thread that flushes all of the
+// InternalMetricsImpls in the process. It is started by the first call to
+// Register() and is never stopped.
+class FlushThread {
+ public:
+  // Returns the process-wide FlushThread.
+  static FlushThread* Get() {
+    static FlushThread* flush_thread = new FlushThread();
+    return flush_thread;
+  }
+
+  // Flushes |internal_metrics| once every |flush_interval| until
+  // Unregister(|internal_metrics|) is invoked.
+  void Register(InternalMetrics* internal_metrics,
+                std::chrono::milliseconds flush_interval) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    schedules_[internal_metrics] = {
+        flush_interval, std::chrono::steady_clock::now() + flush_interval};
+    if (!thread_.joinable()) {
+      thread_ = std::thread([this] { Run(); });
+    }
+    schedule_changed_.notify_all();
+  }
+
+  // Stops flushing |internal_metrics|. When this returns, |internal_metrics|
+  // is not being flushed by the flush thread and will not be flushed by it
+  // again.
+  void Unregister(InternalMetrics* internal_metrics) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    schedules_.erase(internal_metrics);
+    flush_done_.wait(lock, [this, internal_metrics] {
+      return flushing_ != internal_metrics;
+    });
+  }
+
+ private:
+  struct Schedule {
+    std::chrono::milliseconds flush_interval;
+    std::chrono::steady_clock::time_point next_flush_time;
+  };
+
+  void Run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+      if (schedules_.empty()) {
+        schedule_changed_.wait(lock);
+        continue;
+      }
+      auto next = std::min_element(
+          schedules_.begin(), schedules_.end(),
+          [](const std::pair<InternalMetrics* const, Schedule>& a,
+             const std::pair<InternalMetrics* const, Schedule>& b) {
+            return a.second.next_flush_time < b.second.next_flush_time;
+          });
+      auto now = std::chrono::steady_clock::now();
+      if (now < next->second.next_flush_time) {
+        schedule_changed_.wait_until(lock, next->second.next_flush_time);
+        continue;
+      }
+      next->second.next_flush_time = now + next->second.flush_interval;
+      flushing_ = next->first;
+      lock.unlock();
+      flushing_->Flush();
+      lock.lock();
+      flushing_ = nullptr;
+      flush_done_.notify_all();
+    }
+  }
+
+  std::mutex mutex_;
+  std::map<InternalMetrics*, Schedule> schedules_;
+  // The InternalMetrics being flushed by |thread_|, if any.
+  InternalMetrics* flushing_ = nullptr;
+  std::condition_variable schedule_changed_;
+  std::condition_variable flush_done_;
+  std::thread thread_;
+};
+
+}  // namespace
+
+InternalMetricsImpl::InternalMetricsImpl(
+    LoggerInterface* logger, std::chrono::milliseconds flush_interval)
+    : logger_(logger), last_flush_time_(std::chrono::steady_clock::now()) {
   CHECK(logger_);
+  for (auto& counter : counters_) {
+    counter.count = 0;
+  }
+  FlushThread::Get()->Register(this, flush_interval);
+}
+
+InternalMetricsImpl::~InternalMetricsImpl() {
+  FlushThread::Get()->Unregister(this);
+  Flush();
 }
 
 void InternalMetricsImpl::LoggerCalled(LoggerCallsMadeEventCode event_code) {
-  logger_->LogEvent(kLoggerCallsMadeMetricId,
-                    static_cast<uint32_t>(event_code));
+  auto index = static_cast<uint32_t>(event_code);
+  if (index < kNumCounters) {
+    counters_[index].count.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  other_counts_[index]++;
+}
+
+void InternalMetricsImpl::Flush() {
+  std::map<uint32_t, uint64_t> other_counts;
+  int64_t period_duration_micros;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    other_counts.swap(other_counts_);
+    auto now = std::chrono::steady_clock::now();
+    period_duration_micros =
+        std::chrono::duration_cast<std::chrono::microseconds>(
+            now - last_flush_time_)
+            .count();
+    last_flush_time_ = now;
+  }
+
+  for (uint32_t index = 0; index < kNumCounters; index++) {
+    LogCount(index,
+             counters_[index].count.exchange(0, std::memory_order_relaxed),
+             period_duration_micros);
+  }
+  for (const auto& event_code_and_count : other_counts) {
+    LogCount(event_code_and_count.first, event_code_and_count.second,
+             period_duration_micros);
+  }
+}
+
+void InternalMetricsImpl::LogCount(uint32_t event_code, uint64_t count,
+                                   int64_t period_duration_micros) {
+  // LogEventCount() takes a 32-bit count, so a larger count is split.
+  while (count > 0) {
+    uint32_t logged_count = static_cast<uint32_t>(std::min<uint64_t>(
+        count, std::numeric_limits<uint32_t>::max()));
+    logger_->LogEventCount(kLoggerCallsMadeMetricId, event_code, "",
+                           period_duration_micros, logged_count);
+    count -= logged_count;
+  }
 }
 
 }  // namespace logger
@@ -5,8 +5,10 @@
 #ifndef COBALT_LOGGER_INTERNAL_METRICS_H_
 #define COBALT_LOGGER_INTERNAL_METRICS_H_
 
-#include <memory>
-#include <string>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
 
 #include "logger/logger_interface.h"
 
@@ -23,6 +25,9 @@ class InternalMetrics {
   // every call to Logger along with which method was called.
   virtual void LoggerCalled(LoggerCallsMadeEventCode event_code) = 0;
 
+  // Logs any internal metrics that have been collected but not yet logged.
+  virtual void Flush() = 0;
+
   virtual ~InternalMetrics() {}
 };
 
@@ -33,22 +38,75 @@ class InternalMetrics {
 class NoOpInternalMetrics : public InternalMetrics {
   void LoggerCalled(LoggerCallsMadeEventCode event_code) override {}
 
+  void Flush() override {}
+
   ~NoOpInternalMetrics() override {}
 };
 
 // InternalMetricsImpl is the actual implementation of InternalMetrics. It is a
 // wrapper around the (non nullptr) LoggerInterface* that was provided to the
 // Logger constructor.
+//
+// Logging an internal metric every time the Logger is called would double the
+// cost of each call, so instead InternalMetricsImpl aggregates the calls
+// in-process. LoggerCalled() only increments an atomic counter for the
+// event code and never logs. Flush() logs a single count per event code.
+//
+// A single flush thread, shared by all of the InternalMetricsImpls in the
+// process, flushes each of them once every |flush_interval|. The counters are
+// also flushed on destruction.
+//
+// All methods of this class are thread-safe.
 class InternalMetricsImpl : public InternalMetrics {
  public:
-  explicit InternalMetricsImpl(LoggerInterface* logger);
+  // |logger| must remain valid as long as the InternalMetricsImpl is being
+  // used, including during its destruction. It is invoked from the shared
+  // flush thread.
+  //
+  // |flush_interval| The time between two automatic flushes.
+  explicit InternalMetricsImpl(
+      LoggerInterface* logger,
+      std::chrono::milliseconds flush_interval = std::chrono::seconds(60));
 
   void LoggerCalled(LoggerCallsMadeEventCode event_code) override;
 
-  ~InternalMetricsImpl() override {}
+  // Logs the number of calls to LoggerCalled() since the previous flush for
+  // each event code with a non-zero count, using one LogEventCount() call for
+  // the logger_calls_made Metric, which is of type EVENT_COUNT, per event
+  // code. Then resets the counters.
+  void Flush() override;
+
+  // Stops the automatic flushes and then flushes the counters.
+  ~InternalMetricsImpl() override;
 
  private:
+  static const size_t kCacheLineSize = 64;
+
+  // Event codes less than kNumCounters are counted by lock-free counters.
+  // The calls with any larger event code are counted in |other_counts_|.
+  static const uint32_t kNumCounters = 16;
+
+  // Each counter is on its own cache line so that threads incrementing
+  // counters for different event codes do not contend.
+  struct PaddedCounter {
+    std::atomic<uint64_t> count;
+    char padding[kCacheLineSize - sizeof(std::atomic<uint64_t>)];
+  };
+
+  // Logs |count| calls with the given |event_code| that were made over the
+  // last |period_duration_micros|.
+  void LogCount(uint32_t event_code, uint64_t count,
+                int64_t period_duration_micros);
+
   LoggerInterface* logger_;  // not owned
+  PaddedCounter counters_[kNumCounters];
+
+  std::mutex mutex_;
+  // The counts of the calls with event codes of at least kNumCounters.
+  // Protected by |mutex_|.
+  std::map<uint32_t, uint64_t> other_counts_;
+  // The time of the previous flush. Protected by |mutex_|.
+  std::chrono::steady_clock::time_point last_flush_time_;
 };
 
 }  // namespace logger
@@ -0,0 +1,200 @@
+// Copyright 2018 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "logger/internal_metrics.h"
+
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "./gtest.h"
+
+namespace cobalt {
+namespace logger {
+
+namespace {
+
+// A LoggerInterface that sums the counts of the logger_calls_made Metric
+// passed to LogEventCount(), by event code.
+class CountingLogger : public LoggerInterface {
+ public:
+  Status LogEvent(uint32_t metric_id, uint32_t event_code) override {
+    ADD_FAILURE() << "logger_calls_made is an EVENT_COUNT Metric";
+    return kInvalidArguments;
+  }
+  Status LogEventCount(uint32_t metric_id, uint32_t event_code,
+                       const std::string& component,
+                       int64_t period_duration_micros,
+                       uint32_t count) override {
+    EXPECT_EQ(kLoggerCallsMadeMetricId, metric_id);
+    EXPECT_GE(period_duration_micros, 0);
+    EXPECT_GT(count, 0u);
+    std::lock_guard<std::mutex> lock(mutex_);
+    num_calls_++;
+    logging_threads_.insert(std::this_thread::get_id());
+    counts_[event_code] += count;
+    return kOK;
+  }
+  Status LogElapsedTime(uint32_t metric_id, uint32_t event_code,
+                        const std::string& component,
+                        int64_t elapsed_micros) override {
+    return kOK;
+  }
+  Status LogFrameRate(uint32_t metric_id, uint32_t event_code,
+                      const std::string& component, float fps) override {
+    return kOK;
+  }
+  Status LogMemoryUsage(uint32_t metric_id, uint32_t event_code,
+                        const std::string& component, int64_t bytes) override {
+    return kOK;
+  }
+  Status LogIntHistogram(uint32_t metric_id, uint32_t event_code,
+                         const std::string& component,
+                         HistogramPtr histogram) override {
+    return kOK;
+  }
+  Status LogString(uint32_t metric_id, const std::string& str) override {
+    return kOK;
+  }
+  Status LogCustomEvent(uint32_t metric_id,
+                        EventValuesPtr event_values) override {
+    return kOK;
+  }
+  Status LogEvents(std::vector<EventSpec> events) override {
+    ADD_FAILURE() << "InternalMetricsImpl must log with LogEventCount()";
+    return kOK;
+  }
+
+  size_t num_calls() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return num_calls_;
+  }
+
+  uint64_t count(LoggerCallsMadeEventCode event_code) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return counts_[static_cast<uint32_t>(event_code)];
+  }
+
+  // Returns the set of threads on which LogEventCount() has been invoked.
+  std::set<std::thread::id> logging_threads() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return logging_threads_;
+  }
+
+ private:
+  std::mutex mutex_;
+  size_t num_calls_ = 0;
+  std::map<uint32_t, uint64_t> counts_;
+  std::set<std::thread::id> logging_threads_;
+};
+
+// Returns once |logger| has counted |expected_count| calls with the given
+// |event_code|, or after a timeout.
+void WaitForCount(CountingLogger* logger, LoggerCallsMadeEventCode event_code,
+                  uint64_t expected_count) {
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+  while (logger->count(event_code) < expected_count &&
+         std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+}
+
+}  // namespace
+
+// Tests that LoggerCalled() only counts the calls, and that Flush() logs a
+// single count for each event code that was called.
+TEST(InternalMetricsImplTest, Flush) {
+  CountingLogger logger;
+  InternalMetricsImpl internal_metrics(&logger);
+  for (int i = 0; i < 5; i++) {
+    internal_metrics.LoggerCalled(LoggerCallsMadeEventCode::LogEvent);
+  }
+  internal_metrics.LoggerCalled(LoggerCallsMadeEventCode::LogString);
+  EXPECT_EQ(0u, logger.num_calls());
+
+  internal_metrics.Flush();
+  EXPECT_EQ(2u, logger.num_calls());
+  EXPECT_EQ(5u, logger.count(LoggerCallsMadeEventCode::LogEvent));
+  EXPECT_EQ(1u, logger.count(LoggerCallsMadeEventCode::LogString));
+
+  // Nothing is logged if there have been no calls since the last flush.
+  internal_metrics.Flush();
+  EXPECT_EQ(2u, logger.num_calls());
+}
+
+// Tests that the counters are flushed automatically by the flush thread, and
+// never on the thread that calls LoggerCalled().
+TEST(InternalMetricsImplTest, FlushInterval) {
+  CountingLogger logger;
+  InternalMetricsImpl internal_metrics(&logger, std::chrono::milliseconds(1));
+  for (int i = 0; i < 3; i++) {
+    internal_metrics.LoggerCalled(LoggerCallsMadeEventCode::LogEventCount);
+  }
+  WaitForCount(&logger, LoggerCallsMadeEventCode::LogEventCount, 3);
+  EXPECT_EQ(3u, logger.count(LoggerCallsMadeEventCode::LogEventCount));
+  EXPECT_EQ(0u, logger.logging_threads().count(std::this_thread::get_id()));
+}
+
+// Tests that several InternalMetricsImpls are flushed by the same thread.
+TEST(InternalMetricsImplTest, SharedFlushThread) {
+  CountingLogger logger;
+  InternalMetricsImpl internal_metrics_1(&logger,
+                                         std::chrono::milliseconds(1));
+  InternalMetricsImpl internal_metrics_2(&logger,
+                                         std::chrono::milliseconds(2));
+  internal_metrics_1.LoggerCalled(LoggerCallsMadeEventCode::LogString);
+  internal_metrics_2.LoggerCalled(LoggerCallsMadeEventCode::LogString);
+  WaitForCount(&logger, LoggerCallsMadeEventCode::LogString, 2);
+  EXPECT_EQ(2u, logger.count(LoggerCallsMadeEventCode::LogString));
+  EXPECT_EQ(1u, logger.logging_threads().size());
+}
+
+// Tests that the counters are flushed on destruction, without waiting for
+// the flush interval.
+TEST(InternalMetricsImplTest, FlushOnDestruction) {
+  CountingLogger logger;
+  {
+    InternalMetricsImpl internal_metrics(&logger, std::chrono::hours(1));
+    internal_metrics.LoggerCalled(LoggerCallsMadeEventCode::LogMemoryUsage);
+    EXPECT_EQ(0u, logger.num_calls());
+  }
+  EXPECT_EQ(1u, logger.num_calls());
+  EXPECT_EQ(1u, logger.count(LoggerCallsMadeEventCode::LogMemoryUsage));
+}
+
+// Tests that no calls are lost when several threads call LoggerCalled()
+// concurrently.
+TEST(InternalMetricsImplTest, ConcurrentCalls) {
+  const int kNumThreads = 4;
+  const int kNumCallsPerThread = 10000;
+  CountingLogger logger;
+  InternalMetricsImpl internal_metrics(&logger);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kNumThreads; t++) {
+    threads.emplace_back([&internal_metrics, t] {
+      for (int i = 0; i < kNumCallsPerThread; i++) {
+        internal_metrics.LoggerCalled(
+            t % 2 == 0 ? LoggerCallsMadeEventCode::LogEvent
+                       : LoggerCallsMadeEventCode::LogElapsedTime);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  internal_metrics.Flush();
+  EXPECT_EQ(kNumThreads / 2 * kNumCallsPerThread,
+            logger.count(LoggerCallsMadeEventCode::LogEvent));
+  EXPECT_EQ(kNumThreads / 2 * kNumCallsPerThread,
+            logger.count(LoggerCallsMadeEventCode::LogElapsedTime));
+}
+
+}  // namespace logger
+}  // namespace cobalt
@@ -4,13 +4,15 @@
 
 #include "logger/logger.h"
 
+#include <map>
 #include <memory>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include "./event.pb.h"
 #include "./logging.h"
 #include "./observation2.pb.h"
-#include "algorithms/rappor/rappor_config_helper.h"
 #include "config/encodings.pb.h"
 #include "config/id.h"
 #include "config/metric_definition.pb.h"
@@ -22,7 +24,6 @@
 namespace cobalt {
 namespace logger {
 
-using ::cobalt::rappor::RapporConfigHelper;
 using ::cobalt::util::ClockInterface;
 using ::cobalt::util::SystemClock;
 using ::cobalt::util::TimeToDayIndex;
@@ -30,11 +31,101 @@ using ::google::protobuf::RepeatedPtrField;
 
 namespace {
 
+// Returns true iff the Log*() methods reuse Events of type |type| from the
+// per-thread Event cache instead of allocating a new Event for every logged
+// Event. These are the types that consist only of scalars and short strings.
+bool IsCachedEventType(Event::TypeCase type) {
+  switch (type) {
+    case Event::kOccurrenceEvent:
+    case Event::kCountEvent:
+    case Event::kElapsedTimeEvent:
+    case Event::kFrameRateEvent:
+    case Event::kMemoryUsageEvent:
+      return true;
+    default:
+      return false;
+  }
+}
+
+// The per-thread Event cache holds at most one Event of each cached type,
+// indexed by type. An Event taken from the cache keeps its type and the
+// storage of its fields, so a Log*() method that uses the cache must set every
+// field of the typed Event. If the cached Event is already in use, for example
+// because logging an Event caused another Event to be logged on the same
+// thread, a new Event is allocated instead.
+thread_local std::unique_ptr<Event> event_cache[Event::kMemoryUsageEvent + 1];
+
+std::unique_ptr<Event> TakeCachedEvent(Event::TypeCase type) {
+  if (IsCachedEventType(type) && event_cache[type]) {
+    return std::move(event_cache[type]);
+  }
+  return std::make_unique<Event>();
+}
+
+void ReturnCachedEvent(std::unique_ptr<Event> event) {
+  if (event && IsCachedEventType(event->type_case()) &&
+      !event_cache[event->type_case()]) {
+    event_cache[event->type_case()] = std::move(event);
+  }
+}
+
 struct EventRecord {
-  const MetricDefinition* metric;
-  std::unique_ptr<Event> event = std::make_unique<Event>();
+  EventRecord() : event(std::make_unique<Event>()) {}
+
+  // Takes the Event from the per-thread cache of Events of type |type|.
+  explicit EventRecord(Event::TypeCase type) : event(TakeCachedEvent(type)) {}
+
+  ~EventRecord() { ReturnCachedEvent(std::move(event)); }
+
+  const MetricPlan* plan = nullptr;
+  const MetricDefinition* metric = nullptr;
+  std::unique_ptr<Event> event;
 };
 
+// Determines the type of Metric to which an Event of the same type as |event|
+// must belong, and the LoggerCallsMadeEventCode of the corresponding Log*()
+// method. Returns false if the type of |event| is not set.
+bool MetricTypeForEvent(const Event& event,
+                        MetricDefinition::MetricType* metric_type,
+                        LoggerCallsMadeEventCode* logger_call) {
+  switch (event.type_case()) {
+    case Event::kOccurrenceEvent:
+      *metric_type = MetricDefinition::EVENT_OCCURRED;
+      *logger_call = LoggerCallsMadeEventCode::LogEvent;
+      return true;
+    case Event::kCountEvent:
+      *metric_type = MetricDefinition::EVENT_COUNT;
+      *logger_call = LoggerCallsMadeEventCode::LogEventCount;
+      return true;
+    case Event::kElapsedTimeEvent:
+      *metric_type = MetricDefinition::ELAPSED_TIME;
+      *logger_call = LoggerCallsMadeEventCode::LogElapsedTime;
+      return true;
+    case Event::kFrameRateEvent:
+      *metric_type = MetricDefinition::FRAME_RATE;
+      *logger_call = LoggerCallsMadeEventCode::LogFrameRate;
+      return true;
+    case Event::kMemoryUsageEvent:
+      *metric_type = MetricDefinition::MEMORY_USAGE;
+      *logger_call = LoggerCallsMadeEventCode::LogMemoryUsage;
+      return true;
+    case Event::kIntHistogramEvent:
+      *metric_type = MetricDefinition::INT_HISTOGRAM;
+      *logger_call = LoggerCallsMadeEventCode::LogIntHistogram;
+      return true;
+    case Event::kStringUsedEvent:
+      *metric_type = MetricDefinition::STRING_USED;
+      *logger_call = LoggerCallsMadeEventCode::LogString;
+      return true;
+    case Event::kCustomEvent:
+      *metric_type = MetricDefinition::CUSTOM;
+      *logger_call = LoggerCallsMadeEventCode::LogCustomEvent;
+      return true;
+    default:
+      return false;
+  }
+}
+
 }  // namespace
 
 // EventLogger is an abstract interface used internally in logger.cc to
@@ -46,6 +137,11 @@ class EventLogger {
 
   virtual ~EventLogger() = default;
 
+  // Returns a new instance of the subclass of EventLogger for Metrics of type
+  // |metric_type|, or nullptr if there is no such subclass.
+  static std::unique_ptr<EventLogger> Create(
+      MetricDefinition::MetricType metric_type, Logger* logger);
+
   // Finds the Metric with the given ID. Expects that this has type
   // |expected_metric_type|. If not logs an error and returns.
   // If so then Logs the Event specified by |event_record| to Cobalt.
@@ -53,11 +149,26 @@ class EventLogger {
              MetricDefinition::MetricType expected_metric_type,
              EventRecord* event_record);
 
+  // Logs the Event specified by |event_record| as part of a batch. The caller
+  // has already looked up the MetricPlan for the Metric with ID |metric_id|,
+  // stored it and its Metric in |event_record| (nullptr if there is no such
+  // Metric) and set the day_index of the Event. Expects that the Metric has
+  // type |expected_metric_type|. Instead of being written to the Observation
+  // Store the immediate Observations are appended to |observations|.
+  Status LogAsPartOfBatch(
+      uint32_t metric_id, MetricDefinition::MetricType expected_metric_type,
+      EventRecord* event_record,
+      std::vector<ObservationWriter::ObservationAndMetadata>* observations);
+
  protected:
   const Encoder* encoder() { return logger_->encoder_; }
+  EventAggregator* event_aggregator() { return logger_->event_aggregator_; }
   const ProjectContext* project_context() { return logger_->project_context_; }
   Encoder::Result BadReportType(const MetricDefinition& metric,
                                 const ReportDefinition& report);
+  // Returns a result with status kOK and no Observation, indicating that no
+  // immediate Observation should be generated for a report.
+  Encoder::Result NoImmediateObservation();
 
  private:
   // Sets up |event_record| with initial data.
@@ -65,15 +176,29 @@ class EventLogger {
                          MetricDefinition::MetricType expected_type,
                          EventRecord* event_record);
 
+  // Checks that |metric|, the result of looking up the Metric with ID
+  // |metric_id|, is not null and has type |expected_type|.
+  Status CheckMetric(uint32_t metric_id,
+                     MetricDefinition::MetricType expected_type,
+                     const MetricDefinition* metric);
+
+  // Validates the initialized |event_record| and passes it to each of the
+  // Reports of its Metric. If |observations| is not null then the immediate
+  // Observations are appended to it instead of being written to the
+  // Observation Store.
+  Status ProcessEvent(
+      EventRecord* event_record,
+      std::vector<ObservationWriter::ObservationAndMetadata>* observations);
+
   virtual Status ValidateEvent(const EventRecord& event_record);
 
-  // Given an EventRecord and a ReportDefinition, determines whether or not
+  // Given an EventRecord and a ReportPlan, determines whether or not
   // the Event should be used to update a local aggregation and if so passes
   // the Event to the Local Aggregator.
-  Status MaybeUpdateLocalAggregation(const ReportDefinition& report,
-                                     EventRecord* event_record);
+  virtual Status MaybeUpdateLocalAggregation(const ReportPlan& report_plan,
+                                             EventRecord* event_record);
 
-  // Given an EventRecord and a ReportDefinition, determines whether or not
+  // Given an EventRecord and a ReportPlan, determines whether or not
   // the Event should be used to generate an immediate Observation and if so
   // does generate one and writes it to the Observation Store.
   //
@@ -81,11 +206,15 @@ class EventLogger {
   // |event_record|. This should be set true only when it is known that
   // |event_record| is no longer needed. Setting this true allows the data in
   // |event_record| to be moved rather than copied.
-  Status MaybeGenerateImmediateObservation(const ReportDefinition& report,
-                                           bool may_invalidate,
-                                           EventRecord* event_record);
-
-  // Given an EventRecord and a ReportDefinition, determines whether or not
+  //
+  // If |observations| is not null then the Observation is appended to it
+  // instead of being written to the Observation Store.
+  Status MaybeGenerateImmediateObservation(
+      const ReportPlan& report_plan, bool may_invalidate,
+      EventRecord* event_record,
+      std::vector<ObservationWriter::ObservationAndMetadata>* observations);
+
+  // Given an EventRecord and a ReportPlan, determines whether or not
   // the Event should be used to generate an immediate Observation and if so
   // does generate one. This method is invoked by
   // MaybeGenerateImmediateObservation().
@@ -95,7 +224,7 @@ class EventLogger {
   // |event_record| is no longer needed. Setting this true allows the data in
   // |event_record| to be moved rather than copied.
   virtual Encoder::Result MaybeEncodeImmediateObservation(
-      const ReportDefinition& report, bool may_invalidate,
+      const ReportPlan& report_plan, bool may_invalidate,
       EventRecord* event_record);
 
   Logger* logger_;
@@ -109,8 +238,10 @@ class OccurrenceEventLogger : public EventLogger {
 
  private:
   Status ValidateEvent(const EventRecord& event_record) override;
+  Status MaybeUpdateLocalAggregation(const ReportPlan& report_plan,
+                                     EventRecord* event_record) override;
   Encoder::Result MaybeEncodeImmediateObservation(
-      const ReportDefinition& report, bool may_invalidate,
+      const ReportPlan& report_plan, bool may_invalidate,
       EventRecord* event_record) override;
 };
 
@@ -121,8 +252,10 @@ class CountEventLogger : public EventLogger {
   virtual ~CountEventLogger() = default;
 
  private:
+  Status MaybeUpdateLocalAggregation(const ReportPlan& report_plan,
+                                     EventRecord* event_record) override;
   Encoder::Result MaybeEncodeImmediateObservation(
-      const ReportDefinition& report, bool may_invalidate,
+      const ReportPlan& report_plan, bool may_invalidate,
       EventRecord* event_record) override;
 };
 
@@ -137,7 +270,7 @@ class IntegerPerformanceEventLogger : public EventLogger {
 
  private:
   Encoder::Result MaybeEncodeImmediateObservation(
-      const ReportDefinition& report, bool may_invalidate,
+      const ReportPlan& report_plan, bool may_invalidate,
       EventRecord* event_record) override;
   virtual uint32_t EventCode(const Event& event) = 0;
   virtual std::string Component(const Event& event) = 0;
@@ -192,7 +325,7 @@ class IntHistogramEventLogger : public EventLogger {
  private:
   Status ValidateEvent(const EventRecord& event_record) override;
   Encoder::Result MaybeEncodeImmediateObservation(
-      const ReportDefinition& report, bool may_invalidate,
+      const ReportPlan& report_plan, bool may_invalidate,
       EventRecord* event_record) override;
 };
 
@@ -204,7 +337,7 @@ class StringUsedEventLogger : public EventLogger {
 
  private:
   Encoder::Result MaybeEncodeImmediateObservation(
-      const ReportDefinition& report, bool may_invalidate,
+      const ReportPlan& report_plan, bool may_invalidate,
       EventRecord* event_record) override;
 };
 
@@ -217,91 +350,102 @@ class CustomEventLogger : public EventLogger {
  private:
   Status ValidateEvent(const EventRecord& event_record) override;
   Encoder::Result MaybeEncodeImmediateObservation(
-      const ReportDefinition& report, bool may_invalidate,
+      const ReportPlan& report_plan, bool may_invalidate,
       EventRecord* event_record) override;
 };
 
 //////////////////// Logger method implementations ////////////////////////
 
 Logger::Logger(const Encoder* encoder, ObservationWriter* observation_writer,
-               const ProjectContext* project, LoggerInterface* internal_logger)
+               const ProjectContext* project, LoggerInterface* internal_logger,
+               EventAggregator* event_aggregator)
     : encoder_(encoder),
       observation_writer_(observation_writer),
       project_context_(project),
+      event_aggregator_(event_aggregator),
       clock_(new SystemClock()) {
   CHECK(project);
 
+  if (event_aggregator_) {
+    event_aggregator_->UpdateAggregationConfigs(*project_context_);
+  }
+
   if (internal_logger) {
     internal_metrics_.reset(new InternalMetricsImpl(internal_logger));
   } else {
     // We were not provided with a metrics logger. We must create one.
     internal_metrics_.reset(new NoOpInternalMetrics());
   }
+
+  for (auto metric_type :
+       {MetricDefinition::EVENT_OCCURRED, MetricDefinition::EVENT_COUNT,
+        MetricDefinition::ELAPSED_TIME, MetricDefinition::FRAME_RATE,
+        MetricDefinition::MEMORY_USAGE, MetricDefinition::INT_HISTOGRAM,
+        MetricDefinition::STRING_USED, MetricDefinition::CUSTOM}) {
+    event_loggers_[metric_type] = EventLogger::Create(metric_type, this);
+  }
 }
 
+Logger::~Logger() = default;
+
 Status Logger::LogEvent(uint32_t metric_id, uint32_t event_code) {
-  EventRecord event_record;
+  EventRecord event_record(Event::kOccurrenceEvent);
   internal_metrics_->LoggerCalled(LoggerCallsMadeEventCode::LogEvent);
   auto* occurrence_event = event_record.event->mutable_occurrence_event();
   occurrence_event->set_event_code(event_code);
-  auto event_logger = std::make_unique<OccurrenceEventLogger>(this);
-  return event_logger->Log(metric_id, MetricDefinition::EVENT_OCCURRED,
-                           &event_record);
+  return event_loggers_.at(MetricDefinition::EVENT_OCCURRED)->Log(
+      metric_id, MetricDefinition::EVENT_OCCURRED, &event_record);
 }
 
 Status Logger::LogEventCount(uint32_t metric_id, uint32_t event_code,
                              const std::string& component,
                              int64_t period_duration_micros, uint32_t count) {
   internal_metrics_->LoggerCalled(LoggerCallsMadeEventCode::LogEventCount);
-  EventRecord event_record;
+  EventRecord event_record(Event::kCountEvent);
   auto* count_event = event_record.event->mutable_count_event();
   count_event->set_event_code(event_code);
   count_event->set_component(component);
   count_event->set_period_duration_micros(period_duration_micros);
   count_event->set_count(count);
-  auto event_logger = std::make_unique<CountEventLogger>(this);
-  return event_logger->Log(metric_id, MetricDefinition::EVENT_COUNT,
-                           &event_record);
+  return event_loggers_.at(MetricDefinition::EVENT_COUNT)->Log(
+      metric_id, MetricDefinition::EVENT_COUNT, &event_record);
 }
 
 Status Logger::LogElapsedTime(uint32_t metric_id, uint32_t event_code,
                               const std::string& component,
                               int64_t elapsed_micros) {
   internal_metrics_->LoggerCalled(LoggerCallsMadeEventCode::LogElapsedTime);
-  EventRecord event_record;
+  EventRecord event_record(Event::kElapsedTimeEvent);
   auto* elapsed_time_event = event_record.event->mutable_elapsed_time_event();
   elapsed_time_event->set_event_code(event_code);
   elapsed_time_event->set_component(component);
   elapsed_time_event->set_elapsed_micros(elapsed_micros);
-  auto event_logger = std::make_unique<ElapsedTimeEventLogger>(this);
-  return event_logger->Log(metric_id, MetricDefinition::ELAPSED_TIME,
-                           &event_record);
+  return event_loggers_.at(MetricDefinition::ELAPSED_TIME)->Log(
+      metric_id, MetricDefinition::ELAPSED_TIME, &event_record);
 }
 
 Status Logger::LogFrameRate(uint32_t metric_id, uint32_t event_code,
                             const std::string& component, float fps) {
   internal_metrics_->LoggerCalled(LoggerCallsMadeEventCode::LogFrameRate);
-  EventRecord event_record;
+  EventRecord event_record(Event::kFrameRateEvent);
   auto* frame_rate_event = event_record.event->mutable_frame_rate_event();
   frame_rate_event->set_event_code(event_code);
   frame_rate_event->set_component(component);
   frame_rate_event->set_frames_per_1000_seconds(std::round(fps * 1000.0));
-  auto event_logger = std::make_unique<FrameRateEventLogger>(this);
-  return event_logger->Log(metric_id, MetricDefinition::FRAME_RATE,
-                           &event_record);
+  return event_loggers_.at(MetricDefinition::FRAME_RATE)->Log(
+      metric_id, MetricDefinition::FRAME_RATE, &event_record);
 }
 
 Status Logger::LogMemoryUsage(uint32_t metric_id, uint32_t event_code,
                               const std::string& component, int64_t bytes) {
   internal_metrics_->LoggerCalled(LoggerCallsMadeEventCode::LogMemoryUsage);
-  EventRecord event_record;
+  EventRecord event_record(Event::kMemoryUsageEvent);
   auto* memory_usage_event = event_record.event->mutable_memory_usage_event();
   memory_usage_event->set_event_code(event_code);
   memory_usage_event->set_component(component);
   memory_usage_event->set_bytes(bytes);
-  auto event_logger = std::make_unique<MemoryUsageEventLogger>(this);
-  return event_logger->Log(metric_id, MetricDefinition::MEMORY_USAGE,
-                           &event_record);
+  return event_loggers_.at(MetricDefinition::MEMORY_USAGE)->Log(
+      metric_id, MetricDefinition::MEMORY_USAGE, &event_record);
 }
 
 Status Logger::LogIntHistogram(uint32_t metric_id, uint32_t event_code,
@@ -313,9 +457,8 @@ Status Logger::LogIntHistogram(uint32_t metric_id, uint32_t event_code,
   int_histogram_event->set_event_code(event_code);
   int_histogram_event->set_component(component);
   int_histogram_event->mutable_buckets()->Swap(histogram.get());
-  auto event_logger = std::make_unique<IntHistogramEventLogger>(this);
-  return event_logger->Log(metric_id, MetricDefinition::INT_HISTOGRAM,
-                           &event_record);
+  return event_loggers_.at(MetricDefinition::INT_HISTOGRAM)->Log(
+      metric_id, MetricDefinition::INT_HISTOGRAM, &event_record);
 }
 
 Status Logger::LogString(uint32_t metric_id, const std::string& str) {
@@ -323,9 +466,8 @@ Status Logger::LogString(uint32_t metric_id, const std::string& str) {
   EventRecord event_record;
   auto* string_used_event = event_record.event->mutable_string_used_event();
   string_used_event->set_str(str);
-  auto event_logger = std::make_unique<StringUsedEventLogger>(this);
-  return event_logger->Log(metric_id, MetricDefinition::STRING_USED,
-                           &event_record);
+  return event_loggers_.at(MetricDefinition::STRING_USED)->Log(
+      metric_id, MetricDefinition::STRING_USED, &event_record);
 }
 
 Status Logger::LogCustomEvent(uint32_t metric_id, EventValuesPtr event_values) {
@@ -333,12 +475,102 @@ Status Logger::LogCustomEvent(uint32_t metric_id, EventValuesPtr event_values) {
   EventRecord event_record;
   auto* custom_event = event_record.event->mutable_custom_event();
   custom_event->mutable_values()->swap(*event_values);
-  auto event_logger = std::make_unique<CustomEventLogger>(this);
-  return event_logger->Log(metric_id, MetricDefinition::CUSTOM, &event_record);
+  return event_loggers_.at(MetricDefinition::CUSTOM)->Log(
+      metric_id, MetricDefinition::CUSTOM, &event_record);
+}
+
+Status Logger::LogEvents(std::vector<EventSpec> events) {
+  // The MetricPlan and the day index are resolved once for each distinct
+  // metric_id in the batch, using a single reading of the clock. The day
+  // index is recomputed only for those Events that specify their own time.
+  struct ResolvedMetric {
+    const MetricPlan* plan;
+    uint32_t day_index;
+  };
+  std::map<uint32_t, ResolvedMetric> resolved_metrics;
+  std::vector<ObservationWriter::ObservationAndMetadata> observations;
+  observations.reserve(events.size());
+  auto now = std::chrono::system_clock::to_time_t(clock_->now());
+
+  Status status = kOK;
+  for (auto& event_spec : events) {
+    MetricDefinition::MetricType metric_type;
+    LoggerCallsMadeEventCode logger_call;
+    if (!MetricTypeForEvent(event_spec.event, &metric_type, &logger_call)) {
+      LOG(ERROR) << "The Event logged for the metric with ID '"
+                 << event_spec.metric_id << "' in project '"
+                 << project_context_->DebugString() << "' has no type set.";
+      if (status == kOK) {
+        status = kInvalidArguments;
+      }
+      continue;
+    }
+    internal_metrics_->LoggerCalled(logger_call);
+
+    auto resolved = resolved_metrics.find(event_spec.metric_id);
+    if (resolved == resolved_metrics.end()) {
+      const auto* plan = project_context_->GetMetricPlan(event_spec.metric_id);
+      uint32_t day_index =
+          plan ? TimeToDayIndex(now, plan->metric->time_zone_policy()) : 0;
+      resolved = resolved_metrics
+                     .emplace(event_spec.metric_id,
+                              ResolvedMetric{plan, day_index})
+                     .first;
+    }
+    EventRecord event_record(event_spec.event.type_case());
+    event_record.plan = resolved->second.plan;
+    event_record.metric =
+        event_record.plan ? event_record.plan->metric : nullptr;
+    event_record.event->Swap(&event_spec.event);
+    if (event_spec.time == std::chrono::system_clock::time_point() ||
+        event_record.metric == nullptr) {
+      event_record.event->set_day_index(resolved->second.day_index);
+    } else {
+      event_record.event->set_day_index(TimeToDayIndex(
+          std::chrono::system_clock::to_time_t(event_spec.time),
+          event_record.metric->time_zone_policy()));
+    }
+    auto event_status = event_loggers_.at(metric_type)->LogAsPartOfBatch(
+        event_spec.metric_id, metric_type, &event_record, &observations);
+    if (event_status != kOK && status == kOK) {
+      status = event_status;
+    }
+  }
+
+  auto write_status =
+      observation_writer_->WriteObservations(std::move(observations));
+  if (write_status != kOK && status == kOK) {
+    status = write_status;
+  }
+  return status;
 }
 
 //////////////////// EventLogger method implementations ////////////////////////
 
+std::unique_ptr<EventLogger> EventLogger::Create(
+    MetricDefinition::MetricType metric_type, Logger* logger) {
+  switch (metric_type) {
+    case MetricDefinition::EVENT_OCCURRED:
+      return std::make_unique<OccurrenceEventLogger>(logger);
+    case MetricDefinition::EVENT_COUNT:
+      return std::make_unique<CountEventLogger>(logger);
+    case MetricDefinition::ELAPSED_TIME:
+      return std::make_unique<ElapsedTimeEventLogger>(logger);
+    case MetricDefinition::FRAME_RATE:
+      return std::make_unique<FrameRateEventLogger>(logger);
+    case MetricDefinition::MEMORY_USAGE:
+      return std::make_unique<MemoryUsageEventLogger>(logger);
+    case MetricDefinition::INT_HISTOGRAM:
+      return std::make_unique<IntHistogramEventLogger>(logger);
+    case MetricDefinition::STRING_USED:
+      return std::make_unique<StringUsedEventLogger>(logger);
+    case MetricDefinition::CUSTOM:
+      return std::make_unique<CustomEventLogger>(logger);
+    default:
+      return nullptr;
+  }
+}
+
 Status EventLogger::Log(uint32_t metric_id,
                         MetricDefinition::MetricType expected_metric_type,
                         EventRecord* event_record) {
@@ -348,18 +580,41 @@ Status EventLogger::Log(uint32_t metric_id,
   if (status != kOK) {
     return status;
   }
+  return ProcessEvent(event_record, nullptr);
+}
 
-  int num_reports = event_record->metric->reports_size();
-  int report_index = 0;
-  if (event_record->metric->reports_size() == 0) {
+Status EventLogger::LogAsPartOfBatch(
+    uint32_t metric_id, MetricDefinition::MetricType expected_metric_type,
+    EventRecord* event_record,
+    std::vector<ObservationWriter::ObservationAndMetadata>* observations) {
+  auto status =
+      CheckMetric(metric_id, expected_metric_type, event_record->metric);
+  if (status != kOK) {
+    return status;
+  }
+  return ProcessEvent(event_record, observations);
+}
+
+Status EventLogger::ProcessEvent(
+    EventRecord* event_record,
+    std::vector<ObservationWriter::ObservationAndMetadata>* observations) {
+  auto status = ValidateEvent(*event_record);
+  if (status != kOK) {
+    return status;
+  }
+
+  const auto& report_plans = event_record->plan->reports;
+  size_t num_reports = report_plans.size();
+  size_t report_index = 0;
+  if (num_reports == 0) {
     VLOG(1) << "Warning: An event was logged for a metric with no reports "
                "defined. Metric ["
             << MetricDebugString(*event_record->metric) << "] in project "
             << project_context()->DebugString() << ".";
   }
 
-  for (const auto& report : event_record->metric->reports()) {
-    status = MaybeUpdateLocalAggregation(report, event_record);
+  for (const auto& report_plan : report_plans) {
+    status = MaybeUpdateLocalAggregation(report_plan, event_record);
     if (status != kOK) {
       return status;
     }
@@ -372,8 +627,8 @@ Status EventLogger::Log(uint32_t metric_id,
     // Since the |event_record| is invalidated, any other operation on the
     // |event_record| must be performed before this for loop.
     bool may_invalidate = ++report_index == num_reports;
-    status =
-        MaybeGenerateImmediateObservation(report, may_invalidate, event_record);
+    status = MaybeGenerateImmediateObservation(report_plan, may_invalidate,
+                                               event_record, observations);
     if (status != kOK) {
       return status;
     }
@@ -385,17 +640,12 @@ Status EventLogger::Log(uint32_t metric_id,
 Status EventLogger::InitializeEvent(uint32_t metric_id,
                                     MetricDefinition::MetricType expected_type,
                                     EventRecord* event_record) {
-  event_record->metric = project_context()->GetMetric(metric_id);
-  if (event_record->metric == nullptr) {
-    LOG(ERROR) << "There is no metric with ID '" << metric_id << "' registered "
-               << "in project '" << project_context()->DebugString() << "'.";
-    return kInvalidArguments;
-  }
-  if (event_record->metric->metric_type() != expected_type) {
-    LOG(ERROR) << "Metric '" << MetricDebugString(*event_record->metric)
-               << "' in project '" << project_context()->DebugString()
-               << "' is not of type " << expected_type << ".";
-    return kInvalidArguments;
+  event_record->plan = project_context()->GetMetricPlan(metric_id);
+  event_record->metric =
+      event_record->plan ? event_record->plan->metric : nullptr;
+  auto status = CheckMetric(metric_id, expected_type, event_record->metric);
+  if (status != kOK) {
+    return status;
   }
 
   // Compute the day_index.
@@ -403,7 +653,24 @@ Status EventLogger::InitializeEvent(uint32_t metric_id,
       std::chrono::system_clock::to_time_t(logger_->clock_->now()),
       event_record->metric->time_zone_policy()));
 
-  return ValidateEvent(*event_record);
+  return kOK;
+}
+
+Status EventLogger::CheckMetric(uint32_t metric_id,
+                                MetricDefinition::MetricType expected_type,
+                                const MetricDefinition* metric) {
+  if (metric == nullptr) {
+    LOG(ERROR) << "There is no metric with ID '" << metric_id << "' registered "
+               << "in project '" << project_context()->DebugString() << "'.";
+    return kInvalidArguments;
+  }
+  if (metric->metric_type() != expected_type) {
+    LOG(ERROR) << "Metric '" << MetricDebugString(*metric) << "' in project '"
+               << project_context()->DebugString() << "' is not of type "
+               << expected_type << ".";
+    return kInvalidArguments;
+  }
+  return kOK;
 }
 
 Status EventLogger::ValidateEvent(const EventRecord& event_record) {
@@ -411,35 +678,47 @@ Status EventLogger::ValidateEvent(const EventRecord& event_record) {
 }
 
 // The default implementation of MaybeUpdateLocalAggregation does nothing
-// and returns OK.
-Status EventLogger::MaybeUpdateLocalAggregation(const ReportDefinition& report,
+// and returns OK. It is overridden in subclasses of EventLogger
+// corresponding to Metric types for which there exist Report types that are
+// locally aggregated by the EventAggregator.
+Status EventLogger::MaybeUpdateLocalAggregation(const ReportPlan& report_plan,
                                                 EventRecord* event_record) {
-  // TODO(pesk) Implement this method in subclasses of EventLoger
-  // corresponding to Metric types for which there exist Report types for
-  // which which you want to perform local aggregation.
   return kOK;
 }
 
 Status EventLogger::MaybeGenerateImmediateObservation(
-    const ReportDefinition& report, bool may_invalidate,
-    EventRecord* event_record) {
+    const ReportPlan& report_plan, bool may_invalidate,
+    EventRecord* event_record,
+    std::vector<ObservationWriter::ObservationAndMetadata>* observations) {
   auto encoder_result =
-      MaybeEncodeImmediateObservation(report, may_invalidate, event_record);
+      MaybeEncodeImmediateObservation(report_plan, may_invalidate,
+                                      event_record);
   if (encoder_result.status != kOK) {
     return encoder_result.status;
   }
   if (encoder_result.observation == nullptr) {
     return kOK;
   }
-  return logger_->observation_writer_->WriteObservation(
-      *encoder_result.observation, std::move(encoder_result.metadata));
+  const auto* observation_writer = logger_->observation_writer_;
+  auto metadata =
+      observation_writer->RegisterMetadata(*encoder_result.metadata);
+  if (observations != nullptr) {
+    observations->push_back({std::move(encoder_result.observation), metadata});
+    return kOK;
+  }
+  return observation_writer->WriteObservation(*encoder_result.observation,
+                                              metadata);
 }
 
 // The default implementation of MaybeEncodeImmediateObservation does
 // nothing and returns OK.
 Encoder::Result EventLogger::MaybeEncodeImmediateObservation(
-    const ReportDefinition& report, bool may_invalidate,
+    const ReportPlan& report_plan, bool may_invalidate,
     EventRecord* event_record) {
+  return NoImmediateObservation();
+}
+
+Encoder::Result EventLogger::NoImmediateObservation() {
   Encoder::Result result;
   result.status = kOK;
   result.observation = nullptr;
@@ -473,9 +752,22 @@ Status OccurrenceEventLogger::ValidateEvent(const EventRecord& event_record) {
   return kOK;
 }
 
+Status OccurrenceEventLogger::MaybeUpdateLocalAggregation(
+    const ReportPlan& report_plan, EventRecord* event_record) {
+  const ReportDefinition& report = *report_plan.report;
+  if (event_aggregator() == nullptr ||
+      report.report_type() != ReportDefinition::UNIQUE_N_DAY_ACTIVES) {
+    return kOK;
+  }
+  return event_aggregator()->LogUniqueActivesEvent(
+      project_context()->RefMetric(event_record->metric), report,
+      *(event_record->event));
+}
+
 Encoder::Result OccurrenceEventLogger::MaybeEncodeImmediateObservation(
-    const ReportDefinition& report, bool may_invalidate,
+    const ReportPlan& report_plan, bool may_invalidate,
     EventRecord* event_record) {
+  const ReportDefinition& report = *report_plan.report;
   const MetricDefinition& metric = *(event_record->metric);
   const Event& event = *(event_record->event);
   CHECK(event.has_occurrence_event());
@@ -486,8 +778,13 @@ Encoder::Result OccurrenceEventLogger::MaybeEncodeImmediateObservation(
     case ReportDefinition::SIMPLE_OCCURRENCE_COUNT: {
       return encoder()->EncodeBasicRapporObservation(
           project_context()->RefMetric(&metric), &report, event.day_index(),
-          occurrence_event.event_code(),
-          RapporConfigHelper::BasicRapporNumCategories(metric));
+          occurrence_event.event_code(), report_plan.basic_rappor_config);
+    }
+
+    // Observations for this report type are generated by the EventAggregator
+    // rather than immediately.
+    case ReportDefinition::UNIQUE_N_DAY_ACTIVES: {
+      return NoImmediateObservation();
     }
 
     default:
@@ -497,9 +794,23 @@ Encoder::Result OccurrenceEventLogger::MaybeEncodeImmediateObservation(
 
 /////////////// CountEventLogger method implementations ////////////////////////
 
+Status CountEventLogger::MaybeUpdateLocalAggregation(
+    const ReportPlan& report_plan, EventRecord* event_record) {
+  const ReportDefinition& report = *report_plan.report;
+  if (event_aggregator() == nullptr ||
+      report.report_type() !=
+          ReportDefinition::EVENT_COMPONENT_OCCURRENCE_COUNT) {
+    return kOK;
+  }
+  return event_aggregator()->LogCountEvent(
+      project_context()->RefMetric(event_record->metric), report,
+      *(event_record->event));
+}
+
 Encoder::Result CountEventLogger::MaybeEncodeImmediateObservation(
-    const ReportDefinition& report, bool may_invalidate,
+    const ReportPlan& report_plan, bool may_invalidate,
     EventRecord* event_record) {
+  const ReportDefinition& report = *report_plan.report;
   const MetricDefinition& metric = *(event_record->metric);
   const Event& event = *(event_record->event);
   CHECK(event.has_count_event());
@@ -508,6 +819,11 @@ Encoder::Result CountEventLogger::MaybeEncodeImmediateObservation(
     // Each report type has its own logic for generating immediate
     // observations.
     case ReportDefinition::EVENT_COMPONENT_OCCURRENCE_COUNT: {
+      // If there is an EventAggregator then the count has been added to its
+      // tallies and the Observation will be generated at the end of the day.
+      if (event_aggregator()) {
+        return NoImmediateObservation();
+      }
       return encoder()->EncodeIntegerEventObservation(
           project_context()->RefMetric(&metric), &report, event.day_index(),
           count_event.event_code(), count_event.component(),
@@ -522,8 +838,9 @@ Encoder::Result CountEventLogger::MaybeEncodeImmediateObservation(
 /////////////// IntegerPerformanceEventLogger method implementations ///////////
 
 Encoder::Result IntegerPerformanceEventLogger::MaybeEncodeImmediateObservation(
-    const ReportDefinition& report, bool may_invalidate,
+    const ReportPlan& report_plan, bool may_invalidate,
     EventRecord* event_record) {
+  const ReportDefinition& report = *report_plan.report;
   const MetricDefinition& metric = *(event_record->metric);
   const Event& event = *(event_record->event);
   switch (report.report_type()) {
@@ -599,34 +916,25 @@ Status IntHistogramEventLogger::ValidateEvent(const EventRecord& event_record) {
   CHECK(event_record.event->has_int_histogram_event());
   const auto& int_histogram_event = event_record.event->int_histogram_event();
   const auto& metric = *(event_record.metric);
-  if (!metric.has_int_buckets()) {
-    LOG(ERROR) << "Invalid Cobalt config: Metric " << MetricDebugString(metric)
-               << " in project " << project_context()->DebugString()
-               << " does not have an |int_buckets| field set.";
-    return kInvalidConfig;
-  }
-  const auto& int_buckets = metric.int_buckets();
-  uint32_t num_valid_buckets;
-  switch (int_buckets.buckets_case()) {
-    case IntegerBuckets::kExponential:
-      num_valid_buckets = int_buckets.exponential().num_buckets();
-      break;
-    case IntegerBuckets::kLinear:
-      num_valid_buckets = int_buckets.linear().num_buckets();
-      break;
-    case IntegerBuckets::BUCKETS_NOT_SET:
+  // The number of valid buckets was computed when the ProjectContext was
+  // constructed. It is zero only if the |int_buckets| field is invalid.
+  uint32_t num_valid_buckets = event_record.plan->num_int_buckets;
+  if (num_valid_buckets == 0) {
+    if (!metric.has_int_buckets()) {
+      LOG(ERROR) << "Invalid Cobalt config: Metric "
+                 << MetricDebugString(metric) << " in project "
+                 << project_context()->DebugString()
+                 << " does not have an |int_buckets| field set.";
+    } else {
       LOG(ERROR) << "Invalid Cobalt config: Metric "
                  << MetricDebugString(metric) << " in project "
                  << project_context()->DebugString()
                  << " has an invalid |int_buckets| field. Either exponential "
                     "or linear buckets must be specified.";
-      return kInvalidConfig;
+    }
+    return kInvalidConfig;
   }
 
-  // In addition to the specified num_buckets, there are the underflow and
-  // overflow buckets.
-  num_valid_buckets += 2;
-
   size_t num_provided_buckets = int_histogram_event.buckets_size();
   for (auto i = 0u; i < num_provided_buckets; i++) {
     if (int_histogram_event.buckets(i).index() >= num_valid_buckets) {
@@ -643,8 +951,9 @@ Status IntHistogramEventLogger::ValidateEvent(const EventRecord& event_record) {
 }
 
 Encoder::Result IntHistogramEventLogger::MaybeEncodeImmediateObservation(
-    const ReportDefinition& report, bool may_invalidate,
+    const ReportPlan& report_plan, bool may_invalidate,
     EventRecord* event_record) {
+  const ReportDefinition& report = *report_plan.report;
   const MetricDefinition& metric = *(event_record->metric);
   const Event& event = *(event_record->event);
   CHECK(event.has_int_histogram_event());
@@ -676,8 +985,9 @@ Encoder::Result IntHistogramEventLogger::MaybeEncodeImmediateObservation(
 
 /////////////// StringUsedEventLogger method implementations ///////////////////
 Encoder::Result StringUsedEventLogger::MaybeEncodeImmediateObservation(
-    const ReportDefinition& report, bool may_invalidate,
+    const ReportPlan& report_plan, bool may_invalidate,
     EventRecord* event_record) {
+  const ReportDefinition& report = *report_plan.report;
   const MetricDefinition& metric = *(event_record->metric);
   const Event& event = *(event_record->event);
   CHECK(event.has_string_used_event());
@@ -688,7 +998,7 @@ Encoder::Result StringUsedEventLogger::MaybeEncodeImmediateObservation(
     case ReportDefinition::HIGH_FREQUENCY_STRING_COUNTS: {
       return encoder()->EncodeRapporObservation(
           project_context()->RefMetric(&metric), &report, event.day_index(),
-          string_used_event.str());
+          string_used_event.str(), report_plan.string_rappor_config);
     }
     case ReportDefinition::STRING_COUNTS_WITH_THRESHOLD: {
       return encoder()->EncodeForculusObservation(
@@ -708,8 +1018,9 @@ Status CustomEventLogger::ValidateEvent(const EventRecord& event_record) {
 }
 
 Encoder::Result CustomEventLogger::MaybeEncodeImmediateObservation(
-    const ReportDefinition& report, bool may_invalidate,
+    const ReportPlan& report_plan, bool may_invalidate,
     EventRecord* event_record) {
+  const ReportDefinition& report = *report_plan.report;
   const MetricDefinition& metric = *(event_record->metric);
   const Event& event = *(event_record->event);
   CHECK(event.has_custom_event());
@@ -5,6 +5,7 @@
 #ifndef COBALT_LOGGER_LOGGER_H_
 #define COBALT_LOGGER_LOGGER_H_
 
+#include <map>
 #include <memory>
 #include <string>
 #include <utility>
@@ -12,6 +13,7 @@
 
 #include "./observation2.pb.h"
 #include "logger/encoder.h"
+#include "logger/event_aggregator.h"
 #include "logger/internal_metrics.h"
 #include "logger/logger_interface.h"
 #include "logger/observation_writer.h"
@@ -22,6 +24,8 @@
 namespace cobalt {
 namespace logger {
 
+class EventLogger;
+
 // Concrete implementation of LoggerInterface.
 //
 // After constructing a Logger use the Log*() methods to Log Events to Cobalt.
@@ -45,13 +49,22 @@ class Logger : public LoggerInterface {
   // Logger will log events.
   //
   // |internal_logger| An instance of LoggerInterface, used internally by the
-  // Logger to send metrics about Cobalt to Cobalt. If nullptr, no such internal
-  // logging will be performed by this Logger.
+  // Logger to send metrics about Cobalt to Cobalt. The metrics are aggregated
+  // in-process and logged periodically and when the Logger is destroyed, so
+  // this must remain valid until the Logger has been destroyed. If nullptr, no
+  // such internal logging will be performed by this Logger.
+  //
+  // |event_aggregator| The system's singleton instance of EventAggregator. If
+  // not nullptr, the Logger registers the locally aggregated Reports of
+  // |project| with it and passes Events for those Reports to it instead of
+  // generating immediate Observations. Must remain valid as long as the Logger
+  // is in use. If nullptr, no local aggregation is performed.
   Logger(const Encoder* encoder, ObservationWriter* observation_writer,
          const ProjectContext* project,
-         LoggerInterface* internal_logger = nullptr);
+         LoggerInterface* internal_logger = nullptr,
+         EventAggregator* event_aggregator = nullptr);
 
-  virtual ~Logger() = default;
+  virtual ~Logger();
 
   Status LogEvent(uint32_t metric_id, uint32_t event_code) override;
 
@@ -78,6 +91,8 @@ class Logger : public LoggerInterface {
   Status LogCustomEvent(uint32_t metric_id,
                         EventValuesPtr event_values) override;
 
+  Status LogEvents(std::vector<EventSpec> events) override;
+
  private:
   friend class EventLogger;
 
@@ -88,8 +103,14 @@ class Logger : public LoggerInterface {
   const Encoder* encoder_;
   const ObservationWriter* observation_writer_;
   const ProjectContext* project_context_;
+  EventAggregator* event_aggregator_;
   std::unique_ptr<util::ClockInterface> clock_;
 
+  // One EventLogger for each Metric type. These are created by the constructor
+  // so that logging an Event does not require allocating an EventLogger.
+  std::map<MetricDefinition::MetricType, std::unique_ptr<EventLogger>>
+      event_loggers_;
+
   std::unique_ptr<InternalMetrics> internal_metrics_;
 };
 
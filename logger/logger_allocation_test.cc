@@ -0,0 +1,284 @@
+// Copyright 2018 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Tests that, in the steady state, the Logger does not allocate on the heap
+// when logging Events of the occurrence and integer Metric types whose
+// Reports do not generate immediate Observations. This covers everything that
+// the Logger does before an Observation is encoded. For Reports that do
+// generate immediate Observations it bounds the number of allocations made by
+// encoding, encrypting and writing each Observation.
+
+#include <google/protobuf/text_format.h>
+
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "./gtest.h"
+#include "client/benchmarks/heap_allocations.h"
+#include "encoder/client_secret.h"
+#include "encoder/no_op_observation_store.h"
+#include "logger/encoder.h"
+#include "logger/event_aggregator.h"
+#include "logger/logger.h"
+#include "logger/project_context.h"
+#include "logger/status.h"
+#include "util/consistent_proto_store.h"
+#include "util/encrypted_message_util.h"
+#include "util/posix_file_system.h"
+
+namespace cobalt {
+
+using benchmarks::ThreadHeapAllocations;
+using encoder::ClientSecret;
+using encoder::NoOpObservationStore;
+using encoder::NoOpUpdateRecipient;
+using util::ConsistentProtoStore;
+using util::EncryptedMessageMaker;
+using util::PosixFileSystem;
+
+namespace logger {
+
+namespace {
+static const uint32_t kCustomerId = 1;
+static const uint32_t kProjectId = 1;
+static const char kCustomerName[] = "Fuchsia";
+static const char kProjectName[] = "Cobalt";
+
+static const char kAggregateStoreFile[] = "/tmp/logger_allocation_test_store";
+
+// Metric IDs
+const uint32_t kDeviceBootsMetricId = 1;
+const uint32_t kReadCacheHitsMetricId = 2;
+const uint32_t kModuleLoadTimeMetricId = 3;
+const uint32_t kLoginModuleFrameRateMetricId = 4;
+const uint32_t kLedgerMemoryUsageMetricId = 5;
+const uint32_t kSettingsChangedMetricId = 6;
+const uint32_t kRpcLatencyMetricId = 7;
+
+const int kNumWarmUpCalls = 10;
+const uint64_t kNumCalls = 100;
+
+// The number of allocations made for each Observation that is written to the
+// Observation Store: the ObservationMetadata, the EncryptedMessage, its
+// ciphertext and the serialized Observation. The Observation Store takes
+// ownership of them.
+const uint64_t kNumStoredAllocations = 4;
+
+// The maximum number of further allocations made for each Observation of
+// type BasicRapporObservation, by the setup and the encoding of the
+// BasicRapporEncoder.
+const uint64_t kMaxBasicRapporAllocations = 9;
+
+// The Reports of the DeviceBoots and ReadCacheHits Metrics are locally
+// aggregated and the ModuleLoadTime, LoginModuleFrameRate and
+// LedgerMemoryUsage Metrics have no Reports. The Reports of the
+// SettingsChanged and RpcLatency Metrics generate immediate Observations.
+static const char kMetricDefinitions[] = R"(
+metric {
+  metric_name: "DeviceBoots"
+  metric_type: EVENT_OCCURRED
+  customer_id: 1
+  project_id: 1
+  id: 1
+  max_event_code: 2
+  reports: {
+    report_name: "DeviceBoots_UniqueDevices"
+    id: 11
+    report_type: UNIQUE_N_DAY_ACTIVES
+    window_size: WINDOW_1_DAY
+  }
+}
+
+metric {
+  metric_name: "ReadCacheHits"
+  metric_type: EVENT_COUNT
+  customer_id: 1
+  project_id: 1
+  id: 2
+  reports: {
+    report_name: "ReadCacheHitCounts"
+    id: 21
+    report_type: EVENT_COMPONENT_OCCURRENCE_COUNT
+  }
+}
+
+metric {
+  metric_name: "ModuleLoadTime"
+  metric_type: ELAPSED_TIME
+  customer_id: 1
+  project_id: 1
+  id: 3
+}
+
+metric {
+  metric_name: "LoginModuleFrameRate"
+  metric_type: FRAME_RATE
+  customer_id: 1
+  project_id: 1
+  id: 4
+}
+
+metric {
+  metric_name: "LedgerMemoryUsage"
+  metric_type: MEMORY_USAGE
+  customer_id: 1
+  project_id: 1
+  id: 5
+}
+
+metric {
+  metric_name: "SettingsChanged"
+  metric_type: EVENT_OCCURRED
+  customer_id: 1
+  project_id: 1
+  id: 6
+  max_event_code: 2
+  reports: {
+    report_name: "SettingsChangedCounts"
+    id: 61
+    report_type: SIMPLE_OCCURRENCE_COUNT
+    local_privacy_noise_level: SMALL
+  }
+}
+
+metric {
+  metric_name: "RpcLatency"
+  metric_type: ELAPSED_TIME
+  customer_id: 1
+  project_id: 1
+  id: 7
+  reports: {
+    report_name: "RpcLatency_Aggregated"
+    id: 71
+    report_type: NUMERIC_AGGREGATION
+  }
+}
+)";
+
+bool PopulateMetricDefinitions(MetricDefinitions* metric_definitions) {
+  google::protobuf::TextFormat::Parser parser;
+  return parser.ParseFromString(kMetricDefinitions, metric_definitions);
+}
+
+}  // namespace
+
+class LoggerAllocationTest : public ::testing::Test {
+ protected:
+  void SetUp() {
+    PosixFileSystem fs;
+    fs.Delete(kAggregateStoreFile);
+    auto metric_definitions = std::make_unique<MetricDefinitions>();
+    ASSERT_TRUE(PopulateMetricDefinitions(metric_definitions.get()));
+    project_context_.reset(new ProjectContext(kCustomerId, kProjectId,
+                                              kCustomerName, kProjectName,
+                                              std::move(metric_definitions)));
+    observation_encrypter_.reset(
+        new EncryptedMessageMaker("", EncryptedMessage::NONE));
+    observation_writer_.reset(new ObservationWriter(
+        &observation_store_, &update_recipient_, observation_encrypter_.get()));
+    encoder_.reset(new Encoder(ClientSecret::GenerateNewSecret(), nullptr));
+    proto_store_.reset(new ConsistentProtoStore(
+        kAggregateStoreFile, std::make_unique<PosixFileSystem>()));
+    event_aggregator_.reset(new EventAggregator(
+        encoder_.get(), observation_writer_.get(), proto_store_.get()));
+    logger_.reset(new Logger(encoder_.get(), observation_writer_.get(),
+                             project_context_.get(), nullptr,
+                             event_aggregator_.get()));
+  }
+
+  void TearDown() {
+    logger_.reset();
+    event_aggregator_.reset();
+    PosixFileSystem fs;
+    fs.Delete(kAggregateStoreFile);
+  }
+
+  // Invokes |log| kNumWarmUpCalls times and then returns the number of heap
+  // allocations made by kNumCalls further invocations, each of which is
+  // expected to succeed.
+  template <typename LogFunction>
+  uint64_t CountAllocations(LogFunction log) {
+    for (int i = 0; i < kNumWarmUpCalls; i++) {
+      EXPECT_EQ(kOK, log());
+    }
+    uint64_t start_num_allocations = ThreadHeapAllocations();
+    for (uint64_t i = 0; i < kNumCalls; i++) {
+      EXPECT_EQ(kOK, log());
+    }
+    return ThreadHeapAllocations() - start_num_allocations;
+  }
+
+  NoOpObservationStore observation_store_;
+  NoOpUpdateRecipient update_recipient_;
+  std::unique_ptr<ProjectContext> project_context_;
+  std::unique_ptr<EncryptedMessageMaker> observation_encrypter_;
+  std::unique_ptr<ObservationWriter> observation_writer_;
+  std::unique_ptr<Encoder> encoder_;
+  std::unique_ptr<ConsistentProtoStore> proto_store_;
+  std::unique_ptr<EventAggregator> event_aggregator_;
+  std::unique_ptr<Logger> logger_;
+};
+
+TEST_F(LoggerAllocationTest, LogEvent) {
+  EXPECT_EQ(0u, CountAllocations([this]() {
+              return logger_->LogEvent(kDeviceBootsMetricId, 1);
+            }));
+}
+
+TEST_F(LoggerAllocationTest, LogEventCount) {
+  const std::string component = "component";
+  EXPECT_EQ(0u, CountAllocations([this, &component]() {
+              return logger_->LogEventCount(kReadCacheHitsMetricId, 1,
+                                            component, 0, 1);
+            }));
+}
+
+TEST_F(LoggerAllocationTest, LogElapsedTime) {
+  const std::string component = "component";
+  EXPECT_EQ(0u, CountAllocations([this, &component]() {
+              return logger_->LogElapsedTime(kModuleLoadTimeMetricId, 1,
+                                             component, 4004);
+            }));
+}
+
+TEST_F(LoggerAllocationTest, LogFrameRate) {
+  const std::string component = "component";
+  EXPECT_EQ(0u, CountAllocations([this, &component]() {
+              return logger_->LogFrameRate(kLoginModuleFrameRateMetricId, 1,
+                                           component, 5.123);
+            }));
+}
+
+TEST_F(LoggerAllocationTest, LogMemoryUsage) {
+  const std::string component = "component";
+  EXPECT_EQ(0u, CountAllocations([this, &component]() {
+              return logger_->LogMemoryUsage(kLedgerMemoryUsageMetricId, 1,
+                                             component, 606);
+            }));
+}
+
+// Tests that, when an immediate Observation is generated, the Encoder takes
+// the Observation from its pool so that the only allocations are those of the
+// objects that are handed over to the Observation Store.
+TEST_F(LoggerAllocationTest, LogElapsedTimeImmediateObservation) {
+  const std::string component = "component";
+  EXPECT_EQ(kNumCalls * kNumStoredAllocations,
+            CountAllocations([this, &component]() {
+              return logger_->LogElapsedTime(kRpcLatencyMetricId, 1,
+                                             component, 4004);
+            }));
+}
+
+// Tests that the allocations made for an immediate Observation of type
+// BasicRapporObservation are bounded.
+TEST_F(LoggerAllocationTest, LogEventImmediateObservation) {
+  EXPECT_GE(kNumCalls * (kNumStoredAllocations + kMaxBasicRapporAllocations),
+            CountAllocations([this]() {
+              return logger_->LogEvent(kSettingsChangedMetricId, 1);
+            }));
+}
+
+}  // namespace logger
+}  // namespace cobalt
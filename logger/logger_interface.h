@@ -5,17 +5,37 @@
 #ifndef COBALT_LOGGER_LOGGER_INTERFACE_H_
 #define COBALT_LOGGER_LOGGER_INTERFACE_H_
 
+#include <chrono>
 #include <memory>
 #include <string>
 #include <utility>
 #include <vector>
 
+#include "./event.pb.h"
 #include "logger/encoder.h"
 #include "logger/status.h"
 
 namespace cobalt {
 namespace logger {
 
+// An EventSpec specifies a single Event to be logged via
+// LoggerInterface::LogEvents().
+struct EventSpec {
+  // ID of the Metric the logged Event will belong to. It must be one of the
+  // Metrics from the ProjectContext passed to the constructor of the Logger.
+  uint32_t metric_id = 0;
+
+  // The Event to log. Exactly one of the members of its |type| oneof must be
+  // set and this must correspond to the type of the Metric, as described for
+  // the other Log*() methods below. The |day_index| is ignored: it is set by
+  // the Logger from |time|.
+  Event event;
+
+  // The time at which the Event occurred. If this is left unset then the
+  // Logger uses the time at which LogEvents() is invoked.
+  std::chrono::system_clock::time_point time;
+};
+
 // Logger is the client-facing interface to Cobalt.
 //
 // LoggerInterface is an abstract interface to Logger that allows Logger to
@@ -170,6 +190,19 @@ class LoggerInterface {
   // contents match the proto defined.
   virtual Status LogCustomEvent(uint32_t metric_id,
                                 EventValuesPtr event_values) = 0;
+
+  // Logs a batch of Events. This is equivalent to invoking the corresponding
+  // Log*() method for each of |events| in order, but is more efficient: the
+  // Metric and the day index are resolved once for each distinct Metric in the
+  // batch, and all of the resulting immediate Observations are written to the
+  // ObservationStore at once.
+  //
+  // An attempt is made to log every Event even if logging an earlier one
+  // fails. Returns kOK if all of the Events were logged successfully and
+  // otherwise the status of the first failure.
+  //
+  // |events| The Events to log.
+  virtual Status LogEvents(std::vector<EventSpec> events) = 0;
 };
 
 }  // namespace logger
@@ -7,6 +7,7 @@
 #include <google/protobuf/text_format.h>
 #include <google/protobuf/util/message_differencer.h>
 
+#include <chrono>
 #include <memory>
 #include <string>
 #include <utility>
@@ -30,6 +31,8 @@ namespace cobalt {
 using encoder::ClientSecret;
 using encoder::LegacyShippingManager;
 using encoder::MemoryObservationStore;
+using encoder::MetadataHandle;
+using encoder::MetadataRegistry;
 using encoder::ObservationStoreUpdateRecipient;
 using encoder::ObservationStoreWriterInterface;
 using encoder::SendRetryerInterface;
@@ -246,8 +249,28 @@ class FakeObservationStore : public ObservationStoreWriterInterface {
     return kOk;
   }
 
+  MetadataHandle RegisterMetadata(
+      const ObservationMetadata& metadata) override {
+    return metadata_registry_.Register(metadata);
+  }
+
+  StoreStatus AddEncryptedObservationByHandle(
+      std::unique_ptr<EncryptedMessage> message,
+      MetadataHandle metadata) override {
+    auto entry = metadata_registry_.Get(metadata);
+    if (entry == nullptr) {
+      return kWriteFailed;
+    }
+    return AddEncryptedObservation(
+        std::move(message),
+        std::make_unique<ObservationMetadata>(entry->metadata));
+  }
+
   std::vector<std::unique_ptr<EncryptedMessage>> messages_received;
   std::vector<std::unique_ptr<ObservationMetadata>> metadata_received;
+
+ private:
+  MetadataRegistry metadata_registry_;
 };
 
 class TestUpdateRecipient : public ObservationStoreUpdateRecipient {
@@ -506,5 +529,85 @@ TEST_F(LoggerTest, LogCustomEvent) {
   }
 }
 
+// Tests the method LogEvents().
+TEST_F(LoggerTest, LogEvents) {
+  std::vector<EventSpec> events(3);
+  events[0].metric_id = kReadCacheHitsMetricId;
+  auto* count_event = events[0].event.mutable_count_event();
+  count_event->set_event_code(43);
+  count_event->set_component("component2");
+  count_event->set_count(303);
+  events[1].metric_id = kLedgerMemoryUsageMetricId;
+  auto* memory_usage_event = events[1].event.mutable_memory_usage_event();
+  memory_usage_event->set_event_code(46);
+  memory_usage_event->set_bytes(606);
+  events[2] = events[0];
+  events[2].event.mutable_count_event()->set_count(404);
+  ASSERT_EQ(kOK, logger_->LogEvents(std::move(events)));
+
+  // All of the Observations are written at once.
+  EXPECT_EQ(1, update_recipient_->invocation_count);
+  std::vector<uint32_t> expected_report_ids = {111, 141, 241, 111};
+  std::vector<int64_t> expected_values = {303, 606, 606, 404};
+  ASSERT_EQ(expected_report_ids.size(),
+            observation_store_->messages_received.size());
+  ASSERT_EQ(expected_report_ids.size(),
+            observation_store_->metadata_received.size());
+  MessageDecrypter message_decrypter("");
+  for (auto i = 0u; i < expected_report_ids.size(); i++) {
+    EXPECT_EQ(expected_report_ids[i],
+              observation_store_->metadata_received[i]->report_id());
+    Observation2 observation;
+    ASSERT_TRUE(message_decrypter.DecryptMessage(
+        *(observation_store_->messages_received[i]), &observation));
+    ASSERT_TRUE(observation.has_numeric_event());
+    EXPECT_EQ(expected_values[i], observation.numeric_event().value());
+  }
+}
+
+// Tests that LogEvents() uses the time of an Event, if it is set, to compute
+// the day index of its Observations.
+TEST_F(LoggerTest, LogEventsWithTime) {
+  std::vector<EventSpec> events(2);
+  events[0].metric_id = kLedgerMemoryUsageMetricId;
+  events[0].event.mutable_memory_usage_event()->set_bytes(606);
+  events[0].time = std::chrono::system_clock::time_point(
+      std::chrono::hours(24 * 100 + 1));
+  events[1] = events[0];
+  events[1].time = std::chrono::system_clock::time_point();
+  ASSERT_EQ(kOK, logger_->LogEvents(std::move(events)));
+
+  // The memory usage Metric has two Reports.
+  ASSERT_EQ(4u, observation_store_->metadata_received.size());
+  EXPECT_EQ(100u, observation_store_->metadata_received[0]->day_index());
+  EXPECT_EQ(100u, observation_store_->metadata_received[1]->day_index());
+  EXPECT_LT(100u, observation_store_->metadata_received[2]->day_index());
+  EXPECT_LT(100u, observation_store_->metadata_received[3]->day_index());
+}
+
+// Tests that LogEvents() logs the valid Events of a batch and returns an
+// error if any of the Events is invalid.
+TEST_F(LoggerTest, LogEventsWithInvalidEvent) {
+  std::vector<EventSpec> events(4);
+  // An unknown metric ID.
+  events[0].metric_id = 999;
+  events[0].event.mutable_occurrence_event()->set_event_code(1);
+  // The wrong type of Event for the Metric.
+  events[1].metric_id = kReadCacheHitsMetricId;
+  events[1].event.mutable_occurrence_event()->set_event_code(1);
+  // An Event whose type is not set.
+  events[2].metric_id = kErrorOccurredMetricId;
+  // A valid Event.
+  events[3].metric_id = kErrorOccurredMetricId;
+  events[3].event.mutable_occurrence_event()->set_event_code(42);
+  EXPECT_EQ(kInvalidArguments, logger_->LogEvents(std::move(events)));
+
+  Observation2 observation;
+  uint32_t expected_report_id = 123;
+  ASSERT_TRUE(
+      FetchSingleImmediateObservation(&observation, expected_report_id));
+  ASSERT_TRUE(observation.has_basic_rappor());
+}
+
 }  // namespace logger
 }  // namespace cobalt
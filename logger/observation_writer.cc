@@ -4,8 +4,17 @@
 
 #include "logger/observation_writer.h"
 
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <tuple>
 #include <utility>
+#include <vector>
 
 #include "./logging.h"
 
@@ -14,24 +23,342 @@ namespace logger {
 
 using ::cobalt::encoder::ObservationStoreWriterInterface;
 
+constexpr size_t ObservationWriter::kDefaultMaxInFlightBytes;
+
+// A pool of threads that encrypt batches of Observations concurrently and
+// write the results to the Observation Store.
+//
+// Each batch handed to Write() is given a sequence number. All idle threads
+// share the encryption of the oldest batch that still has Observations left
+// to encrypt, one Observation at a time, so that a large batch is encrypted
+// on every thread. The batches may finish encryption in any order, but they
+// are written to the store strictly in the order of their sequence numbers:
+// a finished batch waits in |encrypted_jobs_| until all earlier ones have
+// been written. Whichever thread finds the next batch ready writes it, and
+// any later ready batches, outside of |mutex_|. Only one thread writes at a
+// time.
+class ObservationWriter::EncryptionPool {
+ public:
+  EncryptionPool(const ObservationWriter* writer, size_t num_threads,
+                 size_t max_in_flight_bytes)
+      : writer_(writer), max_in_flight_bytes_(max_in_flight_bytes) {
+    for (size_t i = 0; i < num_threads; i++) {
+      threads_.emplace_back([this] { Run(); });
+    }
+  }
+
+  ~EncryptionPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      shut_down_ = true;
+    }
+    job_available_.notify_all();
+    for (auto& thread : threads_) {
+      thread.join();
+    }
+  }
+
+  // Adds the non-empty |observations| to the pool as a single batch, first
+  // waiting until there is room for them under the in-flight bound, and then
+  // waits until the batch has been written. Returns the status of the
+  // encryption and of the write, as ObservationWriter::WriteObservations()
+  // does without a pool.
+  Status Write(std::vector<ObservationAndMetadata> observations) {
+    auto job = std::make_shared<Job>();
+    for (const auto& observation : observations) {
+      job->num_bytes += observation.observation->ByteSizeLong();
+    }
+    job->encrypted_messages.resize(observations.size());
+    job->observations = std::move(observations);
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    space_available_.wait(lock, [this, &job] {
+      return in_flight_bytes_ == 0 ||
+             in_flight_bytes_ + job->num_bytes <= max_in_flight_bytes_;
+    });
+    in_flight_bytes_ += job->num_bytes;
+    job->sequence_number = next_sequence_number_++;
+    jobs_.push_back(job);
+    job_available_.notify_all();
+    written_.wait(lock, [&job] { return job->written; });
+    return job->status;
+  }
+
+  // Waits until every batch submitted before the call has been written.
+  void Flush() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    uint64_t sequence_number = next_sequence_number_;
+    written_.wait(lock, [this, sequence_number] {
+      return next_to_write_ >= sequence_number;
+    });
+  }
+
+ private:
+  struct Job {
+    uint64_t sequence_number = 0;
+    size_t num_bytes = 0;
+    std::vector<ObservationAndMetadata> observations;
+    // The encryption of observations[i] is written to encrypted_messages[i]
+    // by the thread that claimed i. It stays null if the encryption failed.
+    std::vector<std::unique_ptr<EncryptedMessage>> encrypted_messages;
+    // The number of Observations claimed by a thread and the number of those
+    // whose encryption has finished.
+    size_t num_claimed = 0;
+    size_t num_encrypted = 0;
+    // Set once the batch has been written, together with its status.
+    bool written = false;
+    Status status = kOK;
+  };
+
+  // The main method run by each thread. Returns once the pool is shut down
+  // and there are no jobs left.
+  void Run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+      job_available_.wait(lock,
+                          [this] { return shut_down_ || !jobs_.empty(); });
+      if (jobs_.empty()) {
+        return;
+      }
+      std::shared_ptr<Job> job = jobs_.front();
+      size_t index = job->num_claimed++;
+      if (job->num_claimed == job->observations.size()) {
+        jobs_.pop_front();
+      }
+      lock.unlock();
+
+      job->encrypted_messages[index] = writer_->EncryptObservation(
+          *job->observations[index].observation);
+
+      lock.lock();
+      if (++job->num_encrypted < job->observations.size()) {
+        // Another thread is still encrypting part of this job.
+        continue;
+      }
+      encrypted_jobs_.emplace(job->sequence_number, std::move(job));
+      if (writing_) {
+        // The thread that is writing will also write this job.
+        continue;
+      }
+      writing_ = true;
+      while (!encrypted_jobs_.empty() &&
+             encrypted_jobs_.begin()->first == next_to_write_) {
+        std::shared_ptr<Job> ready = std::move(encrypted_jobs_.begin()->second);
+        encrypted_jobs_.erase(encrypted_jobs_.begin());
+        lock.unlock();
+        Status status = Store(ready.get());
+        lock.lock();
+        ready->status = status;
+        ready->written = true;
+        next_to_write_++;
+        in_flight_bytes_ -= ready->num_bytes;
+        space_available_.notify_all();
+        written_.notify_all();
+      }
+      writing_ = false;
+    }
+  }
+
+  // Writes the encrypted Observations of |job| to the store and returns the
+  // status of the batch.
+  Status Store(Job* job) {
+    Status status = kOK;
+    std::vector<EncryptedObservation> encrypted_observations;
+    encrypted_observations.reserve(job->observations.size());
+    for (size_t i = 0; i < job->observations.size(); i++) {
+      if (!job->encrypted_messages[i]) {
+        status = kOther;
+        continue;
+      }
+      encrypted_observations.push_back({std::move(job->encrypted_messages[i]),
+                                        job->observations[i].metadata});
+    }
+    auto store_status =
+        writer_->StoreEncryptedObservations(std::move(encrypted_observations));
+    return status != kOK ? status : store_status;
+  }
+
+  const ObservationWriter* writer_;  // not owned
+  const size_t max_in_flight_bytes_;
+
+  std::mutex mutex_;
+  std::condition_variable job_available_;
+  std::condition_variable space_available_;
+  std::condition_variable written_;
+  // Batches with Observations that no thread has claimed yet, in order of
+  // sequence number.
+  std::deque<std::shared_ptr<Job>> jobs_;
+  // Encrypted batches waiting for an earlier batch to be written, keyed by
+  // sequence number.
+  std::map<uint64_t, std::shared_ptr<Job>> encrypted_jobs_;
+  uint64_t next_sequence_number_ = 0;
+  uint64_t next_to_write_ = 0;
+  // The total serialized size of the batches that have been submitted but not
+  // yet written.
+  size_t in_flight_bytes_ = 0;
+  bool writing_ = false;
+  bool shut_down_ = false;
+
+  std::vector<std::thread> threads_;
+};
+
+ObservationWriter::ObservationWriter(
+    ObservationStoreWriterInterface* observation_store,
+    encoder::ObservationStoreUpdateRecipient* update_recipient,
+    util::EncryptedMessageMaker* observation_encrypter,
+    size_t num_encryption_threads, size_t max_in_flight_bytes)
+    : observation_store_(observation_store),
+      update_recipient_(update_recipient),
+      observation_encrypter_(observation_encrypter) {
+  if (num_encryption_threads > 0) {
+    encryption_pool_.reset(new EncryptionPool(this, num_encryption_threads,
+                                              max_in_flight_bytes));
+  }
+}
+
+ObservationWriter::~ObservationWriter() = default;
+
+namespace {
+
+// The fields of an ObservationMetadata compared by
+// ObservationWriter::MetadataLess, other than the experiments of its system
+// profile.
+using MetadataFields =
+    std::tuple<uint32_t, uint32_t, uint32_t, uint32_t, uint32_t, int, int,
+               const std::string&, const std::string&, int>;
+
+MetadataFields GetMetadataFields(const ObservationMetadata& metadata) {
+  const auto& profile = metadata.system_profile();
+  return MetadataFields(metadata.customer_id(), metadata.project_id(),
+                        metadata.metric_id(), metadata.report_id(),
+                        metadata.day_index(), profile.os(), profile.arch(),
+                        profile.board_name(), profile.product_name(),
+                        profile.experiments_size());
+}
+
+}  // namespace
+
+bool ObservationWriter::MetadataLess::operator()(
+    const ObservationMetadata& a, const ObservationMetadata& b) const {
+  MetadataFields a_fields = GetMetadataFields(a);
+  MetadataFields b_fields = GetMetadataFields(b);
+  if (a_fields != b_fields) {
+    return a_fields < b_fields;
+  }
+  return std::lexicographical_compare(
+      a.system_profile().experiments().begin(),
+      a.system_profile().experiments().end(),
+      b.system_profile().experiments().begin(),
+      b.system_profile().experiments().end(),
+      [](const Experiment& x, const Experiment& y) {
+        return std::make_tuple(x.experiment_id(), x.arm_id()) <
+               std::make_tuple(y.experiment_id(), y.arm_id());
+      });
+}
+
+encoder::MetadataHandle ObservationWriter::RegisterMetadata(
+    const ObservationMetadata& metadata) const {
+  std::lock_guard<std::mutex> lock(metadata_mutex_);
+  auto handle = metadata_handles_.find(metadata);
+  if (handle != metadata_handles_.end()) {
+    return handle->second;
+  }
+  return metadata_handles_
+      .emplace(metadata, observation_store_->RegisterMetadata(metadata))
+      .first->second;
+}
+
 Status ObservationWriter::WriteObservation(
-    const Observation2& observation,
-    std::unique_ptr<ObservationMetadata> metadata) const {
+    const Observation2& observation, encoder::MetadataHandle metadata) const {
+  auto encrypted_observation = EncryptObservation(observation);
+  if (!encrypted_observation) {
+    return kOther;
+  }
+  auto store_status = observation_store_->AddEncryptedObservationByHandle(
+      std::move(encrypted_observation), metadata);
+  if (store_status != ObservationStoreWriterInterface::kOk) {
+    LOG(ERROR) << "ObservationStore::AddEncryptedObservationByHandle() failed "
+                  "with status "
+               << store_status;
+    return ToStatus(store_status);
+  }
+  update_recipient_->NotifyObservationsAdded();
+  return kOK;
+}
+
+Status ObservationWriter::WriteObservations(
+    std::vector<ObservationAndMetadata> observations) const {
+  if (observations.empty()) {
+    return kOK;
+  }
+  if (encryption_pool_) {
+    return encryption_pool_->Write(std::move(observations));
+  }
+  Status status = kOK;
+  std::vector<EncryptedObservation> encrypted_observations;
+  encrypted_observations.reserve(observations.size());
+  for (auto& observation : observations) {
+    auto encrypted_observation = EncryptObservation(*observation.observation);
+    if (!encrypted_observation) {
+      status = kOther;
+      continue;
+    }
+    encrypted_observations.push_back(
+        {std::move(encrypted_observation), observation.metadata});
+  }
+  auto store_status =
+      StoreEncryptedObservations(std::move(encrypted_observations));
+  return status != kOK ? status : store_status;
+}
+
+void ObservationWriter::Flush() const {
+  if (encryption_pool_) {
+    encryption_pool_->Flush();
+  }
+}
+
+Status ObservationWriter::ToStatus(
+    ObservationStoreWriterInterface::StoreStatus store_status) {
+  switch (store_status) {
+    case ObservationStoreWriterInterface::kOk:
+      return kOK;
+    case ObservationStoreWriterInterface::kObservationTooBig:
+      return kTooBig;
+    case ObservationStoreWriterInterface::kStoreFull:
+      return kFull;
+    default:
+      return kOther;
+  }
+}
+
+std::unique_ptr<EncryptedMessage> ObservationWriter::EncryptObservation(
+    const Observation2& observation) const {
   auto encrypted_observation = std::make_unique<EncryptedMessage>();
   if (!observation_encrypter_->Encrypt(observation,
                                        encrypted_observation.get())) {
     LOG(ERROR) << "Encryption of an Observation failed.";
-    return kOther;
+    return nullptr;
+  }
+  return encrypted_observation;
+}
+
+Status ObservationWriter::StoreEncryptedObservations(
+    std::vector<EncryptedObservation> encrypted_observations) const {
+  if (encrypted_observations.empty()) {
+    return kOK;
+  }
+  size_t num_added = 0;
+  auto store_status = observation_store_->AddEncryptedObservations(
+      std::move(encrypted_observations), &num_added);
+  if (num_added > 0) {
+    update_recipient_->NotifyObservationsAdded();
   }
-  auto store_status = observation_store_->AddEncryptedObservation(
-      std::move(encrypted_observation), std::move(metadata));
   if (store_status != ObservationStoreWriterInterface::kOk) {
     LOG(ERROR)
-        << "ObservationStore::AddEncryptedObservation() failed with status "
+        << "ObservationStore::AddEncryptedObservations() failed with status "
         << store_status;
-    return kOther;
+    return ToStatus(store_status);
   }
-  update_recipient_->NotifyObservationsAdded();
   return kOK;
 }
 
@@ -5,9 +5,14 @@
 #ifndef COBALT_LOGGER_OBSERVATION_WRITER_H_
 #define COBALT_LOGGER_OBSERVATION_WRITER_H_
 
+#include <cstddef>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <vector>
 
 #include "./observation2.pb.h"
+#include "encoder/metadata_registry.h"
 #include "encoder/observation_store.h"
 #include "encoder/observation_store_update_recipient.h"
 #include "logger/status.h"
@@ -21,8 +26,25 @@ namespace logger {
 //
 // A system has a single instance of ObservationWriter, which is used by the
 // EventAggregator and multiple Loggers.
+//
+// By default the Observations are encrypted and written on the calling thread.
+// Optionally the ObservationWriter owns a pool of encryption threads. In that
+// case WriteObservations() hands its batch to the pool and waits for it to be
+// written. The pool encrypts the batches of all of the waiting callers
+// concurrently, including the Observations within a single batch, and writes
+// the batches to the Observation Store in the order in which they were handed
+// over. WriteObservation() always encrypts and writes its single Observation
+// on the calling thread, since handing it to the pool would only add a copy
+// and a wait behind the batches that are already in the pool.
+//
+// All public methods of this class are thread-safe.
 class ObservationWriter {
  public:
+  // The default bound on the total serialized size of the Observations that
+  // have been handed to the encryption threads but not yet written to the
+  // Observation Store.
+  static constexpr size_t kDefaultMaxInFlightBytes = 1024 * 1024;
+
   // Constructor:
   //
   // |observation_store| A writer interface to the system's singleton instance
@@ -36,24 +58,111 @@ class ObservationWriter {
   // |observation_encrypter| This is used to encrypt Observations to the public
   // key of Cobalt's Analyzer prior to writing them into the Observation Store.
   // This must remain valid as long as the ObservationWriter is being used.
+  // If |num_encryption_threads| is positive then Encrypt() is invoked
+  // concurrently from that many threads, which EncryptedMessageMaker
+  // supports.
+  //
+  // |num_encryption_threads| The number of threads in the encryption pool. If
+  // this is zero, which is the default, there is no pool and the Observations
+  // are encrypted and written synchronously.
+  //
+  // |max_in_flight_bytes| Only used if there is an encryption pool. Once the
+  // Observations waiting in the pool add up to this many serialized bytes, a
+  // WriteObservations() call blocks until some of them have been written. A
+  // single batch that exceeds the bound by itself is accepted when the pool is
+  // empty.
   ObservationWriter(encoder::ObservationStoreWriterInterface* observation_store,
                     encoder::ObservationStoreUpdateRecipient* update_recipient,
-                    util::EncryptedMessageMaker* observation_encrypter)
-      : observation_store_(observation_store),
-        update_recipient_(update_recipient),
-        observation_encrypter_(observation_encrypter) {}
-
-  // Given an Observation |observation| and an ObservationMetadata |metadata|,
-  // writes an encryption of the Observation together with the unencrypted
-  // metadata to the Observation Store, and notifies the UpdateRecipient that an
-  // Observation has been added to the store.
+                    util::EncryptedMessageMaker* observation_encrypter,
+                    size_t num_encryption_threads = 0,
+                    size_t max_in_flight_bytes = kDefaultMaxInFlightBytes);
+
+  // Waits for the encryption pool, if there is one, to write all of the
+  // Observations it has been given and then stops its threads.
+  ~ObservationWriter();
+
+  // Returns the handle with which Observations with the ObservationMetadata
+  // |metadata| are written. The first time that the metadata of a (customer,
+  // project, metric, report, day, system profile) is passed it is registered
+  // with the Observation Store. Later calls find its handle by comparing those
+  // fields, without serializing |metadata|.
+  encoder::MetadataHandle RegisterMetadata(
+      const ObservationMetadata& metadata) const;
+
+  // Given an Observation |observation| and the handle |metadata| of its
+  // ObservationMetadata, returned by RegisterMetadata(), writes an encryption
+  // of the Observation together with the unencrypted metadata to the
+  // Observation Store, and notifies the UpdateRecipient that an Observation
+  // has been added to the store.
+  //
+  // The Observation is encrypted and written on the calling thread, whether
+  // or not there is an encryption pool.
+  //
+  // Returns kOK on success, kFull or kTooBig if the Observation Store rejected
+  // the Observation for that reason, and kOther for any other failure.
   Status WriteObservation(const Observation2& observation,
-                          std::unique_ptr<ObservationMetadata> metadata) const;
+                          encoder::MetadataHandle metadata) const;
+
+  // An Observation together with the handle of its ObservationMetadata,
+  // returned by RegisterMetadata().
+  struct ObservationAndMetadata {
+    std::unique_ptr<Observation2> observation;
+    encoder::MetadataHandle metadata;
+  };
+
+  // Writes encryptions of each of the given Observations, together with their
+  // unencrypted metadata, to the Observation Store using a single call to
+  // AddEncryptedObservations(), and notifies the UpdateRecipient once if any
+  // Observation was added. An attempt is made to write every Observation even
+  // if an earlier one fails. Returns kOK if all of them were written. If an
+  // encryption failed it returns kOther, and otherwise the status of the
+  // write as for WriteObservation().
+  Status WriteObservations(
+      std::vector<ObservationAndMetadata> observations) const;
+
+  // Blocks until every batch handed to the encryption pool before the call
+  // has been written to the Observation Store. Does nothing if there is no
+  // encryption pool.
+  void Flush() const;
 
  private:
+  class EncryptionPool;
+
+  using EncryptedObservation =
+      encoder::ObservationStoreWriterInterface::EncryptedObservation;
+
+  // Maps a status of the Observation Store to a logger Status.
+  static Status ToStatus(
+      encoder::ObservationStoreWriterInterface::StoreStatus store_status);
+
+  // Returns the encryption of |observation|, or nullptr if the encryption
+  // failed.
+  std::unique_ptr<EncryptedMessage> EncryptObservation(
+      const Observation2& observation) const;
+
+  // Writes the |encrypted_observations| to the Observation Store using a
+  // single call to AddEncryptedObservations(), and notifies the
+  // UpdateRecipient once if any of them was added.
+  Status StoreEncryptedObservations(
+      std::vector<EncryptedObservation> encrypted_observations) const;
+
+  // Orders ObservationMetadata by the fields that identify the metadata of
+  // the Observations made by the Encoder.
+  struct MetadataLess {
+    bool operator()(const ObservationMetadata& a,
+                    const ObservationMetadata& b) const;
+  };
+
   encoder::ObservationStoreWriterInterface* observation_store_;
   encoder::ObservationStoreUpdateRecipient* update_recipient_;
   util::EncryptedMessageMaker* observation_encrypter_;
+  std::unique_ptr<EncryptionPool> encryption_pool_;
+
+  // Guards |metadata_handles_|.
+  mutable std::mutex metadata_mutex_;
+  // The handle of each ObservationMetadata passed to RegisterMetadata().
+  mutable std::map<ObservationMetadata, encoder::MetadataHandle, MetadataLess>
+      metadata_handles_;
 };
 
 }  // namespace logger
@@ -0,0 +1,344 @@
+// Copyright 2018 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "logger/observation_writer.h"
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "./gtest.h"
+#include "util/crypto_util/cipher.h"
+
+namespace cobalt {
+
+using encoder::MetadataHandle;
+using encoder::MetadataRegistry;
+using encoder::ObservationStoreUpdateRecipient;
+using encoder::ObservationStoreWriterInterface;
+using util::EncryptedMessageMaker;
+using util::MessageDecrypter;
+
+namespace logger {
+
+namespace {
+
+// An ObservationStoreWriterInterface that records the Observations added to
+// it, in order. Once it holds |capacity| Observations it rejects further ones
+// with kStoreFull.
+class FakeObservationStore : public ObservationStoreWriterInterface {
+ public:
+  StoreStatus AddEncryptedObservation(
+      std::unique_ptr<EncryptedMessage> message,
+      std::unique_ptr<ObservationMetadata> metadata) override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    last_adding_thread_ = std::this_thread::get_id();
+    if (metadata_.size() >= capacity_) {
+      return kStoreFull;
+    }
+    messages_.push_back(std::move(message));
+    metadata_.push_back(std::move(metadata));
+    return kOk;
+  }
+
+  MetadataHandle RegisterMetadata(
+      const ObservationMetadata& metadata) override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    num_registrations_++;
+    return metadata_registry_.Register(metadata);
+  }
+
+  StoreStatus AddEncryptedObservationByHandle(
+      std::unique_ptr<EncryptedMessage> message,
+      MetadataHandle metadata) override {
+    auto entry = metadata_registry_.Get(metadata);
+    if (entry == nullptr) {
+      return kWriteFailed;
+    }
+    return AddEncryptedObservation(
+        std::move(message),
+        std::make_unique<ObservationMetadata>(entry->metadata));
+  }
+
+  void set_capacity(size_t capacity) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    capacity_ = capacity;
+  }
+
+  std::vector<std::unique_ptr<ObservationMetadata>> TakeMetadata() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return std::move(metadata_);
+  }
+
+  std::vector<std::unique_ptr<EncryptedMessage>> TakeMessages() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return std::move(messages_);
+  }
+
+  // Returns the thread that most recently added an Observation.
+  std::thread::id last_adding_thread() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return last_adding_thread_;
+  }
+
+  // Returns the number of calls to RegisterMetadata().
+  size_t num_registrations() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return num_registrations_;
+  }
+
+ private:
+  std::mutex mutex_;
+  size_t capacity_ = SIZE_MAX;
+  std::thread::id last_adding_thread_;
+  size_t num_registrations_ = 0;
+  MetadataRegistry metadata_registry_;
+  std::vector<std::unique_ptr<EncryptedMessage>> messages_;
+  std::vector<std::unique_ptr<ObservationMetadata>> metadata_;
+};
+
+class CountingUpdateRecipient : public ObservationStoreUpdateRecipient {
+ public:
+  void NotifyObservationsAdded() override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    num_notifications_++;
+  }
+
+  size_t num_notifications() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return num_notifications_;
+  }
+
+ private:
+  std::mutex mutex_;
+  size_t num_notifications_ = 0;
+};
+
+// The random_id of the Observation made by MakeObservation().
+std::string RandomId(uint32_t metric_id, uint32_t day_index) {
+  return std::to_string(metric_id) + ":" + std::to_string(day_index);
+}
+
+// Returns an Observation together with the handle, registered with |writer|,
+// of metadata with the given |metric_id| and |day_index|.
+ObservationWriter::ObservationAndMetadata MakeObservation(
+    const ObservationWriter& writer, uint32_t metric_id, uint32_t day_index) {
+  ObservationWriter::ObservationAndMetadata observation;
+  observation.observation = std::make_unique<Observation2>();
+  observation.observation->set_random_id(RandomId(metric_id, day_index));
+  ObservationMetadata metadata;
+  metadata.set_metric_id(metric_id);
+  metadata.set_day_index(day_index);
+  observation.metadata = writer.RegisterMetadata(metadata);
+  return observation;
+}
+
+}  // namespace
+
+class ObservationWriterTest : public ::testing::Test {
+ protected:
+  ObservationWriterTest() : encrypter_("", EncryptedMessage::NONE) {}
+
+  FakeObservationStore store_;
+  CountingUpdateRecipient update_recipient_;
+  EncryptedMessageMaker encrypter_;
+};
+
+// Tests that without an encryption pool the Observations are written before
+// the Write*() methods return.
+TEST_F(ObservationWriterTest, Synchronous) {
+  ObservationWriter writer(&store_, &update_recipient_, &encrypter_);
+  auto observation = MakeObservation(writer, 1, 10);
+  EXPECT_EQ(kOK, writer.WriteObservation(*observation.observation,
+                                         observation.metadata));
+  std::vector<ObservationWriter::ObservationAndMetadata> observations;
+  observations.push_back(MakeObservation(writer, 1, 11));
+  observations.push_back(MakeObservation(writer, 1, 12));
+  EXPECT_EQ(kOK, writer.WriteObservations(std::move(observations)));
+
+  EXPECT_EQ(2u, update_recipient_.num_notifications());
+  auto metadata = store_.TakeMetadata();
+  ASSERT_EQ(3u, metadata.size());
+  for (uint32_t i = 0; i < 3; i++) {
+    EXPECT_EQ(10 + i, metadata[i]->day_index());
+  }
+}
+
+// Tests that the metadata of each (metric, day, system profile) is registered
+// with the store once, and that Observations written with its handle are
+// stored with it.
+TEST_F(ObservationWriterTest, RegisterMetadata) {
+  ObservationWriter writer(&store_, &update_recipient_, &encrypter_);
+  ObservationMetadata metadata;
+  metadata.set_metric_id(1);
+  metadata.set_day_index(10);
+  metadata.mutable_system_profile()->set_board_name("board");
+  auto handle = writer.RegisterMetadata(metadata);
+  EXPECT_EQ(handle, writer.RegisterMetadata(metadata));
+  EXPECT_EQ(1u, store_.num_registrations());
+
+  ObservationMetadata other_metadata = metadata;
+  other_metadata.mutable_system_profile()->set_board_name("other board");
+  auto other_handle = writer.RegisterMetadata(other_metadata);
+  EXPECT_NE(handle, other_handle);
+  other_metadata = metadata;
+  other_metadata.set_day_index(11);
+  EXPECT_NE(handle, writer.RegisterMetadata(other_metadata));
+  EXPECT_EQ(3u, store_.num_registrations());
+
+  Observation2 observation;
+  EXPECT_EQ(kOK, writer.WriteObservation(observation, other_handle));
+  auto stored_metadata = store_.TakeMetadata();
+  ASSERT_EQ(1u, stored_metadata.size());
+  EXPECT_EQ("other board", stored_metadata[0]->system_profile().board_name());
+}
+
+// Tests that with an encryption pool all of the batches are written by the
+// time Flush() returns, in the order in which they were handed over.
+TEST_F(ObservationWriterTest, EncryptionPool) {
+  ObservationWriter writer(&store_, &update_recipient_, &encrypter_,
+                           /*num_encryption_threads=*/4);
+  for (uint32_t i = 0; i < 100; i += 10) {
+    std::vector<ObservationWriter::ObservationAndMetadata> observations;
+    for (uint32_t j = i; j < i + 10; j++) {
+      observations.push_back(MakeObservation(writer, 1, j));
+    }
+    EXPECT_EQ(kOK, writer.WriteObservations(std::move(observations)));
+  }
+  writer.Flush();
+  auto metadata = store_.TakeMetadata();
+  ASSERT_EQ(100u, metadata.size());
+  for (uint32_t i = 0; i < 100; i++) {
+    EXPECT_EQ(i, metadata[i]->day_index());
+  }
+  EXPECT_GT(update_recipient_.num_notifications(), 0u);
+}
+
+// Tests that with an encryption pool a single Observation is still encrypted
+// and written on the calling thread.
+TEST_F(ObservationWriterTest, EncryptionPoolWritesSingleObservationInline) {
+  ObservationWriter writer(&store_, &update_recipient_, &encrypter_,
+                           /*num_encryption_threads=*/4);
+  auto observation = MakeObservation(writer, 1, 10);
+  EXPECT_EQ(kOK, writer.WriteObservation(*observation.observation,
+                                         observation.metadata));
+  EXPECT_EQ(std::this_thread::get_id(), store_.last_adding_thread());
+  EXPECT_EQ(1u, store_.TakeMetadata().size());
+  EXPECT_EQ(1u, update_recipient_.num_notifications());
+}
+
+// Tests that when several threads write through an encryption pool whose
+// in-flight bound is smaller than a single Observation, every Observation is
+// written and the Observations of each metric are written in order.
+TEST_F(ObservationWriterTest, ConcurrentWritersPreserveOrderPerMetric) {
+  const uint32_t kNumWriters = 4;
+  const uint32_t kNumObservationsPerWriter = 500;
+  {
+    ObservationWriter writer(&store_, &update_recipient_, &encrypter_,
+                             /*num_encryption_threads=*/3,
+                             /*max_in_flight_bytes=*/1);
+    std::vector<std::thread> writers;
+    for (uint32_t w = 0; w < kNumWriters; w++) {
+      writers.emplace_back([&writer, w] {
+        for (uint32_t i = 0; i < kNumObservationsPerWriter; i += 2) {
+          std::vector<ObservationWriter::ObservationAndMetadata> observations;
+          observations.push_back(MakeObservation(writer, w, i));
+          observations.push_back(MakeObservation(writer, w, i + 1));
+          EXPECT_EQ(kOK, writer.WriteObservations(std::move(observations)));
+        }
+      });
+    }
+    for (auto& thread : writers) {
+      thread.join();
+    }
+    // The destructor writes whatever is still in the pool.
+  }
+
+  auto metadata = store_.TakeMetadata();
+  ASSERT_EQ(kNumWriters * kNumObservationsPerWriter, metadata.size());
+  std::vector<uint32_t> next_day_index(kNumWriters, 0);
+  for (const auto& m : metadata) {
+    ASSERT_LT(m->metric_id(), kNumWriters);
+    EXPECT_EQ(next_day_index[m->metric_id()], m->day_index());
+    next_day_index[m->metric_id()] = m->day_index() + 1;
+  }
+}
+
+// Tests that the status of the Observation Store is returned to the caller
+// with and without an encryption pool, so that the caller sees when the store
+// is full.
+TEST_F(ObservationWriterTest, StoreFull) {
+  store_.set_capacity(3);
+  for (size_t num_encryption_threads : {0, 4}) {
+    SCOPED_TRACE(num_encryption_threads);
+    store_.TakeMetadata();
+    ObservationWriter writer(&store_, &update_recipient_, &encrypter_,
+                             num_encryption_threads);
+    auto observation = MakeObservation(writer, 1, 10);
+    EXPECT_EQ(kOK, writer.WriteObservation(*observation.observation,
+                                           observation.metadata));
+    std::vector<ObservationWriter::ObservationAndMetadata> observations;
+    for (uint32_t i = 0; i < 3; i++) {
+      observations.push_back(MakeObservation(writer, 1, 11 + i));
+    }
+    EXPECT_EQ(kFull, writer.WriteObservations(std::move(observations)));
+    observation = MakeObservation(writer, 1, 14);
+    EXPECT_EQ(kFull, writer.WriteObservation(*observation.observation,
+                                             observation.metadata));
+    EXPECT_EQ(3u, store_.TakeMetadata().size());
+  }
+}
+
+// Tests that when several threads write through an encryption pool with
+// HYBRID_ECDH_V1 encryption, every Observation can be decrypted with the
+// Analyzer's private key and matches its own metadata.
+TEST_F(ObservationWriterTest, EncryptionPoolHybridEncryption) {
+  const uint32_t kNumWriters = 8;
+  const uint32_t kNumObservationsPerWriter = 50;
+  std::string public_key_pem;
+  std::string private_key_pem;
+  ASSERT_TRUE(crypto::HybridCipher::GenerateKeyPairPEM(&public_key_pem,
+                                                       &private_key_pem));
+  EncryptedMessageMaker hybrid_encrypter(public_key_pem,
+                                         EncryptedMessage::HYBRID_ECDH_V1);
+  {
+    ObservationWriter writer(&store_, &update_recipient_, &hybrid_encrypter,
+                             /*num_encryption_threads=*/8);
+    std::vector<std::thread> writers;
+    for (uint32_t w = 0; w < kNumWriters; w++) {
+      writers.emplace_back([&writer, w] {
+        for (uint32_t i = 0; i < kNumObservationsPerWriter; i += 5) {
+          std::vector<ObservationWriter::ObservationAndMetadata> observations;
+          for (uint32_t j = i; j < i + 5; j++) {
+            observations.push_back(MakeObservation(writer, w, j));
+          }
+          EXPECT_EQ(kOK, writer.WriteObservations(std::move(observations)));
+        }
+      });
+    }
+    for (auto& thread : writers) {
+      thread.join();
+    }
+  }
+
+  auto messages = store_.TakeMessages();
+  auto metadata = store_.TakeMetadata();
+  ASSERT_EQ(kNumWriters * kNumObservationsPerWriter, messages.size());
+  ASSERT_EQ(messages.size(), metadata.size());
+  MessageDecrypter decrypter(private_key_pem);
+  for (size_t i = 0; i < messages.size(); i++) {
+    EXPECT_EQ(EncryptedMessage::HYBRID_ECDH_V1, messages[i]->scheme());
+    Observation2 observation;
+    ASSERT_TRUE(decrypter.DecryptMessage(*messages[i], &observation)) << i;
+    EXPECT_EQ(RandomId(metadata[i]->metric_id(), metadata[i]->day_index()),
+              observation.random_id());
+  }
+}
+
+}  // namespace logger
+}  // namespace cobalt
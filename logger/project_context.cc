@@ -7,10 +7,13 @@
 #include <sstream>
 
 #include "./logging.h"
+#include "algorithms/rappor/rappor_config_helper.h"
 
 namespace cobalt {
 namespace logger {
 
+using ::cobalt::rappor::RapporConfigHelper;
+
 std::string MetricDebugString(const MetricDefinition& metric) {
   std::ostringstream stream;
   stream << metric.metric_name() << " (" << metric.id() << ")";
@@ -44,8 +47,87 @@ std::string MetricRef::FullyQualifiedName() const {
   return stream.str();
 }
 
+BasicRapporConfig MakeBasicRapporConfig(const MetricRef& metric,
+                                        const ReportDefinition& report,
+                                        uint32_t num_categories) {
+  BasicRapporConfig basic_rappor_config;
+  basic_rappor_config.set_prob_rr(RapporConfigHelper::kProbRR);
+  basic_rappor_config.mutable_indexed_categories()->set_num_categories(
+      num_categories);
+  float prob_bit_flip =
+      RapporConfigHelper::ProbBitFlip(report, metric.FullyQualifiedName());
+  basic_rappor_config.set_prob_0_becomes_1(prob_bit_flip);
+  basic_rappor_config.set_prob_1_stays_1(1.0 - prob_bit_flip);
+  return basic_rappor_config;
+}
+
+RapporConfig MakeStringRapporConfig(const MetricRef& metric,
+                                    const ReportDefinition& report) {
+  RapporConfig rappor_config;
+  rappor_config.set_num_hashes(RapporConfigHelper::kNumHashes);
+  rappor_config.set_num_cohorts(
+      RapporConfigHelper::StringRapporNumCohorts(report));
+  rappor_config.set_num_bloom_bits(
+      RapporConfigHelper::StringRapporNumBloomBits(report));
+  rappor_config.set_prob_rr(RapporConfigHelper::kProbRR);
+  float prob_bit_flip =
+      RapporConfigHelper::ProbBitFlip(report, metric.FullyQualifiedName());
+  rappor_config.set_prob_0_becomes_1(prob_bit_flip);
+  rappor_config.set_prob_1_stays_1(1.0 - prob_bit_flip);
+  return rappor_config;
+}
+
 namespace {
 
+// Returns the number of valid bucket indices for the |int_buckets| field of
+// |metric|, including the underflow and overflow buckets, or zero if that
+// field is missing or invalid.
+uint32_t NumIntBuckets(const MetricDefinition& metric) {
+  if (!metric.has_int_buckets()) {
+    return 0;
+  }
+  const auto& int_buckets = metric.int_buckets();
+  switch (int_buckets.buckets_case()) {
+    case IntegerBuckets::kExponential:
+      return int_buckets.exponential().num_buckets() + 2;
+    case IntegerBuckets::kLinear:
+      return int_buckets.linear().num_buckets() + 2;
+    case IntegerBuckets::BUCKETS_NOT_SET:
+      return 0;
+  }
+  return 0;
+}
+
+MetricPlan MakeMetricPlan(const MetricRef& metric_ref,
+                          const MetricDefinition& metric) {
+  MetricPlan plan;
+  plan.metric = &metric;
+  if (metric.metric_type() == MetricDefinition::INT_HISTOGRAM) {
+    plan.num_int_buckets = NumIntBuckets(metric);
+  }
+  plan.reports.reserve(metric.reports_size());
+  for (const auto& report : metric.reports()) {
+    ReportPlan report_plan;
+    report_plan.report = &report;
+    switch (report.report_type()) {
+      case ReportDefinition::SIMPLE_OCCURRENCE_COUNT:
+      case ReportDefinition::UNIQUE_N_DAY_ACTIVES:
+        report_plan.basic_rappor_config = MakeBasicRapporConfig(
+            metric_ref, report,
+            RapporConfigHelper::BasicRapporNumCategories(metric));
+        break;
+      case ReportDefinition::HIGH_FREQUENCY_STRING_COUNTS:
+        report_plan.string_rappor_config =
+            MakeStringRapporConfig(metric_ref, report);
+        break;
+      default:
+        break;
+    }
+    plan.reports.push_back(std::move(report_plan));
+  }
+  return plan;
+}
+
 void PopulateProject(uint32_t customer_id, uint32_t project_id,
                      const std::string& customer_name,
                      const std::string& project_name,
@@ -68,11 +150,12 @@ ProjectContext::ProjectContext(
   CHECK(metric_definitions_);
   PopulateProject(customer_id, project_id, customer_name, project_name,
                   release_stage, &project_);
+  metric_plans_.reserve(metric_definitions_->metric_size());
   for (const auto& metric : metric_definitions_->metric()) {
     if (metric.customer_id() == project_.customer_id() &&
         metric.project_id() == project_.project_id()) {
       metrics_by_name_[metric.metric_name()] = &metric;
-      metrics_by_id_[metric.id()] = &metric;
+      metric_plans_.push_back(MakeMetricPlan(RefMetric(&metric), metric));
     } else {
       LOG(ERROR) << "ProjectContext constructor found a MetricDefinition "
                     "for the wrong project. Expected customer "
@@ -83,12 +166,32 @@ ProjectContext::ProjectContext(
                  << " project_id=" << metric.project_id();
     }
   }
+  for (const auto& plan : metric_plans_) {
+    uint32_t metric_id = plan.metric->id();
+    if (metric_id < kMaxDenseMetricId) {
+      if (metric_id >= dense_metric_plans_.size()) {
+        dense_metric_plans_.resize(metric_id + 1, nullptr);
+      }
+      dense_metric_plans_[metric_id] = &plan;
+    } else {
+      sparse_metric_plans_[metric_id] = &plan;
+    }
+  }
 }
 
 const MetricDefinition* ProjectContext::GetMetric(
     const uint32_t metric_id) const {
-  auto iter = metrics_by_id_.find(metric_id);
-  if (iter == metrics_by_id_.end()) {
+  const MetricPlan* plan = GetMetricPlan(metric_id);
+  return plan ? plan->metric : nullptr;
+}
+
+const MetricPlan* ProjectContext::GetMetricPlan(
+    const uint32_t metric_id) const {
+  if (metric_id < dense_metric_plans_.size()) {
+    return dense_metric_plans_[metric_id];
+  }
+  auto iter = sparse_metric_plans_.find(metric_id);
+  if (iter == sparse_metric_plans_.end()) {
     return nullptr;
   }
   return iter->second;
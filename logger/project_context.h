@@ -9,9 +9,12 @@
 #include <memory>
 #include <string>
 #include <utility>
+#include <vector>
 
+#include "config/encodings.pb.h"
 #include "config/metric_definition.pb.h"
 #include "config/project.pb.h"
+#include "config/report_definition.pb.h"
 #include "logger/status.h"
 
 namespace cobalt {
@@ -46,6 +49,43 @@ class MetricRef {
   const MetricDefinition* metric_definition_;
 };
 
+// Builds the BasicRapporConfig used for encoding Observations for |report|
+// using Basic RAPPOR with |num_categories| indexed categories.
+BasicRapporConfig MakeBasicRapporConfig(const MetricRef& metric,
+                                        const ReportDefinition& report,
+                                        uint32_t num_categories);
+
+// Builds the RapporConfig used for encoding Observations for |report| using
+// String RAPPOR.
+RapporConfig MakeStringRapporConfig(const MetricRef& metric,
+                                    const ReportDefinition& report);
+
+// A ReportPlan holds the data needed for encoding Observations for a single
+// Report. It is computed from the Cobalt config once, when the ProjectContext
+// is constructed, rather than every time an Event is logged.
+struct ReportPlan {
+  const ReportDefinition* report = nullptr;
+
+  // Set for Reports of type SIMPLE_OCCURRENCE_COUNT and UNIQUE_N_DAY_ACTIVES.
+  BasicRapporConfig basic_rappor_config;
+
+  // Set for Reports of type HIGH_FREQUENCY_STRING_COUNTS.
+  RapporConfig string_rappor_config;
+};
+
+// A MetricPlan holds a ReportPlan for each of the Reports of a single Metric,
+// in the same order as the Reports in the MetricDefinition, together with the
+// other data that the Logger needs for logging Events for the Metric.
+struct MetricPlan {
+  const MetricDefinition* metric = nullptr;
+  std::vector<ReportPlan> reports;
+
+  // For a Metric of type INT_HISTOGRAM with a valid |int_buckets| field, the
+  // number of valid bucket indices, including the underflow and overflow
+  // buckets. Otherwise zero.
+  uint32_t num_int_buckets = 0;
+};
+
 // ProjectContext stores the Cobalt configuration for a single Cobalt project.
 class ProjectContext {
  public:
@@ -56,6 +96,12 @@ class ProjectContext {
 
   const MetricDefinition* GetMetric(const std::string& metric_name) const;
   const MetricDefinition* GetMetric(const uint32_t metric_id) const;
+
+  // Returns the MetricPlan for the Metric with the given ID, or nullptr if
+  // there is no such Metric. Metric IDs are usually small, so for most Metrics
+  // this is a single array lookup.
+  const MetricPlan* GetMetricPlan(const uint32_t metric_id) const;
+
   // Makes a MetricRef that wraps this ProjectContext's Project and the given
   // metric_definition (which should have been obtained via GetMetric()).
   // The Project and MetricDefinition must remain valid as long as the returned
@@ -64,13 +110,26 @@ class ProjectContext {
 
   const Project& project() const { return project_; }
 
+  // Returns all of the MetricDefinitions of this project.
+  const MetricDefinitions& metrics() const { return *metric_definitions_; }
+
   const std::string DebugString() const;
 
  private:
   Project project_;
   const std::unique_ptr<MetricDefinitions> metric_definitions_;
   std::map<const std::string, const MetricDefinition*> metrics_by_name_;
-  std::map<const uint32_t, const MetricDefinition*> metrics_by_id_;
+
+  // One MetricPlan for each MetricDefinition of this project. This is not
+  // modified after construction so pointers into it remain valid.
+  std::vector<MetricPlan> metric_plans_;
+
+  // |dense_metric_plans_| is indexed by metric ID and holds the MetricPlans
+  // for the Metrics whose IDs are less than kMaxDenseMetricId. The MetricPlans
+  // for any other Metrics are in |sparse_metric_plans_|.
+  static const uint32_t kMaxDenseMetricId = 1024;
+  std::vector<const MetricPlan*> dense_metric_plans_;
+  std::map<const uint32_t, const MetricPlan*> sparse_metric_plans_;
 };
 
 }  // namespace logger
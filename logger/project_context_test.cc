@@ -0,0 +1,190 @@
+// Copyright 2018 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "logger/project_context.h"
+
+#include <google/protobuf/text_format.h>
+
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "./gtest.h"
+#include "algorithms/rappor/rappor_config_helper.h"
+
+namespace cobalt {
+
+using rappor::RapporConfigHelper;
+
+namespace logger {
+
+namespace {
+static const uint32_t kCustomerId = 1;
+static const uint32_t kProjectId = 1;
+static const char kCustomerName[] = "Fuchsia";
+static const char kProjectName[] = "Cobalt";
+
+// The last Metric has an ID that is too large to be stored in the dense
+// index of MetricPlans. The Metric with the wrong project ID is ignored.
+static const char kMetricDefinitions[] = R"(
+metric {
+  metric_name: "ErrorOccurred"
+  metric_type: EVENT_OCCURRED
+  customer_id: 1
+  project_id: 1
+  id: 1
+  max_event_code: 100
+  reports: {
+    report_name: "ErrorCountsByType"
+    id: 11
+    report_type: SIMPLE_OCCURRENCE_COUNT
+    local_privacy_noise_level: SMALL
+  }
+  reports: {
+    report_name: "ErrorUniqueDevices"
+    id: 12
+    report_type: UNIQUE_N_DAY_ACTIVES
+    local_privacy_noise_level: LARGE
+    window_size: WINDOW_1_DAY
+  }
+}
+
+metric {
+  metric_name: "FileSystemWriteTimes"
+  metric_type: INT_HISTOGRAM
+  int_buckets: {
+    linear: {
+      floor: 0
+      num_buckets: 10
+      step_size: 1
+    }
+  }
+  customer_id: 1
+  project_id: 1
+  id: 3
+  reports: {
+    report_name: "FileSystemWriteTimes_Histogram"
+    id: 31
+    report_type: INT_RANGE_HISTOGRAM
+  }
+}
+
+metric {
+  metric_name: "ModuleDownloads"
+  metric_type: STRING_USED
+  customer_id: 1
+  project_id: 1
+  id: 4
+  reports: {
+    report_name: "ModuleDownloads_HeavyHitters"
+    id: 41
+    report_type: HIGH_FREQUENCY_STRING_COUNTS
+    local_privacy_noise_level: MEDIUM
+    expected_population_size: 500
+    expected_string_set_size: 200
+  }
+}
+
+metric {
+  metric_name: "OtherProjectMetric"
+  metric_type: EVENT_OCCURRED
+  customer_id: 1
+  project_id: 2
+  id: 5
+}
+
+metric {
+  metric_name: "LargeIdMetric"
+  metric_type: EVENT_OCCURRED
+  customer_id: 1
+  project_id: 1
+  id: 1000000
+  max_event_code: 5
+}
+)";
+
+std::unique_ptr<ProjectContext> MakeProjectContext() {
+  auto metric_definitions = std::make_unique<MetricDefinitions>();
+  google::protobuf::TextFormat::Parser parser;
+  EXPECT_TRUE(
+      parser.ParseFromString(kMetricDefinitions, metric_definitions.get()));
+  return std::make_unique<ProjectContext>(kCustomerId, kProjectId,
+                                          kCustomerName, kProjectName,
+                                          std::move(metric_definitions));
+}
+
+}  // namespace
+
+// Tests that GetMetricPlan() and GetMetric() find Metrics by ID, both in the
+// dense index and in the sparse index.
+TEST(ProjectContextTest, GetMetricPlan) {
+  auto project_context = MakeProjectContext();
+  for (uint32_t metric_id : {1u, 3u, 4u, 1000000u}) {
+    const auto* plan = project_context->GetMetricPlan(metric_id);
+    ASSERT_NE(nullptr, plan);
+    EXPECT_EQ(metric_id, plan->metric->id());
+    EXPECT_EQ(plan->metric, project_context->GetMetric(metric_id));
+    ASSERT_EQ(static_cast<size_t>(plan->metric->reports_size()),
+              plan->reports.size());
+    for (size_t i = 0; i < plan->reports.size(); i++) {
+      EXPECT_EQ(&plan->metric->reports(i), plan->reports[i].report);
+    }
+  }
+  for (uint32_t metric_id : {0u, 2u, 5u, 1023u, 1024u, 999999u}) {
+    EXPECT_EQ(nullptr, project_context->GetMetricPlan(metric_id));
+    EXPECT_EQ(nullptr, project_context->GetMetric(metric_id));
+  }
+}
+
+// Tests that the Basic RAPPOR configs in the MetricPlan are the same as the
+// ones that the Encoder computes for each Observation.
+TEST(ProjectContextTest, BasicRapporConfigs) {
+  auto project_context = MakeProjectContext();
+  const auto* plan = project_context->GetMetricPlan(1);
+  ASSERT_NE(nullptr, plan);
+  ASSERT_EQ(2u, plan->reports.size());
+  auto metric_ref = project_context->RefMetric(plan->metric);
+  for (const auto& report_plan : plan->reports) {
+    auto expected_config = MakeBasicRapporConfig(
+        metric_ref, *report_plan.report,
+        RapporConfigHelper::BasicRapporNumCategories(*plan->metric));
+    EXPECT_EQ(expected_config.SerializeAsString(),
+              report_plan.basic_rappor_config.SerializeAsString());
+  }
+  EXPECT_EQ(101u, plan->reports[0]
+                      .basic_rappor_config.indexed_categories()
+                      .num_categories());
+  EXPECT_FLOAT_EQ(0.01,
+                  plan->reports[0].basic_rappor_config.prob_0_becomes_1());
+  EXPECT_FLOAT_EQ(0.25,
+                  plan->reports[1].basic_rappor_config.prob_0_becomes_1());
+}
+
+// Tests that the String RAPPOR config in the MetricPlan is the same as the one
+// that the Encoder computes for each Observation.
+TEST(ProjectContextTest, StringRapporConfig) {
+  auto project_context = MakeProjectContext();
+  const auto* plan = project_context->GetMetricPlan(4);
+  ASSERT_NE(nullptr, plan);
+  ASSERT_EQ(1u, plan->reports.size());
+  const auto& report_plan = plan->reports[0];
+  auto expected_config = MakeStringRapporConfig(
+      project_context->RefMetric(plan->metric), *report_plan.report);
+  EXPECT_EQ(expected_config.SerializeAsString(),
+            report_plan.string_rappor_config.SerializeAsString());
+  EXPECT_EQ(static_cast<uint32_t>(RapporConfigHelper::kNumHashes),
+            report_plan.string_rappor_config.num_hashes());
+  EXPECT_FLOAT_EQ(0.1, report_plan.string_rappor_config.prob_0_becomes_1());
+}
+
+// Tests that the number of valid histogram buckets, including the underflow
+// and overflow buckets, is computed for INT_HISTOGRAM Metrics only.
+TEST(ProjectContextTest, NumIntBuckets) {
+  auto project_context = MakeProjectContext();
+  EXPECT_EQ(12u, project_context->GetMetricPlan(3)->num_int_buckets);
+  EXPECT_EQ(0u, project_context->GetMetricPlan(1)->num_int_buckets);
+}
+
+}  // namespace logger
+}  // namespace cobalt
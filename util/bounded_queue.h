@@ -0,0 +1,158 @@
+// Copyright 2018 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef COBALT_UTIL_BOUNDED_QUEUE_H_
+#define COBALT_UTIL_BOUNDED_QUEUE_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+namespace cobalt {
+namespace util {
+
+// BoundedQueue is a fixed-capacity FIFO queue that may be used concurrently by
+// any number of producer threads and any number of consumer threads without
+// locking. Neither TryPush() nor TryPop() ever blocks: if the queue is full or
+// empty, respectively, they return false immediately.
+//
+// This is the bounded queue of Dmitry Vyukov. Each slot of the ring buffer
+// carries a sequence number that tells producers and consumers whether the
+// slot is ready for them, so a thread only contends with the other threads
+// that are using the same end of the queue.
+//
+// T must be default constructible and move assignable. The slots of the queue
+// are default constructed up front and values are moved in and out of them,
+// so a T that owns storage (such as a protocol buffer) may leave some of that
+// storage behind in the slot when it is popped.
+//
+// Example usage:
+//
+// BoundedQueue<int> queue(128);
+// queue.TryPush(42);
+// int value;
+// if (queue.TryPop(&value)) {
+//   LOG(INFO) << "Popped " << value;
+// }
+template <class T>
+class BoundedQueue {
+ public:
+  // Constructs an empty queue that can hold at least |capacity| values.
+  // |capacity| is rounded up to a power of 2.
+  explicit BoundedQueue(size_t capacity)
+      : capacity_(RoundUpToPowerOfTwo(capacity)),
+        cells_(new Cell[capacity_]) {
+    for (size_t i = 0; i < capacity_; i++) {
+      cells_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    enqueue_pos_.store(0, std::memory_order_relaxed);
+    dequeue_pos_.store(0, std::memory_order_relaxed);
+  }
+
+  // Moves |value| into the queue and returns true, or returns false if the
+  // queue is full. In the latter case |value| is not modified.
+  bool TryPush(T&& value) {
+    Cell* cell;
+    size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+    while (true) {
+      cell = &cells_[pos & (capacity_ - 1)];
+      size_t sequence = cell->sequence.load(std::memory_order_acquire);
+      intptr_t diff =
+          static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+      if (diff == 0) {
+        // The cell is free. Try to claim it.
+        if (enqueue_pos_.compare_exchange_weak(pos, pos + 1,
+                                               std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        // The cell still holds the value pushed one lap ago.
+        return false;
+      } else {
+        // Another producer claimed the cell first.
+        pos = enqueue_pos_.load(std::memory_order_relaxed);
+      }
+    }
+    cell->data = std::move(value);
+    cell->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Moves the value at the front of the queue into |*value| and returns true,
+  // or returns false if the queue is empty.
+  bool TryPop(T* value) {
+    Cell* cell;
+    size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+    while (true) {
+      cell = &cells_[pos & (capacity_ - 1)];
+      size_t sequence = cell->sequence.load(std::memory_order_acquire);
+      intptr_t diff =
+          static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos + 1);
+      if (diff == 0) {
+        // The cell holds a value. Try to claim it.
+        if (dequeue_pos_.compare_exchange_weak(pos, pos + 1,
+                                               std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        // The cell has not been pushed to yet.
+        return false;
+      } else {
+        // Another consumer claimed the cell first.
+        pos = dequeue_pos_.load(std::memory_order_relaxed);
+      }
+    }
+    *value = std::move(cell->data);
+    cell->sequence.store(pos + capacity_, std::memory_order_release);
+    return true;
+  }
+
+  // Returns the number of values in the queue. If the queue is being used
+  // concurrently then this is only an estimate.
+  size_t size() const {
+    size_t enqueue_pos = enqueue_pos_.load(std::memory_order_relaxed);
+    size_t dequeue_pos = dequeue_pos_.load(std::memory_order_relaxed);
+    return enqueue_pos > dequeue_pos ? enqueue_pos - dequeue_pos : 0;
+  }
+
+  // Returns the maximum number of values that the queue can hold.
+  size_t capacity() const { return capacity_; }
+
+ private:
+  static const size_t kCacheLineSize = 64;
+
+  struct Cell {
+    std::atomic<size_t> sequence;
+    T data;
+  };
+
+  static size_t RoundUpToPowerOfTwo(size_t n) {
+    size_t power = 1;
+    while (power < n) {
+      power <<= 1;
+    }
+    return power;
+  }
+
+  const size_t capacity_;
+  const std::unique_ptr<Cell[]> cells_;
+
+  // The producers' and the consumers' positions are kept on separate cache
+  // lines so that producers and consumers do not contend with each other.
+  char pad0_[kCacheLineSize];
+  std::atomic<size_t> enqueue_pos_;
+  char pad1_[kCacheLineSize - sizeof(std::atomic<size_t>)];
+  std::atomic<size_t> dequeue_pos_;
+  char pad2_[kCacheLineSize - sizeof(std::atomic<size_t>)];
+
+  BoundedQueue(const BoundedQueue&) = delete;
+  BoundedQueue& operator=(const BoundedQueue&) = delete;
+};
+
+}  // namespace util
+}  // namespace cobalt
+
+#endif  // COBALT_UTIL_BOUNDED_QUEUE_H_
@@ -0,0 +1,121 @@
+// Copyright 2018 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "util/bounded_queue.h"
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "./gtest.h"
+
+namespace cobalt {
+namespace util {
+
+// Tests that the capacity is rounded up to a power of 2.
+TEST(BoundedQueueTest, Capacity) {
+  EXPECT_EQ(1u, BoundedQueue<int>(0).capacity());
+  EXPECT_EQ(1u, BoundedQueue<int>(1).capacity());
+  EXPECT_EQ(8u, BoundedQueue<int>(5).capacity());
+  EXPECT_EQ(64u, BoundedQueue<int>(64).capacity());
+}
+
+// Tests pushing and popping on a single thread, including wrapping around
+// the ring buffer several times.
+TEST(BoundedQueueTest, PushAndPop) {
+  BoundedQueue<std::string> queue(4);
+  std::string value;
+  EXPECT_FALSE(queue.TryPop(&value));
+  for (int lap = 0; lap < 3; lap++) {
+    for (int i = 0; i < 4; i++) {
+      EXPECT_TRUE(queue.TryPush(std::to_string(lap * 4 + i)));
+    }
+    EXPECT_EQ(4u, queue.size());
+    std::string rejected = "rejected";
+    EXPECT_FALSE(queue.TryPush(std::move(rejected)));
+    EXPECT_EQ("rejected", rejected);
+    for (int i = 0; i < 4; i++) {
+      ASSERT_TRUE(queue.TryPop(&value));
+      EXPECT_EQ(std::to_string(lap * 4 + i), value);
+    }
+    EXPECT_EQ(0u, queue.size());
+    EXPECT_FALSE(queue.TryPop(&value));
+  }
+}
+
+// Tests that a move-only type can be used.
+TEST(BoundedQueueTest, MoveOnly) {
+  BoundedQueue<std::unique_ptr<int>> queue(2);
+  EXPECT_TRUE(queue.TryPush(std::make_unique<int>(7)));
+  std::unique_ptr<int> value;
+  ASSERT_TRUE(queue.TryPop(&value));
+  ASSERT_NE(nullptr, value);
+  EXPECT_EQ(7, *value);
+}
+
+// Tests that when several producers and several consumers use the queue
+// concurrently every value is popped exactly once, and the values pushed by
+// any one producer are popped in the order in which they were pushed.
+TEST(BoundedQueueTest, ConcurrentProducersAndConsumers) {
+  const int kNumProducers = 4;
+  const int kNumConsumers = 4;
+  const int kNumValuesPerProducer = 20000;
+  BoundedQueue<int> queue(64);
+
+  std::vector<std::thread> producers;
+  for (int p = 0; p < kNumProducers; p++) {
+    producers.emplace_back([&queue, p]() {
+      for (int i = 0; i < kNumValuesPerProducer; i++) {
+        while (!queue.TryPush(p * kNumValuesPerProducer + i)) {
+          std::this_thread::yield();
+        }
+      }
+    });
+  }
+
+  // Each consumer records the values it popped, in order.
+  std::vector<std::vector<int>> popped(kNumConsumers);
+  std::atomic<int> num_popped(0);
+  std::vector<std::thread> consumers;
+  for (int c = 0; c < kNumConsumers; c++) {
+    consumers.emplace_back([&queue, &popped, &num_popped, c]() {
+      int value;
+      while (num_popped.load() < kNumProducers * kNumValuesPerProducer) {
+        if (queue.TryPop(&value)) {
+          popped[c].push_back(value);
+          num_popped++;
+        } else {
+          std::this_thread::yield();
+        }
+      }
+    });
+  }
+
+  for (auto& producer : producers) {
+    producer.join();
+  }
+  for (auto& consumer : consumers) {
+    consumer.join();
+  }
+
+  std::vector<int> count(kNumProducers * kNumValuesPerProducer, 0);
+  for (const auto& values : popped) {
+    std::vector<int> last_seen(kNumProducers, -1);
+    for (int value : values) {
+      count[value]++;
+      int producer = value / kNumValuesPerProducer;
+      EXPECT_LT(last_seen[producer], value);
+      last_seen[producer] = value;
+    }
+  }
+  for (int c : count) {
+    EXPECT_EQ(1, c);
+  }
+  EXPECT_EQ(0u, queue.size());
+}
+
+}  // namespace util
+}  // namespace cobalt
@@ -0,0 +1,149 @@
+// Copyright 2018 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "util/buffered_file_writer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <string>
+
+#include "./logging.h"
+
+namespace cobalt {
+namespace util {
+
+constexpr size_t BufferedFileWriter::kDefaultBufferSize;
+
+std::unique_ptr<BufferedFileWriter> BufferedFileWriter::Open(
+    FileSystem* fs, const std::string& file, DurabilityPolicy policy,
+    size_t buffer_size) {
+  CHECK(fs);
+  auto fd_or = fs->OpenForAppend(file);
+  if (!fd_or.ok()) {
+    LOG(ERROR) << fd_or.status().error_message();
+    return nullptr;
+  }
+  return std::unique_ptr<BufferedFileWriter>(new BufferedFileWriter(
+      fs, fd_or.ValueOrDie(), policy, std::max<size_t>(buffer_size, 1)));
+}
+
+BufferedFileWriter::BufferedFileWriter(FileSystem* fs, int fd,
+                                       DurabilityPolicy policy,
+                                       size_t buffer_size)
+    : fs_(fs), fd_(fd), policy_(policy), buffer_(buffer_size) {}
+
+BufferedFileWriter::~BufferedFileWriter() { Close(); }
+
+bool BufferedFileWriter::Next(void** data, int* size) {
+  if (broken_ || fd_ < 0) {
+    return false;
+  }
+  if (buffer_used_ == buffer_.size() && !Flush()) {
+    return false;
+  }
+  *data = buffer_.data() + buffer_used_;
+  *size = static_cast<int>(buffer_.size() - buffer_used_);
+  buffer_used_ = buffer_.size();
+  return true;
+}
+
+void BufferedFileWriter::BackUp(int count) {
+  CHECK(static_cast<size_t>(count) <= buffer_used_);
+  buffer_used_ -= count;
+}
+
+google::protobuf::int64 BufferedFileWriter::ByteCount() const {
+  return bytes_written_ + buffer_used_;
+}
+
+bool BufferedFileWriter::Append(const char* data, size_t size) {
+  while (size > 0) {
+    void* chunk;
+    int chunk_size;
+    if (!Next(&chunk, &chunk_size)) {
+      return false;
+    }
+    size_t n = std::min(size, static_cast<size_t>(chunk_size));
+    std::memcpy(chunk, data, n);
+    BackUp(chunk_size - n);
+    data += n;
+    size -= n;
+  }
+  return true;
+}
+
+bool BufferedFileWriter::EndRecord() {
+  if (broken_ || fd_ < 0) {
+    return false;
+  }
+  records_since_sync_++;
+  if (policy_.mode != DurabilityPolicy::kSyncEveryN) {
+    return true;
+  }
+  if ((policy_.sync_every_records > 0 &&
+       records_since_sync_ >= policy_.sync_every_records) ||
+      (policy_.sync_every_bytes > 0 &&
+       ByteCount() - bytes_at_last_sync_ >= policy_.sync_every_bytes)) {
+    return Sync();
+  }
+  return true;
+}
+
+bool BufferedFileWriter::Flush() {
+  if (broken_ || fd_ < 0) {
+    return false;
+  }
+  if (buffer_used_ == 0) {
+    return true;
+  }
+  num_writes_++;
+  if (!fs_->Write(fd_, buffer_.data(), buffer_used_)) {
+    LOG(ERROR) << "BufferedFileWriter: Write() failed.";
+    broken_ = true;
+    return false;
+  }
+  bytes_written_ += buffer_used_;
+  buffer_used_ = 0;
+  return true;
+}
+
+bool BufferedFileWriter::Sync() {
+  if (!Flush()) {
+    return false;
+  }
+  num_syncs_++;
+  if (!fs_->Sync(fd_)) {
+    LOG(ERROR) << "BufferedFileWriter: Sync() failed.";
+    broken_ = true;
+    return false;
+  }
+  records_since_sync_ = 0;
+  bytes_at_last_sync_ = bytes_written_;
+  return true;
+}
+
+bool BufferedFileWriter::SyncIfDirty() {
+  if (ByteCount() == static_cast<google::protobuf::int64>(
+                         bytes_at_last_sync_)) {
+    return !broken_;
+  }
+  return Sync();
+}
+
+bool BufferedFileWriter::Close() {
+  if (fd_ < 0) {
+    return !broken_;
+  }
+  bool ok =
+      policy_.mode == DurabilityPolicy::kNoSync ? Flush() : SyncIfDirty();
+  if (!fs_->Close(fd_)) {
+    ok = false;
+  }
+  fd_ = -1;
+  return ok;
+}
+
+}  // namespace util
+}  // namespace cobalt
@@ -0,0 +1,133 @@
+// Copyright 2018 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef COBALT_UTIL_BUFFERED_FILE_WRITER_H_
+#define COBALT_UTIL_BUFFERED_FILE_WRITER_H_
+
+#include <google/protobuf/io/zero_copy_stream.h>
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "util/file_system.h"
+
+namespace cobalt {
+namespace util {
+
+// A DurabilityPolicy determines when the data written through a
+// BufferedFileWriter is committed to durable storage, and so bounds how much
+// of it may be lost if the device loses power.
+struct DurabilityPolicy {
+  enum Mode {
+    // The data is never explicitly committed. The buffer is written to the
+    // file when it is full and when the file is closed, and it is up to the
+    // operating system when the file's data reaches durable storage.
+    kNoSync,
+
+    // The data is committed as soon as |sync_every_records| records or
+    // |sync_every_bytes| bytes have been written since the last commit,
+    // whichever comes first. A value of zero disables that bound. At most that
+    // many records or bytes may be lost.
+    kSyncEveryN,
+
+    // The data is committed every |group_commit_interval| by a timer run by
+    // the owner of the BufferedFileWriter, which invokes SyncIfDirty(). All of
+    // the records written during an interval are committed together. At most
+    // one interval's worth of records may be lost.
+    kGroupCommit,
+  };
+
+  Mode mode = kNoSync;
+  size_t sync_every_records = 0;
+  size_t sync_every_bytes = 0;
+  std::chrono::milliseconds group_commit_interval = std::chrono::seconds(1);
+};
+
+// BufferedFileWriter appends to a file using the raw file descriptor
+// operations of a FileSystem. Appended bytes are collected in a buffer of a
+// fixed size, which is written to the file with a single Write() when it
+// fills up, so that small appends do not each become a system call.
+//
+// BufferedFileWriter is a ZeroCopyOutputStream, so protocol buffers may be
+// serialized directly into its buffer. The writer is told where each record
+// ends via EndRecord(), which is where the DurabilityPolicy is applied.
+//
+// Once a FileSystem operation has failed the writer is broken: every later
+// operation fails without touching the file.
+//
+// This class is not thread-safe.
+class BufferedFileWriter : public google::protobuf::io::ZeroCopyOutputStream {
+ public:
+  static constexpr size_t kDefaultBufferSize = 64 * 1024;
+
+  // Opens |file| for appending using |fs|, which must remain valid as long as
+  // the writer is being used. Returns nullptr if the file could not be
+  // opened.
+  static std::unique_ptr<BufferedFileWriter> Open(
+      FileSystem* fs, const std::string& file, DurabilityPolicy policy,
+      size_t buffer_size = kDefaultBufferSize);
+
+  // Invokes Close().
+  ~BufferedFileWriter() override;
+
+  // ZeroCopyOutputStream. Next() returns the unused part of the buffer,
+  // writing the buffer to the file first if it is full.
+  bool Next(void** data, int* size) override;
+  void BackUp(int count) override;
+  // Returns the total number of bytes appended, including those still in the
+  // buffer.
+  google::protobuf::int64 ByteCount() const override;
+
+  // Appends |size| bytes from |data|.
+  bool Append(const char* data, size_t size);
+
+  // Marks the end of a record and, with the kSyncEveryN policy, commits the
+  // data if one of the policy's bounds has been reached.
+  bool EndRecord();
+
+  // Writes the buffer to the file, without committing it.
+  bool Flush();
+
+  // Writes the buffer to the file and commits the file's data to durable
+  // storage.
+  bool Sync();
+
+  // Invokes Sync() if anything has been appended since the last commit.
+  bool SyncIfDirty();
+
+  // Writes the buffer to the file, commits anything not yet committed unless
+  // the policy is kNoSync, and closes the file. Does nothing if the file is
+  // already closed.
+  bool Close();
+
+  // The number of Write() and Sync() operations performed on the file.
+  uint64_t num_writes() const { return num_writes_; }
+  uint64_t num_syncs() const { return num_syncs_; }
+
+ private:
+  BufferedFileWriter(FileSystem* fs, int fd, DurabilityPolicy policy,
+                     size_t buffer_size);
+
+  FileSystem* fs_;  // not owned
+  int fd_;
+  const DurabilityPolicy policy_;
+  std::vector<char> buffer_;
+  // The number of bytes of |buffer_| that hold appended data.
+  size_t buffer_used_ = 0;
+  // The number of bytes written to the file.
+  uint64_t bytes_written_ = 0;
+  size_t records_since_sync_ = 0;
+  uint64_t bytes_at_last_sync_ = 0;
+  bool broken_ = false;
+  uint64_t num_writes_ = 0;
+  uint64_t num_syncs_ = 0;
+};
+
+}  // namespace util
+}  // namespace cobalt
+
+#endif  // COBALT_UTIL_BUFFERED_FILE_WRITER_H_
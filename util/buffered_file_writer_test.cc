@@ -0,0 +1,178 @@
+// Copyright 2018 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "util/buffered_file_writer.h"
+
+#include <chrono>
+#include <memory>
+#include <sstream>
+#include <string>
+
+#include "util/posix_file_system.h"
+
+#include "./gtest.h"
+
+namespace cobalt {
+namespace util {
+
+namespace {
+
+// A PosixFileSystem that counts the calls to Write() and Sync(), and that can
+// be made to fail them.
+class CountingFileSystem : public PosixFileSystem {
+ public:
+  bool Write(int fd, const char* data, size_t size) override {
+    num_writes_++;
+    return !fail_writes_ && PosixFileSystem::Write(fd, data, size);
+  }
+
+  bool Sync(int fd) override {
+    num_syncs_++;
+    return PosixFileSystem::Sync(fd);
+  }
+
+  void FailWrites() { fail_writes_ = true; }
+  int num_writes() const { return num_writes_; }
+  int num_syncs() const { return num_syncs_; }
+
+ private:
+  bool fail_writes_ = false;
+  int num_writes_ = 0;
+  int num_syncs_ = 0;
+};
+
+}  // namespace
+
+class BufferedFileWriterTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    std::stringstream fname;
+    fname << "/tmp/buffered_file_writer_test_"
+          << std::chrono::duration_cast<std::chrono::microseconds>(
+                 std::chrono::system_clock::now().time_since_epoch())
+                 .count();
+    file_name_ = fname.str();
+  }
+
+  void TearDown() override { fs_.Delete(file_name_); }
+
+  std::unique_ptr<BufferedFileWriter> Open(DurabilityPolicy policy,
+                                           size_t buffer_size = 16) {
+    auto writer =
+        BufferedFileWriter::Open(&fs_, file_name_, policy, buffer_size);
+    EXPECT_NE(nullptr, writer);
+    return writer;
+  }
+
+  size_t FileSize() { return fs_.FileSize(file_name_).ConsumeValueOr(0); }
+
+  CountingFileSystem fs_;
+  std::string file_name_;
+};
+
+// Tests that appends are collected in the buffer and written when it fills up
+// and when the writer is closed.
+TEST_F(BufferedFileWriterTest, BuffersAppends) {
+  auto writer = Open(DurabilityPolicy());
+  ASSERT_TRUE(writer->Append("0123456789", 10));
+  EXPECT_EQ(10, writer->ByteCount());
+  EXPECT_EQ(0, fs_.num_writes());
+  EXPECT_EQ(0u, FileSize());
+
+  ASSERT_TRUE(writer->Append("0123456789", 10));
+  EXPECT_EQ(20, writer->ByteCount());
+  EXPECT_EQ(1, fs_.num_writes());
+  EXPECT_EQ(16u, FileSize());
+
+  ASSERT_TRUE(writer->Close());
+  EXPECT_EQ(2, fs_.num_writes());
+  EXPECT_EQ(20u, FileSize());
+  // kNoSync never commits the file.
+  EXPECT_EQ(0, fs_.num_syncs());
+  EXPECT_EQ(2u, writer->num_writes());
+  EXPECT_EQ(0u, writer->num_syncs());
+}
+
+// Tests that a file that already exists is appended to.
+TEST_F(BufferedFileWriterTest, AppendsToExistingFile) {
+  auto writer = Open(DurabilityPolicy());
+  ASSERT_TRUE(writer->Append("abc", 3));
+  ASSERT_TRUE(writer->Close());
+  writer = Open(DurabilityPolicy());
+  ASSERT_TRUE(writer->Append("def", 3));
+  ASSERT_TRUE(writer->Close());
+  EXPECT_EQ(6u, FileSize());
+}
+
+TEST_F(BufferedFileWriterTest, SyncEveryNRecords) {
+  DurabilityPolicy policy;
+  policy.mode = DurabilityPolicy::kSyncEveryN;
+  policy.sync_every_records = 3;
+  auto writer = Open(policy);
+  for (int i = 0; i < 7; i++) {
+    ASSERT_TRUE(writer->Append("x", 1));
+    ASSERT_TRUE(writer->EndRecord());
+  }
+  EXPECT_EQ(2, fs_.num_syncs());
+  EXPECT_EQ(6u, FileSize());
+  ASSERT_TRUE(writer->Close());
+  EXPECT_EQ(3, fs_.num_syncs());
+  EXPECT_EQ(7u, FileSize());
+}
+
+TEST_F(BufferedFileWriterTest, SyncEveryNBytes) {
+  DurabilityPolicy policy;
+  policy.mode = DurabilityPolicy::kSyncEveryN;
+  policy.sync_every_bytes = 10;
+  auto writer = Open(policy);
+  for (int i = 0; i < 5; i++) {
+    ASSERT_TRUE(writer->Append("abcd", 4));
+    ASSERT_TRUE(writer->EndRecord());
+  }
+  // Synced after the 3rd record (12 bytes) and not again after the 5th (8
+  // more bytes).
+  EXPECT_EQ(1, fs_.num_syncs());
+  EXPECT_EQ(12u, FileSize());
+}
+
+TEST_F(BufferedFileWriterTest, SyncIfDirty) {
+  DurabilityPolicy policy;
+  policy.mode = DurabilityPolicy::kGroupCommit;
+  auto writer = Open(policy);
+  ASSERT_TRUE(writer->SyncIfDirty());
+  EXPECT_EQ(0, fs_.num_syncs());
+
+  ASSERT_TRUE(writer->Append("abc", 3));
+  ASSERT_TRUE(writer->EndRecord());
+  EXPECT_EQ(0, fs_.num_syncs());
+  ASSERT_TRUE(writer->SyncIfDirty());
+  EXPECT_EQ(1, fs_.num_syncs());
+  EXPECT_EQ(3u, FileSize());
+  ASSERT_TRUE(writer->SyncIfDirty());
+  EXPECT_EQ(1, fs_.num_syncs());
+
+  // Closing a file that has already been committed does not commit it again.
+  ASSERT_TRUE(writer->Close());
+  EXPECT_EQ(1, fs_.num_syncs());
+}
+
+// Tests that the writer is broken once a write has failed.
+TEST_F(BufferedFileWriterTest, WriteFailure) {
+  auto writer = Open(DurabilityPolicy());
+  ASSERT_TRUE(writer->Append("abc", 3));
+  fs_.FailWrites();
+  EXPECT_FALSE(writer->Flush());
+  EXPECT_FALSE(writer->Append("abc", 3));
+  EXPECT_FALSE(writer->EndRecord());
+  EXPECT_FALSE(writer->Close());
+}
+
+TEST_F(BufferedFileWriterTest, OpenFailure) {
+  EXPECT_EQ(nullptr, BufferedFileWriter::Open(
+                         &fs_, "/tmp/no/such/directory/file",
+                         DurabilityPolicy()));
+}
+
+}  // namespace util
+}  // namespace cobalt
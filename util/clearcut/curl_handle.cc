@@ -25,6 +25,7 @@ CurlHandle::~CurlHandle() {
     curl_easy_cleanup(handle_);
     handle_ = nullptr;
   }
+  curl_slist_free_all(header_list_);
 }
 
 StatusOr<std::unique_ptr<CurlHandle>> CurlHandle::Init() {
@@ -58,25 +59,32 @@ Status CurlHandle::Setopt(CURLoption option, Param parameter) {
 
 Status CurlHandle::SetHeaders(
     const std::map<std::string, std::string> &headers) {
-  if (!headers.empty()) {
-    struct curl_slist *header_list = nullptr;
-    for (const auto &header : headers) {
-      std::string header_str = header.first + ": " + header.second;
-      if (header.second == "") {
-        header_str = header.first + ";";
-      }
-      header_list = curl_slist_append(header_list, header_str.c_str());
+  struct curl_slist *header_list = nullptr;
+  for (const auto &header : headers) {
+    std::string header_str = header.first + ": " + header.second;
+    if (header.second == "") {
+      header_str = header.first + ";";
     }
-    return Setopt(CURLOPT_HTTPHEADER, header_list);
+    header_list = curl_slist_append(header_list, header_str.c_str());
   }
-  return Status::OK;
+  // curl does not copy the list, so the list of the previous request is only
+  // freed once it has been replaced.
+  auto status = Setopt(CURLOPT_HTTPHEADER, header_list);
+  curl_slist_free_all(header_list_);
+  header_list_ = header_list;
+  return status;
 }
 
 Status CurlHandle::SetTimeout(int64_t timeout_ms) {
-  if (timeout_ms > 0) {
-    return Setopt(CURLOPT_TIMEOUT_MS, timeout_ms);
-  }
-  return Status::OK;
+  return Setopt(CURLOPT_TIMEOUT_MS, timeout_ms > 0 ? timeout_ms : 0);
+}
+
+Status CurlHandle::SetKeepAlive() { return Setopt(CURLOPT_TCP_KEEPALIVE, 1L); }
+
+int64_t CurlHandle::NumConnects() {
+  long num_connects = 0;  // NOLINT(runtime/int)
+  curl_easy_getinfo(handle_, CURLINFO_NUM_CONNECTS, &num_connects);
+  return num_connects;
 }
 
 Status CurlHandle::CURLCodeToStatus(CURLcode code) {
@@ -91,6 +99,8 @@ StatusOr<HTTPResponse> CurlHandle::Post(std::string url, std::string body) {
   RETURN_IF_ERROR(Setopt(CURLOPT_URL, url.c_str()));
   RETURN_IF_ERROR(Setopt(CURLOPT_POSTFIELDSIZE, body.size()));
   RETURN_IF_ERROR(Setopt(CURLOPT_POSTFIELDS, body.data()));
+  response_body_.clear();
+  errbuf_[0] = '\0';
   auto result = curl_easy_perform(handle_);
 
   switch (result) {
@@ -30,11 +30,24 @@ class CurlHandle {
 
   template <class Param>
   Status Setopt(CURLoption option, Param parameter);
+  // Sets the headers of the requests. They replace the headers of the
+  // previous requests, if the handle is reused.
   Status SetHeaders(const std::map<std::string, std::string> &headers);
+  // Sets the timeout of the requests. If |timeout_ms| is not positive, the
+  // requests have no timeout.
   Status SetTimeout(int64_t timeout_ms);
+  // Enables TCP keep-alive probes on the connections of the handle, so that
+  // the idle connections that curl keeps open between requests stay usable.
+  Status SetKeepAlive();
+
+  // Returns the number of new connections that the last request opened. It is
+  // zero if the request reused a connection of a previous request.
+  int64_t NumConnects();
 
   static StatusOr<std::unique_ptr<CurlHandle>> Init();
 
+  // Posts |body| to |url|. The handle may be used for several requests, in
+  // which case curl reuses their connections where it can.
   StatusOr<HTTPResponse> Post(std::string url, std::string body);
 
  private:
@@ -46,6 +59,7 @@ class CurlHandle {
 
   char errbuf_[CURL_ERROR_SIZE];
   std::string response_body_;
+  struct curl_slist *header_list_ = nullptr;
   CURL *handle_;
 
   // Disallow copy and assign
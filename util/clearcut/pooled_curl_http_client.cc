@@ -0,0 +1,154 @@
+// Copyright 2018 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "util/clearcut/pooled_curl_http_client.h"
+
+#include <zlib.h>
+
+#include <string>
+#include <utility>
+
+#include "./logging.h"
+#include "util/clearcut/curl_http_client.h"
+
+namespace cobalt {
+namespace util {
+namespace clearcut {
+
+using clearcut::HTTPRequest;
+using clearcut::HTTPResponse;
+using util::Status;
+using util::StatusCode;
+
+namespace {
+
+// Compresses |data| into |compressed| in the gzip format. Returns false if
+// zlib fails.
+bool GzipCompress(const std::string &data, std::string *compressed) {
+  z_stream stream = {};
+  // Adding 16 to the window bits selects the gzip format.
+  if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 16 + MAX_WBITS,
+                   8, Z_DEFAULT_STRATEGY) != Z_OK) {
+    return false;
+  }
+  compressed->resize(deflateBound(&stream, data.size()));
+  stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data.data()));
+  stream.avail_in = data.size();
+  stream.next_out = reinterpret_cast<Bytef *>(&(*compressed)[0]);
+  stream.avail_out = compressed->size();
+  int result = deflate(&stream, Z_FINISH);
+  deflateEnd(&stream);
+  if (result != Z_STREAM_END) {
+    return false;
+  }
+  compressed->resize(stream.total_out);
+  return true;
+}
+
+}  // namespace
+
+PooledCurlHTTPClient::PooledCurlHTTPClient()
+    : PooledCurlHTTPClient(Options()) {}
+
+PooledCurlHTTPClient::PooledCurlHTTPClient(const Options &options)
+    : HTTPClient(),
+      options_(options),
+      num_connections_(0),
+      request_body_bytes_(0) {
+  CHECK_GT(options_.num_workers, 0u);
+  if (!CurlHTTPClient::global_init_called_) {
+    CurlHTTPClient::global_init_called_ = true;
+    curl_global_init(CURL_GLOBAL_ALL);
+  }
+  for (size_t i = 0; i < options_.num_workers; i++) {
+    workers_.emplace_back([this] { Run(); });
+  }
+}
+
+PooledCurlHTTPClient::~PooledCurlHTTPClient() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    shut_down_ = true;
+  }
+  job_available_.notify_all();
+  for (auto &worker : workers_) {
+    worker.join();
+  }
+  for (auto &job : jobs_) {
+    job->promise.set_value(
+        Status(StatusCode::CANCELLED, "The HTTP client was destroyed."));
+  }
+}
+
+std::future<StatusOr<HTTPResponse>> PooledCurlHTTPClient::Post(
+    HTTPRequest request, std::chrono::steady_clock::time_point deadline) {
+  auto job = std::make_unique<Job>(std::move(request), deadline);
+  auto future = job->promise.get_future();
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    jobs_.push_back(std::move(job));
+  }
+  job_available_.notify_one();
+  return future;
+}
+
+void PooledCurlHTTPClient::Run() {
+  // The handle of this worker, which is kept for as long as it can be used so
+  // that its connections are reused.
+  std::unique_ptr<CurlHandle> handle;
+  while (true) {
+    std::unique_ptr<Job> job;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      job_available_.wait(lock,
+                          [this] { return shut_down_ || !jobs_.empty(); });
+      if (shut_down_) {
+        return;
+      }
+      job = std::move(jobs_.front());
+      jobs_.pop_front();
+    }
+    job->promise.set_value(Send(&handle, job.get()));
+  }
+}
+
+StatusOr<HTTPResponse> PooledCurlHTTPClient::Send(
+    std::unique_ptr<CurlHandle> *handle, Job *job) {
+  auto timeout_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                        job->deadline - std::chrono::steady_clock::now())
+                        .count();
+  if (timeout_ms <= 0) {
+    return Status(StatusCode::DEADLINE_EXCEEDED, "Post request timed out.");
+  }
+
+  if (*handle == nullptr) {
+    auto handle_or = CurlHandle::Init();
+    if (!handle_or.ok()) {
+      return handle_or.status();
+    }
+    *handle = handle_or.ConsumeValueOrDie();
+    RETURN_IF_ERROR((*handle)->SetKeepAlive());
+  }
+
+  auto &request = job->request;
+  if (options_.gzip_request_body) {
+    std::string compressed_body;
+    if (!GzipCompress(request.body, &compressed_body)) {
+      return Status(StatusCode::INTERNAL, "Unable to compress the request.");
+    }
+    request.body = std::move(compressed_body);
+    request.headers["Content-Encoding"] = "gzip";
+  }
+
+  RETURN_IF_ERROR((*handle)->SetTimeout(timeout_ms));
+  RETURN_IF_ERROR((*handle)->SetHeaders(request.headers));
+  auto response = (*handle)->Post(request.url, request.body);
+  num_connections_ += (*handle)->NumConnects();
+  request_body_bytes_ += request.body.size();
+  return response;
+}
+
+}  // namespace clearcut
+}  // namespace util
+}  // namespace cobalt
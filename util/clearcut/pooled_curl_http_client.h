@@ -0,0 +1,107 @@
+// Copyright 2018 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef COBALT_UTIL_CLEARCUT_POOLED_CURL_HTTP_CLIENT_H_
+#define COBALT_UTIL_CLEARCUT_POOLED_CURL_HTTP_CLIENT_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "third_party/clearcut/http_client.h"
+#include "third_party/tensorflow_statusor/statusor.h"
+#include "util/clearcut/curl_handle.h"
+
+namespace cobalt {
+namespace util {
+namespace clearcut {
+
+using ::clearcut::HTTPClient;
+using ::clearcut::HTTPRequest;
+using ::clearcut::HTTPResponse;
+using tensorflow_statusor::StatusOr;
+
+// PooledCurlHTTPClient implements clearcut::HTTPClient with a curl backend,
+// like CurlHTTPClient, but instead of creating a thread and a CurlHandle for
+// each request, it runs the requests on a fixed pool of worker threads, each
+// of which keeps one CurlHandle for its lifetime. curl keeps the connections
+// of a handle open between requests, so the consecutive requests of a worker
+// to the same host reuse its connection and do not pay for the TCP and TLS
+// handshakes again.
+//
+// Optionally, the body of each request is gzip-compressed and sent with the
+// header "Content-Encoding: gzip".
+//
+// A request whose deadline has passed by the time a worker picks it up fails
+// with DEADLINE_EXCEEDED. The requests that are still queued when the client
+// is destroyed fail with CANCELLED.
+//
+// This is designed to be used on linux clients (not fuchsia).
+class PooledCurlHTTPClient : public clearcut::HTTPClient {
+ public:
+  struct Options {
+    // The number of worker threads, and so of concurrent requests and of
+    // connections kept open per host.
+    size_t num_workers = 1;
+    // Whether the bodies of the requests are gzip-compressed.
+    bool gzip_request_body = false;
+  };
+
+  PooledCurlHTTPClient();
+  explicit PooledCurlHTTPClient(const Options &options);
+
+  // Waits for the requests in progress to finish.
+  ~PooledCurlHTTPClient() override;
+
+  std::future<StatusOr<clearcut::HTTPResponse>> Post(
+      clearcut::HTTPRequest request,
+      std::chrono::steady_clock::time_point deadline) override;
+
+  // The number of connections that the workers have opened.
+  size_t num_connections() const { return num_connections_; }
+
+  // The number of bytes of request bodies, after compression, that the
+  // workers have sent.
+  size_t request_body_bytes() const { return request_body_bytes_; }
+
+ private:
+  struct Job {
+    Job(clearcut::HTTPRequest request,
+        std::chrono::steady_clock::time_point deadline)
+        : request(std::move(request)), deadline(deadline) {}
+
+    clearcut::HTTPRequest request;
+    std::chrono::steady_clock::time_point deadline;
+    std::promise<StatusOr<clearcut::HTTPResponse>> promise;
+  };
+
+  // The main method of the worker threads.
+  void Run();
+
+  // Sends the request of |job| with |*handle|, which is created if it is
+  // null.
+  StatusOr<clearcut::HTTPResponse> Send(std::unique_ptr<CurlHandle> *handle,
+                                        Job *job);
+
+  const Options options_;
+  std::atomic<size_t> num_connections_;
+  std::atomic<size_t> request_body_bytes_;
+
+  std::mutex mutex_;
+  std::condition_variable job_available_;
+  std::deque<std::unique_ptr<Job>> jobs_;
+  bool shut_down_ = false;
+  std::vector<std::thread> workers_;
+};
+
+}  // namespace clearcut
+}  // namespace util
+}  // namespace cobalt
+
+#endif  // COBALT_UTIL_CLEARCUT_POOLED_CURL_HTTP_CLIENT_H_
@@ -0,0 +1,269 @@
+// Copyright 2018 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "util/clearcut/pooled_curl_http_client.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "./gtest.h"
+
+namespace cobalt {
+namespace util {
+namespace clearcut {
+
+namespace {
+
+// LocalHTTPServer is a stand-in for the Clearcut server. It listens on a port
+// of the loopback interface, records the requests that it receives, and
+// answers each with "200 OK", keeping the connection alive.
+class LocalHTTPServer {
+ public:
+  struct Request {
+    std::map<std::string, std::string> headers;
+    std::string body;
+  };
+
+  LocalHTTPServer() {
+    listen_fd_ = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = 0;
+    socklen_t address_size = sizeof(address);
+    EXPECT_EQ(0, bind(listen_fd_, reinterpret_cast<sockaddr *>(&address),
+                      address_size));
+    EXPECT_EQ(0, listen(listen_fd_, 16));
+    EXPECT_EQ(0, getsockname(listen_fd_, reinterpret_cast<sockaddr *>(&address),
+                             &address_size));
+    port_ = ntohs(address.sin_port);
+    accept_thread_ = std::thread([this] { Accept(); });
+  }
+
+  ~LocalHTTPServer() {
+    shutdown(listen_fd_, SHUT_RDWR);
+    accept_thread_.join();
+    close(listen_fd_);
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      for (int fd : connection_fds_) {
+        shutdown(fd, SHUT_RDWR);
+      }
+    }
+    for (auto &thread : connection_threads_) {
+      thread.join();
+    }
+    for (int fd : connection_fds_) {
+      close(fd);
+    }
+  }
+
+  std::string url() const {
+    return "http://127.0.0.1:" + std::to_string(port_) + "/log";
+  }
+
+  size_t num_connections() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return connection_fds_.size();
+  }
+
+  std::vector<Request> requests() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return requests_;
+  }
+
+ private:
+  void Accept() {
+    while (true) {
+      int fd = accept(listen_fd_, nullptr, nullptr);
+      if (fd < 0) {
+        return;
+      }
+      std::lock_guard<std::mutex> lock(mutex_);
+      connection_fds_.push_back(fd);
+      connection_threads_.emplace_back([this, fd] { Serve(fd); });
+    }
+  }
+
+  // Serves the requests of one connection until the client closes it.
+  void Serve(int fd) {
+    std::string buffer;
+    char chunk[4096];
+    while (true) {
+      Request request;
+      size_t header_end;
+      while ((header_end = buffer.find("\r\n\r\n")) == std::string::npos) {
+        ssize_t num_read = read(fd, chunk, sizeof(chunk));
+        if (num_read <= 0) {
+          return;
+        }
+        buffer.append(chunk, num_read);
+      }
+      // Parse the header lines that follow the request line.
+      size_t line_start = buffer.find("\r\n") + 2;
+      while (line_start < header_end) {
+        size_t line_end = buffer.find("\r\n", line_start);
+        std::string line = buffer.substr(line_start, line_end - line_start);
+        size_t colon = line.find(':');
+        if (colon != std::string::npos) {
+          std::string name = line.substr(0, colon);
+          std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+          size_t value_start = line.find_first_not_of(' ', colon + 1);
+          request.headers[name] = line.substr(value_start);
+        }
+        line_start = line_end + 2;
+      }
+      buffer.erase(0, header_end + 4);
+
+      size_t content_length = std::stoul(request.headers["content-length"]);
+      while (buffer.size() < content_length) {
+        ssize_t num_read = read(fd, chunk, sizeof(chunk));
+        if (num_read <= 0) {
+          return;
+        }
+        buffer.append(chunk, num_read);
+      }
+      request.body = buffer.substr(0, content_length);
+      buffer.erase(0, content_length);
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        requests_.push_back(std::move(request));
+      }
+
+      const std::string response =
+          "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nok";
+      if (write(fd, response.data(), response.size()) !=
+          static_cast<ssize_t>(response.size())) {
+        return;
+      }
+    }
+  }
+
+  int listen_fd_;
+  uint16_t port_;
+  std::thread accept_thread_;
+  std::mutex mutex_;
+  std::vector<int> connection_fds_;
+  std::vector<std::thread> connection_threads_;
+  std::vector<Request> requests_;
+};
+
+// Decompresses |compressed|, which is in the gzip format.
+std::string GzipDecompress(const std::string &compressed) {
+  z_stream stream = {};
+  EXPECT_EQ(Z_OK, inflateInit2(&stream, 16 + MAX_WBITS));
+  std::string data(1024 * 1024, '\0');
+  stream.next_in =
+      reinterpret_cast<Bytef *>(const_cast<char *>(compressed.data()));
+  stream.avail_in = compressed.size();
+  stream.next_out = reinterpret_cast<Bytef *>(&data[0]);
+  stream.avail_out = data.size();
+  EXPECT_EQ(Z_STREAM_END, inflate(&stream, Z_FINISH));
+  data.resize(stream.total_out);
+  inflateEnd(&stream);
+  return data;
+}
+
+std::chrono::steady_clock::time_point Deadline() {
+  return std::chrono::steady_clock::now() + std::chrono::seconds(10);
+}
+
+}  // namespace
+
+// Tests that consecutive requests reuse one connection.
+TEST(PooledCurlHTTPClientTest, ReusesConnection) {
+  LocalHTTPServer server;
+  PooledCurlHTTPClient client;
+  const int kNumRequests = 5;
+  for (int i = 0; i < kNumRequests; i++) {
+    HTTPRequest request(server.url(), "request " + std::to_string(i));
+    auto response_or = client.Post(std::move(request), Deadline()).get();
+    ASSERT_TRUE(response_or.ok()) << response_or.status().error_message();
+    auto response = response_or.ConsumeValueOrDie();
+    EXPECT_EQ(200, response.http_code);
+    EXPECT_EQ("ok", response.response);
+  }
+
+  auto requests = server.requests();
+  ASSERT_EQ(static_cast<size_t>(kNumRequests), requests.size());
+  for (int i = 0; i < kNumRequests; i++) {
+    EXPECT_EQ("request " + std::to_string(i), requests[i].body);
+  }
+  EXPECT_EQ(1u, server.num_connections());
+  EXPECT_EQ(1u, client.num_connections());
+}
+
+// Tests that the requests are spread over the workers, each of which opens
+// at most one connection.
+TEST(PooledCurlHTTPClientTest, ConcurrentWorkers) {
+  LocalHTTPServer server;
+  PooledCurlHTTPClient::Options options;
+  options.num_workers = 3;
+  PooledCurlHTTPClient client(options);
+  const int kNumRequests = 30;
+  std::vector<std::future<StatusOr<HTTPResponse>>> responses;
+  for (int i = 0; i < kNumRequests; i++) {
+    HTTPRequest request(server.url(), "request " + std::to_string(i));
+    responses.push_back(client.Post(std::move(request), Deadline()));
+  }
+  for (auto &response : responses) {
+    EXPECT_TRUE(response.get().ok());
+  }
+
+  EXPECT_EQ(static_cast<size_t>(kNumRequests), server.requests().size());
+  EXPECT_LE(server.num_connections(), options.num_workers);
+  EXPECT_EQ(server.num_connections(), client.num_connections());
+}
+
+// Tests that with gzip_request_body the request body is sent compressed,
+// with the header that says so.
+TEST(PooledCurlHTTPClientTest, GzipRequestBody) {
+  LocalHTTPServer server;
+  PooledCurlHTTPClient::Options options;
+  options.gzip_request_body = true;
+  PooledCurlHTTPClient client(options);
+  const std::string body(10000, 'a');
+  HTTPRequest request(server.url(), body);
+  request.headers["Content-Type"] = "application/x-protobuf";
+  ASSERT_TRUE(client.Post(std::move(request), Deadline()).get().ok());
+
+  auto requests = server.requests();
+  ASSERT_EQ(1u, requests.size());
+  EXPECT_EQ("gzip", requests[0].headers["content-encoding"]);
+  EXPECT_EQ("application/x-protobuf", requests[0].headers["content-type"]);
+  EXPECT_LT(requests[0].body.size(), body.size() / 10);
+  EXPECT_EQ(requests[0].body.size(), client.request_body_bytes());
+  EXPECT_EQ(body, GzipDecompress(requests[0].body));
+}
+
+// Tests that a request whose deadline has passed is not sent.
+TEST(PooledCurlHTTPClientTest, DeadlineExceeded) {
+  LocalHTTPServer server;
+  PooledCurlHTTPClient client;
+  HTTPRequest request(server.url(), "late");
+  auto response_or = client
+                         .Post(std::move(request),
+                               std::chrono::steady_clock::now() -
+                                   std::chrono::seconds(1))
+                         .get();
+  EXPECT_EQ(StatusCode::DEADLINE_EXCEEDED,
+            response_or.status().error_code());
+  EXPECT_EQ(0u, client.num_connections());
+  EXPECT_TRUE(server.requests().empty());
+}
+
+}  // namespace clearcut
+}  // namespace util
+}  // namespace cobalt
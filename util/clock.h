@@ -6,6 +6,7 @@
 #define COBALT_UTIL_CLOCK_H_
 
 #include <chrono>
+#include <functional>
 
 namespace cobalt {
 namespace util {
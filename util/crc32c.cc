@@ -0,0 +1,65 @@
+// Copyright 2018 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "util/crc32c.h"
+
+namespace cobalt {
+namespace util {
+
+namespace {
+
+// The reflected CRC-32C polynomial.
+const uint32_t kPolynomial = 0x82f63b78;
+
+// Tables for the "slicing-by-8" algorithm, which processes 8 bytes per step:
+// tables[0] is the usual byte-at-a-time table, and tables[k][b] is the CRC of
+// the byte b followed by k zero bytes.
+struct Tables {
+  uint32_t tables[8][256];
+
+  Tables() {
+    for (uint32_t b = 0; b < 256; b++) {
+      uint32_t crc = b;
+      for (int bit = 0; bit < 8; bit++) {
+        crc = (crc >> 1) ^ ((crc & 1) ? kPolynomial : 0);
+      }
+      tables[0][b] = crc;
+    }
+    for (uint32_t b = 0; b < 256; b++) {
+      for (int k = 1; k < 8; k++) {
+        uint32_t previous = tables[k - 1][b];
+        tables[k][b] = (previous >> 8) ^ tables[0][previous & 0xff];
+      }
+    }
+  }
+};
+
+const Tables& GetTables() {
+  static const Tables* tables = new Tables();
+  return *tables;
+}
+
+}  // namespace
+
+uint32_t Crc32cExtend(uint32_t crc, const char* data, size_t size) {
+  const auto& t = GetTables().tables;
+  const auto* p = reinterpret_cast<const uint8_t*>(data);
+  crc = ~crc;
+  while (size >= 8) {
+    uint32_t low = crc ^ (p[0] | p[1] << 8 | p[2] << 16 |
+                          static_cast<uint32_t>(p[3]) << 24);
+    crc = t[7][low & 0xff] ^ t[6][(low >> 8) & 0xff] ^
+          t[5][(low >> 16) & 0xff] ^ t[4][low >> 24] ^ t[3][p[4]] ^
+          t[2][p[5]] ^ t[1][p[6]] ^ t[0][p[7]];
+    p += 8;
+    size -= 8;
+  }
+  while (size-- > 0) {
+    crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xff];
+  }
+  return ~crc;
+}
+
+}  // namespace util
+}  // namespace cobalt
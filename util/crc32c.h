@@ -0,0 +1,26 @@
+// Copyright 2018 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef COBALT_UTIL_CRC32C_H_
+#define COBALT_UTIL_CRC32C_H_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace cobalt {
+namespace util {
+
+// Returns the CRC-32C (Castagnoli) checksum of the |size| bytes at |data|,
+// continuing from |crc|, the checksum of any preceding bytes.
+uint32_t Crc32cExtend(uint32_t crc, const char* data, size_t size);
+
+// Returns the CRC-32C (Castagnoli) checksum of the |size| bytes at |data|.
+inline uint32_t Crc32c(const char* data, size_t size) {
+  return Crc32cExtend(0, data, size);
+}
+
+}  // namespace util
+}  // namespace cobalt
+
+#endif  // COBALT_UTIL_CRC32C_H_
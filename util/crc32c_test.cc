@@ -0,0 +1,45 @@
+// Copyright 2018 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "util/crc32c.h"
+
+#include <string>
+
+#include "./gtest.h"
+
+namespace cobalt {
+namespace util {
+
+// Tests against the check value of CRC-32C and the test vectors of RFC 3720.
+TEST(Crc32cTest, KnownValues) {
+  EXPECT_EQ(0u, Crc32c("", 0));
+  EXPECT_EQ(0xe3069283u, Crc32c("123456789", 9));
+  std::string zeros(32, '\0');
+  EXPECT_EQ(0x8a9136aau, Crc32c(zeros.data(), zeros.size()));
+  std::string ones(32, '\xff');
+  EXPECT_EQ(0x62a8ab43u, Crc32c(ones.data(), ones.size()));
+  std::string ascending;
+  for (int i = 0; i < 32; i++) {
+    ascending.push_back(static_cast<char>(i));
+  }
+  EXPECT_EQ(0x46dd794eu, Crc32c(ascending.data(), ascending.size()));
+}
+
+// Tests that a checksum computed in pieces of every alignment matches the
+// checksum computed at once.
+TEST(Crc32cTest, Extend) {
+  std::string data;
+  for (int i = 0; i < 100; i++) {
+    data.push_back(static_cast<char>(i * 7));
+  }
+  uint32_t expected = Crc32c(data.data(), data.size());
+  for (size_t split = 0; split <= data.size(); split++) {
+    uint32_t crc = Crc32c(data.data(), split);
+    EXPECT_EQ(expected,
+              Crc32cExtend(crc, data.data() + split, data.size() - split));
+  }
+}
+
+}  // namespace util
+}  // namespace cobalt
@@ -263,7 +263,7 @@ bool HybridCipher::GenerateKeyPairPEM(std::string* public_key_pem_out,
 }
 
 HybridCipher::HybridCipher()
-    : context_(new HybridCipherContext()), symm_cipher_(new SymmetricCipher) {}
+    : context_(new HybridCipherContext()) {}
 
 HybridCipher::~HybridCipher() {}
 
@@ -429,14 +429,16 @@ bool HybridCipher::EncryptInternal(const byte* ptext, size_t ptext_len,
     return false;
   }
 
-  // Do symmetric encryption with hkdf_derived_key
-  if (!symm_cipher_->set_key(hkdf_derived_key)) {
+  // Do symmetric encryption with hkdf_derived_key. The SymmetricCipher is
+  // local so that concurrent encryptions do not share a key.
+  SymmetricCipher symm_cipher;
+  if (!symm_cipher.set_key(hkdf_derived_key)) {
     return false;
   }
   // For hybrid mode, we can fix the nonce to all zeroes without losing
   // security. See: https://goto.google.com/aes-gcm-zero-nonce-security
-  if (!symm_cipher_->Encrypt(kAllZeroNonce, ptext, ptext_len,
-                             symmetric_ctext_out)) {
+  if (!symm_cipher.Encrypt(kAllZeroNonce, ptext, ptext_len,
+                           symmetric_ctext_out)) {
     return false;
   }
 
@@ -484,14 +486,15 @@ bool HybridCipher::DecryptInternal(const byte public_key_part[PUBLIC_KEY_SIZE],
     return false;
   }
 
-  // Decrypt using symm_cipher_ interface
-  if (!symm_cipher_->set_key(hkdf_derived_key)) {
+  // Decrypt using a local SymmetricCipher, as in EncryptInternal().
+  SymmetricCipher symm_cipher;
+  if (!symm_cipher.set_key(hkdf_derived_key)) {
     return false;
   }
 
   // Our encryption always uses the all-zero nonce.
-  if (!symm_cipher_->Decrypt(kAllZeroNonce, symmetric_ctext,
-                             symmetric_ctext_len, ptext)) {
+  if (!symm_cipher.Decrypt(kAllZeroNonce, symmetric_ctext, symmetric_ctext_len,
+                           ptext)) {
     return false;
   }
 
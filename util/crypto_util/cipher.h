@@ -118,7 +118,10 @@ class SymmetricCipher {
 //
 // An instance of HybridCipher may be used repeatedly for multiple
 // encryptions or decryptions. The method set_public_key() must be used before
-// encryptions and set_private_key() must be used before decryptions.
+// encryptions and set_private_key() must be used before decryptions. Once the
+// key has been set, Encrypt() and Decrypt() may be invoked concurrently from
+// several threads: each invocation uses its own SymmetricCipher for the
+// derived key.
 //
 // Note 1: We choose to fix the nonce (to all-zeroes) to save on overhead. This
 // is particularly useful when we're encrypting small plaintexts. For more
@@ -261,7 +264,6 @@ class HybridCipher {
                        size_t symmetric_ctext_len, std::vector<byte>* ptext);
 
   std::unique_ptr<HybridCipherContext> context_;
-  std::unique_ptr<SymmetricCipher> symm_cipher_;
 };
 
 }  // namespace crypto
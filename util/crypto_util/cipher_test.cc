@@ -19,6 +19,7 @@
 
 #include <limits.h>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include "util/crypto_util/cipher.h"
@@ -176,6 +177,54 @@ TEST(HybridCipherTest, Test) {
   }
 }
 
+// Tests that a single HybridCipher may be used to encrypt from several
+// threads at once: every ciphertext must decrypt to its own plaintext.
+TEST(HybridCipherTest, ConcurrentEncryption) {
+  const int kNumThreads = 8;
+  const int kNumMessagesPerThread = 50;
+  std::string public_key;
+  std::string private_key;
+  doGenerateKeys(&public_key, &private_key);
+  HybridCipher encrypter;
+  ASSERT_TRUE(encrypter.set_public_key_pem(public_key));
+
+  std::vector<std::vector<std::vector<byte>>> cipher_texts(kNumThreads);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kNumThreads; t++) {
+    threads.emplace_back([&encrypter, &cipher_texts, t] {
+      for (int i = 0; i < kNumMessagesPerThread; i++) {
+        std::string plain_text =
+            std::to_string(t) + ":" + std::to_string(i) + ":" + kLines[i % 4];
+        cipher_texts[t].emplace_back();
+        EXPECT_TRUE(encrypter.Encrypt((const byte*)plain_text.data(),
+                                      plain_text.size(),
+                                      &cipher_texts[t].back()));
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  HybridCipher decrypter;
+  ASSERT_TRUE(decrypter.set_private_key_pem(private_key));
+  for (int t = 0; t < kNumThreads; t++) {
+    ASSERT_EQ(static_cast<size_t>(kNumMessagesPerThread),
+              cipher_texts[t].size());
+    for (int i = 0; i < kNumMessagesPerThread; i++) {
+      std::vector<byte> recovered_text;
+      ASSERT_TRUE(decrypter.Decrypt(cipher_texts[t][i].data(),
+                                    cipher_texts[t][i].size(),
+                                    &recovered_text))
+          << "thread " << t << " message " << i;
+      EXPECT_EQ(
+          std::to_string(t) + ":" + std::to_string(i) + ":" + kLines[i % 4],
+          std::string((const char*)recovered_text.data(),
+                      recovered_text.size()));
+    }
+  }
+}
+
 }  // namespace crypto
 
 }  // namespace cobalt
@@ -15,6 +15,8 @@
 #include <openssl/rand.h>
 
 #include <cmath>
+#include <cstring>
+#include <vector>
 
 #include "util/crypto_util/random.h"
 
@@ -39,16 +41,32 @@ uint64_t Random::RandomUint64() {
   return x;
 }
 
+const uint32_t* Random::RandomWords(std::size_t num_words) {
+  thread_local std::vector<uint32_t> words;
+  if (words.size() < num_words) {
+    words.resize(num_words);
+  }
+  RandomBytes(reinterpret_cast<byte*>(words.data()),
+              num_words * sizeof(uint32_t));
+  return words.data();
+}
+
+uint64_t Random::BitThreshold(float p) {
+  if (p <= 0.0 || p > 1.0) {
+    return 0;
+  }
+  // The integer n in the range [0, 2^32] such that n/2^32 best approximates
+  // p.
+  return round(static_cast<double>(p) * (static_cast<double>(UINT32_MAX) + 1));
+}
+
 byte Random::RandomBits(float p) {
   if (p <= 0.0 || p > 1.0) {
     return 0;
   }
   byte ret_val = 0;
 
-  // threshold is the integer n in the range [0, 2^32] such that
-  // n/2^32 best approximates p.
-  uint64_t threshold =
-      round(static_cast<double>(p) * (static_cast<double>(UINT32_MAX) + 1));
+  uint64_t threshold = BitThreshold(p);
 
   for (int i = 0; i < 8; i++) {
     uint8_t random_bit = (RandomUint32() < threshold);
@@ -57,6 +75,21 @@ byte Random::RandomBits(float p) {
   return ret_val;
 }
 
+void Random::RandomBits(float p, byte* buf, std::size_t num) {
+  uint64_t threshold = BitThreshold(p);
+  if (threshold == 0) {
+    std::memset(buf, 0, num);
+    return;
+  }
+
+  // Bit i of byte j is set if the (8 * j + i)-th 32-bit word is less than the
+  // threshold, as in RandomBits(p).
+  const uint32_t* words = RandomWords(8 * num);
+  for (std::size_t j = 0; j < num; j++) {
+    buf[j] = BitsBelowThreshold(threshold, words + 8 * j);
+  }
+}
+
 }  // namespace crypto
 
 }  // namespace cobalt
@@ -49,6 +49,39 @@ class Random {
   // result is undefined. p will be rounded to the nearest value of the form
   // n/(2^32) where n is an integer in the range [0, 2^32].
   byte RandomBits(float p);
+
+  // Writes |num| bytes to |buf| whose bits are independent and each equal to
+  // one with the probability p, with the same distribution as |num| calls to
+  // RandomBits(p). All of the random data is obtained with a single call to
+  // RandomWords(), and the bits are computed in a loop that the compiler can
+  // vectorize, so this is much faster than calling RandomBits(p) for each
+  // byte.
+  void RandomBits(float p, byte *buf, std::size_t num);
+
+  // Fills a per-thread buffer with |num_words| random 32-bit words using a
+  // single call to RandomBytes(), and returns the buffer. The buffer is reused
+  // by the next call to RandomWords() on the same thread, so the words must be
+  // consumed before then. This lets a caller that needs random bits for
+  // several probabilities obtain all of the random data at once, without
+  // allocating once the buffer is large enough.
+  const uint32_t *RandomWords(std::size_t num_words);
+
+  // Returns the threshold that RandomBits(p) compares each random word with:
+  // a uniformly random 32-bit word is less than it with the probability p,
+  // rounded as described for RandomBits(p). This is 0 if p is not in the
+  // range (0.0, 1.0].
+  static uint64_t BitThreshold(float p);
+
+  // Returns the byte whose bit i is one iff words[i] is less than
+  // |threshold|, for i in [0, 8). Given 8 uniformly random words and the
+  // threshold BitThreshold(p) it has the same distribution as RandomBits(p).
+  static byte BitsBelowThreshold(uint64_t threshold, const uint32_t *words) {
+    byte bits = 0;
+    for (int i = 0; i < 8; i++) {
+      bits |= static_cast<byte>(words[i] < threshold) << i;
+    }
+    return bits;
+  }
 };
 
 }  // namespace crypto
@@ -16,6 +16,7 @@
 #include <bitset>
 #include <cmath>
 #include <memory>
+#include <random>
 #include <utility>
 #include <vector>
 
@@ -122,6 +123,76 @@ TEST(RandomTest, TestRandomBits) {
   }
 }
 
+// SequentialRandom is a Random whose RandomBytes() returns consecutive
+// segments of a single pseudo-random stream, so that the bytes it returns do
+// not depend on how they are requested.
+class SequentialRandom : public Random {
+ public:
+  void RandomBytes(byte *buf, std::size_t num) override {
+    for (std::size_t i = 0; i < num; i++) {
+      buf[i] = static_cast<byte>(engine_());
+    }
+  }
+
+ private:
+  std::mt19937 engine_;
+};
+
+// Tests the function RandomBits() that fills a buffer. Given the same random
+// data, it must produce the same bytes as successive calls to RandomBits(p),
+// and so have the same distribution.
+TEST(RandomTest, TestRandomBitsBuffer) {
+  std::unique_ptr<Random> rand(new Random());
+  std::vector<byte> buf(100, 17);
+
+  // When p = 0 none of the bits should be set.
+  rand->RandomBits(0.0, buf.data(), buf.size());
+  EXPECT_EQ(std::vector<byte>(100, 0), buf);
+
+  // When p = 1 all of the bits should be set.
+  rand->RandomBits(1.0, buf.data(), buf.size());
+  EXPECT_EQ(std::vector<byte>(100, 255), buf);
+
+  for (float p : {0.01, 0.1, 0.25, 0.5, 0.75, 0.9, 0.99}) {
+    SequentialRandom bulk_rand;
+    bulk_rand.RandomBits(p, buf.data(), buf.size());
+    SequentialRandom byte_rand;
+    for (size_t i = 0; i < buf.size(); i++) {
+      EXPECT_EQ(byte_rand.RandomBits(p), buf[i]) << "p=" << p << " i=" << i;
+    }
+  }
+}
+
+// Tests that RandomWords() returns the data of a single call to RandomBytes()
+// in a buffer that is reused by the next call.
+TEST(RandomTest, TestRandomWords) {
+  SequentialRandom words_rand;
+  const uint32_t* words = words_rand.RandomWords(16);
+  SequentialRandom bytes_rand;
+  uint32_t expected_words[16];
+  bytes_rand.RandomBytes(reinterpret_cast<byte*>(expected_words),
+                         sizeof(expected_words));
+  for (int i = 0; i < 16; i++) {
+    EXPECT_EQ(expected_words[i], words[i]) << "i=" << i;
+  }
+
+  EXPECT_EQ(words, words_rand.RandomWords(8));
+  bytes_rand.RandomBytes(reinterpret_cast<byte*>(expected_words),
+                         8 * sizeof(uint32_t));
+  for (int i = 0; i < 8; i++) {
+    EXPECT_EQ(expected_words[i], words[i]) << "i=" << i;
+  }
+}
+
+// Tests the function BitThreshold().
+TEST(RandomTest, TestBitThreshold) {
+  EXPECT_EQ(0u, Random::BitThreshold(0.0));
+  EXPECT_EQ(0u, Random::BitThreshold(-0.5));
+  EXPECT_EQ(0u, Random::BitThreshold(1.5));
+  EXPECT_EQ(1ull << 31, Random::BitThreshold(0.5));
+  EXPECT_EQ(1ull << 32, Random::BitThreshold(1.0));
+}
+
 }  // namespace crypto
 
 }  // namespace cobalt
@@ -28,6 +28,12 @@ class DeterministicRandom : public Random {
  public:
   DeterministicRandom() : num_calls_(0) {}
 
+  // Constructs a DeterministicRandom for the given |stream|. Different
+  // streams use disjoint ranges of nonces, and so yield independent bytes for
+  // up to 2^32 calls to RandomBytes(). Stream 0 is the default.
+  explicit DeterministicRandom(uint32_t stream)
+      : num_calls_(static_cast<uint64_t>(stream) << 32) {}
+
   virtual ~DeterministicRandom() {}
 
   // Implementes a deterministic PRNG by using chacha20 with a zero key and a
@@ -14,6 +14,8 @@
 
 #include "util/encrypted_message_util.h"
 
+#include <string>
+#include <utility>
 #include <vector>
 
 #include "./encrypted_message.pb.h"
@@ -50,10 +52,18 @@ bool EncryptedMessageMaker::Encrypt(
 
   std::string serialized_message;
   message.SerializeToString(&serialized_message);
+  return EncryptSerialized(std::move(serialized_message), encrypted_message);
+}
+
+bool EncryptedMessageMaker::EncryptSerialized(
+    std::string serialized_message, EncryptedMessage* encrypted_message) const {
+  if (!encrypted_message) {
+    return false;
+  }
 
   if (encryption_scheme_ == EncryptedMessage::NONE) {
     encrypted_message->set_scheme(EncryptedMessage::NONE);
-    encrypted_message->set_ciphertext(serialized_message);
+    encrypted_message->set_ciphertext(std::move(serialized_message));
     return true;
   }
 
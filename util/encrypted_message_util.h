@@ -64,9 +64,18 @@ class EncryptedMessageMaker {
 
   // Encrypts a protocol buffer |message| and populates |encrypted_message|
   // with the result. Returns true for success or false on failure.
+  //
+  // Encrypt() and EncryptSerialized() may be invoked concurrently from
+  // several threads.
   bool Encrypt(const google::protobuf::MessageLite& message,
                EncryptedMessage* encrypted_message) const;
 
+  // Encrypts an already serialized protocol buffer |serialized_message| and
+  // populates |encrypted_message| with the result. Returns true for success or
+  // false on failure.
+  bool EncryptSerialized(std::string serialized_message,
+                         EncryptedMessage* encrypted_message) const;
+
  private:
   std::unique_ptr<crypto::HybridCipher> cipher_;
   EncryptedMessage::EncryptionScheme encryption_scheme_;
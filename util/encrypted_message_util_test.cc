@@ -93,6 +93,32 @@ TEST(EncryptedMessageUtilTest, HybridEncryption) {
   EXPECT_FALSE(bad_decrypter.DecryptMessage(encrypted_message, &observation));
 }
 
+// Tests encrypting an already serialized message with both schemes.
+TEST(EncryptedMessageUtilTest, EncryptSerialized) {
+  std::string public_key;
+  std::string private_key;
+  EXPECT_TRUE(HybridCipher::GenerateKeyPairPEM(&public_key, &private_key));
+
+  auto observation = MakeDummyObservation("hello");
+  std::string serialized_observation;
+  ASSERT_TRUE(observation.SerializeToString(&serialized_observation));
+
+  EncryptedMessageMaker none_maker("dummy_key", EncryptedMessage::NONE);
+  EncryptedMessage encrypted_message;
+  ASSERT_TRUE(
+      none_maker.EncryptSerialized(serialized_observation, &encrypted_message));
+  EXPECT_EQ(serialized_observation, encrypted_message.ciphertext());
+
+  EncryptedMessageMaker hybrid_maker(public_key,
+                                     EncryptedMessage::HYBRID_ECDH_V1);
+  ASSERT_TRUE(hybrid_maker.EncryptSerialized(serialized_observation,
+                                             &encrypted_message));
+  MessageDecrypter decrypter(private_key);
+  observation.Clear();
+  EXPECT_TRUE(decrypter.DecryptMessage(encrypted_message, &observation));
+  EXPECT_EQ(1u, observation.parts().count("hello"));
+}
+
 // Tests that using encryption incorrectly fails but doesn't cause any crashes.
 TEST(EncryptedMessageUtilTest, Crazy) {
   std::string public_key;
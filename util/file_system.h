@@ -5,6 +5,7 @@
 #ifndef COBALT_UTIL_FILE_SYSTEM_H_
 #define COBALT_UTIL_FILE_SYSTEM_H_
 
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -13,6 +14,21 @@
 namespace cobalt {
 namespace util {
 
+// FileContents is a read-only view of the contents of a file, as returned by
+// FileSystem::MapFile(). The contents remain valid until the FileContents is
+// destroyed.
+class FileContents {
+ public:
+  virtual ~FileContents() {}
+
+  // Returns a pointer to the first byte of the contents. May be nullptr if
+  // size() is zero.
+  virtual const char *data() const = 0;
+
+  // Returns the number of bytes in the contents.
+  virtual size_t size() const = 0;
+};
+
 // FileSystem is an abstract class used for interacting with the file system
 // in a platform independent way.
 class FileSystem {
@@ -64,6 +80,48 @@ class FileSystem {
   // Returns: True if the file was renamed successfully.
   virtual bool Rename(const std::string &from, const std::string &to) = 0;
 
+  // OpenForAppend opens a file for writing at its end, creating it if it does
+  // not exist.
+  //
+  // |file|. An absolute path to the file to be opened.
+  //
+  // Returns: A StatusOr containing a file descriptor for the open file. The
+  // file descriptor must be closed using Close().
+  virtual tensorflow_statusor::StatusOr<int> OpenForAppend(
+      const std::string &file) = 0;
+
+  // Write writes all of |data| to an open file.
+  //
+  // |fd|. A file descriptor returned by OpenForAppend().
+  // |data|. The bytes to be written.
+  // |size|. The number of bytes to be written.
+  //
+  // Returns: True if all |size| bytes were written.
+  virtual bool Write(int fd, const char *data, size_t size) = 0;
+
+  // Sync blocks until all data written to an open file has been committed to
+  // durable storage.
+  //
+  // |fd|. A file descriptor returned by OpenForAppend().
+  //
+  // Returns: True if the data was committed successfully.
+  virtual bool Sync(int fd) = 0;
+
+  // MapFile makes the contents of a file available for reading without copying
+  // them, for example by mapping the file into memory. The file should not be
+  // modified while the returned FileContents exists.
+  //
+  // |file|. An absolute path to the file to be mapped.
+  //
+  // Returns: A StatusOr containing the contents of the file.
+  virtual tensorflow_statusor::StatusOr<std::unique_ptr<FileContents>> MapFile(
+      const std::string &file) = 0;
+
+  // Close closes a file descriptor returned by one of the Open*() methods.
+  //
+  // Returns: True if the file descriptor was closed successfully.
+  virtual bool Close(int fd) = 0;
+
   virtual ~FileSystem() {}
 };
 
@@ -4,8 +4,12 @@
 
 #include <dirent.h>
 #include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
+#include <cerrno>
+#include <cstring>
 #include <memory>
 #include <sstream>
 
@@ -73,5 +77,91 @@ bool PosixFileSystem::Rename(const std::string &from, const std::string &to) {
   return std::rename(from.c_str(), to.c_str()) == 0;
 }
 
+StatusOr<int> PosixFileSystem::OpenForAppend(const std::string &file) {
+  int fd = open(file.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,
+                S_IRUSR | S_IWUSR);
+  if (fd < 0) {
+    std::stringstream ss;
+    ss << "Unable to open file [" << file << "]: " << std::strerror(errno)
+       << "[" << errno << "]";
+    return Status(StatusCode::INTERNAL, ss.str());
+  }
+  return fd;
+}
+
+bool PosixFileSystem::Write(int fd, const char *data, size_t size) {
+  while (size > 0) {
+    ssize_t written = write(fd, data, size);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    data += written;
+    size -= written;
+  }
+  return true;
+}
+
+bool PosixFileSystem::Sync(int fd) { return fsync(fd) == 0; }
+
+namespace {
+
+// The contents of a file that has been mapped into memory with mmap().
+class MappedFileContents : public FileContents {
+ public:
+  MappedFileContents(void *data, size_t size) : data_(data), size_(size) {}
+  ~MappedFileContents() override {
+    if (data_ != nullptr) {
+      munmap(data_, size_);
+    }
+  }
+
+  const char *data() const override { return static_cast<char *>(data_); }
+  size_t size() const override { return size_; }
+
+ private:
+  void *data_;
+  size_t size_;
+};
+
+}  // namespace
+
+StatusOr<std::unique_ptr<FileContents>> PosixFileSystem::MapFile(
+    const std::string &file) {
+  int fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    std::stringstream ss;
+    ss << "Unable to open file [" << file << "]: " << std::strerror(errno)
+       << "[" << errno << "]";
+    if (fd >= 0) {
+      close(fd);
+    }
+    return Status(StatusCode::INTERNAL, ss.str());
+  }
+  size_t size = st.st_size;
+  if (size == 0) {
+    // mmap() does not accept empty mappings.
+    close(fd);
+    return std::unique_ptr<FileContents>(new MappedFileContents(nullptr, 0));
+  }
+  void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  // The mapping remains valid after the file descriptor is closed.
+  close(fd);
+  if (data == MAP_FAILED) {
+    std::stringstream ss;
+    ss << "Unable to map file [" << file << "]: " << std::strerror(errno)
+       << "[" << errno << "]";
+    return Status(StatusCode::INTERNAL, ss.str());
+  }
+  // The contents are read from start to end.
+  madvise(data, size, MADV_SEQUENTIAL);
+  return std::unique_ptr<FileContents>(new MappedFileContents(data, size));
+}
+
+bool PosixFileSystem::Close(int fd) { return close(fd) == 0; }
+
 }  // namespace util
 }  // namespace cobalt
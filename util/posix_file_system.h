@@ -5,6 +5,7 @@
 #ifndef COBALT_UTIL_POSIX_FILE_SYSTEM_H_
 #define COBALT_UTIL_POSIX_FILE_SYSTEM_H_
 
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -24,6 +25,13 @@ class PosixFileSystem : public FileSystem {
       const std::string &file) override;
   bool FileExists(const std::string &file) override;
   bool Rename(const std::string &from, const std::string &to) override;
+  tensorflow_statusor::StatusOr<int> OpenForAppend(
+      const std::string &file) override;
+  bool Write(int fd, const char *data, size_t size) override;
+  bool Sync(int fd) override;
+  tensorflow_statusor::StatusOr<std::unique_ptr<FileContents>> MapFile(
+      const std::string &file) override;
+  bool Close(int fd) override;
 };
 
 }  // namespace util